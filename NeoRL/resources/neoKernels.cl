@@ -24,19 +24,50 @@ constant sampler_t defaultUnnormalizedSampler = CLK_NORMALIZED_COORDS_FALSE |
 
 constant float minFloatEpsilon = 0.0001f;
 
-float randFloat(uint2* state) {
-	const float invMaxInt = 1.0f / 4294967296.0f;
-	uint x = (*state).x * 17 + (*state).y * 13123;
-	(*state).x = (x << 13) ^ x;
-	(*state).y ^= (x << 7);
+// Counter-based generator (Philox4x32-10)
+// The counter is made of the work-item index, a draw index and the step, the key selects the stream
+typedef struct {
+	uint4 counter;
+	uint2 key;
+} RandomState;
+
+uint4 philox4x32(uint4 counter, uint2 key) {
+	for (int r = 0; r < 10; r++) {
+		uint hi0 = mul_hi(0xD2511F53u, counter.x);
+		uint lo0 = 0xD2511F53u * counter.x;
+		uint hi1 = mul_hi(0xCD9E8D57u, counter.z);
+		uint lo1 = 0xCD9E8D57u * counter.z;
+
+		counter = (uint4)(hi1 ^ counter.y ^ key.x, lo1, hi0 ^ counter.w ^ key.y, lo0);
+
+		key += (uint2)(0x9E3779B9u, 0xBB67AE85u);
+	}
+
+	return counter;
+}
+
+RandomState randomState(uint2 key, uint2 step) {
+	RandomState state;
+
+	uint index = get_global_id(0) + get_global_size(0) * (get_global_id(1) + get_global_size(1) * get_global_id(2));
+
+	state.counter = (uint4)(index, 0, step.x, step.y);
+	state.key = key;
+
+	return state;
+}
 
-	uint tmp = x * (x * x * 15731 + 74323) + 871483;
+float randFloat(RandomState* state) {
+	uint4 bits = philox4x32((*state).counter, (*state).key);
 
-	return convert_float(tmp) * invMaxInt;
+	(*state).counter.y++;
+
+	// 24 bits in [0, 1)
+	return convert_float(bits.x >> 8) * (1.0f / 16777216.0f);
 }
 
-float randNormal(uint2* state) {
-	float u1 = randFloat(state);
+float randNormal(RandomState* state) {
+	float u1 = fmax(randFloat(state), minFloatEpsilon);
 	float u2 = randFloat(state);
 
 	return sqrt(-2.0f * log(u1)) * cos(6.28318f * u2);
@@ -72,7 +103,7 @@ bool inBounds(int2 position, int2 lowerBound, int2 upperBound) {
 
 // Initialize a random uniform 2D image (X field)
 void kernel randomUniform2D(write_only image2d_t values, uint2 seed, float2 minMax) {
-	uint2 seedValue = seed + (uint2)(get_global_id(0) * 29 + 12, get_global_id(1) * 16 + 23) * 36;
+	RandomState seedValue = randomState(seed, (uint2)(0));
 
 	int2 position = (int2)(get_global_id(0), get_global_id(1));
 
@@ -83,7 +114,7 @@ void kernel randomUniform2D(write_only image2d_t values, uint2 seed, float2 minM
 
 // Initialize a random uniform 3D image (X field)
 void kernel randomUniform3D(write_only image3d_t values, uint2 seed, float2 minMax) {
-	uint2 seedValue = seed + (uint2)(get_global_id(0) * 12 + 76 + get_global_id(2) * 3, get_global_id(1) * 21 + 42 + get_global_id(2) * 7) * 12;
+	RandomState seedValue = randomState(seed, (uint2)(0));
 
 	int3 position = (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
 
@@ -94,7 +125,7 @@ void kernel randomUniform3D(write_only image3d_t values, uint2 seed, float2 minM
 
 // Initialize a random uniform 2D image (XY fields)
 void kernel randomUniform2DXY(write_only image2d_t values, uint2 seed, float2 minMax) {
-	uint2 seedValue = seed + (uint2)(get_global_id(0) * 15 + 66, get_global_id(1) * 61 + 2) * 56;
+	RandomState seedValue = randomState(seed, (uint2)(0));
 
 	int2 position = (int2)(get_global_id(0), get_global_id(1));
 
@@ -105,7 +136,7 @@ void kernel randomUniform2DXY(write_only image2d_t values, uint2 seed, float2 mi
 
 // Initialize a random uniform 2D image (XZ fields)
 void kernel randomUniform2DXZ(write_only image2d_t values, uint2 seed, float2 minMax) {
-	uint2 seedValue = seed + (uint2)(get_global_id(0) * 29 + 12, get_global_id(1) * 16 + 23) * 36;
+	RandomState seedValue = randomState(seed, (uint2)(0));
 
 	int2 position = (int2)(get_global_id(0), get_global_id(1));
 
@@ -116,7 +147,7 @@ void kernel randomUniform2DXZ(write_only image2d_t values, uint2 seed, float2 mi
 
 // Initialize a random uniform 3D image (XY fields)
 void kernel randomUniform3DXY(write_only image3d_t values, uint2 seed, float2 minMax) {
-	uint2 seedValue = seed + (uint2)(get_global_id(0) * 12 + 76 + get_global_id(2) * 3, get_global_id(1) * 21 + 42 + get_global_id(2) * 7) * 12;
+	RandomState seedValue = randomState(seed, (uint2)(0));
 
 	int3 position = (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
 
@@ -127,7 +158,7 @@ void kernel randomUniform3DXY(write_only image3d_t values, uint2 seed, float2 mi
 
 // Initialize a random uniform 3D image (XZ fields)
 void kernel randomUniform3DXZ(write_only image3d_t values, uint2 seed, float2 minMax) {
-	uint2 seedValue = seed + (uint2)(get_global_id(0) * 12 + 76 + get_global_id(2) * 3, get_global_id(1) * 21 + 42 + get_global_id(2) * 7) * 12;
+	RandomState seedValue = randomState(seed, (uint2)(0));
 
 	int3 position = (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
 
@@ -136,41 +167,297 @@ void kernel randomUniform3DXZ(write_only image3d_t values, uint2 seed, float2 mi
 	write_imagef(values, (int4)(position, 0), (float4)(v.x, 0.0f, v.y, 0.0f));
 }
 
-// ----------------------------------------- Comparison Sparse Coder -----------------------------------------
+// Advance a random stream to the next step
+void kernel randomAdvance(global uint2* step) {
+	uint2 s = step[0];
 
-void kernel cscForwardError(read_only image2d_t hiddenStates, read_only image2d_t visibleStates,
-	write_only image2d_t reconstructionError, read_only image3d_t weights,
+	s.x++;
+
+	if (s.x == 0)
+		s.y++;
+
+	step[0] = s;
+}
+
+// Receptive field kernels take precomputed tables (see FieldTables): per hidden unit the field origin and the range of
+// field offsets inside the visible layer, per visible unit the (hidden position, weight index) connections that reach it
+// from within its reverse radii
+
+// ----------------------------------------- Pruned Weights -----------------------------------------
+
+// Retained connections are stored per hidden unit as weight indices into the receptive field and values,
+// and per visible unit as (hidden index, connection index) pairs for the reverse direction
+
+void kernel prunedActivate(read_only image2d_t visibleStates,
+	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront,
+	global const int* rowStarts, global const int* weightIndices, global const float* values,
+	int2 hiddenSize, float2 hiddenToVisible, int radius)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
+	
+	float sum = read_imagef(hiddenSummationTempBack, hiddenPosition).x;
+
+	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+
+	int weightDiam = radius * 2 + 1;
+
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * hiddenSize.x;
+
+	int end = rowStarts[hiddenIndex + 1];
+
+	for (int ci = rowStarts[hiddenIndex]; ci < end; ci++) {
+		int wi = weightIndices[ci];
+
+		int2 visiblePosition = fieldLowerBound + (int2)(wi / weightDiam, wi % weightDiam);
+
+		sum += values[ci] * read_imagef(visibleStates, visiblePosition).x;
+	}
+
+	write_imagef(hiddenSummationTempFront, hiddenPosition, (float4)(sum));
+}
+
+void kernel prunedReconstructError(read_only image2d_t hiddenStates, read_only image2d_t visibleStates,
+	write_only image2d_t reconstructionError,
+	global const int* visibleRowStarts, global const int2* visibleConnections, global const float* values,
+	int2 visibleSize, int2 hiddenSize)
+{
+	int2 visiblePosition = (int2)(get_global_id(0), get_global_id(1));
+
+	int visibleIndex = visiblePosition.x + visiblePosition.y * visibleSize.x;
+
+	float recon = 0.0f;
+
+	int end = visibleRowStarts[visibleIndex + 1];
+
+	for (int ci = visibleRowStarts[visibleIndex]; ci < end; ci++) {
+		int2 connection = visibleConnections[ci];
+
+		int2 hiddenPosition = (int2)(connection.x % hiddenSize.x, connection.x / hiddenSize.x);
+
+		recon += read_imagef(hiddenStates, hiddenPosition).x * values[connection.y];
+	}
+
+	float state = read_imagef(visibleStates, visiblePosition).x;
+
+	write_imagef(reconstructionError, visiblePosition, (float4)(state - recon));
+}
+
+void kernel prunedErrorPropagate(read_only image2d_t targets, read_only image2d_t hiddenStatesPrev,
+	write_only image2d_t errors,
+	global const int* visibleRowStarts, global const int2* visibleConnections, global const float* values,
+	int2 visibleSize, int2 hiddenSize)
+{
+	int2 visiblePosition = (int2)(get_global_id(0), get_global_id(1));
+
+	int visibleIndex = visiblePosition.x + visiblePosition.y * visibleSize.x;
+
+	float error = 0.0f;
+
+	int end = visibleRowStarts[visibleIndex + 1];
+
+	for (int ci = visibleRowStarts[visibleIndex]; ci < end; ci++) {
+		int2 connection = visibleConnections[ci];
+
+		int2 hiddenPosition = (int2)(connection.x % hiddenSize.x, connection.x / hiddenSize.x);
+
+		float predError = read_imagef(targets, hiddenPosition).x - read_imagef(hiddenStatesPrev, hiddenPosition).x;
+
+		error += predError * values[connection.y];
+	}
+
+	write_imagef(errors, visiblePosition, (float4)(error));
+}
+
+// ----------------------------------------- Weight Mirrors -----------------------------------------
+
+// Visible-major copy of receptive field weights, so passes from the visible side read the weights of a visible unit contiguously.
+// A visible unit has a slot for every hidden unit in its reverse radii, slots of hidden units that do not reach it hold 0
+
+// Index of a connection in a mirror, -1 if outside the reverse radii
+int mirrorIndex(int2 visiblePosition, int2 hiddenPosition, int2 visibleSize, float2 visibleToHidden, int2 reverseRadii) {
+	int2 hiddenPositionCenter = (int2)(visiblePosition.x * visibleToHidden.x + 0.5f, visiblePosition.y * visibleToHidden.y + 0.5f);
+
+	int2 offset = hiddenPosition - hiddenPositionCenter + reverseRadii;
+
+	int2 reverseDiam = reverseRadii * 2 + (int2)(1);
+
+	if (offset.x < 0 || offset.x >= reverseDiam.x || offset.y < 0 || offset.y >= reverseDiam.y)
+		return -1;
+
+	return (visiblePosition.x + visiblePosition.y * visibleSize.x) * reverseDiam.x * reverseDiam.y + offset.y + offset.x * reverseDiam.y;
+}
+
+void kernel mirrorWeights(read_only image3d_t weights, global float* weightsMirror,
 	int2 visibleSize, int2 hiddenSize, float2 visibleToHidden, float2 hiddenToVisible, int radius, int2 reverseRadii)
 {
 	int2 visiblePosition = (int2)(get_global_id(0), get_global_id(1));
 	int2 hiddenPositionCenter = (int2)(visiblePosition.x * visibleToHidden.x + 0.5f, visiblePosition.y * visibleToHidden.y + 0.5f);
-	
-	float recon = 0.0f;
+
+	int2 reverseDiam = reverseRadii * 2 + (int2)(1);
+
+	global float* slots = weightsMirror + (visiblePosition.x + visiblePosition.y * visibleSize.x) * reverseDiam.x * reverseDiam.y;
+
+	int slot = 0;
 
 	for (int dx = -reverseRadii.x; dx <= reverseRadii.x; dx++)
 		for (int dy = -reverseRadii.y; dy <= reverseRadii.y; dy++) {
 			int2 hiddenPosition = hiddenPositionCenter + (int2)(dx, dy);
-		
+
+			float weight = 0.0f;
+
 			if (inBounds0(hiddenPosition, hiddenSize)) {
 				// Next layer node's receptive field
 				int2 fieldCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
 
 				int2 fieldLowerBound = fieldCenter - (int2)(radius);
 				int2 fieldUpperBound = fieldCenter + (int2)(radius + 1); // So is included in inBounds
-		
+
 				// Check for containment
-				if (inBounds(visiblePosition, fieldLowerBound, fieldUpperBound)) {	
+				if (inBounds(visiblePosition, fieldLowerBound, fieldUpperBound)) {
 					int2 offset = visiblePosition - fieldLowerBound;
 
-					float hiddenState = read_imagef(hiddenStates, hiddenPosition).x;
-
 					int wi = offset.y + offset.x * (radius * 2 + 1);
 
-					float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
-				
-					recon += hiddenState * weight;
+					weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
 				}
 			}
+
+			slots[slot++] = weight;
+		}
+}
+
+// ----------------------------------------- Learn Records -----------------------------------------
+
+// Each unit appends the steps at which its value is nonzero (in step order), recording step 0 starts over
+
+void kernel recordActive(read_only image2d_t values, global int* steps, global float* records, global int* counts, int capacity, int step)
+{
+	int2 position = (int2)(get_global_id(0), get_global_id(1));
+
+	int index = position.x + position.y * get_global_size(0);
+
+	float value = read_imagef(values, position).x;
+
+	int count = step == 0 ? 0 : counts[index];
+
+	if (value != 0.0f) {
+		steps[index * capacity + count] = step;
+		records[index * capacity + count] = value;
+
+		count++;
+	}
+
+	counts[index] = count;
+}
+
+// ----------------------------------------- Packed Weights -----------------------------------------
+
+// Receptive field weights packed four consecutive weight indices per RGBA texel, so activation fetches a texel per four connections
+// and sums them with a dot product. Lanes past the last weight index hold 0.
+// Swarm Q weights already hold two useful lanes (x and z), so they are packed as two weight indices per texel instead
+
+void kernel packWeights(read_only image3d_t weights, write_only image3d_t weightsPacked, int numWeights) {
+	int4 position = (int4)(get_global_id(0), get_global_id(1), get_global_id(2), 0);
+
+	int wi = position.z * 4;
+
+	float4 packed;
+
+	packed.x = read_imagef(weights, (int4)(position.x, position.y, wi, 0)).x;
+	packed.y = wi + 1 < numWeights ? read_imagef(weights, (int4)(position.x, position.y, wi + 1, 0)).x : 0.0f;
+	packed.z = wi + 2 < numWeights ? read_imagef(weights, (int4)(position.x, position.y, wi + 2, 0)).x : 0.0f;
+	packed.w = wi + 3 < numWeights ? read_imagef(weights, (int4)(position.x, position.y, wi + 3, 0)).x : 0.0f;
+
+	write_imagef(weightsPacked, position, packed);
+}
+
+void kernel packWeightPairs(read_only image3d_t weights, write_only image3d_t weightsPacked, int numWeights) {
+	int4 position = (int4)(get_global_id(0), get_global_id(1), get_global_id(2), 0);
+
+	int wi = position.z * 2;
+
+	float2 first = read_imagef(weights, (int4)(position.x, position.y, wi, 0)).xz;
+	float2 second = wi + 1 < numWeights ? read_imagef(weights, (int4)(position.x, position.y, wi + 1, 0)).xz : (float2)(0.0f);
+
+	write_imagef(weightsPacked, position, (float4)(first, second));
+}
+
+// State of the visible unit at a field offset (0 outside the valid range or at the skipped offset), advancing the offset by one weight index
+float packedFieldState(read_only image2d_t visibleStates, int2 fieldLowerBound, int4 fieldRange, int weightDiam, int skipOffset, int* ox, int* oy) {
+	float state = 0.0f;
+
+	if (*ox >= fieldRange.x && *ox < fieldRange.z && *oy >= fieldRange.y && *oy < fieldRange.w && !(*ox == skipOffset && *oy == skipOffset))
+		state = read_imagef(visibleStates, fieldLowerBound + (int2)(*ox, *oy)).x;
+
+	(*oy)++;
+
+	if (*oy == weightDiam) {
+		*oy = 0;
+		(*ox)++;
+	}
+
+	return state;
+}
+
+// Sum over the field of a hidden unit, only visiting the texels that overlap its valid range
+float packedFieldSum(read_only image2d_t visibleStates, read_only image3d_t weightsPacked,
+	global const int2* fieldOrigins, global const int4* fieldRanges, int radius, int skipOffset, int2 hiddenPosition, int hiddenIndex)
+{
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
+
+	int weightDiam = radius * 2 + 1;
+
+	int texelStart = (fieldRange.y + fieldRange.x * weightDiam) / 4;
+	int texelEnd = (fieldRange.w + (fieldRange.z - 1) * weightDiam + 3) / 4;
+
+	int ox = (texelStart * 4) / weightDiam;
+	int oy = (texelStart * 4) % weightDiam;
+
+	float sum = 0.0f;
+
+	for (int t = texelStart; t < texelEnd; t++) {
+		float4 weight = read_imagef(weightsPacked, (int4)(hiddenPosition.x, hiddenPosition.y, t, 0));
+
+		float4 state;
+
+		state.x = packedFieldState(visibleStates, fieldLowerBound, fieldRange, weightDiam, skipOffset, &ox, &oy);
+		state.y = packedFieldState(visibleStates, fieldLowerBound, fieldRange, weightDiam, skipOffset, &ox, &oy);
+		state.z = packedFieldState(visibleStates, fieldLowerBound, fieldRange, weightDiam, skipOffset, &ox, &oy);
+		state.w = packedFieldState(visibleStates, fieldLowerBound, fieldRange, weightDiam, skipOffset, &ox, &oy);
+
+		sum += dot(weight, state);
+	}
+
+	return sum;
+}
+
+// ----------------------------------------- Comparison Sparse Coder -----------------------------------------
+
+void kernel cscForwardErrorMirrored(read_only image2d_t hiddenStates, read_only image2d_t visibleStates,
+	write_only image2d_t reconstructionError, global const float* weightsMirror,
+	int2 visibleSize, int2 hiddenSize, float2 visibleToHidden, int2 reverseRadii)
+{
+	int2 visiblePosition = (int2)(get_global_id(0), get_global_id(1));
+	int2 hiddenPositionCenter = (int2)(visiblePosition.x * visibleToHidden.x + 0.5f, visiblePosition.y * visibleToHidden.y + 0.5f);
+
+	int2 reverseDiam = reverseRadii * 2 + (int2)(1);
+
+	global const float* slots = weightsMirror + (visiblePosition.x + visiblePosition.y * visibleSize.x) * reverseDiam.x * reverseDiam.y;
+
+	float recon = 0.0f;
+
+	int slot = 0;
+
+	for (int dx = -reverseRadii.x; dx <= reverseRadii.x; dx++)
+		for (int dy = -reverseRadii.y; dy <= reverseRadii.y; dy++) {
+			int2 hiddenPosition = hiddenPositionCenter + (int2)(dx, dy);
+
+			if (inBounds0(hiddenPosition, hiddenSize))
+				recon += read_imagef(hiddenStates, hiddenPosition).x * slots[slot];
+
+			slot++;
 		}
 
 	float state = read_imagef(visibleStates, visiblePosition).x;
@@ -180,32 +467,61 @@ void kernel cscForwardError(read_only image2d_t hiddenStates, read_only image2d_
 	write_imagef(reconstructionError, visiblePosition, (float4)(error));
 }
 
+void kernel cscForwardError(read_only image2d_t hiddenStates, read_only image2d_t visibleStates,
+	write_only image2d_t reconstructionError, read_only image3d_t weights,
+	global const int* reverseStarts, global const int4* reverseConnections, int2 visibleSize)
+{
+	int2 visiblePosition = (int2)(get_global_id(0), get_global_id(1));
+
+	int visibleIndex = visiblePosition.x + visiblePosition.y * visibleSize.x;
+
+	float recon = 0.0f;
+
+	int end = reverseStarts[visibleIndex + 1];
+
+	for (int ci = reverseStarts[visibleIndex]; ci < end; ci++) {
+		int4 connection = reverseConnections[ci];
+
+		int2 hiddenPosition = connection.xy;
+
+		float hiddenState = read_imagef(hiddenStates, hiddenPosition).x;
+
+		float weight = read_imagef(weights, connection).x;
+
+		recon += hiddenState * weight;
+	}
+
+	float state = read_imagef(visibleStates, visiblePosition).x;
+
+	float error = state - recon;
+
+	write_imagef(reconstructionError, visiblePosition, (float4)(error));
+}
+
 void kernel cscActivate(read_only image2d_t visibleStates,
 	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weights,
-	int2 visibleSize, float2 hiddenToVisible, int radius)
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
 	
 	float sum = read_imagef(hiddenSummationTempBack, hiddenPosition).x;
 
-	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
 
-	for (int dx = -radius; dx <= radius; dx++)
-		for (int dy = -radius; dy <= radius; dy++) {
-			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
 
-			if (inBounds0(visiblePosition, visibleSize)) {
-				int2 offset = visiblePosition - fieldLowerBound;
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
 
-				int wi = offset.y + offset.x * (radius * 2 + 1);
+			int wi = oy + ox * (radius * 2 + 1);
 
-				float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
+			float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
 
-				float state = read_imagef(visibleStates, visiblePosition).x;
+			float state = read_imagef(visibleStates, visiblePosition).x;
 
-				sum += state * weight;
-			}
+			sum += state * weight;
 		}
 
 	write_imagef(hiddenSummationTempFront, hiddenPosition, (float4)(sum));
@@ -213,38 +529,51 @@ void kernel cscActivate(read_only image2d_t visibleStates,
 
 void kernel cscActivateIgnoreMiddle(read_only image2d_t visibleStates,
 	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weights,
-	int2 visibleSize, float2 hiddenToVisible, int radius)
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
 	
 	float sum = read_imagef(hiddenSummationTempBack, hiddenPosition).x;
 
-	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
 
-	for (int dx = -radius; dx <= radius; dx++)
-		for (int dy = -radius; dy <= radius; dy++) {
-			if (dx == 0 && dy == 0)
-				continue;
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
 
-			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			if (ox == radius && oy == radius)
+				continue;
 
-			if (inBounds0(visiblePosition, visibleSize)) {
-				int2 offset = visiblePosition - fieldLowerBound;
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
 
-				int wi = offset.y + offset.x * (radius * 2 + 1);
+			int wi = oy + ox * (radius * 2 + 1);
 
-				float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
+			float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
 
-				float state = read_imagef(visibleStates, visiblePosition).x;
+			float state = read_imagef(visibleStates, visiblePosition).x;
 
-				sum += state * weight;
-			}
+			sum += state * weight;
 		}
 
 	write_imagef(hiddenSummationTempFront, hiddenPosition, (float4)(sum));
 }
 
+void kernel cscActivatePacked(read_only image2d_t visibleStates,
+	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weightsPacked,
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius, int ignoreMiddle)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
+
+	float sum = read_imagef(hiddenSummationTempBack, hiddenPosition).x;
+
+	sum += packedFieldSum(visibleStates, weightsPacked, fieldOrigins, fieldRanges, radius, ignoreMiddle ? radius : -1, hiddenPosition, hiddenIndex);
+
+	write_imagef(hiddenSummationTempFront, hiddenPosition, (float4)(sum));
+}
+
 void kernel cscSolveHidden(read_only image2d_t hiddenSummationTemp,
 	read_only image2d_t hiddenStatesBack, write_only image2d_t hiddenStatesFront,
 	int2 hiddenSize, int radius, float activeRatio)
@@ -300,34 +629,40 @@ void kernel cscLearnHiddenBiases(read_only image2d_t visibleBiasesBack, write_on
 void kernel cscLearnHiddenWeights(read_only image2d_t visibleErrors, read_only image2d_t visibleStates,
 	read_only image2d_t hiddenErrors, read_only image2d_t hiddenStates,
 	read_only image3d_t weightsBack, write_only image3d_t weightsFront,
-	int2 visibleSize, float2 hiddenToVisible, int radius, float weightAlpha)
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius, float weightAlpha,
+	global float* weightsMirror, float2 visibleToHidden, int2 reverseRadii)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
 
-	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
+
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
 
 	float state = read_imagef(hiddenStates, hiddenPosition).x;
 	
 	float error = read_imagef(hiddenErrors, hiddenPosition).x * state;
 
-	for (int dx = -radius; dx <= radius; dx++)
-		for (int dy = -radius; dy <= radius; dy++) {
-			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
 
-			if (inBounds0(visiblePosition, visibleSize)) {
-				int2 offset = visiblePosition - fieldLowerBound;
+			int wi = oy + ox * (radius * 2 + 1);
 
-				int wi = offset.y + offset.x * (radius * 2 + 1);
+			float weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
 
-				float weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
+			float visibleError = read_imagef(visibleErrors, visiblePosition).x;
+			float visibleState = read_imagef(visibleStates, visiblePosition).x;
 
-				float visibleError = read_imagef(visibleErrors, visiblePosition).x;
-				float visibleState = read_imagef(visibleStates, visiblePosition).x;
+			float weight = weightPrev + weightAlpha * ((visibleError - weightPrev) * state);
 
-				float weight = weightPrev + weightAlpha * ((visibleError - weightPrev) * state);
+			write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight));
 
-				write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight));
+			if (weightsMirror != 0) {
+				int mi = mirrorIndex(visiblePosition, hiddenPosition, visibleSize, visibleToHidden, reverseRadii);
+
+				if (mi >= 0)
+					weightsMirror[mi] = weight;
 			}
 		}
 }
@@ -335,12 +670,15 @@ void kernel cscLearnHiddenWeights(read_only image2d_t visibleErrors, read_only i
 void kernel cscLearnHiddenWeightsTraces(read_only image2d_t rewards, read_only image2d_t visibleErrors, read_only image2d_t visibleStates,
 	read_only image2d_t hiddenErrors, read_only image2d_t hiddenStates,
 	read_only image3d_t weightsBack, write_only image3d_t weightsFront,
-	int2 visibleSize, float2 hiddenToVisible, int radius, float weightAlpha, float weightLambda)
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius, float weightAlpha, float weightLambda,
+	global float* weightsMirror, float2 visibleToHidden, int2 reverseRadii)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
 
-	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
+
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
 
 	float reward = read_imagef(rewards, hiddenPosition).x;
 
@@ -348,64 +686,228 @@ void kernel cscLearnHiddenWeightsTraces(read_only image2d_t rewards, read_only i
 
 	float error = read_imagef(hiddenErrors, hiddenPosition).x * state;
 
-	for (int dx = -radius; dx <= radius; dx++)
-		for (int dy = -radius; dy <= radius; dy++) {
-			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
 
-			if (inBounds0(visiblePosition, visibleSize)) {
-				int2 offset = visiblePosition - fieldLowerBound;
+			int wi = oy + ox * (radius * 2 + 1);
 
-				int wi = offset.y + offset.x * (radius * 2 + 1);
+			float2 weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xy;
 
-				float2 weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xy;
+			float visibleError = read_imagef(visibleErrors, visiblePosition).x;
+			float visibleState = read_imagef(visibleStates, visiblePosition).x;
+
+			float2 weight = (float2)(weightPrev.x + reward * weightPrev.y, weightPrev.y * weightLambda + weightAlpha * ((visibleError - weightPrev.x) * state));
 
-				float visibleError = read_imagef(visibleErrors, visiblePosition).x;
-				float visibleState = read_imagef(visibleStates, visiblePosition).x;
+			write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight.x, weight.y, 0.0f, 0.0f));
 
-				float2 weight = (float2)(weightPrev.x + reward * weightPrev.y, weightPrev.y * weightLambda + weightAlpha * ((visibleError - weightPrev.x) * state));
+			if (weightsMirror != 0) {
+				int mi = mirrorIndex(visiblePosition, hiddenPosition, visibleSize, visibleToHidden, reverseRadii);
 
-				write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight.x, weight.y, 0.0f, 0.0f));
+				if (mi >= 0)
+					weightsMirror[mi] = weight.x;
 			}
 		}
 }
 
-// ----------------------------------------- Sparse Coder -----------------------------------------
+// Batched trace learning replays the recorded steps of a batch in order: the rewards and reconstruction errors of every step,
+// and the steps at which the hidden unit was active (as recordActive). Same result as cscLearnHiddenWeightsTraces on each step
 
-void kernel scReconstructVisibleError(read_only image2d_t hiddenStates, read_only image2d_t visibleStates,
-	write_only image2d_t reconstructionError, read_only image3d_t weights,
-	int2 visibleSize, int2 hiddenSize, float2 visibleToHidden, float2 hiddenToVisible, int radius, int2 reverseRadii)
+void kernel cscLearnHiddenWeightsTracesBatched(global const float* rewardsBatch, global const float* visibleErrorsBatch,
+	global const int* activeSteps, global const float* activeStates, global const int* activeCounts, int activeCapacity,
+	read_only image3d_t weightsBack, write_only image3d_t weightsFront,
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius, float weightAlpha, float weightLambda, int count,
+	global float* weightsMirror, float2 visibleToHidden, int2 reverseRadii)
 {
-	int2 visiblePosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 hiddenPositionCenter = (int2)(visiblePosition.x * visibleToHidden.x + 0.5f, visiblePosition.y * visibleToHidden.y + 0.5f);
-	
-	float recon = 0.0f;
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
 
-	for (int dx = -reverseRadii.x; dx <= reverseRadii.x; dx++)
-		for (int dy = -reverseRadii.y; dy <= reverseRadii.y; dy++) {
-			int2 hiddenPosition = hiddenPositionCenter + (int2)(dx, dy);
-		
-			if (inBounds0(hiddenPosition, hiddenSize)) {
-				// Next layer node's receptive field
-				int2 fieldCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
 
-				int2 fieldLowerBound = fieldCenter - (int2)(radius);
-				int2 fieldUpperBound = fieldCenter + (int2)(radius + 1); // So is included in inBounds
-		
-				// Check for containment
-				if (inBounds(visiblePosition, fieldLowerBound, fieldUpperBound)) {	
-					int2 offset = visiblePosition - fieldLowerBound;
+	int numHidden = get_global_size(0) * get_global_size(1);
+	int numVisible = visibleSize.x * visibleSize.y;
 
-					float hiddenState = read_imagef(hiddenStates, hiddenPosition).x;
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
 
-					int wi = offset.y + offset.x * (radius * 2 + 1);
+	int activeStart = hiddenIndex * activeCapacity;
+	int activeCount = activeCounts[hiddenIndex];
 
-					float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
-				
-					recon += hiddenState * weight;
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
+
+			int wi = oy + ox * (radius * 2 + 1);
+
+			int visibleIndex = visiblePosition.x + visiblePosition.y * visibleSize.x;
+
+			float2 weight = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xy;
+
+			int ai = 0;
+
+			for (int s = 0; s < count; s++) {
+				float reward = rewardsBatch[hiddenIndex + s * numHidden];
+
+				float weightPrev = weight.x;
+
+				weight.x += reward * weight.y;
+				weight.y *= weightLambda;
+
+				// The trace only grows on the steps the unit was active
+				if (ai < activeCount && activeSteps[activeStart + ai] == s) {
+					float visibleError = visibleErrorsBatch[visibleIndex + s * numVisible];
+
+					weight.y += weightAlpha * ((visibleError - weightPrev) * activeStates[activeStart + ai]);
+
+					ai++;
 				}
 			}
+
+			write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight.x, weight.y, 0.0f, 0.0f));
+
+			if (weightsMirror != 0) {
+				int mi = mirrorIndex(visiblePosition, hiddenPosition, visibleSize, visibleToHidden, reverseRadii);
+
+				if (mi >= 0)
+					weightsMirror[mi] = weight.x;
+			}
+		}
+}
+
+// Fused error activation and learning: sums the reconstruction error onto the hidden unit with the weights from before
+// the update (as cscActivate on the errors would), updates the weights in the same pass, and learns the biases if learnBiases is set
+
+void kernel cscLearnHiddenWeightsFused(read_only image2d_t visibleErrors, read_only image2d_t hiddenStates,
+	read_only image2d_t hiddenErrorSummationTempBack, write_only image2d_t hiddenErrorSummationTempFront,
+	read_only image3d_t weightsBack, write_only image3d_t weightsFront,
+	read_only image2d_t hiddenBiasesBack, write_only image2d_t hiddenBiasesFront,
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius, float weightAlpha, int ignoreMiddle,
+	int learnBiases, float boostAlpha, float activeRatio,
+	global float* weightsMirror, float2 visibleToHidden, int2 reverseRadii)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
+
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
+
+	float state = read_imagef(hiddenStates, hiddenPosition).x;
+
+	float errorSum = read_imagef(hiddenErrorSummationTempBack, hiddenPosition).x;
+
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
+
+			int wi = oy + ox * (radius * 2 + 1);
+
+			float weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
+
+			float visibleError = read_imagef(visibleErrors, visiblePosition).x;
+
+			if (!ignoreMiddle || ox != radius || oy != radius)
+				errorSum += visibleError * weightPrev;
+
+			float weight = weightPrev + weightAlpha * ((visibleError - weightPrev) * state);
+
+			write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight));
+
+			if (weightsMirror != 0) {
+				int mi = mirrorIndex(visiblePosition, hiddenPosition, visibleSize, visibleToHidden, reverseRadii);
+
+				if (mi >= 0)
+					weightsMirror[mi] = weight;
+			}
+		}
+
+	write_imagef(hiddenErrorSummationTempFront, hiddenPosition, (float4)(errorSum));
+
+	if (learnBiases) {
+		float biasPrev = read_imagef(hiddenBiasesBack, hiddenPosition).x;
+
+		write_imagef(hiddenBiasesFront, hiddenPosition, (float4)(biasPrev + boostAlpha * (activeRatio - state)));
+	}
+}
+
+void kernel cscLearnHiddenWeightsTracesFused(read_only image2d_t rewards, read_only image2d_t visibleErrors, read_only image2d_t hiddenStates,
+	read_only image2d_t hiddenErrorSummationTempBack, write_only image2d_t hiddenErrorSummationTempFront,
+	read_only image3d_t weightsBack, write_only image3d_t weightsFront,
+	read_only image2d_t hiddenBiasesBack, write_only image2d_t hiddenBiasesFront,
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius, float weightAlpha, float weightLambda, int ignoreMiddle,
+	int learnBiases, float boostAlpha, float activeRatio,
+	global float* weightsMirror, float2 visibleToHidden, int2 reverseRadii)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
+
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
+
+	float reward = read_imagef(rewards, hiddenPosition).x;
+
+	float state = read_imagef(hiddenStates, hiddenPosition).x;
+
+	float errorSum = read_imagef(hiddenErrorSummationTempBack, hiddenPosition).x;
+
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
+
+			int wi = oy + ox * (radius * 2 + 1);
+
+			float2 weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xy;
+
+			float visibleError = read_imagef(visibleErrors, visiblePosition).x;
+
+			if (!ignoreMiddle || ox != radius || oy != radius)
+				errorSum += visibleError * weightPrev.x;
+
+			float2 weight = (float2)(weightPrev.x + reward * weightPrev.y, weightPrev.y * weightLambda + weightAlpha * ((visibleError - weightPrev.x) * state));
+
+			write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight.x, weight.y, 0.0f, 0.0f));
+
+			if (weightsMirror != 0) {
+				int mi = mirrorIndex(visiblePosition, hiddenPosition, visibleSize, visibleToHidden, reverseRadii);
+
+				if (mi >= 0)
+					weightsMirror[mi] = weight.x;
+			}
 		}
 
+	write_imagef(hiddenErrorSummationTempFront, hiddenPosition, (float4)(errorSum));
+
+	if (learnBiases) {
+		float biasPrev = read_imagef(hiddenBiasesBack, hiddenPosition).x;
+
+		write_imagef(hiddenBiasesFront, hiddenPosition, (float4)(biasPrev + boostAlpha * (activeRatio - state)));
+	}
+}
+
+// ----------------------------------------- Sparse Coder -----------------------------------------
+
+void kernel scReconstructVisibleError(read_only image2d_t hiddenStates, read_only image2d_t visibleStates,
+	write_only image2d_t reconstructionError, read_only image3d_t weights,
+	global const int* reverseStarts, global const int4* reverseConnections, int2 visibleSize)
+{
+	int2 visiblePosition = (int2)(get_global_id(0), get_global_id(1));
+
+	int visibleIndex = visiblePosition.x + visiblePosition.y * visibleSize.x;
+
+	float recon = 0.0f;
+
+	int end = reverseStarts[visibleIndex + 1];
+
+	for (int ci = reverseStarts[visibleIndex]; ci < end; ci++) {
+		int4 connection = reverseConnections[ci];
+
+		float hiddenState = read_imagef(hiddenStates, connection.xy).x;
+
+		float weight = read_imagef(weights, connection).x;
+
+		recon += hiddenState * weight;
+	}
+
 	float state = read_imagef(visibleStates, visiblePosition).x;
 
 	float error = state - recon;
@@ -415,30 +917,28 @@ void kernel scReconstructVisibleError(read_only image2d_t hiddenStates, read_onl
 
 void kernel scActivateFromReconstructionError(read_only image2d_t reconstructionError,
 	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weights,
-	int2 visibleSize, float2 hiddenToVisible, int radius)
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
 	
 	float sum = read_imagef(hiddenSummationTempBack, hiddenPosition).x;
 
-	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
 
-	for (int dx = -radius; dx <= radius; dx++)
-		for (int dy = -radius; dy <= radius; dy++) {
-			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
 
-			if (inBounds0(visiblePosition, visibleSize)) {
-				int2 offset = visiblePosition - fieldLowerBound;
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
 
-				int wi = offset.y + offset.x * (radius * 2 + 1);
+			int wi = oy + ox * (radius * 2 + 1);
 
-				float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
+			float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
 
-				float error = read_imagef(reconstructionError, visiblePosition).x;
+			float error = read_imagef(reconstructionError, visiblePosition).x;
 
-				sum += weight * error;
-			}
+			sum += weight * error;
 		}
 
 	write_imagef(hiddenSummationTempFront, hiddenPosition, (float4)(sum));
@@ -502,6 +1002,186 @@ void kernel scSolveHidden(read_only image2d_t hiddenSummationTemp,
 	write_imagef(hiddenActivationsFront, hiddenPosition, (float4)(activation));
 }
 
+// Counts the hidden units whose spike changed in an iteration, for early exit
+void kernel scCountSpikeChanges(read_only image2d_t spikes, read_only image2d_t spikesPrev, global int* counts, int iter) {
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+
+	if ((read_imagef(spikes, hiddenPosition).x > 0.5f) != (read_imagef(spikesPrev, hiddenPosition).x > 0.5f))
+		atomic_inc(&counts[iter]);
+}
+
+// Persistent solver: runs all iterations of the explaining-away loop in one launch of a single work-group.
+// Hidden spikes, states and activations live in local memory, reconstruction errors are exchanged through global memory
+// (barriers order both, as there is only one work-group). Each work-item handles a strided subset of the units.
+// Visible layers are packed into flat buffers, layers holds (visibleSize.xy, radius, weight channels, visible offset,
+// weight offset, reverseRadii.xy) and layerTransforms (hiddenToVisible.xy, visibleToHidden.xy) per layer.
+// Weights are stored as copied from their images, element (hidden index + wi * hidden count) times the channels
+
+void kernel scSolvePersistent(global const float* weights, global const float* visibleStates, global float* reconstructionErrors,
+	global const int8* layers, global const float4* layerTransforms, int numLayers,
+	global const float* hiddenThresholds, global const float* weightsLateral,
+	global float* hiddenSpikes, global float* hiddenStates, global float* hiddenActivations,
+	local float* spikesA, local float* spikesB, local float* states, local float* activations,
+	int2 hiddenSize, int lateralRadius, float leak, int iterations)
+{
+	int numHidden = hiddenSize.x * hiddenSize.y;
+
+	int lid = get_local_id(0);
+	int groupSize = get_local_size(0);
+
+	for (int hi = lid; hi < numHidden; hi += groupSize) {
+		spikesA[hi] = hiddenSpikes[hi];
+		states[hi] = hiddenStates[hi];
+		activations[hi] = hiddenActivations[hi];
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	local float* spikesPrev = spikesA;
+	local float* spikesNext = spikesB;
+
+	int lateralDiam = lateralRadius * 2 + 1;
+
+	for (int iter = 0; iter < iterations; iter++) {
+		float accum = 1.0f / (1.0f + iter);
+
+		// Solve hidden (as scActivateFromReconstructionError per layer, then scSolveHidden)
+		for (int hi = lid; hi < numHidden; hi += groupSize) {
+			int2 hiddenPosition = (int2)(hi % hiddenSize.x, hi / hiddenSize.x);
+
+			float excitation = 0.0f;
+
+			for (int li = 0; li < numLayers; li++) {
+				int8 layer = layers[li];
+				float4 transform = layerTransforms[li];
+
+				int2 visibleSize = layer.s01;
+				int radius = layer.s2;
+				int channels = layer.s3;
+
+				global const float* layerWeights = weights + layer.s5;
+				global const float* layerErrors = reconstructionErrors + layer.s4;
+
+				int2 visiblePositionCenter = (int2)(hiddenPosition.x * transform.x + 0.5f, hiddenPosition.y * transform.y + 0.5f);
+
+				int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+
+				for (int dx = -radius; dx <= radius; dx++)
+					for (int dy = -radius; dy <= radius; dy++) {
+						int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+
+						if (inBounds0(visiblePosition, visibleSize)) {
+							int2 offset = visiblePosition - fieldLowerBound;
+
+							int wi = offset.y + offset.x * (radius * 2 + 1);
+
+							float weight = layerWeights[(hi + wi * numHidden) * channels];
+
+							float error = layerErrors[visiblePosition.x + visiblePosition.y * visibleSize.x];
+
+							excitation += weight * error;
+						}
+					}
+			}
+
+			int2 fieldLowerBound = hiddenPosition - (int2)(lateralRadius);
+
+			float inhibition = 0.0f;
+
+			for (int dx = -lateralRadius; dx <= lateralRadius; dx++)
+				for (int dy = -lateralRadius; dy <= lateralRadius; dy++) {
+					if (dx == 0 && dy == 0)
+						continue;
+
+					int2 otherPosition = hiddenPosition + (int2)(dx, dy);
+
+					if (inBounds0(otherPosition, hiddenSize)) {
+						int2 offset = otherPosition - fieldLowerBound;
+
+						int wi = offset.y + offset.x * lateralDiam;
+
+						inhibition += weightsLateral[hi + wi * numHidden] * spikesPrev[otherPosition.x + otherPosition.y * hiddenSize.x];
+					}
+				}
+
+			float activation = (1.0f - leak) * activations[hi] + excitation - inhibition;
+
+			float spike = 0.0f;
+
+			if (activation > hiddenThresholds[hi]) {
+				spike = 1.0f;
+
+				activation = 0.0f;
+			}
+
+			spikesNext[hi] = spike;
+			states[hi] = (1.0f - accum) * states[hi] + accum * spike;
+			activations[hi] = activation;
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		// Reconstruct (as scReconstructVisibleError per layer)
+		for (int li = 0; li < numLayers; li++) {
+			int8 layer = layers[li];
+			float4 transform = layerTransforms[li];
+
+			int2 visibleSize = layer.s01;
+			int radius = layer.s2;
+			int channels = layer.s3;
+			int2 reverseRadii = layer.s67;
+
+			global const float* layerWeights = weights + layer.s5;
+
+			for (int vi = lid; vi < visibleSize.x * visibleSize.y; vi += groupSize) {
+				int2 visiblePosition = (int2)(vi % visibleSize.x, vi / visibleSize.x);
+				int2 hiddenPositionCenter = (int2)(visiblePosition.x * transform.z + 0.5f, visiblePosition.y * transform.w + 0.5f);
+
+				float recon = 0.0f;
+
+				for (int dx = -reverseRadii.x; dx <= reverseRadii.x; dx++)
+					for (int dy = -reverseRadii.y; dy <= reverseRadii.y; dy++) {
+						int2 hiddenPosition = hiddenPositionCenter + (int2)(dx, dy);
+
+						if (inBounds0(hiddenPosition, hiddenSize)) {
+							// Next layer node's receptive field
+							int2 fieldCenter = (int2)(hiddenPosition.x * transform.x + 0.5f, hiddenPosition.y * transform.y + 0.5f);
+
+							int2 fieldLowerBound = fieldCenter - (int2)(radius);
+							int2 fieldUpperBound = fieldCenter + (int2)(radius + 1); // So is included in inBounds
+
+							// Check for containment
+							if (inBounds(visiblePosition, fieldLowerBound, fieldUpperBound)) {
+								int2 offset = visiblePosition - fieldLowerBound;
+
+								int hiddenIndex = hiddenPosition.x + hiddenPosition.y * hiddenSize.x;
+
+								int wi = offset.y + offset.x * (radius * 2 + 1);
+
+								recon += states[hiddenIndex] * layerWeights[(hiddenIndex + wi * numHidden) * channels];
+							}
+						}
+					}
+
+				reconstructionErrors[layer.s4 + vi] = visibleStates[layer.s4 + vi] - recon;
+			}
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+
+		local float* spikesTemp = spikesPrev;
+
+		spikesPrev = spikesNext;
+		spikesNext = spikesTemp;
+	}
+
+	for (int hi = lid; hi < numHidden; hi += groupSize) {
+		hiddenSpikes[hi] = spikesPrev[hi];
+		hiddenStates[hi] = states[hi];
+		hiddenActivations[hi] = activations[hi];
+	}
+}
+
 void kernel scLearnThresholds(read_only image2d_t hiddenThresholdsBack, write_only image2d_t hiddenThresholdsFront,
 	read_only image2d_t hiddenStates,
 	float thresholdAlpha, float activeRatio)
@@ -519,69 +1199,66 @@ void kernel scLearnThresholds(read_only image2d_t hiddenThresholdsBack, write_on
 
 void kernel scLearnSparseCoderWeights(read_only image2d_t reconstructionError,
 	read_only image2d_t hiddenStates, read_only image3d_t weightsBack, write_only image3d_t weightsFront,
-	int2 visibleSize, float2 hiddenToVisible, int radius, float weightAlpha)
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius, float weightAlpha)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
 
-	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
 
-	float state = read_imagef(hiddenStates, hiddenPosition).x;
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
 
-	for (int dx = -radius; dx <= radius; dx++)
-		for (int dy = -radius; dy <= radius; dy++) {
-			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+	float state = read_imagef(hiddenStates, hiddenPosition).x;
 
-			if (inBounds0(visiblePosition, visibleSize)) {
-				int2 offset = visiblePosition - fieldLowerBound;
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
 
-				int wi = offset.y + offset.x * (radius * 2 + 1);
+			int wi = oy + ox * (radius * 2 + 1);
 
-				float weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
+			float weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
 
-				float error = read_imagef(reconstructionError, visiblePosition).x;
+			float error = read_imagef(reconstructionError, visiblePosition).x;
 
-				float weight = weightPrev + weightAlpha * error * state;
+			float weight = weightPrev + weightAlpha * error * state;
 
-				write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight));
-			}
+			write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight));
 		}
 }
 
 void kernel scLearnSparseCoderWeightsTraces(read_only image2d_t reconstructionError,
 	read_only image2d_t hiddenStates, read_only image3d_t weightsBack, write_only image3d_t weightsFront,
 	read_only image2d_t rewards,
-	int2 visibleSize, float2 hiddenToVisible, int radius, float weightAlpha, float weightTraceLambda)
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius, float weightAlpha, float weightTraceLambda)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
 
-	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
+
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
 
 	float state = read_imagef(hiddenStates, hiddenPosition).x;
 
 	float reward = read_imagef(rewards, hiddenPosition).x;
 
-	for (int dx = -radius; dx <= radius; dx++)
-		for (int dy = -radius; dy <= radius; dy++) {
-			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
-
-			if (inBounds0(visiblePosition, visibleSize)) {
-				int2 offset = visiblePosition - fieldLowerBound;
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
 
-				int wi = offset.y + offset.x * (radius * 2 + 1);
+			int wi = oy + ox * (radius * 2 + 1);
 
-				float2 weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xy;
+			float2 weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xy;
 
-				float error = read_imagef(reconstructionError, visiblePosition).x;
+			float error = read_imagef(reconstructionError, visiblePosition).x;
 
-				float2 weight = (float2)(weightPrev.x + reward * weightPrev.y, weightPrev.y * weightTraceLambda + weightAlpha * state * error);
+			float2 weight = (float2)(weightPrev.x + reward * weightPrev.y, weightPrev.y * weightTraceLambda + weightAlpha * state * error);
 
-				write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight, 0.0f, 0.0f));
-			}
+			write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight, 0.0f, 0.0f));
 		}
 }
 
+// Lateral weights keep computing their bounds, their indexing is shared with the inhibition loops of scSolveHidden and scSolvePersistent
 void kernel scLearnSparseCoderWeightsLateral(read_only image2d_t hiddenStates,
 	read_only image3d_t weightsLateralBack, write_only image3d_t weightsLateralFront,
 	int2 hiddenSize, int radius, float weightLateralAlpha, float activeRatioSquared)
@@ -616,131 +1293,330 @@ void kernel scLearnSparseCoderWeightsLateral(read_only image2d_t hiddenStates,
 
 void kernel predErrorPropagate(read_only image2d_t targets, read_only image2d_t hiddenStatesPrev,
 	write_only image2d_t errors, read_only image3d_t weights,
-	int2 visibleSize, int2 hiddenSize, float2 visibleToHidden, float2 hiddenToVisible, int radius, int2 reverseRadii)
+	global const int* reverseStarts, global const int4* reverseConnections, int2 visibleSize)
+{
+	int2 visiblePosition = (int2)(get_global_id(0), get_global_id(1));
+
+	int visibleIndex = visiblePosition.x + visiblePosition.y * visibleSize.x;
+
+	float error = 0.0f;
+
+	int end = reverseStarts[visibleIndex + 1];
+
+	for (int ci = reverseStarts[visibleIndex]; ci < end; ci++) {
+		int4 connection = reverseConnections[ci];
+
+		int2 hiddenPosition = connection.xy;
+
+		float predError = read_imagef(targets, hiddenPosition).x - read_imagef(hiddenStatesPrev, hiddenPosition).x;
+
+		float weight = read_imagef(weights, connection).x;
+
+		error += predError * weight;
+	}
+
+	write_imagef(errors, visiblePosition, (float4)(error));
+}
+
+void kernel predErrorPropagateMirrored(read_only image2d_t targets, read_only image2d_t hiddenStatesPrev,
+	write_only image2d_t errors, global const float* weightsMirror,
+	int2 visibleSize, int2 hiddenSize, float2 visibleToHidden, int2 reverseRadii)
 {
 	int2 visiblePosition = (int2)(get_global_id(0), get_global_id(1));
 	int2 hiddenPositionCenter = (int2)(visiblePosition.x * visibleToHidden.x + 0.5f, visiblePosition.y * visibleToHidden.y + 0.5f);
-	
+
+	int2 reverseDiam = reverseRadii * 2 + (int2)(1);
+
+	global const float* slots = weightsMirror + (visiblePosition.x + visiblePosition.y * visibleSize.x) * reverseDiam.x * reverseDiam.y;
+
 	float error = 0.0f;
 
+	int slot = 0;
+
 	for (int dx = -reverseRadii.x; dx <= reverseRadii.x; dx++)
 		for (int dy = -reverseRadii.y; dy <= reverseRadii.y; dy++) {
 			int2 hiddenPosition = hiddenPositionCenter + (int2)(dx, dy);
-		
+
 			if (inBounds0(hiddenPosition, hiddenSize)) {
-				// Next layer node's receptive field
-				int2 fieldCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
+				float predError = read_imagef(targets, hiddenPosition).x - read_imagef(hiddenStatesPrev, hiddenPosition).x;
 
-				int2 fieldLowerBound = fieldCenter - (int2)(radius);
-				int2 fieldUpperBound = fieldCenter + (int2)(radius + 1); // So is included in inBounds
-		
-				// Check for containment
-				if (inBounds(visiblePosition, fieldLowerBound, fieldUpperBound)) {	
-					int2 offset = visiblePosition - fieldLowerBound;
+				error += predError * slots[slot];
+			}
+
+			slot++;
+		}
+
+	write_imagef(errors, visiblePosition, (float4)(error));
+}
+
+void kernel predActivate(read_only image2d_t visibleStates,
+	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weights,
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+	
+	float sum = read_imagef(hiddenSummationTempBack, hiddenPosition).x;
+
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
+
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
+
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
+
+			int wi = oy + ox * (radius * 2 + 1);
+
+			float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
+
+			float state = read_imagef(visibleStates, visiblePosition).x;
+
+			sum += weight * state;
+		}
+
+	write_imagef(hiddenSummationTempFront, hiddenPosition, (float4)(sum));
+}
+
+void kernel predActivatePacked(read_only image2d_t visibleStates,
+	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weightsPacked,
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
+
+	float sum = read_imagef(hiddenSummationTempBack, hiddenPosition).x;
+
+	sum += packedFieldSum(visibleStates, weightsPacked, fieldOrigins, fieldRanges, radius, -1, hiddenPosition, hiddenIndex);
+
+	write_imagef(hiddenSummationTempFront, hiddenPosition, (float4)(sum));
+}
+
+void kernel predSolveHidden(read_only image2d_t hiddenSummationTemp,
+	read_only image2d_t hiddenStatesBack, write_only image2d_t hiddenStatesFront,
+	read_only image2d_t hiddenActivationsBack, write_only image2d_t hiddenActivationsFront) 
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+	
+	float sum = read_imagef(hiddenSummationTemp, hiddenPosition).x;
+	
+	float s = sum;//sigmoid(sum);
+
+	write_imagef(hiddenStatesFront, hiddenPosition, (float4)(s));
+	write_imagef(hiddenActivationsFront, hiddenPosition, (float4)(s));
+}
+
+void kernel predSolveHiddenThreshold(read_only image2d_t hiddenSummationTemp,
+	read_only image2d_t hiddenStatesBack, write_only image2d_t hiddenStatesFront, 
+	read_only image2d_t hiddenActivationsBack, write_only image2d_t hiddenActivationsFront) 
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+	
+	float activation = read_imagef(hiddenSummationTemp, hiddenPosition).x;
+
+	float state = activation > 0.5f ? 1.0f : 0.0f;
+
+	write_imagef(hiddenStatesFront, hiddenPosition, (float4)(state));
+	write_imagef(hiddenActivationsFront, hiddenPosition, (float4)(activation));
+}
+
+// Fused activation, solve and error propagation of up to two visible layers in a single launch.
+// The errors only depend on the previous predictions, so each work-item solves its hidden unit (if any)
+// and propagates the errors onto its visible units (if any) independently, summations stay in registers
+
+float predFieldSum(read_only image2d_t visibleStates, read_only image3d_t weights,
+	global const int2* fieldOrigins, global const int4* fieldRanges, int radius, int2 hiddenPosition, int hiddenIndex)
+{
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
+
+	float sum = 0.0f;
+
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
+
+			int wi = oy + ox * (radius * 2 + 1);
+
+			sum += read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x * read_imagef(visibleStates, visiblePosition).x;
+		}
+
+	return sum;
+}
+
+float predReverseError(read_only image2d_t targets, read_only image2d_t hiddenStatesPrev, read_only image3d_t weights,
+	global const int* reverseStarts, global const int4* reverseConnections, int visibleIndex)
+{
+	float error = 0.0f;
+
+	int end = reverseStarts[visibleIndex + 1];
+
+	for (int ci = reverseStarts[visibleIndex]; ci < end; ci++) {
+		int4 connection = reverseConnections[ci];
+
+		float predError = read_imagef(targets, connection.xy).x - read_imagef(hiddenStatesPrev, connection.xy).x;
+
+		error += predError * read_imagef(weights, connection).x;
+	}
+
+	return error;
+}
+
+void kernel predActivatePropagate(
+	read_only image2d_t visibleStates0, read_only image3d_t weights0, global const int2* fieldOrigins0, global const int4* fieldRanges0,
+	global const int* reverseStarts0, global const int4* reverseConnections0, write_only image2d_t errors0, int2 visibleSize0, int radius0,
+	read_only image2d_t visibleStates1, read_only image3d_t weights1, global const int2* fieldOrigins1, global const int4* fieldRanges1,
+	global const int* reverseStarts1, global const int4* reverseConnections1, write_only image2d_t errors1, int2 visibleSize1, int radius1,
+	int numLayers, read_only image2d_t targets, read_only image2d_t hiddenStatesPrev,
+	write_only image2d_t hiddenStatesFront, write_only image2d_t hiddenActivationsFront, int2 hiddenSize, int threshold)
+{
+	int2 position = (int2)(get_global_id(0), get_global_id(1));
+
+	if (inBounds0(position, hiddenSize)) {
+		int hiddenIndex = position.x + position.y * hiddenSize.x;
+
+		float sum = predFieldSum(visibleStates0, weights0, fieldOrigins0, fieldRanges0, radius0, position, hiddenIndex);
+
+		if (numLayers > 1)
+			sum += predFieldSum(visibleStates1, weights1, fieldOrigins1, fieldRanges1, radius1, position, hiddenIndex);
+
+		float state = threshold ? (sum > 0.5f ? 1.0f : 0.0f) : sum;
+
+		write_imagef(hiddenStatesFront, position, (float4)(state));
+		write_imagef(hiddenActivationsFront, position, (float4)(threshold ? sum : state));
+	}
+
+	if (inBounds0(position, visibleSize0))
+		write_imagef(errors0, position, (float4)(predReverseError(targets, hiddenStatesPrev, weights0, reverseStarts0, reverseConnections0, position.x + position.y * visibleSize0.x)));
+
+	if (numLayers > 1 && inBounds0(position, visibleSize1))
+		write_imagef(errors1, position, (float4)(predReverseError(targets, hiddenStatesPrev, weights1, reverseStarts1, reverseConnections1, position.x + position.y * visibleSize1.x)));
+}
+
+void kernel predLearnWeights(read_only image2d_t visibleStatesPrev, 
+	read_only image2d_t targets, read_only image2d_t predictionsPrev, read_only image3d_t weightsBack, write_only image3d_t weightsFront,
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius, float weightAlpha,
+	global float* weightsMirror, float2 visibleToHidden, int2 reverseRadii)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
+
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
+	
+	float target = read_imagef(targets, hiddenPosition).x;
+	float predPrev = read_imagef(predictionsPrev, hiddenPosition).x;
+
+	float alphaError = weightAlpha * (target - predPrev);
+
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
+
+			int wi = oy + ox * (radius * 2 + 1);
+
+			float weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
+
+			float state = read_imagef(visibleStatesPrev, visiblePosition).x;
 
-					float predError = read_imagef(targets, hiddenPosition).x - read_imagef(hiddenStatesPrev, hiddenPosition).x;
+			float weight = weightPrev + alphaError * state;
 
-					int wi = offset.y + offset.x * (radius * 2 + 1);
+			write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight));
 
-					float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
-				
-					error += predError * weight;
-				}
+			if (weightsMirror != 0) {
+				int mi = mirrorIndex(visiblePosition, hiddenPosition, visibleSize, visibleToHidden, reverseRadii);
+
+				if (mi >= 0)
+					weightsMirror[mi] = weight;
 			}
 		}
-
-	write_imagef(errors, visiblePosition, (float4)(error));
 }
 
-void kernel predActivate(read_only image2d_t visibleStates,
-	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weights,
-	int2 visibleSize, float2 hiddenToVisible, int radius)
+// Batched learning records the steps with a nonzero scaled error per hidden unit and the steps with a nonzero state
+// per visible unit (as recordActive), then applies the summed outer products over the steps both have to the weights in one pass
+
+void kernel predRecordError(read_only image2d_t targets, read_only image2d_t predictionsPrev,
+	global int* steps, global float* records, global int* counts, int capacity, float weightAlpha, int step)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
-	
-	float sum = read_imagef(hiddenSummationTempBack, hiddenPosition).x;
-
-	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
 
-	for (int dx = -radius; dx <= radius; dx++)
-		for (int dy = -radius; dy <= radius; dy++) {
-			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
 
-			if (inBounds0(visiblePosition, visibleSize)) {
-				int2 offset = visiblePosition - fieldLowerBound;
+	float target = read_imagef(targets, hiddenPosition).x;
+	float predPrev = read_imagef(predictionsPrev, hiddenPosition).x;
 
-				int wi = offset.y + offset.x * (radius * 2 + 1);
+	float alphaError = weightAlpha * (target - predPrev);
 
-				float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
+	int count = step == 0 ? 0 : counts[hiddenIndex];
 
-				float state = read_imagef(visibleStates, visiblePosition).x;
+	if (alphaError != 0.0f) {
+		steps[hiddenIndex * capacity + count] = step;
+		records[hiddenIndex * capacity + count] = alphaError;
 
-				sum += weight * state;
-			}
-		}
+		count++;
+	}
 
-	write_imagef(hiddenSummationTempFront, hiddenPosition, (float4)(sum));
+	counts[hiddenIndex] = count;
 }
 
-void kernel predSolveHidden(read_only image2d_t hiddenSummationTemp,
-	read_only image2d_t hiddenStatesBack, write_only image2d_t hiddenStatesFront,
-	read_only image2d_t hiddenActivationsBack, write_only image2d_t hiddenActivationsFront) 
+void kernel predLearnWeightsBatched(global const int* stateSteps, global const float* states, global const int* stateCounts, int stateCapacity,
+	global const int* errorSteps, global const float* errors, global const int* errorCounts, int errorCapacity,
+	read_only image3d_t weightsBack, write_only image3d_t weightsFront,
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius,
+	global float* weightsMirror, float2 visibleToHidden, int2 reverseRadii)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	
-	float sum = read_imagef(hiddenSummationTemp, hiddenPosition).x;
-	
-	float s = sum;//sigmoid(sum);
 
-	write_imagef(hiddenStatesFront, hiddenPosition, (float4)(s));
-	write_imagef(hiddenActivationsFront, hiddenPosition, (float4)(s));
-}
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
 
-void kernel predSolveHiddenThreshold(read_only image2d_t hiddenSummationTemp,
-	read_only image2d_t hiddenStatesBack, write_only image2d_t hiddenStatesFront, 
-	read_only image2d_t hiddenActivationsBack, write_only image2d_t hiddenActivationsFront) 
-{
-	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	
-	float activation = read_imagef(hiddenSummationTemp, hiddenPosition).x;
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
 
-	float state = activation > 0.5f ? 1.0f : 0.0f;
+	int errorStart = hiddenIndex * errorCapacity;
+	int errorCount = errorCounts[hiddenIndex];
 
-	write_imagef(hiddenStatesFront, hiddenPosition, (float4)(state));
-	write_imagef(hiddenActivationsFront, hiddenPosition, (float4)(activation));
-}
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
 
-void kernel predLearnWeights(read_only image2d_t visibleStatesPrev, 
-	read_only image2d_t targets, read_only image2d_t predictionsPrev, read_only image3d_t weightsBack, write_only image3d_t weightsFront,
-	int2 visibleSize, float2 hiddenToVisible, int radius, float weightAlpha)
-{
-	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
+			int wi = oy + ox * (radius * 2 + 1);
 
-	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
-	
-	float target = read_imagef(targets, hiddenPosition).x;
-	float predPrev = read_imagef(predictionsPrev, hiddenPosition).x;
+			float weight = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
 
-	float alphaError = weightAlpha * (target - predPrev);
+			int visibleIndex = visiblePosition.x + visiblePosition.y * visibleSize.x;
 
-	for (int dx = -radius; dx <= radius; dx++)
-		for (int dy = -radius; dy <= radius; dy++) {
-			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+			int stateStart = visibleIndex * stateCapacity;
+			int stateCount = stateCounts[visibleIndex];
 
-			if (inBounds0(visiblePosition, visibleSize)) {
-				int2 offset = visiblePosition - fieldLowerBound;
+			// Both records are in step order, merge them
+			int ei = 0;
+			int si = 0;
 
-				int wi = offset.y + offset.x * (radius * 2 + 1);
+			while (ei < errorCount && si < stateCount) {
+				int errorStep = errorSteps[errorStart + ei];
+				int stateStep = stateSteps[stateStart + si];
 
-				float weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
+				if (errorStep == stateStep) {
+					weight += errors[errorStart + ei] * states[stateStart + si];
 
-				float state = read_imagef(visibleStatesPrev, visiblePosition).x;
+					ei++;
+					si++;
+				}
+				else if (errorStep < stateStep)
+					ei++;
+				else
+					si++;
+			}
 
-				float weight = weightPrev + alphaError * state;
+			write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight));
 
-				write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), (float4)(weight));
+			if (weightsMirror != 0) {
+				int mi = mirrorIndex(visiblePosition, hiddenPosition, visibleSize, visibleToHidden, reverseRadii);
+
+				if (mi >= 0)
+					weightsMirror[mi] = weight;
 			}
 		}
 }
@@ -781,72 +1657,138 @@ void kernel predLearnWeightsTraces(read_only image2d_t visibleStatesPrev,
 		}
 }
 
+// Quantized (int8) inference. Weights are scaled per hidden unit by the largest absolute weight of the unit,
+// and summed in int32 against binary (> 0.5) visible states
+
+void kernel predQuantizeScales(read_only image3d_t weights, read_only image2d_t scalesBack, write_only image2d_t scalesFront,
+	int numWeights)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+
+	float scale = read_imagef(scalesBack, hiddenPosition).x;
+
+	for (int wi = 0; wi < numWeights; wi++)
+		scale = fmax(scale, fabs(read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x));
+
+	write_imagef(scalesFront, hiddenPosition, (float4)(scale));
+}
+
+void kernel predQuantizeWeights(read_only image3d_t weights, read_only image2d_t scales, write_only image3d_t weightsQuantized) {
+	int3 position = (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
+
+	float scale = read_imagef(scales, position.xy).x;
+
+	float weight = read_imagef(weights, (int4)(position, 0)).x;
+
+	int quantized = scale > 0.0f ? clamp(convert_int_rte(weight / scale * 127.0f), -127, 127) : 0;
+
+	write_imagei(weightsQuantized, (int4)(position, 0), (int4)(quantized));
+}
+
+void kernel predActivateQuantized(read_only image2d_t visibleStates,
+	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weightsQuantized,
+	int2 visibleSize, float2 hiddenToVisible, int radius)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
+	
+	int sum = read_imagei(hiddenSummationTempBack, hiddenPosition).x;
+
+	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+
+	for (int dx = -radius; dx <= radius; dx++)
+		for (int dy = -radius; dy <= radius; dy++) {
+			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+
+			if (inBounds0(visiblePosition, visibleSize) && read_imagef(visibleStates, visiblePosition).x > 0.5f) {
+				int2 offset = visiblePosition - fieldLowerBound;
+
+				int wi = offset.y + offset.x * (radius * 2 + 1);
+
+				sum += read_imagei(weightsQuantized, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
+			}
+		}
+
+	write_imagei(hiddenSummationTempFront, hiddenPosition, (int4)(sum));
+}
+
+void kernel predSolveHiddenQuantized(read_only image2d_t hiddenSummationTemp, read_only image2d_t scales,
+	write_only image2d_t hiddenStatesFront, write_only image2d_t hiddenActivationsFront) 
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+	
+	float sum = convert_float(read_imagei(hiddenSummationTemp, hiddenPosition).x) * read_imagef(scales, hiddenPosition).x * (1.0f / 127.0f);
+
+	write_imagef(hiddenStatesFront, hiddenPosition, (float4)(sum));
+	write_imagef(hiddenActivationsFront, hiddenPosition, (float4)(sum));
+}
+
+void kernel predSolveHiddenThresholdQuantized(read_only image2d_t hiddenSummationTemp, read_only image2d_t scales,
+	write_only image2d_t hiddenStatesFront, write_only image2d_t hiddenActivationsFront) 
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+	
+	float activation = convert_float(read_imagei(hiddenSummationTemp, hiddenPosition).x) * read_imagef(scales, hiddenPosition).x * (1.0f / 127.0f);
+
+	float state = activation > 0.5f ? 1.0f : 0.0f;
+
+	write_imagef(hiddenStatesFront, hiddenPosition, (float4)(state));
+	write_imagef(hiddenActivationsFront, hiddenPosition, (float4)(activation));
+}
+
 // ----------------------------------------- Predictor Swarm -----------------------------------------
 
 void kernel predErrorPropagateSwarm(read_only image2d_t targets, read_only image2d_t hiddenStatesPrev,
 	write_only image2d_t errors, read_only image3d_t weights,
-	int2 visibleSize, int2 hiddenSize, float2 visibleToHidden, float2 hiddenToVisible, int radius, int2 reverseRadii)
+	global const int* reverseStarts, global const int4* reverseConnections, int2 visibleSize)
 {
 	int2 visiblePosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 hiddenPositionCenter = (int2)(visiblePosition.x * visibleToHidden.x + 0.5f, visiblePosition.y * visibleToHidden.y + 0.5f);
-	
+
+	int visibleIndex = visiblePosition.x + visiblePosition.y * visibleSize.x;
+
 	float error = 0.0f;
 
-	for (int dx = -reverseRadii.x; dx <= reverseRadii.x; dx++)
-		for (int dy = -reverseRadii.y; dy <= reverseRadii.y; dy++) {
-			int2 hiddenPosition = hiddenPositionCenter + (int2)(dx, dy);
-		
-			if (inBounds0(hiddenPosition, hiddenSize)) {
-				// Next layer node's receptive field
-				int2 fieldCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
+	int end = reverseStarts[visibleIndex + 1];
 
-				int2 fieldLowerBound = fieldCenter - (int2)(radius);
-				int2 fieldUpperBound = fieldCenter + (int2)(radius + 1); // So is included in inBounds
-		
-				// Check for containment
-				if (inBounds(visiblePosition, fieldLowerBound, fieldUpperBound)) {	
-					int2 offset = visiblePosition - fieldLowerBound;
+	for (int ci = reverseStarts[visibleIndex]; ci < end; ci++) {
+		int4 connection = reverseConnections[ci];
 
-					float predError = read_imagef(targets, hiddenPosition).x - read_imagef(hiddenStatesPrev, hiddenPosition).x;
+		int2 hiddenPosition = connection.xy;
 
-					int wi = offset.y + offset.x * (radius * 2 + 1);
+		float predError = read_imagef(targets, hiddenPosition).x - read_imagef(hiddenStatesPrev, hiddenPosition).x;
 
-					float weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).x;
-				
-					error += predError * weight;
-				}
-			}
-		}
+		float weight = read_imagef(weights, connection).x;
+
+		error += predError * weight;
+	}
 
 	write_imagef(errors, visiblePosition, (float4)(error));
 }
 
 void kernel predActivateSwarm(read_only image2d_t visibleStates,
 	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weights,
-	int2 visibleSize, float2 hiddenToVisible, int radius)
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
 	
 	float2 sum = read_imagef(hiddenSummationTempBack, hiddenPosition).xy;
 
-	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
 
-	for (int dx = -radius; dx <= radius; dx++)
-		for (int dy = -radius; dy <= radius; dy++) {
-			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
 
-			if (inBounds0(visiblePosition, visibleSize)) {
-				int2 offset = visiblePosition - fieldLowerBound;
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
 
-				int wi = offset.y + offset.x * (radius * 2 + 1);
+			int wi = oy + ox * (radius * 2 + 1);
 
-				float2 weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xz;
+			float2 weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xz;
 
-				float state = read_imagef(visibleStates, visiblePosition).x;
+			float state = read_imagef(visibleStates, visiblePosition).x;
 
-				sum += weight * state;
-			}
+			sum += weight * state;
 		}
 
 	write_imagef(hiddenSummationTempFront, hiddenPosition, (float4)(sum, 0.0f, 0.0f));
@@ -855,9 +1797,9 @@ void kernel predActivateSwarm(read_only image2d_t visibleStates,
 void kernel predSolveHiddenSwarm(read_only image2d_t hiddenSummationTemp,
 	read_only image2d_t hiddenStatesBack, write_only image2d_t hiddenStatesFront,
 	read_only image2d_t hiddenActivationsBack, write_only image2d_t hiddenActivationsFront,
-	float noise, uint2 seed) 
+	float noise, uint2 rngKey, global const uint2* rngStep)
 {
-	uint2 seedValue = seed + (uint2)(get_global_id(0) * 123 + 5, get_global_id(1) * 24 + 2) * 45;
+	RandomState seedValue = randomState(rngKey, rngStep[0]);
 
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
 	
@@ -874,9 +1816,9 @@ void kernel predSolveHiddenSwarm(read_only image2d_t hiddenSummationTemp,
 void kernel predSolveHiddenThresholdSwarm(read_only image2d_t hiddenSummationTemp,
 	read_only image2d_t hiddenStatesBack, write_only image2d_t hiddenStatesFront, 
 	read_only image2d_t hiddenActivationsBack, write_only image2d_t hiddenActivationsFront,
-	float noise, uint2 seed)  
+	float noise, uint2 rngKey, global const uint2* rngStep)
 {
-	uint2 seedValue = seed + (uint2)(get_global_id(0) * 45 + 25, get_global_id(1) * 56 + 24) * 6;
+	RandomState seedValue = randomState(rngKey, rngStep[0]);
 
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
 	
@@ -892,12 +1834,14 @@ void kernel predSolveHiddenThresholdSwarm(read_only image2d_t hiddenSummationTem
 
 void kernel predLearnWeightsTracesSwarm(read_only image2d_t visibleStatesPrev, 
 	read_only image2d_t targets, read_only image2d_t predictionStates, read_only image2d_t predictionActivationsPrev, read_only image2d_t predictionStatesPrev, read_only image3d_t weightsBack, write_only image3d_t weightsFront,
-	int2 visibleSize, float2 hiddenToVisible, int radius, float3 weightAlpha, float2 weightLambda, float reward, float gamma)
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius, float3 weightAlpha, float2 weightLambda, float reward, float gamma)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
 
-	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
+
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
 	
 	float target = read_imagef(targets, hiddenPosition).x;
 	float2 state = read_imagef(predictionStates, hiddenPosition).xy;
@@ -910,34 +1854,122 @@ void kernel predLearnWeightsTracesSwarm(read_only image2d_t visibleStatesPrev,
 
 	float tdError = reward + gamma * state.y - predPrev.y;
 
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
+
+			int wi = oy + ox * (radius * 2 + 1);
+
+			float4 weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0));
+
+			float statePrev = read_imagef(visibleStatesPrev, visiblePosition).x;
+
+			//float oneMinusStatePrev = 1.0f - statePrev;
+
+			float newYTrace = weightPrev.y * weightLambda.x + weightAlpha.x * randError * statePrev;
+			float newWTrace = weightPrev.w * weightLambda.y + weightAlpha.y * statePrev;
+
+			float4 weight = (float4)(weightPrev.x + weightAlpha.z * predError * statePrev + (tdError > 0.0f ? 1.0f : 0.0f) * newYTrace, newYTrace,
+					weightPrev.z + tdError * newWTrace, newWTrace);
+
+			write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), weight);
+		}
+}
+
+// Quantized (int8) inference, the two activation weights (x and z) are scaled separately
+
+void kernel predQuantizeScalesSwarm(read_only image3d_t weights, read_only image2d_t scalesBack, write_only image2d_t scalesFront,
+	int numWeights)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+
+	float2 scale = read_imagef(scalesBack, hiddenPosition).xy;
+
+	for (int wi = 0; wi < numWeights; wi++)
+		scale = fmax(scale, fabs(read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xz));
+
+	write_imagef(scalesFront, hiddenPosition, (float4)(scale, 0.0f, 0.0f));
+}
+
+void kernel predQuantizeWeightsSwarm(read_only image3d_t weights, read_only image2d_t scales, write_only image3d_t weightsQuantized) {
+	int3 position = (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
+
+	float2 scale = read_imagef(scales, position.xy).xy;
+
+	float2 weight = read_imagef(weights, (int4)(position, 0)).xz;
+
+	int2 quantized = (int2)(scale.x > 0.0f ? clamp(convert_int_rte(weight.x / scale.x * 127.0f), -127, 127) : 0,
+		scale.y > 0.0f ? clamp(convert_int_rte(weight.y / scale.y * 127.0f), -127, 127) : 0);
+
+	write_imagei(weightsQuantized, (int4)(position, 0), (int4)(quantized, 0, 0));
+}
+
+void kernel predActivateQuantizedSwarm(read_only image2d_t visibleStates,
+	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weightsQuantized,
+	int2 visibleSize, float2 hiddenToVisible, int radius)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+	int2 visiblePositionCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
+	
+	int2 sum = read_imagei(hiddenSummationTempBack, hiddenPosition).xy;
+
+	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
+
 	for (int dx = -radius; dx <= radius; dx++)
 		for (int dy = -radius; dy <= radius; dy++) {
 			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
 
-			if (inBounds0(visiblePosition, visibleSize)) {
+			if (inBounds0(visiblePosition, visibleSize) && read_imagef(visibleStates, visiblePosition).x > 0.5f) {
 				int2 offset = visiblePosition - fieldLowerBound;
 
 				int wi = offset.y + offset.x * (radius * 2 + 1);
 
-				float4 weightPrev = read_imagef(weightsBack, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0));
+				sum += read_imagei(weightsQuantized, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xy;
+			}
+		}
 
-				float statePrev = read_imagef(visibleStatesPrev, visiblePosition).x;
+	write_imagei(hiddenSummationTempFront, hiddenPosition, (int4)(sum, 0, 0));
+}
 
-				//float oneMinusStatePrev = 1.0f - statePrev;
+void kernel predSolveHiddenQuantizedSwarm(read_only image2d_t hiddenSummationTemp, read_only image2d_t scales,
+	write_only image2d_t hiddenStatesFront, write_only image2d_t hiddenActivationsFront,
+	float noise, uint2 rngKey, global const uint2* rngStep)
+{
+	RandomState seedValue = randomState(rngKey, rngStep[0]);
 
-				float newYTrace = weightPrev.y * weightLambda.x + weightAlpha.x * randError * statePrev;
-				float newWTrace = weightPrev.w * weightLambda.y + weightAlpha.y * statePrev;
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+	
+	float2 sum = convert_float2(read_imagei(hiddenSummationTemp, hiddenPosition).xy) * read_imagef(scales, hiddenPosition).xy * (1.0f / 127.0f);
 
-				float4 weight = (float4)(weightPrev.x + weightAlpha.z * predError * statePrev + (tdError > 0.0f ? 1.0f : 0.0f) * newYTrace, newYTrace,
-						weightPrev.z + tdError * newWTrace, newWTrace);
+	float s = sigmoid(sum.x);
 
-				write_imagef(weightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), weight);
-			}
-		}
+	float2 state = (float2)(fmin(1.0f, fmax(0.0f, s + randNormal(&seedValue) * noise)), sum.y);
+	
+	write_imagef(hiddenStatesFront, hiddenPosition, (float4)(state, 0.0f, 0.0f));
+	write_imagef(hiddenActivationsFront, hiddenPosition, (float4)(s, sum.y, 0.0f, 0.0f));
+}
+
+void kernel predSolveHiddenThresholdQuantizedSwarm(read_only image2d_t hiddenSummationTemp, read_only image2d_t scales,
+	write_only image2d_t hiddenStatesFront, write_only image2d_t hiddenActivationsFront,
+	float noise, uint2 rngKey, global const uint2* rngStep)
+{
+	RandomState seedValue = randomState(rngKey, rngStep[0]);
+
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+	
+	float2 sum = convert_float2(read_imagei(hiddenSummationTemp, hiddenPosition).xy) * read_imagef(scales, hiddenPosition).xy * (1.0f / 127.0f);
+	
+	float s = sum.x > 0.5f ? 1.0f : 0.0f;
+
+	float2 state = (float2)(randFloat(&seedValue) < noise ? 1.0f - s : s, sum.y);
+	
+	write_imagef(hiddenStatesFront, hiddenPosition, (float4)(state, 0.0f, 0.0f));
+	write_imagef(hiddenActivationsFront, hiddenPosition, (float4)(s, sum.y, 0.0f, 0.0f));
 }
 
 // ----------------------------------------- Predictor Swarm -----------------------------------------
 
+// Not table driven, the Q layer is bounds checked against the hidden size here and changing that would change results
 void kernel swarmQPropagateToHiddenError(read_only image3d_t weights, write_only image2d_t hiddenErrors,
 	int2 qSize, int2 hiddenSize, float2 qToHidden, float2 hiddenToQ, int radius, int2 reverseQRadii)
 {
@@ -1055,6 +2087,54 @@ void kernel swarmInitSummation(read_only image2d_t hiddenBiases, write_only imag
 
 void kernel swarmQActivateToHidden(read_only image2d_t visibleStates,
 	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weights,
+	int2 visibleSize, global const int2* fieldOrigins, global const int4* fieldRanges, int radius)
+{
+	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
+	
+	float2 sum = read_imagef(hiddenSummationTempBack, hiddenPosition).xy;
+
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * get_global_size(0);
+
+	int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+	int4 fieldRange = fieldRanges[hiddenIndex];
+
+	for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+		for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
+
+			int wi = oy + ox * (radius * 2 + 1);
+
+			float2 weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xz;
+
+			float state = read_imagef(visibleStates, visiblePosition).x;
+
+			sum += weight * state;
+		}
+
+	write_imagef(hiddenSummationTempFront, hiddenPosition, (float4)(sum.x, sum.y, 0.0f, 0.0f));
+}
+
+// State of the visible unit at a field offset (0 outside the visible layer, or past the field for the padding lane), advancing the offset by one weight index
+float swarmPackedState(read_only image2d_t visibleStates, int2 visibleSize, int2 fieldLowerBound, int weightDiam, int2* offset) {
+	int2 visiblePosition = fieldLowerBound + *offset;
+
+	float state = 0.0f;
+
+	if ((*offset).x < weightDiam && inBounds0(visiblePosition, visibleSize))
+		state = read_imagef(visibleStates, visiblePosition).x;
+
+	(*offset).y++;
+
+	if ((*offset).y == weightDiam) {
+		(*offset).y = 0;
+		(*offset).x++;
+	}
+
+	return state;
+}
+
+void kernel swarmQActivateToHiddenPacked(read_only image2d_t visibleStates,
+	read_only image2d_t hiddenSummationTempBack, write_only image2d_t hiddenSummationTempFront, read_only image3d_t weightsPacked,
 	int2 visibleSize, float2 hiddenToVisible, int radius)
 {
 	int2 hiddenPosition = (int2)(get_global_id(0), get_global_id(1));
@@ -1064,22 +2144,22 @@ void kernel swarmQActivateToHidden(read_only image2d_t visibleStates,
 
 	int2 fieldLowerBound = visiblePositionCenter - (int2)(radius);
 
-	for (int dx = -radius; dx <= radius; dx++)
-		for (int dy = -radius; dy <= radius; dy++) {
-			int2 visiblePosition = visiblePositionCenter + (int2)(dx, dy);
+	int weightDiam = radius * 2 + 1;
 
-			if (inBounds0(visiblePosition, visibleSize)) {
-				int2 offset = visiblePosition - fieldLowerBound;
+	int numTexels = (weightDiam * weightDiam + 1) / 2;
 
-				int wi = offset.y + offset.x * (radius * 2 + 1);
+	int2 offset = (int2)(0);
+
+	for (int t = 0; t < numTexels; t++) {
+		float4 weight = read_imagef(weightsPacked, (int4)(hiddenPosition.x, hiddenPosition.y, t, 0));
 
-				float2 weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xz;
+		float2 state;
 
-				float state = read_imagef(visibleStates, visiblePosition).x;
+		state.x = swarmPackedState(visibleStates, visibleSize, fieldLowerBound, weightDiam, &offset);
+		state.y = swarmPackedState(visibleStates, visibleSize, fieldLowerBound, weightDiam, &offset);
 
-				sum += weight * state;
-			}
-		}
+		sum += weight.xy * state.x + weight.zw * state.y;
+	}
 
 	write_imagef(hiddenSummationTempFront, hiddenPosition, (float4)(sum.x, sum.y, 0.0f, 0.0f));
 }
@@ -1100,40 +2180,27 @@ void kernel swarmQSolveHidden(read_only image2d_t hiddenSummationTemp,
 
 void kernel swarmHiddenPropagateToVisibleAction(read_only image2d_t hiddenErrors, read_only image2d_t hiddenStates,
 	read_only image3d_t weights, read_only image2d_t actionsBack, write_only image2d_t actionsFront,
-	int2 hiddenSize, int2 visibleSize, float2 hiddenToVisible, float2 visibleToHidden, int radius, int2 reverseRadii,
+	global const int* reverseStarts, global const int4* reverseConnections, int2 visibleSize,
 	float actionAlpha)
 {
 	int2 visiblePosition = (int2)(get_global_id(0), get_global_id(1));
-	int2 hiddenPositionCenter = (int2)(visiblePosition.x * visibleToHidden.x + 0.5f, visiblePosition.y * visibleToHidden.y + 0.5f);
-	
+
+	int visibleIndex = visiblePosition.x + visiblePosition.y * visibleSize.x;
+
 	float error = 0.0f;
 
-	for (int dx = -reverseRadii.x; dx <= reverseRadii.x; dx++)
-		for (int dy = -reverseRadii.y; dy <= reverseRadii.y; dy++) {
-			int2 hiddenPosition = hiddenPositionCenter + (int2)(dx, dy);
-		
-			if (inBounds0(hiddenPosition, hiddenSize)) {
-				// Next layer node's receptive field
-				int2 fieldCenter = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f);
+	int end = reverseStarts[visibleIndex + 1];
 
-				int2 fieldLowerBound = fieldCenter - (int2)(radius);
-				int2 fieldUpperBound = fieldCenter + (int2)(radius + 1); // So is included in inBounds
-		
-				// Check for containment
-				if (inBounds(visiblePosition, fieldLowerBound, fieldUpperBound)) {	
-					int2 offset = visiblePosition - fieldLowerBound;
+	for (int ci = reverseStarts[visibleIndex]; ci < end; ci++) {
+		int4 connection = reverseConnections[ci];
 
-					float2 hiddenState = read_imagef(hiddenStates, hiddenPosition).xy;
-					float2 hiddenError = read_imagef(hiddenErrors, hiddenPosition).xy;
+		float2 hiddenState = read_imagef(hiddenStates, connection.xy).xy;
+		float2 hiddenError = read_imagef(hiddenErrors, connection.xy).xy;
 
-					int wi = offset.y + offset.x * (radius * 2 + 1);
+		float2 weight = read_imagef(weights, connection).xz;
 
-					float2 weight = read_imagef(weights, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0)).xz;
-				
-					error += dot((1.0f - hiddenState * hiddenState) * hiddenError, weight);
-				}
-			}
-		}
+		error += dot((1.0f - hiddenState * hiddenState) * hiddenError, weight);
+	}
 
 	float prevAction = read_imagef(actionsBack, visiblePosition).x;
 
@@ -1143,9 +2210,9 @@ void kernel swarmHiddenPropagateToVisibleAction(read_only image2d_t hiddenErrors
 }
 
 void kernel swarmExploration(read_only image2d_t actions,
-	write_only image2d_t actionsExploratory, float expPert, float expBreak, uint2 seed)  
+	write_only image2d_t actionsExploratory, float expPert, float expBreak, uint2 rngKey, global const uint2* rngStep)
 {
-	uint2 seedValue = seed + (uint2)(get_global_id(0) * 45 + 25, get_global_id(1) * 56 + 24) * 6;
+	RandomState seedValue = randomState(rngKey, rngStep[0]);
 
 	int2 position = (int2)(get_global_id(0), get_global_id(1));
 	
@@ -1413,6 +2480,404 @@ void kernel phCopyAction(read_only image2d_t source, write_only image2d_t destin
 	write_imagef(destination, position, (float4)(s));
 }
 
+void kernel phPoolInput(read_only image2d_t inputs, read_only image2d_t pooledBack, write_only image2d_t pooledFront,
+	int reset)
+{
+	int2 position = (int2)(get_global_id(0), get_global_id(1));
+
+	float input = read_imagef(inputs, position).x;
+
+	float pooled = reset ? input : fmax(input, read_imagef(pooledBack, position).x);
+
+	write_imagef(pooledFront, position, (float4)(pooled));
+}
+
+void kernel phCountChanges(read_only image2d_t states, read_only image2d_t statesPrev, global int* count) {
+	int2 position = (int2)(get_global_id(0), get_global_id(1));
+
+	if ((read_imagef(states, position).x > 0.5f) != (read_imagef(statesPrev, position).x > 0.5f))
+		atomic_inc(count);
+}
+
+void kernel phRolloutArgmax(read_only image2d_t predictions, global int* maxIndex, int2 size) {
+	int index = 0;
+	float maxValue = read_imagef(predictions, (int2)(0, 0)).x;
+
+	for (int y = 0; y < size.y; y++)
+		for (int x = 0; x < size.x; x++) {
+			float value = read_imagef(predictions, (int2)(x, y)).x;
+
+			if (value > maxValue) {
+				maxValue = value;
+				index = x + y * size.x;
+			}
+		}
+
+	maxIndex[0] = index;
+}
+
+void kernel phRolloutPostProcess(read_only image2d_t predictions, write_only image2d_t inputs,
+	global const int* maxIndex, global float* trajectory,
+	int2 size, int mode, float threshold, int offset)
+{
+	int2 position = (int2)(get_global_id(0), get_global_id(1));
+
+	int index = position.x + position.y * size.x;
+
+	float value = read_imagef(predictions, position).x;
+
+	// 1 = one-hot of the maximum, 2 = threshold
+	if (mode == 1)
+		value = index == maxIndex[0] ? 1.0f : 0.0f;
+	else if (mode == 2)
+		value = value > threshold ? 1.0f : 0.0f;
+
+	write_imagef(inputs, position, (float4)(value));
+
+	trajectory[offset + index] = value;
+}
+
+// ----------------------------------------- Hierarchy Megakernel -----------------------------------------
+
+// Whole simulation step of a predictive hierarchy in a single launch of a single work-group, so barriers synchronize
+// all phases. All state lives in one float buffer (weights as copied from their images, element (hidden index + wi * hidden count)
+// times the channels), the layout of each layer holds the offsets of its regions. Sparse coder weights hold traces (2 channels)
+
+typedef struct {
+	int hiddenWidth, hiddenHeight, inputWidth, inputHeight;
+	int hasUpper, predThreshold, feedForwardRadius, recurrentRadius;
+	int lateralRadius, predictiveRadius, feedBackRadius;
+
+	// Reverse radii of the sparse coder (feed forward, recurrent) and predictor (predictive, feed back) visible layers
+	int scReverseRadiusX, scReverseRadiusY, recReverseRadiusX, recReverseRadiusY;
+	int predReverseRadiusX, predReverseRadiusY, feedBackReverseRadiusX, feedBackReverseRadiusY;
+
+	// Offsets (lower feed back errors are those of the layer below, -1 for the first layer)
+	int input, scStates, scStatesPrev, scActivations;
+	int scBiases, scWeights, recWeights, scReconstructionErrors;
+	int recReconstructionErrors, baseLines, rewards, predStates;
+	int predStatesPrev, predActivations, predWeights, feedBackWeights;
+	int predErrors, feedBackErrors, lowerFeedBackErrors, lowerWidth, lowerHeight;
+
+	// Transformations (hidden to visible, visible to hidden)
+	float scToVisibleX, scToVisibleY, scToHiddenX, scToHiddenY;
+	float recToVisibleX, recToVisibleY, recToHiddenX, recToHiddenY;
+	float predToVisibleX, predToVisibleY, predToHiddenX, predToHiddenY;
+
+	// Parameters
+	float scWeightAlpha, recWeightAlpha, scWeightLambda, scActiveRatio;
+	float scBoostAlpha, baseLineDecay, predWeightAlpha;
+} MegaLayer;
+
+float megaFieldSum(global const float* data, int visible, int2 visibleSize, int weights, int channels,
+	int2 hiddenPosition, int2 hiddenSize, float2 hiddenToVisible, int radius, int ignoreMiddle)
+{
+	int numHidden = hiddenSize.x * hiddenSize.y;
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * hiddenSize.x;
+
+	int diam = radius * 2 + 1;
+
+	int2 fieldLowerBound = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f) - (int2)(radius);
+
+	float sum = 0.0f;
+
+	for (int ox = 0; ox < diam; ox++)
+		for (int oy = 0; oy < diam; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
+
+			if (!inBounds0(visiblePosition, visibleSize) || (ignoreMiddle && ox == radius && oy == radius))
+				continue;
+
+			int wi = oy + ox * diam;
+
+			sum += data[weights + (hiddenIndex + wi * numHidden) * channels] * data[visible + visiblePosition.x + visiblePosition.y * visibleSize.x];
+		}
+
+	return sum;
+}
+
+// Sum of the weights onto a visible unit times a per hidden factor (values, minus subtracted if not negative)
+float megaReverseSum(global const float* data, int values, int subtracted, int weights, int channels,
+	int2 visiblePosition, int2 hiddenSize, float2 hiddenToVisible, float2 visibleToHidden, int radius, int2 reverseRadii)
+{
+	int numHidden = hiddenSize.x * hiddenSize.y;
+
+	int diam = radius * 2 + 1;
+
+	int2 hiddenPositionCenter = (int2)(visiblePosition.x * visibleToHidden.x + 0.5f, visiblePosition.y * visibleToHidden.y + 0.5f);
+
+	float sum = 0.0f;
+
+	for (int dx = -reverseRadii.x; dx <= reverseRadii.x; dx++)
+		for (int dy = -reverseRadii.y; dy <= reverseRadii.y; dy++) {
+			int2 hiddenPosition = hiddenPositionCenter + (int2)(dx, dy);
+
+			if (!inBounds0(hiddenPosition, hiddenSize))
+				continue;
+
+			int2 fieldLowerBound = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f) - (int2)(radius);
+
+			if (!inBounds(visiblePosition, fieldLowerBound, fieldLowerBound + (int2)(diam)))
+				continue;
+
+			int2 offset = visiblePosition - fieldLowerBound;
+
+			int hiddenIndex = hiddenPosition.x + hiddenPosition.y * hiddenSize.x;
+
+			int wi = offset.y + offset.x * diam;
+
+			float factor = data[values + hiddenIndex] - (subtracted >= 0 ? data[subtracted + hiddenIndex] : 0.0f);
+
+			sum += factor * data[weights + (hiddenIndex + wi * numHidden) * channels];
+		}
+
+	return sum;
+}
+
+// Trace learning of the sparse coder weights of a hidden unit (as cscLearnHiddenWeightsTracesFused)
+void megaLearnTraces(global float* data, int visibleErrors, int2 visibleSize, int weights,
+	int2 hiddenPosition, int2 hiddenSize, float2 hiddenToVisible, int radius,
+	float state, float reward, float weightAlpha, float weightLambda)
+{
+	int numHidden = hiddenSize.x * hiddenSize.y;
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * hiddenSize.x;
+
+	int diam = radius * 2 + 1;
+
+	int2 fieldLowerBound = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f) - (int2)(radius);
+
+	for (int ox = 0; ox < diam; ox++)
+		for (int oy = 0; oy < diam; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
+
+			if (!inBounds0(visiblePosition, visibleSize))
+				continue;
+
+			int wi = oy + ox * diam;
+
+			global float* weight = data + weights + (hiddenIndex + wi * numHidden) * 2;
+
+			float2 weightPrev = (float2)(weight[0], weight[1]);
+
+			float visibleError = data[visibleErrors + visiblePosition.x + visiblePosition.y * visibleSize.x];
+
+			weight[0] = weightPrev.x + reward * weightPrev.y;
+			weight[1] = weightPrev.y * weightLambda + weightAlpha * ((visibleError - weightPrev.x) * state);
+		}
+}
+
+// Predictor learning of the weights of a hidden unit (as predLearnWeights)
+void megaLearnPrediction(global float* data, int visibleStatesPrev, int2 visibleSize, int weights,
+	int2 hiddenPosition, int2 hiddenSize, float2 hiddenToVisible, int radius, float alphaError)
+{
+	int numHidden = hiddenSize.x * hiddenSize.y;
+	int hiddenIndex = hiddenPosition.x + hiddenPosition.y * hiddenSize.x;
+
+	int diam = radius * 2 + 1;
+
+	int2 fieldLowerBound = (int2)(hiddenPosition.x * hiddenToVisible.x + 0.5f, hiddenPosition.y * hiddenToVisible.y + 0.5f) - (int2)(radius);
+
+	for (int ox = 0; ox < diam; ox++)
+		for (int oy = 0; oy < diam; oy++) {
+			int2 visiblePosition = fieldLowerBound + (int2)(ox, oy);
+
+			if (!inBounds0(visiblePosition, visibleSize))
+				continue;
+
+			int wi = oy + ox * diam;
+
+			data[weights + hiddenIndex + wi * numHidden] += alphaError * data[visibleStatesPrev + visiblePosition.x + visiblePosition.y * visibleSize.x];
+		}
+}
+
+void kernel phMegaStep(global float* data, global const MegaLayer* layers, int numLayers, int learn) {
+	int lid = get_local_id(0);
+	int groupSize = get_local_size(0);
+
+	// Feed forward (sparse coders and baselines)
+	for (int l = 0; l < numLayers; l++) {
+		MegaLayer ml = layers[l];
+
+		int2 hiddenSize = (int2)(ml.hiddenWidth, ml.hiddenHeight);
+		int2 inputSize = (int2)(ml.inputWidth, ml.inputHeight);
+
+		int numHidden = hiddenSize.x * hiddenSize.y;
+		int numInput = inputSize.x * inputSize.y;
+
+		// Activate from biases, input, and recurrent states (as cscActivate, cscActivateIgnoreMiddle)
+		for (int hi = lid; hi < numHidden; hi += groupSize) {
+			int2 hiddenPosition = (int2)(hi % hiddenSize.x, hi / hiddenSize.x);
+
+			float sum = data[ml.scBiases + hi];
+
+			sum += megaFieldSum(data, ml.input, inputSize, ml.scWeights, 2, hiddenPosition, hiddenSize, (float2)(ml.scToVisibleX, ml.scToVisibleY), ml.feedForwardRadius, 0);
+			sum += megaFieldSum(data, ml.scStatesPrev, hiddenSize, ml.recWeights, 2, hiddenPosition, hiddenSize, (float2)(ml.recToVisibleX, ml.recToVisibleY), ml.recurrentRadius, 1);
+
+			data[ml.scActivations + hi] = sum;
+		}
+
+		barrier(CLK_GLOBAL_MEM_FENCE);
+
+		// Solve sparse codes (as cscSolveHidden)
+		for (int hi = lid; hi < numHidden; hi += groupSize) {
+			int2 hiddenPosition = (int2)(hi % hiddenSize.x, hi / hiddenSize.x);
+
+			float activation = data[ml.scActivations + hi];
+
+			float inhibition = 0.0f;
+
+			float counter = 0.0f;
+
+			for (int dx = -ml.lateralRadius; dx <= ml.lateralRadius; dx++)
+				for (int dy = -ml.lateralRadius; dy <= ml.lateralRadius; dy++) {
+					if (dx == 0 && dy == 0)
+						continue;
+
+					int2 otherPosition = hiddenPosition + (int2)(dx, dy);
+
+					if (inBounds0(otherPosition, hiddenSize)) {
+						inhibition += data[ml.scActivations + otherPosition.x + otherPosition.y * hiddenSize.x] >= activation ? 1.0f : 0.0f;
+
+						counter++;
+					}
+				}
+
+			data[ml.scStates + hi] = inhibition < (counter * ml.scActiveRatio) ? 1.0f : 0.0f;
+		}
+
+		barrier(CLK_GLOBAL_MEM_FENCE);
+
+		// Reconstruction errors (as cscForwardError)
+		for (int vi = lid; vi < numInput; vi += groupSize) {
+			int2 visiblePosition = (int2)(vi % inputSize.x, vi / inputSize.x);
+
+			float recon = megaReverseSum(data, ml.scStates, -1, ml.scWeights, 2, visiblePosition, hiddenSize,
+				(float2)(ml.scToVisibleX, ml.scToVisibleY), (float2)(ml.scToHiddenX, ml.scToHiddenY), ml.feedForwardRadius, (int2)(ml.scReverseRadiusX, ml.scReverseRadiusY));
+
+			data[ml.scReconstructionErrors + vi] = data[ml.input + vi] - recon;
+		}
+
+		for (int vi = lid; vi < numHidden; vi += groupSize) {
+			int2 visiblePosition = (int2)(vi % hiddenSize.x, vi / hiddenSize.x);
+
+			float recon = megaReverseSum(data, ml.scStates, -1, ml.recWeights, 2, visiblePosition, hiddenSize,
+				(float2)(ml.recToVisibleX, ml.recToVisibleY), (float2)(ml.recToHiddenX, ml.recToHiddenY), ml.recurrentRadius, (int2)(ml.recReverseRadiusX, ml.recReverseRadiusY));
+
+			data[ml.recReconstructionErrors + vi] = data[ml.scStatesPrev + vi] - recon;
+		}
+
+		barrier(CLK_GLOBAL_MEM_FENCE);
+
+		// Learn with the rewards of the previous step, then update the baselines (as phBaseLineUpdate(SumError))
+		for (int hi = lid; hi < numHidden; hi += groupSize) {
+			int2 hiddenPosition = (int2)(hi % hiddenSize.x, hi / hiddenSize.x);
+
+			float state = data[ml.scStates + hi];
+
+			if (learn) {
+				float reward = data[ml.rewards + hi];
+
+				megaLearnTraces(data, ml.scReconstructionErrors, inputSize, ml.scWeights, hiddenPosition, hiddenSize,
+					(float2)(ml.scToVisibleX, ml.scToVisibleY), ml.feedForwardRadius, state, reward, ml.scWeightAlpha, ml.scWeightLambda);
+				megaLearnTraces(data, ml.recReconstructionErrors, hiddenSize, ml.recWeights, hiddenPosition, hiddenSize,
+					(float2)(ml.recToVisibleX, ml.recToVisibleY), ml.recurrentRadius, state, reward, ml.recWeightAlpha, ml.scWeightLambda);
+
+				data[ml.scBiases + hi] += ml.scBoostAlpha * (ml.scActiveRatio - state);
+			}
+
+			float error = data[ml.predErrors + hi];
+
+			if (ml.lowerFeedBackErrors >= 0 && inBounds0(hiddenPosition, (int2)(ml.lowerWidth, ml.lowerHeight)))
+				error += data[ml.lowerFeedBackErrors + hiddenPosition.x + hiddenPosition.y * ml.lowerWidth];
+
+			float correctness = 1.0f - fabs(error);
+
+			float baseLinePrev = data[ml.baseLines + hi];
+
+			data[ml.rewards + hi] = (baseLinePrev - correctness) > 0.0f ? 1.0f : 0.0f;
+			data[ml.baseLines + hi] = (1.0f - ml.baseLineDecay) * baseLinePrev + ml.baseLineDecay * correctness;
+		}
+
+		barrier(CLK_GLOBAL_MEM_FENCE);
+	}
+
+	// Predictions, top down (as predActivatePropagate)
+	for (int l = numLayers - 1; l >= 0; l--) {
+		MegaLayer ml = layers[l];
+
+		int2 hiddenSize = (int2)(ml.hiddenWidth, ml.hiddenHeight);
+		int2 inputSize = (int2)(ml.inputWidth, ml.inputHeight);
+
+		int numHidden = hiddenSize.x * hiddenSize.y;
+		int numInput = inputSize.x * inputSize.y;
+
+		float2 predToVisible = (float2)(ml.predToVisibleX, ml.predToVisibleY);
+		float2 predToHidden = (float2)(ml.predToHiddenX, ml.predToHiddenY);
+
+		for (int pi = lid; pi < numInput; pi += groupSize) {
+			int2 predPosition = (int2)(pi % inputSize.x, pi / inputSize.x);
+
+			float sum = megaFieldSum(data, ml.scStates, hiddenSize, ml.predWeights, 1, predPosition, inputSize, predToVisible, ml.predictiveRadius, 0);
+
+			if (ml.hasUpper)
+				sum += megaFieldSum(data, layers[l + 1].predStates, hiddenSize, ml.feedBackWeights, 1, predPosition, inputSize, predToVisible, ml.feedBackRadius, 0);
+
+			data[ml.predStatesPrev + pi] = data[ml.predStates + pi];
+			data[ml.predStates + pi] = ml.predThreshold ? (sum > 0.5f ? 1.0f : 0.0f) : sum;
+			data[ml.predActivations + pi] = sum;
+		}
+
+		barrier(CLK_GLOBAL_MEM_FENCE);
+
+		// Errors of the previous predictions against the input (as predErrorPropagate)
+		for (int vi = lid; vi < numHidden; vi += groupSize) {
+			int2 visiblePosition = (int2)(vi % hiddenSize.x, vi / hiddenSize.x);
+
+			data[ml.predErrors + vi] = megaReverseSum(data, ml.input, ml.predStatesPrev, ml.predWeights, 1, visiblePosition, inputSize,
+				predToVisible, predToHidden, ml.predictiveRadius, (int2)(ml.predReverseRadiusX, ml.predReverseRadiusY));
+
+			if (ml.hasUpper)
+				data[ml.feedBackErrors + vi] = megaReverseSum(data, ml.input, ml.predStatesPrev, ml.feedBackWeights, 1, visiblePosition, inputSize,
+					predToVisible, predToHidden, ml.feedBackRadius, (int2)(ml.feedBackReverseRadiusX, ml.feedBackReverseRadiusY));
+		}
+
+		barrier(CLK_GLOBAL_MEM_FENCE);
+	}
+
+	// Learn predictions from the previous states (as predLearnWeights)
+	if (learn) {
+		for (int l = numLayers - 1; l >= 0; l--) {
+			MegaLayer ml = layers[l];
+
+			int2 hiddenSize = (int2)(ml.hiddenWidth, ml.hiddenHeight);
+			int2 inputSize = (int2)(ml.inputWidth, ml.inputHeight);
+
+			float2 predToVisible = (float2)(ml.predToVisibleX, ml.predToVisibleY);
+
+			for (int pi = lid; pi < inputSize.x * inputSize.y; pi += groupSize) {
+				int2 predPosition = (int2)(pi % inputSize.x, pi / inputSize.x);
+
+				float alphaError = ml.predWeightAlpha * (data[ml.input + pi] - data[ml.predStatesPrev + pi]);
+
+				megaLearnPrediction(data, ml.scStatesPrev, hiddenSize, ml.predWeights, predPosition, inputSize, predToVisible, ml.predictiveRadius, alphaError);
+
+				if (ml.hasUpper)
+					megaLearnPrediction(data, layers[l + 1].predStatesPrev, hiddenSize, ml.feedBackWeights, predPosition, inputSize, predToVisible, ml.feedBackRadius, alphaError);
+			}
+		}
+
+		barrier(CLK_GLOBAL_MEM_FENCE);
+	}
+
+	// Buffer updates
+	for (int l = 0; l < numLayers; l++) {
+		MegaLayer ml = layers[l];
+
+		for (int hi = lid; hi < ml.hiddenWidth * ml.hiddenHeight; hi += groupSize)
+			data[ml.scStatesPrev + hi] = data[ml.scStates + hi];
+	}
+}
+
 // ----------------------------------------- Q Route -----------------------------------------
 
 void kernel qForward(read_only image2d_t hiddenStates, read_only image3d_t qWeights, read_only image2d_t qBiases, read_only image2d_t qStatesPrev, write_only image2d_t qStatesFront, write_only image2d_t qActivationsFront,
@@ -1659,4 +3124,121 @@ void kernel qWeightUpdateFirstLayer(read_only image2d_t qStatesPrev, read_only i
 				write_imagef(qWeightsFront, (int4)(hiddenPosition.x, hiddenPosition.y, wi, 0), weight);
 			}
 		}
+}
+
+// ----------------------------------------- Shared Channels -----------------------------------------
+
+void kernel channelToImage(global const float* source, write_only image2d_t destination, int width) {
+	int2 position = (int2)(get_global_id(0), get_global_id(1));
+
+	float s = source[position.x + position.y * width];
+
+	write_imagef(destination, position, (float4)(s));
+}
+
+void kernel imageToChannel(read_only image2d_t source, global float* destination, int width) {
+	int2 position = (int2)(get_global_id(0), get_global_id(1));
+
+	destination[position.x + position.y * width] = read_imagef(source, position).x;
+}
+
+// ----------------------------------------- Metrics -----------------------------------------
+
+// Single work-group reductions, the first work-item accumulates into the metrics buffer
+
+void kernel metricsReduce(read_only image2d_t values, read_only image2d_t targets, int2 size, int squaredError,
+	global float* metrics, int index, local float* partials)
+{
+	int localIndex = get_local_id(0);
+	int localSize = get_local_size(0);
+
+	float sum = 0.0f;
+
+	for (int i = localIndex; i < size.x * size.y; i += localSize) {
+		int2 position = (int2)(i % size.x, i / size.x);
+
+		float value = read_imagef(values, position).x;
+
+		if (squaredError) {
+			float error = value - read_imagef(targets, position).x;
+
+			sum += error * error;
+		}
+		else
+			sum += value;
+	}
+
+	partials[localIndex] = sum;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int stride = localSize / 2; stride > 0; stride /= 2) {
+		if (localIndex < stride)
+			partials[localIndex] += partials[localIndex + stride];
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (localIndex == 0)
+		metrics[index] += partials[0];
+}
+
+void kernel metricsAccumulateUsage(read_only image2d_t states, global float* usage, int width) {
+	int2 position = (int2)(get_global_id(0), get_global_id(1));
+
+	usage[position.x + position.y * width] += read_imagef(states, position).x;
+}
+
+void kernel metricsUsageEntropy(global const float* usage, int count,
+	global float* metrics, int index, local float* partials)
+{
+	int localIndex = get_local_id(0);
+	int localSize = get_local_size(0);
+
+	// Total usage
+	float total = 0.0f;
+
+	for (int i = localIndex; i < count; i += localSize)
+		total += usage[i];
+
+	partials[localIndex] = total;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int stride = localSize / 2; stride > 0; stride /= 2) {
+		if (localIndex < stride)
+			partials[localIndex] += partials[localIndex + stride];
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	total = partials[0];
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Entropy of the usage distribution
+	float entropy = 0.0f;
+
+	if (total > 0.0f)
+		for (int i = localIndex; i < count; i += localSize) {
+			float p = usage[i] / total;
+
+			if (p > 0.0f)
+				entropy -= p * log(p);
+		}
+
+	partials[localIndex] = entropy;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int stride = localSize / 2; stride > 0; stride /= 2) {
+		if (localIndex < stride)
+			partials[localIndex] += partials[localIndex + stride];
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	// Normalized to [0, 1] (1 = all units used equally)
+	if (localIndex == 0)
+		metrics[index] = count > 1 ? partials[0] / log((float)count) : 0.0f;
 }
\ No newline at end of file
@@ -195,7 +195,7 @@ int main() {
 
 			cs.getQueue().enqueueWriteImage(inputImage, CL_TRUE, { 0, 0, 0 }, { 5, 5, 1 }, 0, 0, inputs.data());
 
-			agent.simStep(cs, reward, inputImage, generator);
+			agent.simStep(cs, reward, inputImage);
 
 			cs.getQueue().enqueueReadImage(agent.getAction(), CL_TRUE, { 0, 0, 0 }, { 4, 4, 1 }, 0, 0, actions.data());
 
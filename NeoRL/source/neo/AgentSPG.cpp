@@ -81,6 +81,10 @@ void AgentSPG::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &program
 		cs.getQueue().enqueueFillImage(_layers[l]._baseLines[_back], zeroColor, zeroOrigin, layerRegion);
 		cs.getQueue().enqueueFillImage(_layers[l]._reward, zeroColor, zeroOrigin, layerRegion);
 		cs.getQueue().enqueueFillImage(_layers[l]._scHiddenStatesPrev, zeroColor, zeroOrigin, layerRegion);
+
+		createPooledInputs(cs, l);
+
+		_layers[l]._accumulatedReward = 0.0f;
 	}
 
 	{
@@ -94,19 +98,86 @@ void AgentSPG::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &program
 		cs.getQueue().enqueueFillImage(_action, zeroColor, zeroOrigin, layerRegion);
 	}
 
+	_tick = 0;
+
+	createKernels(program);
+}
+
+void AgentSPG::createPooledInputs(sys::ComputeSystem &cs, int l) {
+	if (l == 0 || _layerDescs[l]._tickStride <= 1) {
+		_layers[l]._pooledInputs = DoubleBuffer2D();
+
+		return;
+	}
+
+	cl_int2 inputSize = _layerDescs[l - 1]._hiddenSize;
+
+	_layers[l]._pooledInputs = createDoubleBuffer2D(cs, inputSize, CL_R, CL_FLOAT);
+
+	cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+	cl::array<cl::size_type, 3> inputRegion = { inputSize.x, inputSize.y, 1 };
+
+	cs.getQueue().enqueueFillImage(_layers[l]._pooledInputs[_back], zeroColor, zeroOrigin, inputRegion);
+}
+
+void AgentSPG::createKernels(sys::ComputeProgram &program) {
 	_baseLineUpdateKernel = cl::Kernel(program.getProgram(), "phBaseLineUpdate");
 	_baseLineUpdateSumErrorKernel = cl::Kernel(program.getProgram(), "phBaseLineUpdateSumError");
 	_inhibitKernel = cl::Kernel(program.getProgram(), "phInhibit");
 	_modulateKernel = cl::Kernel(program.getProgram(), "phModulate");
 	_copyActionKernel = cl::Kernel(program.getProgram(), "phCopyAction");
+	_poolInputKernel = cl::Kernel(program.getProgram(), "phPoolInput");
+
+	// Layers may have changed, enable again after reading
+	_learningScheduler = LearningScheduler();
 }
 
-void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &input, std::mt19937 &rng) {
+void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &input) {
 	// Feed forward
 	cl_int2 prevLayerSize = _layers.front()._sc.getVisibleLayerDesc(0)._size;
 	cl::Image2D prevLayerState = input;
 
+	// Input of each layer (pooled for strided layers)
+	std::vector<cl::Image2D> layerInputs(_layers.size());
+
+	// Layers that learn this step
+	std::vector<bool> learns(_layers.size());
+
+	for (int l = 0; l < _layers.size(); l++)
+		learns[l] = !_learningScheduler.isCreated() || _learningScheduler.learns(l);
+
 	for (int l = 0; l < _layers.size(); l++) {
+		layerInputs[l] = prevLayerState;
+
+		_layers[l]._accumulatedReward += reward;
+
+		if (l != 0 && _layerDescs[l]._tickStride > 1) {
+			cl_int2 inputSize = _layerDescs[l - 1]._hiddenSize;
+
+			int argIndex = 0;
+
+			_poolInputKernel.setArg(argIndex++, prevLayerState);
+			_poolInputKernel.setArg(argIndex++, _layers[l]._pooledInputs[_back]);
+			_poolInputKernel.setArg(argIndex++, _layers[l]._pooledInputs[_front]);
+			_poolInputKernel.setArg(argIndex++, static_cast<cl_int>(_tick % _layerDescs[l]._tickStride == 1));
+
+			cs.enqueueKernel(_poolInputKernel, cl::NDRange(inputSize.x, inputSize.y));
+
+			std::swap(_layers[l]._pooledInputs[_front], _layers[l]._pooledInputs[_back]);
+
+			layerInputs[l] = _layers[l]._pooledInputs[_back];
+		}
+
+		// Held layers keep their states, the layers above see them unchanged
+		if (!ticks(l)) {
+			prevLayerState = _layers[l]._sc.getHiddenStates()[_back];
+			prevLayerSize = _layerDescs[l]._hiddenSize;
+
+			continue;
+		}
+
 		{
 			std::vector<cl::Image2D> visibleStates(2);
 
@@ -114,12 +185,12 @@ void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &
 			{
 				int argIndex = 0;
 
-				_modulateKernel.setArg(argIndex++, prevLayerState);
+				_modulateKernel.setArg(argIndex++, layerInputs[l]);
 				_modulateKernel.setArg(argIndex++, _layers[l]._predAttentionFeedForward.getHiddenStates()[_back]);
 				_modulateKernel.setArg(argIndex++, _layers[l]._modulatedFeedForwardInput);
 				_modulateKernel.setArg(argIndex++, _layerDescs[l]._minAttention);
 
-				cs.getQueue().enqueueNDRangeKernel(_modulateKernel, cl::NullRange, cl::NDRange(prevLayerSize.x, prevLayerSize.y));
+				cs.enqueueKernel(_modulateKernel, cl::NDRange(prevLayerSize.x, prevLayerSize.y));
 			}
 
 			// Modulate
@@ -131,15 +202,16 @@ void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &
 				_modulateKernel.setArg(argIndex++, _layers[l]._modulatedRecurrentInput);
 				_modulateKernel.setArg(argIndex++, _layerDescs[l]._minAttention);
 
-				cs.getQueue().enqueueNDRangeKernel(_modulateKernel, cl::NullRange, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
+				cs.enqueueKernel(_modulateKernel, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
 			}
 
 			visibleStates[0] = _layers[l]._modulatedFeedForwardInput;
 			visibleStates[1] = _layers[l]._modulatedRecurrentInput;
 
-			_layers[l]._sc.activate(cs, visibleStates, _layerDescs[l]._scActiveRatio);
-
-			_layers[l]._sc.learn(cs, _layers[l]._reward, visibleStates, _layerDescs[l]._scBoostAlpha, _layerDescs[l]._scActiveRatio);
+			if (learns[l])
+				_layers[l]._sc.activateAndLearn(cs, _layers[l]._reward, visibleStates, _layerDescs[l]._scBoostAlpha, _layerDescs[l]._scActiveRatio);
+			else
+				_layers[l]._sc.activate(cs, visibleStates, _layerDescs[l]._scActiveRatio);
 		}
 
 		// Get reward
@@ -154,7 +226,7 @@ void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &
 			_baseLineUpdateKernel.setArg(argIndex++, _layerDescs[l]._baseLineDecay);
 			_baseLineUpdateKernel.setArg(argIndex++, _layerDescs[l]._baseLineSensitivity);
 
-			cs.getQueue().enqueueNDRangeKernel(_baseLineUpdateKernel, cl::NullRange, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
+			cs.enqueueKernel(_baseLineUpdateKernel, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
 		}
 		else {
 			int argIndex = 0;
@@ -168,7 +240,7 @@ void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &
 			_baseLineUpdateSumErrorKernel.setArg(argIndex++, _layerDescs[l]._baseLineDecay);
 			_baseLineUpdateSumErrorKernel.setArg(argIndex++, _layerDescs[l]._baseLineSensitivity);
 
-			cs.getQueue().enqueueNDRangeKernel(_baseLineUpdateSumErrorKernel, cl::NullRange, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
+			cs.enqueueKernel(_baseLineUpdateSumErrorKernel, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
 		}
 
 		prevLayerState = _layers[l]._sc.getHiddenStates()[_back];
@@ -176,6 +248,9 @@ void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &
 	}
 
 	for (int l = _layers.size() - 1; l >= 0; l--) {
+		if (!ticks(l))
+			continue;
+
 		std::vector<cl::Image2D> visibleStates;
 
 		if (l < _layers.size() - 1) {
@@ -190,24 +265,29 @@ void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &
 			visibleStates[0] = _layers[l]._sc.getHiddenStates()[_back];
 		}
 
-		_layers[l]._predAction.activate(cs, visibleStates, l != 0 , _layerDescs[l]._noise, rng);
-		_layers[l]._predAttentionFeedForward.activate(cs, visibleStates, false, _layerDescs[l]._noise, rng);
-		_layers[l]._predAttentionRecurrent.activate(cs, visibleStates, false, _layerDescs[l]._noise, rng);
+		_layers[l]._predAction.activate(cs, visibleStates, l != 0 , _layerDescs[l]._noise);
+		_layers[l]._predAttentionFeedForward.activate(cs, visibleStates, false, _layerDescs[l]._noise);
+		_layers[l]._predAttentionRecurrent.activate(cs, visibleStates, false, _layerDescs[l]._noise);
+
+		_layers[l]._predAction.propagateError(cs, layerInputs[l]);
 
-		if (l == 0)
-			_layers[l]._predAction.propagateError(cs, input);
-		else
-			_layers[l]._predAction.propagateError(cs, _layers[l - 1]._sc.getHiddenStates()[_back]);
+		// Error of the previous prediction, which is in the front buffer
+		if (_learningScheduler.isCreated())
+			_learningScheduler.accumulate(cs, l, _layers[l]._predAction.getHiddenStates()[_front], layerInputs[l], _layers[l]._predAction.getHiddenSize());
 	}
 
 	for (int l = _layers.size() - 1; l >= 0; l--) {
+		if (!ticks(l))
+			continue;
+
 		std::vector<cl::Image2D> visibleStatesPrev;
 
 		if (l < _layers.size() - 1) {
 			visibleStatesPrev.resize(2);
 
+			// Feedback used on the previous step, which is still current if the layer above did not tick
 			visibleStatesPrev[0] = _layers[l]._scHiddenStatesPrev;
-			visibleStatesPrev[1] = _layers[l + 1]._predAction.getHiddenStates()[_front];
+			visibleStatesPrev[1] = _layers[l + 1]._predAction.getHiddenStates()[ticks(l + 1) ? _front : _back];
 		}
 		else {
 			visibleStatesPrev.resize(1);
@@ -215,16 +295,28 @@ void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &
 			visibleStatesPrev[0] = _layers[l]._scHiddenStatesPrev;
 		}
 
+		// Reward accumulated while the layer does not learn is dropped
+		if (!learns[l]) {
+			_layers[l]._accumulatedReward = 0.0f;
+
+			continue;
+		}
+
 		if (l == 0) {
 			_layers[l]._predAction.learnTrace(cs, reward, _layerDescs[l]._gamma, _action, visibleStatesPrev, _layerDescs[l]._predWeightAlpha, _layerDescs[l]._predWeightLambda);
 			_layers[l]._predAttentionFeedForward.learnTrace(cs, reward, _layerDescs[l]._gamma, _layers[l]._predAttentionFeedForward.getHiddenStates()[_back], visibleStatesPrev, _layerDescs[l]._predWeightAlpha, _layerDescs[l]._predWeightLambda);
 			_layers[l]._predAttentionRecurrent.learnTrace(cs, reward, _layerDescs[l]._gamma, _layers[l]._predAttentionRecurrent.getHiddenStates()[_back], visibleStatesPrev, _layerDescs[l]._predWeightAlpha, _layerDescs[l]._predWeightLambda);
 		}
 		else {
-			_layers[l]._predAction.learnTrace(cs, reward, _layerDescs[l]._gamma, _layers[l - 1]._sc.getHiddenStates()[_back], visibleStatesPrev, _layerDescs[l]._predWeightAlpha, _layerDescs[l]._predWeightLambda);
-			_layers[l]._predAttentionFeedForward.learnTrace(cs, reward, _layerDescs[l]._gamma, _layers[l]._predAttentionFeedForward.getHiddenStates()[_back], visibleStatesPrev, _layerDescs[l]._predWeightAlpha, _layerDescs[l]._predWeightLambda);
-			_layers[l]._predAttentionRecurrent.learnTrace(cs, reward, _layerDescs[l]._gamma, _layers[l]._predAttentionRecurrent.getHiddenStates()[_back], visibleStatesPrev, _layerDescs[l]._predWeightAlpha, _layerDescs[l]._predWeightLambda);
+			// Strided layers learn from the reward accumulated since their last tick
+			float layerReward = _layers[l]._accumulatedReward;
+
+			_layers[l]._predAction.learnTrace(cs, layerReward, _layerDescs[l]._gamma, layerInputs[l], visibleStatesPrev, _layerDescs[l]._predWeightAlpha, _layerDescs[l]._predWeightLambda);
+			_layers[l]._predAttentionFeedForward.learnTrace(cs, layerReward, _layerDescs[l]._gamma, _layers[l]._predAttentionFeedForward.getHiddenStates()[_back], visibleStatesPrev, _layerDescs[l]._predWeightAlpha, _layerDescs[l]._predWeightLambda);
+			_layers[l]._predAttentionRecurrent.learnTrace(cs, layerReward, _layerDescs[l]._gamma, _layers[l]._predAttentionRecurrent.getHiddenStates()[_back], visibleStatesPrev, _layerDescs[l]._predWeightAlpha, _layerDescs[l]._predWeightLambda);
 		}
+
+		_layers[l]._accumulatedReward = 0.0f;
 	}
 
 	// Copy action
@@ -234,11 +326,14 @@ void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &
 		_copyActionKernel.setArg(argIndex++, _layers.front()._predAction.getHiddenStates()[_back]);
 		_copyActionKernel.setArg(argIndex++, _action);
 
-		cs.getQueue().enqueueNDRangeKernel(_copyActionKernel, cl::NullRange, cl::NDRange(_layers.front()._predAction.getHiddenSize().x, _layers.front()._predAction.getHiddenSize().y));
+		cs.enqueueKernel(_copyActionKernel, cl::NDRange(_layers.front()._predAction.getHiddenSize().x, _layers.front()._predAction.getHiddenSize().y));
 	}
 
 	// Buffer updates
 	for (int l = 0; l < _layers.size(); l++) {
+		if (!ticks(l))
+			continue;
+
 		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
 		cl::array<cl::size_type, 3> layerRegion = { _layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y, 1 };
 
@@ -246,6 +341,19 @@ void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &
 
 		std::swap(_layers[l]._baseLines[_front], _layers[l]._baseLines[_back]);
 	}
+
+	if (_learningScheduler.isCreated())
+		_learningScheduler.step(cs);
+
+	_tick++;
+}
+
+void AgentSPG::simStep(sys::ComputeSystem &cs, float reward, SharedChannel &input, SharedChannel &action) {
+	input.toImage(cs);
+
+	simStep(cs, reward, input.getImage());
+
+	action.fromImage(cs, getAction());
 }
 
 void AgentSPG::clearMemory(sys::ComputeSystem &cs) {
@@ -256,5 +364,130 @@ void AgentSPG::clearMemory(sys::ComputeSystem &cs) {
 		cl::array<cl::size_type, 3> layerRegion = { _layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y, 1 };
 
 		cs.getQueue().enqueueFillImage(_layers[l]._scHiddenStatesPrev, zeroColor, zeroOrigin, layerRegion);
+
+		if (l != 0 && _layerDescs[l]._tickStride > 1) {
+			cl_int2 inputSize = _layerDescs[l - 1]._hiddenSize;
+
+			cl::array<cl::size_type, 3> inputRegion = { inputSize.x, inputSize.y, 1 };
+
+			cs.getQueue().enqueueFillImage(_layers[l]._pooledInputs[_back], zeroColor, zeroOrigin, inputRegion);
+		}
+
+		_layers[l]._accumulatedReward = 0.0f;
+	}
+
+	_tick = 0;
+}
+
+void AgentSPG::writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const {
+	// Layer information
+	snapshot.write(static_cast<cl_int>(_layers.size()));
+
+	for (int li = 0; li < _layers.size(); li++) {
+		const Layer &l = _layers[li];
+
+		// Desc (plain data)
+		snapshot.write(_layerDescs[li]);
+
+		l._sc.writeToSnapshot(cs, snapshot);
+		l._predAction.writeToSnapshot(cs, snapshot);
+		l._predAttentionFeedForward.writeToSnapshot(cs, snapshot);
+		l._predAttentionRecurrent.writeToSnapshot(cs, snapshot);
+
+		// Layer
+		snapshot.writeImage(cs, l._baseLines[_back]);
+		snapshot.writeImage(cs, l._reward);
+		snapshot.writeImage(cs, l._scHiddenStatesPrev);
+
+		if (li != 0)
+			snapshot.writeImage(cs, l._inhibitedAction);
+
+		if (li != 0 && _layerDescs[li]._tickStride > 1)
+			snapshot.writeImage(cs, l._pooledInputs[_back]);
+
+		snapshot.write(l._accumulatedReward);
+	}
+
+	snapshot.write(_tick);
+
+	// Previous action is used for learning on the next step
+	cl_int2 actionSize = { static_cast<cl_int>(_action.getImageInfo<CL_IMAGE_WIDTH>()), static_cast<cl_int>(_action.getImageInfo<CL_IMAGE_HEIGHT>()) };
+
+	snapshot.write(actionSize);
+	snapshot.writeImage(cs, _action);
+}
+
+void AgentSPG::readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot) {
+	// Layer information
+	cl_int numLayers;
+
+	snapshot.read(numLayers);
+
+	_layers.resize(numLayers);
+	_layerDescs.resize(numLayers);
+
+	for (int li = 0; li < _layers.size(); li++) {
+		Layer &l = _layers[li];
+		LayerDesc &ld = _layerDescs[li];
+
+		// Desc
+		snapshot.read(ld);
+
+		l._sc.readFromSnapshot(cs, program, snapshot);
+		l._predAction.readFromSnapshot(cs, program, snapshot);
+		l._predAttentionFeedForward.readFromSnapshot(cs, program, snapshot);
+		l._predAttentionRecurrent.readFromSnapshot(cs, program, snapshot);
+
+		// Layer
+		cl_int2 prevLayerSize = l._sc.getVisibleLayerDesc(0)._size;
+
+		l._modulatedFeedForwardInput = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), prevLayerSize.x, prevLayerSize.y);
+
+		l._modulatedRecurrentInput = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), ld._hiddenSize.x, ld._hiddenSize.y);
+
+		l._baseLines = createDoubleBuffer2D(cs, ld._hiddenSize, CL_R, CL_FLOAT);
+
+		l._reward = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), ld._hiddenSize.x, ld._hiddenSize.y);
+
+		l._scHiddenStatesPrev = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), ld._hiddenSize.x, ld._hiddenSize.y);
+
+		snapshot.readImage(cs, l._baseLines[_back]);
+		snapshot.readImage(cs, l._reward);
+		snapshot.readImage(cs, l._scHiddenStatesPrev);
+
+		if (li != 0) {
+			l._inhibitedAction = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), l._predAction.getHiddenSize().x, l._predAction.getHiddenSize().y);
+
+			snapshot.readImage(cs, l._inhibitedAction);
+		}
+
+		createPooledInputs(cs, li);
+
+		if (li != 0 && ld._tickStride > 1)
+			snapshot.readImage(cs, l._pooledInputs[_back]);
+
+		snapshot.read(l._accumulatedReward);
 	}
+
+	snapshot.read(_tick);
+
+	{
+		cl_int2 actionSize;
+
+		snapshot.read(actionSize);
+
+		_action = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), actionSize.x, actionSize.y);
+
+		snapshot.readImage(cs, _action);
+	}
+
+	createKernels(program);
+}
+
+std::future<bool> AgentSPG::checkpoint(sys::ComputeSystem &cs, Checkpointer &checkpointer, const std::string &fileName, SnapshotChain* pChain) const {
+	std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>();
+
+	writeToSnapshot(cs, *snapshot);
+
+	return checkpointer.submit(cs, snapshot, fileName, pChain);
 }
\ No newline at end of file
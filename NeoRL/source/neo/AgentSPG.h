@@ -2,6 +2,9 @@
 
 #include "ComparisonSparseCoder.h"
 #include "PredictorSwarm.h"
+#include "Checkpointer.h"
+#include "SharedChannel.h"
+#include "LearningScheduler.h"
 
 namespace neo {
 	/*!
@@ -66,6 +69,12 @@ namespace neo {
 			*/
 			cl_float _minAttention;
 
+			/*!
+			\brief Tick stride, the layer only activates and learns every _tickStride steps, pooling its input in between
+			Should be a multiple of the stride of the layer below. The first layer always ticks
+			*/
+			cl_int _tickStride;
+
 			/*!
 			\brief Initialize defaults
 			*/
@@ -80,7 +89,8 @@ namespace neo {
 				_predWeightAlpha({ 0.005f, 0.002f, 0.01f }),
 				_predWeightLambda({ 0.95f, 0.95f }),
 				_gamma(0.99f), _noise(0.04f),
-				_minAttention(0.05f)
+				_minAttention(0.05f),
+				_tickStride(1)
 			{}
 		};
 
@@ -125,6 +135,16 @@ namespace neo {
 			\brief Previous sparse coder hidden states
 			*/
 			cl::Image2D _scHiddenStatesPrev;
+
+			/*!
+			\brief Input pooled over the steps between ticks (strided layers only)
+			*/
+			DoubleBuffer2D _pooledInputs;
+
+			/*!
+			\brief Reward accumulated over the steps between ticks
+			*/
+			cl_float _accumulatedReward;
 		};
 
 	private:
@@ -150,9 +170,44 @@ namespace neo {
 		cl::Kernel _inhibitKernel;
 		cl::Kernel _modulateKernel;
 		cl::Kernel _copyActionKernel;
+		cl::Kernel _poolInputKernel;
 		//!@}
 
+		/*!
+		\brief Number of steps simulated (for tick strides)
+		*/
+		cl_ulong _tick;
+
+		/*!
+		\brief Adaptive learning schedule (not created when disabled)
+		*/
+		LearningScheduler _learningScheduler;
+
+		/*!
+		\brief Whether a layer ticks on the current step
+		*/
+		bool ticks(int l) const {
+			return l == 0 || _tick % _layerDescs[l]._tickStride == 0;
+		}
+
+		/*!
+		\brief Create pooled input buffers for strided layers (same size as the layer below)
+		*/
+		void createPooledInputs(sys::ComputeSystem &cs, int l);
+
+		/*!
+		\brief Create kernels from the program
+		*/
+		void createKernels(sys::ComputeProgram &program);
+
 	public:
+		/*!
+		\brief Initialize defaults
+		*/
+		AgentSPG()
+			: _tick(0)
+		{}
+
 		/*!
 		\brief Create an agent with random initialization
 		Requires the compute system, program with the NeoRL kernels, input/action sizes, layer descs, and initialization information
@@ -165,13 +220,59 @@ namespace neo {
 		/*!
 		\brief Simulation step of agent
 		*/
-		void simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &input, std::mt19937 &rng);
+		void simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &input);
+
+		/*!
+		\brief Simulation step of agent through shared channels
+		Input is copied from the input channel, the action is copied into the action channel (both non-blocking)
+		*/
+		void simStep(sys::ComputeSystem &cs, float reward, SharedChannel &input, SharedChannel &action);
+
+		/*!
+		\brief Enable the adaptive learning schedule
+		Layers whose prediction error plateaus learn less often, or pause, until their error rises again (see LearningScheduler).
+		Eligibility traces of a layer only decay on the steps it learns
+		*/
+		void setLearningSchedule(sys::ComputeSystem &cs, sys::ComputeProgram &program, const LearningScheduler::Params &params = LearningScheduler::Params()) {
+			_learningScheduler.create(cs, program, _layers.size(), params);
+		}
+
+		/*!
+		\brief Disable the adaptive learning schedule, all layers learn every step
+		*/
+		void clearLearningSchedule() {
+			_learningScheduler = LearningScheduler();
+		}
+
+		/*!
+		\brief Get the adaptive learning schedule
+		*/
+		const LearningScheduler &getLearningScheduler() const {
+			return _learningScheduler;
+		}
 
 		/*!
 		\brief Clear working memory
 		*/
 		void clearMemory(sys::ComputeSystem &cs);
 
+		/*!
+		\brief Write to snapshot (non-blocking, the snapshot must be waited on before use)
+		*/
+		void writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const;
+
+		/*!
+		\brief Read from snapshot
+		The same snapshot can be read into several agents (rewind it in between), for instance to fork a trained agent into evaluation workers
+		*/
+		void readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot);
+
+		/*!
+		\brief Asynchronous checkpoint
+		Captures the current state (call between steps) and writes it to a file on the checkpointer's worker thread
+		*/
+		std::future<bool> checkpoint(sys::ComputeSystem &cs, Checkpointer &checkpointer, const std::string &fileName, SnapshotChain* pChain = nullptr) const;
+
 		/*!
 		\brief Get number of layers
 		*/
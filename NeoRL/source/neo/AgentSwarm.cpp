@@ -127,13 +127,17 @@ void AgentSwarm::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &progr
 		cs.getQueue().enqueueFillImage(_lastLayerAction, zeroColor, zeroOrigin, layerRegion);
 	}
 
+	createKernels(program);
+}
+
+void AgentSwarm::createKernels(sys::ComputeProgram &program) {
 	_baseLineUpdateKernel = cl::Kernel(program.getProgram(), "phBaseLineUpdate");
 	_baseLineUpdateSumErrorKernel = cl::Kernel(program.getProgram(), "phBaseLineUpdateSumError");
 	_inhibitKernel = cl::Kernel(program.getProgram(), "phInhibit");
 	_modulateKernel = cl::Kernel(program.getProgram(), "phModulate");
 }
 
-void AgentSwarm::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &input, std::mt19937 &rng) {
+void AgentSwarm::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &input) {
 	// Feed forward
 	cl_int2 prevLayerSize = _layers.front()._sc.getVisibleLayerDesc(0)._size;
 	cl::Image2D prevLayerState = input;
@@ -151,7 +155,7 @@ void AgentSwarm::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D
 				_modulateKernel.setArg(argIndex++, _layers[l]._modulatedFeedForwardInput);
 				_modulateKernel.setArg(argIndex++, _layerDescs[l]._minAttention);
 
-				cs.getQueue().enqueueNDRangeKernel(_modulateKernel, cl::NullRange, cl::NDRange(prevLayerSize.x, prevLayerSize.y));
+				cs.enqueueKernel(_modulateKernel, cl::NDRange(prevLayerSize.x, prevLayerSize.y));
 			}
 
 			// Modulate
@@ -163,15 +167,13 @@ void AgentSwarm::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D
 				_modulateKernel.setArg(argIndex++, _layers[l]._modulatedRecurrentInput);
 				_modulateKernel.setArg(argIndex++, _layerDescs[l]._minAttention);
 
-				cs.getQueue().enqueueNDRangeKernel(_modulateKernel, cl::NullRange, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
+				cs.enqueueKernel(_modulateKernel, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
 			}
 
 			visibleStates[0] = _layers[l]._modulatedFeedForwardInput;
 			visibleStates[1] = _layers[l]._modulatedRecurrentInput;
 
-			_layers[l]._sc.activate(cs, visibleStates, _layerDescs[l]._scActiveRatio);
-
-			_layers[l]._sc.learn(cs, _layers[l]._reward, visibleStates, _layerDescs[l]._scBoostAlpha, _layerDescs[l]._scActiveRatio);
+			_layers[l]._sc.activateAndLearn(cs, _layers[l]._reward, visibleStates, _layerDescs[l]._scBoostAlpha, _layerDescs[l]._scActiveRatio);
 		}
 
 		// Get reward
@@ -186,7 +188,7 @@ void AgentSwarm::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D
 			_baseLineUpdateKernel.setArg(argIndex++, _layerDescs[l]._baseLineDecay);
 			_baseLineUpdateKernel.setArg(argIndex++, _layerDescs[l]._baseLineSensitivity);
 
-			cs.getQueue().enqueueNDRangeKernel(_baseLineUpdateKernel, cl::NullRange, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
+			cs.enqueueKernel(_baseLineUpdateKernel, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
 		}
 		else {
 			int argIndex = 0;
@@ -200,7 +202,7 @@ void AgentSwarm::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D
 			_baseLineUpdateSumErrorKernel.setArg(argIndex++, _layerDescs[l]._baseLineDecay);
 			_baseLineUpdateSumErrorKernel.setArg(argIndex++, _layerDescs[l]._baseLineSensitivity);
 
-			cs.getQueue().enqueueNDRangeKernel(_baseLineUpdateSumErrorKernel, cl::NullRange, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
+			cs.enqueueKernel(_baseLineUpdateSumErrorKernel, cl::NDRange(_layerDescs[l]._hiddenSize.x, _layerDescs[l]._hiddenSize.y));
 		}
 
 		prevLayerState = _layers[l]._sc.getHiddenStates()[_back];
@@ -222,12 +224,7 @@ void AgentSwarm::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D
 			visibleStates[0] = _layers[l]._sc.getHiddenStates()[_back];
 		}
 
-		_layers[l]._pred.activate(cs, visibleStates, true);
-
-		if (l == 0)
-			_layers[l]._pred.propagateError(cs, input);
-		else
-			_layers[l]._pred.propagateError(cs, _layers[l - 1]._sc.getHiddenStates()[_back]);
+		_layers[l]._pred.activateAndPropagate(cs, visibleStates, true, l == 0 ? input : _layers[l - 1]._sc.getHiddenStates()[_back]);
 	}
 
 	for (int l = _layers.size() - 1; l >= 0; l--) {
@@ -260,14 +257,14 @@ void AgentSwarm::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D
 				_layerDescs[l]._swarmExpPert, _layerDescs[l]._swarmExpBreak,
 				_layerDescs[l]._swarmAnnealingIterations, _layerDescs[l]._swarmActionDeriveAlpha,
 				_layerDescs[l]._swarmQHiddenAlpha, _layerDescs[l]._swarmQAlpha, _layerDescs[l]._swarmPredAlpha,
-				_layerDescs[l]._swarmLambda, _layerDescs[l]._swarmGamma, rng);
+				_layerDescs[l]._swarmLambda, _layerDescs[l]._swarmGamma);
 		}
 		else {
 			_layers[l]._swarm.simStep(cs, reward, _layers[l]._sc.getHiddenStates()[_back], _lastLayerAction,
 				_layerDescs[l]._swarmExpPert, _layerDescs[l]._swarmExpBreak,
 				_layerDescs[l]._swarmAnnealingIterations, _layerDescs[l]._swarmActionDeriveAlpha,
 				_layerDescs[l]._swarmQHiddenAlpha, _layerDescs[l]._swarmQAlpha, _layerDescs[l]._swarmPredAlpha,
-				_layerDescs[l]._swarmLambda, _layerDescs[l]._swarmGamma, rng);
+				_layerDescs[l]._swarmLambda, _layerDescs[l]._swarmGamma);
 		}
 
 		// If not first layer, inhibit the action
@@ -280,7 +277,7 @@ void AgentSwarm::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D
 			_inhibitKernel.setArg(argIndex++, _layerDescs[l - 1]._lateralRadius);
 			_inhibitKernel.setArg(argIndex++, _layerDescs[l - 1]._scActiveRatio);
 
-			cs.getQueue().enqueueNDRangeKernel(_inhibitKernel, cl::NullRange, cl::NDRange(_layerDescs[l - 1]._hiddenSize.x, _layerDescs[l - 1]._hiddenSize.y));
+			cs.enqueueKernel(_inhibitKernel, cl::NDRange(_layerDescs[l - 1]._hiddenSize.x, _layerDescs[l - 1]._hiddenSize.y));
 		}
 	}
 
@@ -295,6 +292,14 @@ void AgentSwarm::simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D
 	}
 }
 
+void AgentSwarm::simStep(sys::ComputeSystem &cs, float reward, SharedChannel &input, SharedChannel &action) {
+	input.toImage(cs);
+
+	simStep(cs, reward, input.getImage());
+
+	action.fromImage(cs, getExploratoryActions());
+}
+
 void AgentSwarm::clearMemory(sys::ComputeSystem &cs) {
 	cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
 	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
@@ -304,4 +309,107 @@ void AgentSwarm::clearMemory(sys::ComputeSystem &cs) {
 
 		cs.getQueue().enqueueFillImage(_layers[l]._scHiddenStatesPrev, zeroColor, zeroOrigin, layerRegion);
 	}
+}
+
+void AgentSwarm::setPackedWeights(sys::ComputeSystem &cs, bool enabled) {
+	for (int l = 0; l < _layers.size(); l++) {
+		for (int vli = 0; vli < _layers[l]._sc.getNumVisibleLayers(); vli++)
+			_layers[l]._sc.setPackedWeights(cs, vli, enabled);
+
+		for (int vli = 0; vli < _layers[l]._pred.getNumVisibleLayers(); vli++)
+			_layers[l]._pred.setPackedWeights(cs, vli, enabled);
+
+		for (int vli = 0; vli < _layers[l]._swarm.getNumVisibleLayers(); vli++)
+			_layers[l]._swarm.setPackedWeights(cs, vli, enabled);
+	}
+}
+
+void AgentSwarm::writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const {
+	// Layer information
+	snapshot.write(static_cast<cl_int>(_layers.size()));
+
+	for (int li = 0; li < _layers.size(); li++) {
+		const Layer &l = _layers[li];
+
+		// Desc (plain data)
+		snapshot.write(_layerDescs[li]);
+
+		l._sc.writeToSnapshot(cs, snapshot);
+		l._pred.writeToSnapshot(cs, snapshot);
+		l._swarm.writeToSnapshot(cs, snapshot);
+
+		// Layer
+		snapshot.writeImage(cs, l._baseLines[_back]);
+		snapshot.writeImage(cs, l._reward);
+		snapshot.writeImage(cs, l._scHiddenStatesPrev);
+
+		if (li != 0)
+			snapshot.writeImage(cs, l._inhibitedAction);
+	}
+}
+
+void AgentSwarm::readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot) {
+	// Layer information
+	cl_int numLayers;
+
+	snapshot.read(numLayers);
+
+	_layers.resize(numLayers);
+	_layerDescs.resize(numLayers);
+
+	for (int li = 0; li < _layers.size(); li++) {
+		Layer &l = _layers[li];
+		LayerDesc &ld = _layerDescs[li];
+
+		// Desc
+		snapshot.read(ld);
+
+		l._sc.readFromSnapshot(cs, program, snapshot);
+		l._pred.readFromSnapshot(cs, program, snapshot);
+		l._swarm.readFromSnapshot(cs, program, snapshot);
+
+		// Layer
+		cl_int2 prevLayerSize = l._sc.getVisibleLayerDesc(0)._size;
+
+		l._modulatedFeedForwardInput = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), prevLayerSize.x, prevLayerSize.y);
+
+		l._modulatedRecurrentInput = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), ld._hiddenSize.x, ld._hiddenSize.y);
+
+		l._baseLines = createDoubleBuffer2D(cs, ld._hiddenSize, CL_R, CL_FLOAT);
+
+		l._reward = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), ld._hiddenSize.x, ld._hiddenSize.y);
+
+		l._scHiddenStatesPrev = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), ld._hiddenSize.x, ld._hiddenSize.y);
+
+		snapshot.readImage(cs, l._baseLines[_back]);
+		snapshot.readImage(cs, l._reward);
+		snapshot.readImage(cs, l._scHiddenStatesPrev);
+
+		if (li != 0) {
+			l._inhibitedAction = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), l._swarm.getVisibleLayerDesc(1)._size.x, l._swarm.getVisibleLayerDesc(1)._size.y);
+
+			snapshot.readImage(cs, l._inhibitedAction);
+		}
+	}
+
+	{
+		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+		cl::array<cl::size_type, 3> layerRegion = { _layerDescs.back()._hiddenSize.x, _layerDescs.back()._hiddenSize.y, 1 };
+
+		_lastLayerAction = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), _layerDescs.back()._hiddenSize.x, _layerDescs.back()._hiddenSize.y);
+
+		cs.getQueue().enqueueFillImage(_lastLayerAction, zeroColor, zeroOrigin, layerRegion);
+	}
+
+	createKernels(program);
+}
+
+std::future<bool> AgentSwarm::checkpoint(sys::ComputeSystem &cs, Checkpointer &checkpointer, const std::string &fileName, SnapshotChain* pChain) const {
+	std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>();
+
+	writeToSnapshot(cs, *snapshot);
+
+	return checkpointer.submit(cs, snapshot, fileName, pChain);
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "ComparisonSparseCoder.h"
 #include "Predictor.h"
 #include "Swarm.h"
+#include "Checkpointer.h"
+#include "SharedChannel.h"
 
 namespace neo {
 	/*!
@@ -162,6 +164,11 @@ namespace neo {
 		cl::Kernel _modulateKernel;
 		//!@}
 
+		/*!
+		\brief Create kernels from the program
+		*/
+		void createKernels(sys::ComputeProgram &program);
+
 	public:
 		/*!
 		\brief Create an agent with random initialization
@@ -175,13 +182,41 @@ namespace neo {
 		/*!
 		\brief Simulation step of agent
 		*/
-		void simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &input, std::mt19937 &rng);
+		void simStep(sys::ComputeSystem &cs, float reward, const cl::Image2D &input);
+
+		/*!
+		\brief Simulation step of agent through shared channels
+		Input is copied from the input channel, the exploratory action is copied into the action channel (both non-blocking)
+		*/
+		void simStep(sys::ComputeSystem &cs, float reward, SharedChannel &input, SharedChannel &action);
 
 		/*!
 		\brief Clear working memory
 		*/
 		void clearMemory(sys::ComputeSystem &cs);
 
+		/*!
+		\brief Enable or disable packed weights for all sparse coders, predictors and swarms (see Predictor::setPackedWeights, Swarm::setPackedWeights)
+		*/
+		void setPackedWeights(sys::ComputeSystem &cs, bool enabled);
+
+		/*!
+		\brief Write to snapshot (non-blocking, the snapshot must be waited on before use)
+		*/
+		void writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const;
+
+		/*!
+		\brief Read from snapshot
+		The same snapshot can be read into several agents (rewind it in between), for instance to fork a trained agent into evaluation workers
+		*/
+		void readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot);
+
+		/*!
+		\brief Asynchronous checkpoint
+		Captures the current state (call between steps) and writes it to a file on the checkpointer's worker thread
+		*/
+		std::future<bool> checkpoint(sys::ComputeSystem &cs, Checkpointer &checkpointer, const std::string &fileName, SnapshotChain* pChain = nullptr) const;
+
 		/*!
 		\brief Number of layers in hierarchy
 		*/
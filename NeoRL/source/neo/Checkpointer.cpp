@@ -0,0 +1,107 @@
+#include "Checkpointer.h"
+
+using namespace neo;
+
+Checkpointer::~Checkpointer() {
+	if (_worker.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			_stop = true;
+		}
+
+		_jobAvailable.notify_all();
+
+		_worker.join();
+	}
+}
+
+void Checkpointer::create(int maxInFlight) {
+	assert(maxInFlight > 0);
+	assert(!_worker.joinable());
+
+	_maxInFlight = maxInFlight;
+	_numInFlight = 0;
+	_stop = false;
+
+	_worker = std::thread(&Checkpointer::run, this);
+}
+
+void Checkpointer::run() {
+	while (true) {
+		Job job;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			_jobAvailable.wait(lock, [this] { return _stop || !_jobs.empty(); });
+
+			if (_jobs.empty())
+				return;
+
+			job = std::move(_jobs.front());
+
+			_jobs.pop_front();
+		}
+
+		// Captures were enqueued at a step boundary, waiting here does not block the simulation
+		job._snapshot->wait();
+
+		// Jobs are processed in order by a single worker, so the chain sees snapshots in submission order
+		bool success = job._pChain != nullptr ? job._pChain->save(*job._snapshot, job._fileName) : job._snapshot->saveToFile(job._fileName);
+
+		// Release staging memory before signaling so the in flight limit also bounds memory
+		job._snapshot.reset();
+
+		job._promise.set_value(success);
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			_numInFlight--;
+		}
+
+		_jobDone.notify_all();
+	}
+}
+
+std::future<bool> Checkpointer::submit(sys::ComputeSystem &cs, const std::shared_ptr<Snapshot> &snapshot, const std::string &fileName, SnapshotChain* pChain) {
+	assert(_worker.joinable());
+
+	// Make sure the captures are actually submitted to the device
+	cs.getQueue().flush();
+
+	Job job;
+
+	job._snapshot = snapshot;
+	job._fileName = fileName;
+	job._pChain = pChain;
+
+	std::future<bool> result = job._promise.get_future();
+
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		_jobDone.wait(lock, [this] { return _numInFlight < _maxInFlight; });
+
+		_numInFlight++;
+
+		_jobs.push_back(std::move(job));
+	}
+
+	_jobAvailable.notify_one();
+
+	return result;
+}
+
+void Checkpointer::waitAll() {
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	_jobDone.wait(lock, [this] { return _numInFlight == 0; });
+}
+
+int Checkpointer::getNumInFlight() {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return _numInFlight;
+}
\ No newline at end of file
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "SnapshotDelta.h"
+
+#include <memory>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+namespace neo {
+	/*!
+	\brief Background checkpoint writer
+	Waits for snapshot captures to complete and writes them to disk on a worker thread, so the simulation can keep stepping.
+	Limits the number of checkpoints in flight (submitting blocks while the limit is reached)
+	*/
+	class Checkpointer : private sys::Uncopyable {
+	private:
+		/*!
+		\brief Pending checkpoint
+		*/
+		struct Job {
+			std::shared_ptr<Snapshot> _snapshot;
+			std::string _fileName;
+			SnapshotChain* _pChain;
+			std::promise<bool> _promise;
+		};
+
+		/*!
+		\brief Jobs not yet picked up by the worker
+		*/
+		std::deque<Job> _jobs;
+
+		//!@{
+		/*!
+		\brief In flight limit and count (queued + being written)
+		*/
+		int _maxInFlight;
+		int _numInFlight;
+		//!@}
+
+		/*!
+		\brief Whether the worker should exit once the queue is empty
+		*/
+		bool _stop;
+
+		//!@{
+		/*!
+		\brief Synchronization
+		*/
+		std::mutex _mutex;
+		std::condition_variable _jobAvailable;
+		std::condition_variable _jobDone;
+		//!@}
+
+		/*!
+		\brief Worker thread
+		*/
+		std::thread _worker;
+
+		/*!
+		\brief Worker loop
+		*/
+		void run();
+
+	public:
+		/*!
+		\brief Initialize defaults (not started)
+		*/
+		Checkpointer()
+			: _maxInFlight(0), _numInFlight(0), _stop(false)
+		{}
+
+		/*!
+		\brief Finishes all pending checkpoints
+		*/
+		~Checkpointer();
+
+		/*!
+		\brief Start the worker with a maximum number of checkpoints in flight
+		*/
+		void create(int maxInFlight = 2);
+
+		/*!
+		\brief Submit a captured snapshot for writing to a file
+		Flushes the queue so the captures start. Returns whether the file was written successfully.
+		With a chain, the snapshot is written as a delta against the chain when possible (the chain must only be used by this checkpointer)
+		*/
+		std::future<bool> submit(sys::ComputeSystem &cs, const std::shared_ptr<Snapshot> &snapshot, const std::string &fileName, SnapshotChain* pChain = nullptr);
+
+		/*!
+		\brief Block until all checkpoints in flight have been written
+		*/
+		void waitAll();
+
+		/*!
+		\brief Get number of checkpoints in flight
+		*/
+		int getNumInFlight();
+
+		/*!
+		\brief Get maximum number of checkpoints in flight
+		*/
+		int getMaxInFlight() const {
+			return _maxInFlight;
+		}
+	};
+}
\ No newline at end of file
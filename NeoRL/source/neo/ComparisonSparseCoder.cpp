@@ -42,6 +42,8 @@ void ComparisonSparseCoder::createRandom(sys::ComputeSystem &cs, sys::ComputePro
 
 		vl._reverseRadii = cl_int2{ static_cast<int>(std::ceil(vl._visibleToHidden.x * vld._radius)), static_cast<int>(std::ceil(vl._visibleToHidden.y * vld._radius)) };
 
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._radius, vl._reverseRadii);
+
 		// Create images
 		vl._reconstructionError = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
 
@@ -69,6 +71,10 @@ void ComparisonSparseCoder::createRandom(sys::ComputeSystem &cs, sys::ComputePro
 	cs.getQueue().enqueueFillImage(_hiddenStates[_back], zeroColor, zeroOrigin, hiddenRegion);
 	
 	// Create kernels
+	createKernels(program);
+}
+
+void ComparisonSparseCoder::createKernels(sys::ComputeProgram &program) {
 	_forwardErrorKernel = cl::Kernel(program.getProgram(), "cscForwardError");
 	_activateKernel = cl::Kernel(program.getProgram(), "cscActivate");
 	_activateIgnoreMiddleKernel = cl::Kernel(program.getProgram(), "cscActivateIgnoreMiddle");
@@ -76,6 +82,34 @@ void ComparisonSparseCoder::createRandom(sys::ComputeSystem &cs, sys::ComputePro
 	_learnHiddenBiasesKernel = cl::Kernel(program.getProgram(), "cscLearnHiddenBiases");
 	_learnHiddenWeightsKernel = cl::Kernel(program.getProgram(), "cscLearnHiddenWeights");
 	_learnHiddenWeightsTracesKernel = cl::Kernel(program.getProgram(), "cscLearnHiddenWeightsTraces");
+	_learnHiddenWeightsFusedKernel = cl::Kernel(program.getProgram(), "cscLearnHiddenWeightsFused");
+	_learnHiddenWeightsTracesFusedKernel = cl::Kernel(program.getProgram(), "cscLearnHiddenWeightsTracesFused");
+
+	_prunedActivateKernel = cl::Kernel(program.getProgram(), "prunedActivate");
+	_prunedReconstructErrorKernel = cl::Kernel(program.getProgram(), "prunedReconstructError");
+
+	_mirrorWeightsKernel = cl::Kernel(program.getProgram(), "mirrorWeights");
+	_forwardErrorMirroredKernel = cl::Kernel(program.getProgram(), "cscForwardErrorMirrored");
+
+	_packWeightsKernel = cl::Kernel(program.getProgram(), "packWeights");
+	_activatePackedKernel = cl::Kernel(program.getProgram(), "cscActivatePacked");
+
+	_recordActiveKernel = cl::Kernel(program.getProgram(), "recordActive");
+	_learnHiddenWeightsTracesBatchedKernel = cl::Kernel(program.getProgram(), "cscLearnHiddenWeightsTracesBatched");
+
+	_pruned = false;
+	_inferenceOnly = false;
+
+	_batchRewards = cl::Buffer();
+	_batchActive.release();
+	_learnBatch = 1;
+	_batchCount = 0;
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		_visibleLayers[vli]._weightsMirror = cl::Buffer();
+		_visibleLayers[vli]._weightsPacked = cl::Image3D();
+		_visibleLayers[vli]._batchErrors = cl::Buffer();
+	}
 }
 
 void ComparisonSparseCoder::reconstructError(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates) {
@@ -83,24 +117,84 @@ void ComparisonSparseCoder::reconstructError(sys::ComputeSystem &cs, const std::
 		VisibleLayer &vl = _visibleLayers[vli];
 		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
 
+		if (_pruned) {
+			int argIndex = 0;
+
+			_prunedReconstructErrorKernel.setArg(argIndex++, _hiddenStates[_back]);
+			_prunedReconstructErrorKernel.setArg(argIndex++, visibleStates[vli]);
+			_prunedReconstructErrorKernel.setArg(argIndex++, vl._reconstructionError);
+			vl._prunedWeights.setVisibleArgs(_prunedReconstructErrorKernel, argIndex);
+			_prunedReconstructErrorKernel.setArg(argIndex++, vld._size);
+			_prunedReconstructErrorKernel.setArg(argIndex++, _hiddenSize);
+
+			cs.enqueueKernel(_prunedReconstructErrorKernel, cl::NDRange(vld._size.x, vld._size.y));
+
+			continue;
+		}
+
+		if (vl._weightsMirror() != nullptr) {
+			int argIndex = 0;
+
+			_forwardErrorMirroredKernel.setArg(argIndex++, _hiddenStates[_back]);
+			_forwardErrorMirroredKernel.setArg(argIndex++, visibleStates[vli]);
+			_forwardErrorMirroredKernel.setArg(argIndex++, vl._reconstructionError);
+			_forwardErrorMirroredKernel.setArg(argIndex++, vl._weightsMirror);
+			_forwardErrorMirroredKernel.setArg(argIndex++, vld._size);
+			_forwardErrorMirroredKernel.setArg(argIndex++, _hiddenSize);
+			_forwardErrorMirroredKernel.setArg(argIndex++, vl._visibleToHidden);
+			_forwardErrorMirroredKernel.setArg(argIndex++, vl._reverseRadii);
+
+			cs.enqueueKernel(_forwardErrorMirroredKernel, cl::NDRange(vld._size.x, vld._size.y));
+
+			continue;
+		}
+
 		int argIndex = 0;
 
 		_forwardErrorKernel.setArg(argIndex++, _hiddenStates[_back]);
 		_forwardErrorKernel.setArg(argIndex++, visibleStates[vli]);
 		_forwardErrorKernel.setArg(argIndex++, vl._reconstructionError);
 		_forwardErrorKernel.setArg(argIndex++, vl._weights[_back]);
+		vl._fieldTables.setVisibleArgs(_forwardErrorKernel, argIndex);
 		_forwardErrorKernel.setArg(argIndex++, vld._size);
-		_forwardErrorKernel.setArg(argIndex++, _hiddenSize);
-		_forwardErrorKernel.setArg(argIndex++, vl._visibleToHidden);
-		_forwardErrorKernel.setArg(argIndex++, vl._hiddenToVisible);
-		_forwardErrorKernel.setArg(argIndex++, vld._radius);
-		_forwardErrorKernel.setArg(argIndex++, vl._reverseRadii);
 
-		cs.getQueue().enqueueNDRangeKernel(_forwardErrorKernel, cl::NullRange, cl::NDRange(vld._size.x, vld._size.y));
+		cs.enqueueKernel(_forwardErrorKernel, cl::NDRange(vld._size.x, vld._size.y));
 	}
 }
 
 void ComparisonSparseCoder::activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, float activeRatio) {
+	activateHidden(cs, visibleStates, activeRatio);
+
+	activateErrors(cs);
+}
+
+void ComparisonSparseCoder::activateAndLearn(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, float boostAlpha, float activeRatio) {
+	activateHidden(cs, visibleStates, activeRatio);
+
+	// Pruned error activation can not be fused with learning
+	if (_pruned) {
+		activateErrors(cs);
+
+		learn(cs, visibleStates, boostAlpha, activeRatio);
+	}
+	else
+		learnFused(cs, cl::Image2D(), false, boostAlpha, activeRatio);
+}
+
+void ComparisonSparseCoder::activateAndLearn(sys::ComputeSystem &cs, const cl::Image2D &rewards, std::vector<cl::Image2D> &visibleStates, float boostAlpha, float activeRatio) {
+	activateHidden(cs, visibleStates, activeRatio);
+
+	// Pruned error activation and batched trace learning can not be fused with learning
+	if (_pruned || _learnBatch > 1) {
+		activateErrors(cs);
+
+		learn(cs, rewards, visibleStates, boostAlpha, activeRatio);
+	}
+	else
+		learnFused(cs, rewards, true, boostAlpha, activeRatio);
+}
+
+void ComparisonSparseCoder::activateHidden(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, float activeRatio) {
 	// Start by clearing summation buffer to biases
 	{
 		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
@@ -113,7 +207,23 @@ void ComparisonSparseCoder::activate(sys::ComputeSystem &cs, const std::vector<c
 		VisibleLayer &vl = _visibleLayers[vli];
 		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
 
-		if (vld._ignoreMiddle) {
+		if (_pruned)
+			activatePruned(cs, visibleStates[vli], _hiddenActivationSummationTemp, vli);
+		else if (vl._weightsPacked() != nullptr) {
+			int argIndex = 0;
+
+			_activatePackedKernel.setArg(argIndex++, visibleStates[vli]);
+			_activatePackedKernel.setArg(argIndex++, _hiddenActivationSummationTemp[_back]);
+			_activatePackedKernel.setArg(argIndex++, _hiddenActivationSummationTemp[_front]);
+			_activatePackedKernel.setArg(argIndex++, vl._weightsPacked);
+			_activatePackedKernel.setArg(argIndex++, vld._size);
+			vl._fieldTables.setHiddenArgs(_activatePackedKernel, argIndex);
+			_activatePackedKernel.setArg(argIndex++, vld._radius);
+			_activatePackedKernel.setArg(argIndex++, static_cast<cl_int>(vld._ignoreMiddle));
+
+			cs.enqueueKernel(_activatePackedKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		}
+		else if (vld._ignoreMiddle) {
 			int argIndex = 0;
 
 			_activateIgnoreMiddleKernel.setArg(argIndex++, visibleStates[vli]);
@@ -121,10 +231,10 @@ void ComparisonSparseCoder::activate(sys::ComputeSystem &cs, const std::vector<c
 			_activateIgnoreMiddleKernel.setArg(argIndex++, _hiddenActivationSummationTemp[_front]);
 			_activateIgnoreMiddleKernel.setArg(argIndex++, vl._weights[_back]);
 			_activateIgnoreMiddleKernel.setArg(argIndex++, vld._size);
-			_activateIgnoreMiddleKernel.setArg(argIndex++, vl._hiddenToVisible);
+			vl._fieldTables.setHiddenArgs(_activateIgnoreMiddleKernel, argIndex);
 			_activateIgnoreMiddleKernel.setArg(argIndex++, vld._radius);
 
-			cs.getQueue().enqueueNDRangeKernel(_activateIgnoreMiddleKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+			cs.enqueueKernel(_activateIgnoreMiddleKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 		}
 		else {
 			int argIndex = 0;
@@ -134,10 +244,10 @@ void ComparisonSparseCoder::activate(sys::ComputeSystem &cs, const std::vector<c
 			_activateKernel.setArg(argIndex++, _hiddenActivationSummationTemp[_front]);
 			_activateKernel.setArg(argIndex++, vl._weights[_back]);
 			_activateKernel.setArg(argIndex++, vld._size);
-			_activateKernel.setArg(argIndex++, vl._hiddenToVisible);
+			vl._fieldTables.setHiddenArgs(_activateKernel, argIndex);
 			_activateKernel.setArg(argIndex++, vld._radius);
 
-			cs.getQueue().enqueueNDRangeKernel(_activateKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+			cs.enqueueKernel(_activateKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 		}
 
 		// Swap buffers
@@ -155,7 +265,7 @@ void ComparisonSparseCoder::activate(sys::ComputeSystem &cs, const std::vector<c
 		_solveHiddenKernel.setArg(argIndex++, _lateralRadius);
 		_solveHiddenKernel.setArg(argIndex++, activeRatio);
 		
-		cs.getQueue().enqueueNDRangeKernel(_solveHiddenKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_solveHiddenKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 	}
 
 	// Swap hidden state buffers
@@ -163,7 +273,9 @@ void ComparisonSparseCoder::activate(sys::ComputeSystem &cs, const std::vector<c
 
 	// Reconstruct (second layer forward + error step)
 	reconstructError(cs, visibleStates);
+}
 
+void ComparisonSparseCoder::activateErrors(sys::ComputeSystem &cs) {
 	// Backpropagation - start by clearing summation buffer to zero
 	{
 		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
@@ -178,7 +290,23 @@ void ComparisonSparseCoder::activate(sys::ComputeSystem &cs, const std::vector<c
 		VisibleLayer &vl = _visibleLayers[vli];
 		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
 
-		if (vld._ignoreMiddle) {
+		if (_pruned)
+			activatePruned(cs, vl._reconstructionError, _hiddenErrorSummationTemp, vli);
+		else if (vl._weightsPacked() != nullptr) {
+			int argIndex = 0;
+
+			_activatePackedKernel.setArg(argIndex++, vl._reconstructionError);
+			_activatePackedKernel.setArg(argIndex++, _hiddenErrorSummationTemp[_back]);
+			_activatePackedKernel.setArg(argIndex++, _hiddenErrorSummationTemp[_front]);
+			_activatePackedKernel.setArg(argIndex++, vl._weightsPacked);
+			_activatePackedKernel.setArg(argIndex++, vld._size);
+			vl._fieldTables.setHiddenArgs(_activatePackedKernel, argIndex);
+			_activatePackedKernel.setArg(argIndex++, vld._radius);
+			_activatePackedKernel.setArg(argIndex++, static_cast<cl_int>(vld._ignoreMiddle));
+
+			cs.enqueueKernel(_activatePackedKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		}
+		else if (vld._ignoreMiddle) {
 			int argIndex = 0;
 
 			_activateIgnoreMiddleKernel.setArg(argIndex++, vl._reconstructionError);
@@ -186,10 +314,10 @@ void ComparisonSparseCoder::activate(sys::ComputeSystem &cs, const std::vector<c
 			_activateIgnoreMiddleKernel.setArg(argIndex++, _hiddenErrorSummationTemp[_front]);
 			_activateIgnoreMiddleKernel.setArg(argIndex++, vl._weights[_back]);
 			_activateIgnoreMiddleKernel.setArg(argIndex++, vld._size);
-			_activateIgnoreMiddleKernel.setArg(argIndex++, vl._hiddenToVisible);
+			vl._fieldTables.setHiddenArgs(_activateIgnoreMiddleKernel, argIndex);
 			_activateIgnoreMiddleKernel.setArg(argIndex++, vld._radius);
 
-			cs.getQueue().enqueueNDRangeKernel(_activateIgnoreMiddleKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+			cs.enqueueKernel(_activateIgnoreMiddleKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 		}
 		else {
 			int argIndex = 0;
@@ -199,10 +327,10 @@ void ComparisonSparseCoder::activate(sys::ComputeSystem &cs, const std::vector<c
 			_activateKernel.setArg(argIndex++, _hiddenErrorSummationTemp[_front]);
 			_activateKernel.setArg(argIndex++, vl._weights[_back]);
 			_activateKernel.setArg(argIndex++, vld._size);
-			_activateKernel.setArg(argIndex++, vl._hiddenToVisible);
+			vl._fieldTables.setHiddenArgs(_activateKernel, argIndex);
 			_activateKernel.setArg(argIndex++, vld._radius);
 
-			cs.getQueue().enqueueNDRangeKernel(_activateKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+			cs.enqueueKernel(_activateKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 		}
 
 		// Swap buffers
@@ -210,7 +338,126 @@ void ComparisonSparseCoder::activate(sys::ComputeSystem &cs, const std::vector<c
 	}
 }
 
+void ComparisonSparseCoder::activatePruned(sys::ComputeSystem &cs, const cl::Image2D &visibleStates, DoubleBuffer2D &summationTemp, int vli) {
+	VisibleLayer &vl = _visibleLayers[vli];
+	VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+	int argIndex = 0;
+
+	_prunedActivateKernel.setArg(argIndex++, visibleStates);
+	_prunedActivateKernel.setArg(argIndex++, summationTemp[_back]);
+	_prunedActivateKernel.setArg(argIndex++, summationTemp[_front]);
+	vl._prunedWeights.setHiddenArgs(_prunedActivateKernel, argIndex);
+	_prunedActivateKernel.setArg(argIndex++, _hiddenSize);
+	_prunedActivateKernel.setArg(argIndex++, vl._hiddenToVisible);
+	_prunedActivateKernel.setArg(argIndex++, vld._radius);
+
+	cs.enqueueKernel(_prunedActivateKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+}
+
+float ComparisonSparseCoder::prune(sys::ComputeSystem &cs, float threshold, int topK) {
+	int numRetained = 0;
+	int numConnections = 0;
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		vl._prunedWeights.create(cs, vl._weights[_back], _hiddenSize, vld._size, vl._hiddenToVisible, vld._radius, threshold, topK, vld._ignoreMiddle);
+
+		numRetained += vl._prunedWeights.getNumRetained();
+		numConnections += vl._prunedWeights.getNumConnections();
+	}
+
+	_pruned = true;
+
+	return numConnections > 0 ? static_cast<float>(numRetained) / static_cast<float>(numConnections) : 1.0f;
+}
+
+void ComparisonSparseCoder::setWeightMirror(sys::ComputeSystem &cs, int vli, bool enabled) {
+	VisibleLayer &vl = _visibleLayers[vli];
+
+	if (!enabled) {
+		vl._weightsMirror = cl::Buffer();
+
+		return;
+	}
+
+	if (vl._weightsMirror() == nullptr) {
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int numSlots = (vl._reverseRadii.x * 2 + 1) * (vl._reverseRadii.y * 2 + 1);
+
+		vl._weightsMirror = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, vld._size.x * vld._size.y * numSlots * sizeof(cl_float));
+	}
+
+	rebuildWeightMirror(cs, vli);
+}
+
+void ComparisonSparseCoder::rebuildWeightMirror(sys::ComputeSystem &cs, int vli) {
+	VisibleLayer &vl = _visibleLayers[vli];
+	VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+	int argIndex = 0;
+
+	_mirrorWeightsKernel.setArg(argIndex++, vl._weights[_back]);
+	_mirrorWeightsKernel.setArg(argIndex++, vl._weightsMirror);
+	_mirrorWeightsKernel.setArg(argIndex++, vld._size);
+	_mirrorWeightsKernel.setArg(argIndex++, _hiddenSize);
+	_mirrorWeightsKernel.setArg(argIndex++, vl._visibleToHidden);
+	_mirrorWeightsKernel.setArg(argIndex++, vl._hiddenToVisible);
+	_mirrorWeightsKernel.setArg(argIndex++, vld._radius);
+	_mirrorWeightsKernel.setArg(argIndex++, vl._reverseRadii);
+
+	cs.getQueue().enqueueNDRangeKernel(_mirrorWeightsKernel, cl::NullRange, cl::NDRange(vld._size.x, vld._size.y));
+}
+
+void ComparisonSparseCoder::setPackedWeights(sys::ComputeSystem &cs, int vli, bool enabled) {
+	VisibleLayer &vl = _visibleLayers[vli];
+
+	if (!enabled) {
+		vl._weightsPacked = cl::Image3D();
+
+		return;
+	}
+
+	if (vl._weightsPacked() == nullptr) {
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int weightDiam = vld._radius * 2 + 1;
+
+		int numTexels = (weightDiam * weightDiam + 3) / 4;
+
+		vl._weightsPacked = cl::Image3D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), _hiddenSize.x, _hiddenSize.y, numTexels);
+	}
+
+	repackWeights(cs, vli);
+}
+
+void ComparisonSparseCoder::repackWeights(sys::ComputeSystem &cs, int vli) {
+	VisibleLayer &vl = _visibleLayers[vli];
+	VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+	int weightDiam = vld._radius * 2 + 1;
+
+	int numWeights = weightDiam * weightDiam;
+
+	int argIndex = 0;
+
+	// Reads the weight lane, so works with and without traces
+	_packWeightsKernel.setArg(argIndex++, vl._weights[_back]);
+	_packWeightsKernel.setArg(argIndex++, vl._weightsPacked);
+	_packWeightsKernel.setArg(argIndex++, numWeights);
+
+	cs.getQueue().enqueueNDRangeKernel(_packWeightsKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y, (numWeights + 3) / 4));
+}
+
 void ComparisonSparseCoder::learn(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, float boostAlpha, float activeRatio) {
+	assert(!_inferenceOnly);
+
+	// Pruned weights would be stale
+	_pruned = false;
+
 	// Learn biases
 	{
 		int argIndex = 0;
@@ -222,7 +469,7 @@ void ComparisonSparseCoder::learn(sys::ComputeSystem &cs, const std::vector<cl::
 		_learnHiddenBiasesKernel.setArg(argIndex++, boostAlpha);
 		_learnHiddenBiasesKernel.setArg(argIndex++, activeRatio);
 
-		cs.getQueue().enqueueNDRangeKernel(_learnHiddenBiasesKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_learnHiddenBiasesKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		std::swap(_hiddenBiases[_front], _hiddenBiases[_back]);
 	}
@@ -241,17 +488,28 @@ void ComparisonSparseCoder::learn(sys::ComputeSystem &cs, const std::vector<cl::
 		_learnHiddenWeightsKernel.setArg(argIndex++, vl._weights[_back]);
 		_learnHiddenWeightsKernel.setArg(argIndex++, vl._weights[_front]);
 		_learnHiddenWeightsKernel.setArg(argIndex++, vld._size);
-		_learnHiddenWeightsKernel.setArg(argIndex++, vl._hiddenToVisible);
+		vl._fieldTables.setHiddenArgs(_learnHiddenWeightsKernel, argIndex);
 		_learnHiddenWeightsKernel.setArg(argIndex++, vld._radius);
 		_learnHiddenWeightsKernel.setArg(argIndex++, vld._weightAlpha);
+		_learnHiddenWeightsKernel.setArg(argIndex++, vl._weightsMirror);
+		_learnHiddenWeightsKernel.setArg(argIndex++, vl._visibleToHidden);
+		_learnHiddenWeightsKernel.setArg(argIndex++, vl._reverseRadii);
 
-		cs.getQueue().enqueueNDRangeKernel(_learnHiddenWeightsKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_learnHiddenWeightsKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		std::swap(vl._weights[_front], vl._weights[_back]);
+
+		if (vl._weightsPacked() != nullptr)
+			repackWeights(cs, vli);
 	}
 }
 
 void ComparisonSparseCoder::learn(sys::ComputeSystem &cs, const cl::Image2D &rewards, std::vector<cl::Image2D> &visibleStates, float boostAlpha, float activeRatio) {
+	assert(!_inferenceOnly);
+
+	// Pruned weights would be stale
+	_pruned = false;
+
 	// Learn biases
 	{
 		int argIndex = 0;
@@ -263,16 +521,38 @@ void ComparisonSparseCoder::learn(sys::ComputeSystem &cs, const cl::Image2D &rew
 		_learnHiddenBiasesKernel.setArg(argIndex++, boostAlpha);
 		_learnHiddenBiasesKernel.setArg(argIndex++, activeRatio);
 
-		cs.getQueue().enqueueNDRangeKernel(_learnHiddenBiasesKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_learnHiddenBiasesKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		std::swap(_hiddenBiases[_front], _hiddenBiases[_back]);
 	}
+
+	bool batched = _learnBatch > 1;
+
+	if (batched) {
+		// Record the rewards and active hidden units of the step, shared by the traced layers
+		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+		cl::array<cl::size_type, 3> hiddenRegion = { static_cast<cl::size_type>(_hiddenSize.x), static_cast<cl::size_type>(_hiddenSize.y), 1 };
+
+		cs.getQueue().enqueueCopyImageToBuffer(rewards, _batchRewards, zeroOrigin, hiddenRegion, _batchCount * _hiddenSize.x * _hiddenSize.y * sizeof(cl_float));
+
+		_batchActive.record(cs, _recordActiveKernel, _hiddenStates[_back], _hiddenSize, _batchCount);
+	}
 	
 	// Learn weights
 	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
 		VisibleLayer &vl = _visibleLayers[vli];
 		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
 
+		if (vld._useTraces && batched) {
+			// Record the reconstruction errors, the weights are updated once the batch is full
+			cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+			cl::array<cl::size_type, 3> visibleRegion = { static_cast<cl::size_type>(vld._size.x), static_cast<cl::size_type>(vld._size.y), 1 };
+
+			cs.getQueue().enqueueCopyImageToBuffer(vl._reconstructionError, vl._batchErrors, zeroOrigin, visibleRegion, _batchCount * vld._size.x * vld._size.y * sizeof(cl_float));
+
+			continue;
+		}
+
 		if (vld._useTraces) {
 			int argIndex = 0;
 
@@ -284,12 +564,15 @@ void ComparisonSparseCoder::learn(sys::ComputeSystem &cs, const cl::Image2D &rew
 			_learnHiddenWeightsTracesKernel.setArg(argIndex++, vl._weights[_back]);
 			_learnHiddenWeightsTracesKernel.setArg(argIndex++, vl._weights[_front]);
 			_learnHiddenWeightsTracesKernel.setArg(argIndex++, vld._size);
-			_learnHiddenWeightsTracesKernel.setArg(argIndex++, vl._hiddenToVisible);
+			vl._fieldTables.setHiddenArgs(_learnHiddenWeightsTracesKernel, argIndex);
 			_learnHiddenWeightsTracesKernel.setArg(argIndex++, vld._radius);
 			_learnHiddenWeightsTracesKernel.setArg(argIndex++, vld._weightAlpha);
 			_learnHiddenWeightsTracesKernel.setArg(argIndex++, vld._weightLambda);
+			_learnHiddenWeightsTracesKernel.setArg(argIndex++, vl._weightsMirror);
+			_learnHiddenWeightsTracesKernel.setArg(argIndex++, vl._visibleToHidden);
+			_learnHiddenWeightsTracesKernel.setArg(argIndex++, vl._reverseRadii);
 
-			cs.getQueue().enqueueNDRangeKernel(_learnHiddenWeightsTracesKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+			cs.enqueueKernel(_learnHiddenWeightsTracesKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 		}
 		else {
 			int argIndex = 0;
@@ -301,14 +584,179 @@ void ComparisonSparseCoder::learn(sys::ComputeSystem &cs, const cl::Image2D &rew
 			_learnHiddenWeightsKernel.setArg(argIndex++, vl._weights[_back]);
 			_learnHiddenWeightsKernel.setArg(argIndex++, vl._weights[_front]);
 			_learnHiddenWeightsKernel.setArg(argIndex++, vld._size);
-			_learnHiddenWeightsKernel.setArg(argIndex++, vl._hiddenToVisible);
+			vl._fieldTables.setHiddenArgs(_learnHiddenWeightsKernel, argIndex);
 			_learnHiddenWeightsKernel.setArg(argIndex++, vld._radius);
 			_learnHiddenWeightsKernel.setArg(argIndex++, vld._weightAlpha);
+			_learnHiddenWeightsKernel.setArg(argIndex++, vl._weightsMirror);
+			_learnHiddenWeightsKernel.setArg(argIndex++, vl._visibleToHidden);
+			_learnHiddenWeightsKernel.setArg(argIndex++, vl._reverseRadii);
+
+			cs.enqueueKernel(_learnHiddenWeightsKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		}
+
+		std::swap(vl._weights[_front], vl._weights[_back]);
+
+		if (vl._weightsPacked() != nullptr)
+			repackWeights(cs, vli);
+	}
+
+	if (batched) {
+		_batchCount++;
+
+		if (_batchCount >= _learnBatch)
+			flushLearn(cs);
+	}
+}
+
+void ComparisonSparseCoder::setLearnBatch(sys::ComputeSystem &cs, int steps) {
+	assert(steps >= 1);
+	assert(!_inferenceOnly);
+
+	flushLearn(cs);
 
-			cs.getQueue().enqueueNDRangeKernel(_learnHiddenWeightsKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+	_learnBatch = steps;
+
+	if (_learnBatch <= 1) {
+		_batchRewards = cl::Buffer();
+		_batchActive.release();
+
+		for (int vli = 0; vli < _visibleLayers.size(); vli++)
+			_visibleLayers[vli]._batchErrors = cl::Buffer();
+
+		return;
+	}
+
+	_batchRewards = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, _learnBatch * _hiddenSize.x * _hiddenSize.y * sizeof(cl_float));
+	_batchActive.create(cs, _hiddenSize.x * _hiddenSize.y, _learnBatch);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		if (vld._useTraces)
+			_visibleLayers[vli]._batchErrors = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, _learnBatch * vld._size.x * vld._size.y * sizeof(cl_float));
+	}
+}
+
+void ComparisonSparseCoder::flushLearn(sys::ComputeSystem &cs) {
+	if (_batchCount == 0)
+		return;
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		if (!vld._useTraces)
+			continue;
+
+		int argIndex = 0;
+
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, _batchRewards);
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, vl._batchErrors);
+		_batchActive.setArgs(_learnHiddenWeightsTracesBatchedKernel, argIndex);
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, vl._weights[_back]);
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, vl._weights[_front]);
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, vld._size);
+		vl._fieldTables.setHiddenArgs(_learnHiddenWeightsTracesBatchedKernel, argIndex);
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, vld._radius);
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, vld._weightAlpha);
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, vld._weightLambda);
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, static_cast<cl_int>(_batchCount));
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, vl._weightsMirror);
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, vl._visibleToHidden);
+		_learnHiddenWeightsTracesBatchedKernel.setArg(argIndex++, vl._reverseRadii);
+
+		cs.enqueueKernel(_learnHiddenWeightsTracesBatchedKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+
+		std::swap(vl._weights[_front], vl._weights[_back]);
+
+		if (vl._weightsPacked() != nullptr)
+			repackWeights(cs, vli);
+	}
+
+	_batchCount = 0;
+}
+
+void ComparisonSparseCoder::learnFused(sys::ComputeSystem &cs, const cl::Image2D &rewards, bool useRewards, float boostAlpha, float activeRatio) {
+	assert(!_inferenceOnly);
+
+	// Clear the error summation as activateErrors would
+	{
+		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+		cl::array<cl::size_type, 3> hiddenRegion = { _hiddenSize.x, _hiddenSize.y, 1 };
+
+		cs.getQueue().enqueueFillImage(_hiddenErrorSummationTemp[_back], zeroColor, zeroOrigin, hiddenRegion);
+	}
+
+	// Error activation, weights, and (with the first layer) biases in a single pass per layer
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		cl_int learnBiases = vli == 0;
+
+		if (useRewards && vld._useTraces) {
+			int argIndex = 0;
+
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, rewards);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, vl._reconstructionError);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, _hiddenStates[_back]);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, _hiddenErrorSummationTemp[_back]);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, _hiddenErrorSummationTemp[_front]);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, vl._weights[_back]);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, vl._weights[_front]);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, _hiddenBiases[_back]);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, _hiddenBiases[_front]);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, vld._size);
+			vl._fieldTables.setHiddenArgs(_learnHiddenWeightsTracesFusedKernel, argIndex);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, vld._radius);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, vld._weightAlpha);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, vld._weightLambda);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, static_cast<cl_int>(vld._ignoreMiddle));
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, learnBiases);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, boostAlpha);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, activeRatio);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, vl._weightsMirror);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, vl._visibleToHidden);
+			_learnHiddenWeightsTracesFusedKernel.setArg(argIndex++, vl._reverseRadii);
+
+			cs.enqueueKernel(_learnHiddenWeightsTracesFusedKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		}
+		else {
+			int argIndex = 0;
+
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, vl._reconstructionError);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, _hiddenStates[_back]);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, _hiddenErrorSummationTemp[_back]);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, _hiddenErrorSummationTemp[_front]);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, vl._weights[_back]);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, vl._weights[_front]);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, _hiddenBiases[_back]);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, _hiddenBiases[_front]);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, vld._size);
+			vl._fieldTables.setHiddenArgs(_learnHiddenWeightsFusedKernel, argIndex);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, vld._radius);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, vld._weightAlpha);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, static_cast<cl_int>(vld._ignoreMiddle));
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, learnBiases);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, boostAlpha);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, activeRatio);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, vl._weightsMirror);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, vl._visibleToHidden);
+			_learnHiddenWeightsFusedKernel.setArg(argIndex++, vl._reverseRadii);
+
+			cs.enqueueKernel(_learnHiddenWeightsFusedKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 		}
 
+		std::swap(_hiddenErrorSummationTemp[_front], _hiddenErrorSummationTemp[_back]);
 		std::swap(vl._weights[_front], vl._weights[_back]);
+
+		if (learnBiases)
+			std::swap(_hiddenBiases[_front], _hiddenBiases[_back]);
+
+		if (vl._weightsPacked() != nullptr)
+			repackWeights(cs, vli);
 	}
 }
 
@@ -455,16 +903,104 @@ void ComparisonSparseCoder::readFromStream(sys::ComputeSystem &cs, sys::ComputeP
 		}
 
 		is >> vl._hiddenToVisible.x >> vl._hiddenToVisible.y >> vl._visibleToHidden.x >> vl._visibleToHidden.y >> vl._reverseRadii.x >> vl._reverseRadii.y;
+
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._radius, vl._reverseRadii);
 	}
 
 	// Create kernels
-	_forwardErrorKernel = cl::Kernel(program.getProgram(), "cscForwardError");
-	_activateKernel = cl::Kernel(program.getProgram(), "cscActivate");
-	_activateIgnoreMiddleKernel = cl::Kernel(program.getProgram(), "cscActivateIgnoreMiddle");
-	_solveHiddenKernel = cl::Kernel(program.getProgram(), "cscSolveHidden");
-	_learnHiddenBiasesKernel = cl::Kernel(program.getProgram(), "cscLearnHiddenBiases");
-	_learnHiddenWeightsKernel = cl::Kernel(program.getProgram(), "cscLearnHiddenWeights");
-	_learnHiddenWeightsTracesKernel = cl::Kernel(program.getProgram(), "cscLearnHiddenWeightsTraces");
+	createKernels(program);
+}
+
+void ComparisonSparseCoder::writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const {
+	snapshot.write(_hiddenSize);
+	snapshot.write(_lateralRadius);
+
+	snapshot.writeImage(cs, _hiddenStates[_back]);
+	snapshot.writeImage(cs, _hiddenBiases[_back]);
+
+	// Layer information
+	snapshot.write(static_cast<cl_int>(_visibleLayers.size()));
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		const VisibleLayer &vl = _visibleLayers[vli];
+		const VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		// Desc
+		snapshot.write(vld._size);
+		snapshot.write(vld._radius);
+		snapshot.write(vld._weightAlpha);
+		snapshot.write(vld._weightLambda);
+		snapshot.write(vld._ignoreMiddle);
+		snapshot.write(vld._useTraces);
+
+		// Layer
+		snapshot.writeImage(cs, vl._weights[_back]);
+
+		snapshot.write(vl._hiddenToVisible);
+		snapshot.write(vl._visibleToHidden);
+		snapshot.write(vl._reverseRadii);
+	}
+}
+
+void ComparisonSparseCoder::readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot, bool inferenceOnly) {
+	snapshot.read(_hiddenSize);
+	snapshot.read(_lateralRadius);
+
+	_hiddenStates = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+
+	_hiddenBiases = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+
+	_hiddenActivationSummationTemp = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+	_hiddenErrorSummationTemp = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+
+	snapshot.readImage(cs, _hiddenStates[_back]);
+	snapshot.readImage(cs, _hiddenBiases[_back]);
+
+	// Layer information
+	cl_int numLayers;
+
+	snapshot.read(numLayers);
+
+	_visibleLayerDescs.resize(numLayers);
+	_visibleLayers.resize(numLayers);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		// Desc
+		snapshot.read(vld._size);
+		snapshot.read(vld._radius);
+		snapshot.read(vld._weightAlpha);
+		snapshot.read(vld._weightLambda);
+		snapshot.read(vld._ignoreMiddle);
+		snapshot.read(vld._useTraces);
+
+		// Layer
+		vl._reconstructionError = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
+
+		int weightDiam = vld._radius * 2 + 1;
+
+		int numWeights = weightDiam * weightDiam;
+
+		cl_int3 weightsSize = cl_int3 { _hiddenSize.x, _hiddenSize.y, numWeights };
+
+		vl._weights = createDoubleBuffer3D(cs, weightsSize, vld._useTraces ? CL_RG : CL_R, CL_FLOAT);
+
+		// Traces are state, so only plain weights can stay in a mapping
+		snapshot.readImage(cs, vl._weights[_back], inferenceOnly);
+
+		snapshot.read(vl._hiddenToVisible);
+		snapshot.read(vl._visibleToHidden);
+		snapshot.read(vl._reverseRadii);
+
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._radius, vl._reverseRadii);
+	}
+
+	// Create kernels
+	createKernels(program);
+
+	_inferenceOnly = inferenceOnly;
 }
 
 void ComparisonSparseCoder::clearMemory(sys::ComputeSystem &cs) {
@@ -474,4 +1010,36 @@ void ComparisonSparseCoder::clearMemory(sys::ComputeSystem &cs) {
 	cl::array<cl::size_type, 3> layerRegion = { _hiddenSize.x, _hiddenSize.y, 1 };
 
 	cs.getQueue().enqueueFillImage(_hiddenStates[_back], zeroColor, zeroOrigin, layerRegion);
+}
+
+void ComparisonSparseCoder::writeToStateSlot(sys::ComputeSystem &cs, StateSlot &slot) const {
+	slot.writeState(cs, _hiddenStates[_back]);
+	slot.writeState(cs, _hiddenStates[_front]);
+	slot.writeState(cs, _hiddenBiases[_back]);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++)
+		slot.writeWeights(_visibleLayers[vli]._weights[_back]);
+}
+
+void ComparisonSparseCoder::readFromStateSlot(sys::ComputeSystem &cs, StateSlot &slot) {
+	// Weights read for inference may be read-only
+	assert(!_inferenceOnly || !slot.hasWeights());
+
+	slot.readState(cs, _hiddenStates[_back]);
+	slot.readState(cs, _hiddenStates[_front]);
+	slot.readState(cs, _hiddenBiases[_back]);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		slot.readWeights(cs, _visibleLayers[vli]._weights[_back]);
+
+		if (slot.hasWeights() && _visibleLayers[vli]._weightsMirror() != nullptr)
+			rebuildWeightMirror(cs, vli);
+
+		if (slot.hasWeights() && _visibleLayers[vli]._weightsPacked() != nullptr)
+			repackWeights(cs, vli);
+	}
+
+	// Pending updates belong to the weights that were replaced
+	if (slot.hasWeights())
+		_batchCount = 0;
 }
\ No newline at end of file
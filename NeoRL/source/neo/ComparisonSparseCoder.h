@@ -1,6 +1,10 @@
 #pragma once
 
-#include "Helpers.h"
+#include "Snapshot.h"
+#include "StateSlot.h"
+#include "PrunedWeights.h"
+#include "FieldTables.h"
+#include "LearnRecords.h"
 
 namespace neo {
 	/*!
@@ -64,6 +68,31 @@ namespace neo {
 			*/
 			DoubleBuffer3D _weights;
 
+			/*!
+			\brief Retained weights after pruning
+			*/
+			PrunedWeights _prunedWeights;
+
+			/*!
+			\brief Precomputed receptive field connectivity
+			*/
+			FieldTables _fieldTables;
+
+			/*!
+			\brief Visible-major copy of the weights for reconstruction (empty when disabled)
+			*/
+			cl::Buffer _weightsMirror;
+
+			/*!
+			\brief Weights packed four per RGBA texel for activation (empty when disabled)
+			*/
+			cl::Image3D _weightsPacked;
+
+			/*!
+			\brief Reconstruction errors of the steps recorded for batched trace learning (empty when not batching)
+			*/
+			cl::Buffer _batchErrors;
+
 			//!@{
 			/*!
 			\brief Transformations
@@ -124,14 +153,110 @@ namespace neo {
 		cl::Kernel _learnHiddenBiasesKernel;
 		cl::Kernel _learnHiddenWeightsKernel;
 		cl::Kernel _learnHiddenWeightsTracesKernel;
+		cl::Kernel _learnHiddenWeightsFusedKernel;
+		cl::Kernel _learnHiddenWeightsTracesFusedKernel;
 		//!@}
 
+		/*!
+		\brief Whether activation uses the pruned weights
+		*/
+		bool _pruned;
+
+		/*!
+		\brief Whether the weights were read for inference only (possibly shared with a mapped snapshot, never written)
+		*/
+		bool _inferenceOnly;
+
+		//!@{
+		/*!
+		\brief Pruned weight kernels
+		*/
+		cl::Kernel _prunedActivateKernel;
+		cl::Kernel _prunedReconstructErrorKernel;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Weight mirror kernels
+		*/
+		cl::Kernel _mirrorWeightsKernel;
+		cl::Kernel _forwardErrorMirroredKernel;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Packed weight kernels
+		*/
+		cl::Kernel _packWeightsKernel;
+		cl::Kernel _activatePackedKernel;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Batched trace learning (rewards of the recorded steps, and the steps each hidden unit was active)
+		*/
+		cl::Buffer _batchRewards;
+		LearnRecords _batchActive;
+		int _learnBatch;
+		int _batchCount;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Batched trace learning kernels
+		*/
+		cl::Kernel _recordActiveKernel;
+		cl::Kernel _learnHiddenWeightsTracesBatchedKernel;
+		//!@}
+
+		/*!
+		\brief Find sparse codes and reconstruction errors (first part of activate)
+		*/
+		void activateHidden(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, float activeRatio);
+
+		/*!
+		\brief Sum reconstruction errors onto the hidden units (second part of activate)
+		*/
+		void activateErrors(sys::ComputeSystem &cs);
+
+		/*!
+		\brief Error activation and learning of all layers in one pass over each weight tensor
+		*/
+		void learnFused(sys::ComputeSystem &cs, const cl::Image2D &rewards, bool useRewards, float boostAlpha, float activeRatio);
+
 		/*!
 		\brief Reconstruct and find error with input for all visible layers
 		*/
 		void reconstructError(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates);
 
+		/*!
+		\brief Add the contribution of a visible layer to a summation through its pruned weights
+		*/
+		void activatePruned(sys::ComputeSystem &cs, const cl::Image2D &visibleStates, DoubleBuffer2D &summationTemp, int vli);
+
+		/*!
+		\brief Rebuild the weight mirror of a visible layer from its weights
+		*/
+		void rebuildWeightMirror(sys::ComputeSystem &cs, int vli);
+
+		/*!
+		\brief Repack the packed weights of a visible layer from its weights
+		*/
+		void repackWeights(sys::ComputeSystem &cs, int vli);
+
+		/*!
+		\brief Create kernels from the program
+		*/
+		void createKernels(sys::ComputeProgram &program);
+
 	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		ComparisonSparseCoder()
+			: _pruned(false), _inferenceOnly(false), _learnBatch(1), _batchCount(0)
+		{}
+
 		/*!
 		\brief Create a comparison sparse coder with random initialization
 		Requires the compute system, program with the NeoRL kernels, and initialization information
@@ -154,6 +279,79 @@ namespace neo {
 		void learn(sys::ComputeSystem &cs, const cl::Image2D &rewards, std::vector<cl::Image2D> &visibleStates, float boostAlpha, float activeRatio);
 		//!@}
 
+		//!@{
+		/*!
+		\brief Activate and learn, equivalent to activate followed by learn
+		Fuses the error activation with the weight and bias updates, so learning reads each weight tensor once instead of twice
+		*/
+		void activateAndLearn(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, float boostAlpha, float activeRatio);
+		void activateAndLearn(sys::ComputeSystem &cs, const cl::Image2D &rewards, std::vector<cl::Image2D> &visibleStates, float boostAlpha, float activeRatio);
+		//!@}
+
+		/*!
+		\brief Set the number of steps learning with rewards accumulates before updating the traced weights in one pass (1 updates every step)
+		Each step records the rewards, the reconstruction errors of the traced layers and the active hidden units, the weights are swept
+		once per batch, replaying the trace updates of the steps in order. Activation uses the weights from before the batch until then,
+		and activateAndLearn does not fuse learning while batching. Layers without traces and the biases still learn every step.
+		Applies pending updates first. Pending updates are not part of snapshots, streams or state slots, call flushLearn before writing
+		*/
+		void setLearnBatch(sys::ComputeSystem &cs, int steps);
+
+		/*!
+		\brief Get the number of steps per learning batch
+		*/
+		int getLearnBatch() const {
+			return _learnBatch;
+		}
+
+		/*!
+		\brief Apply the pending trace updates of a partial batch (non-blocking)
+		*/
+		void flushLearn(sys::ComputeSystem &cs);
+
+		/*!
+		\brief Prune the weights for inference (blocking), returns the fraction of connections retained
+		Keeps weights with a magnitude of at least threshold, and of those only the topK largest per unit if topK > 0.
+		Learning drops the pruning, call again after learning
+		*/
+		float prune(sys::ComputeSystem &cs, float threshold, int topK = 0);
+
+		/*!
+		\brief Whether activation uses the pruned weights
+		*/
+		bool isPruned() const {
+			return _pruned;
+		}
+
+		/*!
+		\brief Enable or disable the weight mirror of a visible layer (non-blocking)
+		Reconstruction then reads the weights of each visible unit contiguously, learning keeps the mirror up to date.
+		Not part of snapshots or streams, enable again after reading
+		*/
+		void setWeightMirror(sys::ComputeSystem &cs, int vli, bool enabled);
+
+		/*!
+		\brief Whether a visible layer has a weight mirror
+		*/
+		bool hasWeightMirror(int vli) const {
+			return _visibleLayers[vli]._weightsMirror() != nullptr;
+		}
+
+		/*!
+		\brief Enable or disable packed weights for a visible layer (non-blocking)
+		Hidden and error activation then fetch four weights per texel, learning repacks after each weight update.
+		In activateAndLearn, hidden activation uses the packed weights and only the fused error and learning pass (learnFused) reads the unpacked ones.
+		Not part of snapshots or streams, enable again after reading
+		*/
+		void setPackedWeights(sys::ComputeSystem &cs, int vli, bool enabled);
+
+		/*!
+		\brief Whether a visible layer has packed weights
+		*/
+		bool hasPackedWeights(int vli) const {
+			return _visibleLayers[vli]._weightsPacked() != nullptr;
+		}
+
 		/*!
 		\brief Clear working memory
 		*/
@@ -169,6 +367,34 @@ namespace neo {
 		*/
 		void readFromStream(sys::ComputeSystem &cs, sys::ComputeProgram &program, std::istream &is);
 
+		/*!
+		\brief Write to snapshot (non-blocking)
+		*/
+		void writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const;
+
+		/*!
+		\brief Read from snapshot
+		With inferenceOnly, the weights may be created over the data of a mapped snapshot (see Snapshot::readImage), the model then can not learn
+		*/
+		void readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot, bool inferenceOnly = false);
+
+		/*!
+		\brief Whether the model was read for inference only
+		*/
+		bool isInferenceOnly() const {
+			return _inferenceOnly;
+		}
+
+		/*!
+		\brief Save state (and optionally weights) to a device side slot (non-blocking)
+		*/
+		void writeToStateSlot(sys::ComputeSystem &cs, StateSlot &slot) const;
+
+		/*!
+		\brief Restore state (and optionally weights) from a device side slot (non-blocking)
+		*/
+		void readFromStateSlot(sys::ComputeSystem &cs, StateSlot &slot);
+
 		/*!
 		\brief Get number of visible layers
 		*/
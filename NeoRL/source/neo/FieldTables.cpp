@@ -0,0 +1,95 @@
+#include "FieldTables.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace neo;
+
+// Whether a hidden unit is within the reverse radii of a visible unit (same rounding as the kernels)
+static bool inReverseRadii(int hx, int hy, int vx, int vy, cl_float2 visibleToHidden, cl_int2 reverseRadii) {
+	int centerX = static_cast<int>(vx * visibleToHidden.x + 0.5f);
+	int centerY = static_cast<int>(vy * visibleToHidden.y + 0.5f);
+
+	return std::abs(hx - centerX) <= reverseRadii.x && std::abs(hy - centerY) <= reverseRadii.y;
+}
+
+void FieldTables::create(sys::ComputeSystem &cs, cl_int2 hiddenSize, cl_int2 visibleSize, cl_float2 hiddenToVisible, cl_float2 visibleToHidden, int radius, cl_int2 reverseRadii) {
+	int weightDiam = radius * 2 + 1;
+
+	int numHidden = hiddenSize.x * hiddenSize.y;
+	int numVisible = visibleSize.x * visibleSize.y;
+
+	std::vector<cl_int2> fieldOrigins(numHidden);
+	std::vector<cl_int4> fieldRanges(numHidden);
+
+	std::vector<cl_int> reverseStarts(numVisible + 1, 0);
+
+	for (int hy = 0; hy < hiddenSize.y; hy++)
+		for (int hx = 0; hx < hiddenSize.x; hx++) {
+			int hiddenIndex = hx + hy * hiddenSize.x;
+
+			// Same rounding as the kernels
+			cl_int2 fieldLowerBound = cl_int2{ static_cast<int>(hx * hiddenToVisible.x + 0.5f) - radius, static_cast<int>(hy * hiddenToVisible.y + 0.5f) - radius };
+
+			cl_int4 fieldRange;
+
+			fieldRange.x = std::max(0, -fieldLowerBound.x);
+			fieldRange.y = std::max(0, -fieldLowerBound.y);
+			fieldRange.z = std::max(fieldRange.x, std::min(weightDiam, visibleSize.x - fieldLowerBound.x));
+			fieldRange.w = std::max(fieldRange.y, std::min(weightDiam, visibleSize.y - fieldLowerBound.y));
+
+			fieldOrigins[hiddenIndex] = fieldLowerBound;
+			fieldRanges[hiddenIndex] = fieldRange;
+
+			for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+				for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+					int vx = fieldLowerBound.x + ox;
+					int vy = fieldLowerBound.y + oy;
+
+					if (inReverseRadii(hx, hy, vx, vy, visibleToHidden, reverseRadii))
+						reverseStarts[vx + vy * visibleSize.x + 1]++;
+				}
+		}
+
+	// Reverse rows (counting sort by visible unit)
+	for (int vi = 0; vi < numVisible; vi++)
+		reverseStarts[vi + 1] += reverseStarts[vi];
+
+	std::vector<cl_int4> reverseConnections(std::max(1, reverseStarts[numVisible]));
+	std::vector<cl_int> reverseFill(reverseStarts.begin(), reverseStarts.end() - 1);
+
+	for (int hy = 0; hy < hiddenSize.y; hy++)
+		for (int hx = 0; hx < hiddenSize.x; hx++) {
+			int hiddenIndex = hx + hy * hiddenSize.x;
+
+			cl_int2 fieldLowerBound = fieldOrigins[hiddenIndex];
+			cl_int4 fieldRange = fieldRanges[hiddenIndex];
+
+			for (int ox = fieldRange.x; ox < fieldRange.z; ox++)
+				for (int oy = fieldRange.y; oy < fieldRange.w; oy++) {
+					int vx = fieldLowerBound.x + ox;
+					int vy = fieldLowerBound.y + oy;
+
+					if (!inReverseRadii(hx, hy, vx, vy, visibleToHidden, reverseRadii))
+						continue;
+
+					reverseConnections[reverseFill[vx + vy * visibleSize.x]++] = cl_int4{ hx, hy, oy + ox * weightDiam, 0 };
+				}
+		}
+
+	_fieldOrigins = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, fieldOrigins.size() * sizeof(cl_int2), fieldOrigins.data());
+	_fieldRanges = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, fieldRanges.size() * sizeof(cl_int4), fieldRanges.data());
+
+	_reverseStarts = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, reverseStarts.size() * sizeof(cl_int), reverseStarts.data());
+	_reverseConnections = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, reverseConnections.size() * sizeof(cl_int4), reverseConnections.data());
+}
+
+void FieldTables::setHiddenArgs(cl::Kernel &kernel, int &argIndex) const {
+	kernel.setArg(argIndex++, _fieldOrigins);
+	kernel.setArg(argIndex++, _fieldRanges);
+}
+
+void FieldTables::setVisibleArgs(cl::Kernel &kernel, int &argIndex) const {
+	kernel.setArg(argIndex++, _reverseStarts);
+	kernel.setArg(argIndex++, _reverseConnections);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Helpers.h"
+
+#include <vector>
+
+namespace neo {
+	/*!
+	\brief Precomputed receptive field connectivity of a visible layer
+	Per hidden unit, the field origin (lower bound) and the range of field offsets inside the visible layer.
+	Per visible unit, the connections that reach it (compressed rows of hidden position and weight index),
+	so receptive field kernels loop over exactly the valid connections without bounds or containment tests.
+	The reverse rows only hold hidden units within the reverse radii of the visible unit, as the weight mirrors and
+	the reverse loops of the persistent and megakernel passes do
+	*/
+	class FieldTables {
+	private:
+		//!@{
+		/*!
+		\brief Per hidden unit field origins (int2) and valid offset ranges (int4, [x, y] to [z, w))
+		*/
+		cl::Buffer _fieldOrigins;
+		cl::Buffer _fieldRanges;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Per visible unit row starts, and contributing connections (int4, hidden position and weight index)
+		*/
+		cl::Buffer _reverseStarts;
+		cl::Buffer _reverseConnections;
+		//!@}
+
+	public:
+		/*!
+		\brief Create the tables of a visible layer (blocking)
+		*/
+		void create(sys::ComputeSystem &cs, cl_int2 hiddenSize, cl_int2 visibleSize, cl_float2 hiddenToVisible, cl_float2 visibleToHidden, int radius, cl_int2 reverseRadii);
+
+		/*!
+		\brief Set the arguments of a kernel looping over the field of a hidden unit
+		*/
+		void setHiddenArgs(cl::Kernel &kernel, int &argIndex) const;
+
+		/*!
+		\brief Set the arguments of a kernel looping over the connections reaching a visible unit
+		*/
+		void setVisibleArgs(cl::Kernel &kernel, int &argIndex) const;
+	};
+}
@@ -102,4 +102,61 @@ void neo::randomUniformXZ(cl::Image3D &image3D, sys::ComputeSystem &cs, cl::Kern
 	randomUniform3DXZKernel.setArg(argIndex++, range);
 
 	cs.getQueue().enqueueNDRangeKernel(randomUniform3DXZKernel, cl::NullRange, cl::NDRange(size.x, size.y, size.z));
+}
+
+void neo::metricsReduce(sys::ComputeSystem &cs, cl::Kernel &metricsReduceKernel, const cl::Image2D &values, const cl::Image2D &targets, cl_int2 size, bool squaredError,
+	const cl::Buffer &metrics, int index)
+{
+	int argIndex = 0;
+
+	metricsReduceKernel.setArg(argIndex++, values);
+	metricsReduceKernel.setArg(argIndex++, targets);
+	metricsReduceKernel.setArg(argIndex++, size);
+	metricsReduceKernel.setArg(argIndex++, static_cast<cl_int>(squaredError));
+	metricsReduceKernel.setArg(argIndex++, metrics);
+	metricsReduceKernel.setArg(argIndex++, static_cast<cl_int>(index));
+	metricsReduceKernel.setArg(argIndex++, cl::Local(metricsReduceSize * sizeof(cl_float)));
+
+	cs.getQueue().enqueueNDRangeKernel(metricsReduceKernel, cl::NullRange, cl::NDRange(metricsReduceSize), cl::NDRange(metricsReduceSize));
+}
+
+void RandomStream::create(sys::ComputeSystem &cs, sys::ComputeProgram &program, cl_uint2 key) {
+	_key = key;
+
+	_step = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, sizeof(cl_uint2));
+
+	_advanceKernel = cl::Kernel(program.getProgram(), "randomAdvance");
+
+	setStep(cs, 0);
+}
+
+void RandomStream::create(sys::ComputeSystem &cs, sys::ComputeProgram &program, std::mt19937 &rng) {
+	std::uniform_int_distribution<cl_uint> keyDist;
+
+	cl_uint2 key = { keyDist(rng), keyDist(rng) };
+
+	create(cs, program, key);
+}
+
+void RandomStream::setArgs(cl::Kernel &kernel, int &argIndex, cl_uint substream) const {
+	cl_uint2 key = { _key.x, _key.y + substream };
+
+	kernel.setArg(argIndex++, key);
+	kernel.setArg(argIndex++, _step);
+}
+
+void RandomStream::advance(sys::ComputeSystem &cs) {
+	_advanceKernel.setArg(0, _step);
+
+	cs.getQueue().enqueueNDRangeKernel(_advanceKernel, cl::NullRange, cl::NDRange(1));
+
+	_hostStep++;
+}
+
+void RandomStream::setStep(sys::ComputeSystem &cs, cl_ulong step) {
+	_hostStep = step;
+
+	cl_uint2 words = { static_cast<cl_uint>(step & 0xffffffff), static_cast<cl_uint>(step >> 32) };
+
+	cs.getQueue().enqueueFillBuffer(_step, words, 0, sizeof(cl_uint2));
 }
\ No newline at end of file
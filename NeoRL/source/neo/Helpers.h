@@ -41,4 +41,91 @@ namespace neo {
 	void randomUniformXZ(cl::Image2D &image2D, sys::ComputeSystem &cs, cl::Kernel &randomUniform2DXZKernel, cl_int2 size, cl_float2 range, std::mt19937 &rng);
 	void randomUniformXZ(cl::Image3D &image3D, sys::ComputeSystem &cs, cl::Kernel &randomUniform3DXZKernel, cl_int3 size, cl_float2 range, std::mt19937 &rng);
 	//!@}
+
+	/*!
+	\brief Work-group size of the single work-group metrics reductions
+	*/
+	const int metricsReduceSize = 64;
+
+	/*!
+	\brief Add the sum of an image (or of its squared error against targets) to an element of a metrics buffer (non-blocking)
+	*/
+	void metricsReduce(sys::ComputeSystem &cs, cl::Kernel &metricsReduceKernel, const cl::Image2D &values, const cl::Image2D &targets, cl_int2 size, bool squaredError,
+		const cl::Buffer &metrics, int index);
+
+	/*!
+	\brief Counter-based random stream for kernels
+	Kernels derive their random numbers from a key (the stream) and a step counter kept on the device,
+	so stepping a model does not need new seeds from the host. Sub-streams give independent numbers to
+	several launches within the same step
+	*/
+	class RandomStream {
+	private:
+		/*!
+		\brief Stream key
+		*/
+		cl_uint2 _key;
+
+		/*!
+		\brief Step counter (device, low and high words)
+		*/
+		cl::Buffer _step;
+
+		/*!
+		\brief Host mirror of the step counter
+		*/
+		cl_ulong _hostStep;
+
+		/*!
+		\brief Advance kernel
+		*/
+		cl::Kernel _advanceKernel;
+
+	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		RandomStream()
+			: _hostStep(0)
+		{
+			_key.x = _key.y = 0;
+		}
+
+		//!@{
+		/*!
+		\brief Create a stream from a key, or with a key drawn from a generator
+		*/
+		void create(sys::ComputeSystem &cs, sys::ComputeProgram &program, cl_uint2 key);
+		void create(sys::ComputeSystem &cs, sys::ComputeProgram &program, std::mt19937 &rng);
+		//!@}
+
+		/*!
+		\brief Set the key and step arguments of a kernel for a sub-stream
+		*/
+		void setArgs(cl::Kernel &kernel, int &argIndex, cl_uint substream = 0) const;
+
+		/*!
+		\brief Move to the next step (non-blocking, on the device)
+		*/
+		void advance(sys::ComputeSystem &cs);
+
+		/*!
+		\brief Set the step counter (non-blocking)
+		*/
+		void setStep(sys::ComputeSystem &cs, cl_ulong step);
+
+		/*!
+		\brief Get the stream key
+		*/
+		cl_uint2 getKey() const {
+			return _key;
+		}
+
+		/*!
+		\brief Get the step counter
+		*/
+		cl_ulong getStep() const {
+			return _hostStep;
+		}
+	};
 }
\ No newline at end of file
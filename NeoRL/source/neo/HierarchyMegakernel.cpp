@@ -0,0 +1,242 @@
+#include "HierarchyMegakernel.h"
+
+#include "PredictiveHierarchy.h"
+
+#include <algorithm>
+
+using namespace neo;
+
+const int HierarchyMegakernel::_maxLayerSize;
+
+static cl::array<cl::size_type, 3> imageRegion(const cl::Image2D &image) {
+	cl::array<cl::size_type, 3> region = { image.getImageInfo<CL_IMAGE_WIDTH>(), image.getImageInfo<CL_IMAGE_HEIGHT>(), 1 };
+
+	return region;
+}
+
+static cl::array<cl::size_type, 3> imageRegion(const cl::Image3D &image) {
+	cl::array<cl::size_type, 3> region = { image.getImageInfo<CL_IMAGE_WIDTH>(), image.getImageInfo<CL_IMAGE_HEIGHT>(), image.getImageInfo<CL_IMAGE_DEPTH>() };
+
+	return region;
+}
+
+bool HierarchyMegakernel::isSupported(const PredictiveHierarchy &ph) {
+	if (ph.getLearningScheduler().isCreated() || ph.getSkipUnchanged())
+		return false;
+
+	cl_int2 inputSize = ph.getFirstLayerPred().getHiddenSize();
+
+	if (inputSize.x > _maxLayerSize || inputSize.y > _maxLayerSize)
+		return false;
+
+	for (int l = 0; l < ph.getNumLayers(); l++) {
+		const PredictiveHierarchy::Layer &layer = ph.getLayer(l);
+		const PredictiveHierarchy::LayerDesc &ld = ph.getLayerDescs(l);
+
+		if (ld._size.x > _maxLayerSize || ld._size.y > _maxLayerSize)
+			return false;
+
+		if (l != 0 && ld._tickStride > 1)
+			return false;
+
+		// Syncing writes the weights back, which may be read-only
+		if (layer._sc.isInferenceOnly() || layer._pred.isInferenceOnly())
+			return false;
+
+		if (layer._sc.isPruned() || layer._pred.isQuantized() || layer._pred.isPruned() || layer._pred.getLearnBatch() > 1 || layer._sc.getLearnBatch() > 1)
+			return false;
+
+		for (int vli = 0; vli < layer._sc.getNumVisibleLayers(); vli++) {
+			if (layer._sc.hasWeightMirror(vli) || layer._sc.hasPackedWeights(vli) || !layer._sc.getVisibleLayerDesc(vli)._useTraces)
+				return false;
+		}
+
+		for (int vli = 0; vli < layer._pred.getNumVisibleLayers(); vli++) {
+			if (layer._pred.hasWeightMirror(vli) || layer._pred.hasPackedWeights(vli))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+cl_int HierarchyMegakernel::bind(const cl::Image &image, cl::array<cl::size_type, 3> region, int channels, cl::size_type &size) {
+	Binding binding;
+
+	binding._image = image;
+	binding._offset = size;
+	binding._region = region;
+
+	_bindings.push_back(binding);
+
+	size += region[0] * region[1] * region[2] * channels;
+
+	return static_cast<cl_int>(binding._offset);
+}
+
+void HierarchyMegakernel::create(sys::ComputeSystem &cs, sys::ComputeProgram &program, const PredictiveHierarchy &ph) {
+	_stepKernel = cl::Kernel(program.getProgram(), "phMegaStep");
+
+	pack(cs, ph);
+}
+
+void HierarchyMegakernel::pack(sys::ComputeSystem &cs, const PredictiveHierarchy &ph) {
+	assert(isSupported(ph));
+
+	int numLayers = ph.getNumLayers();
+
+	std::vector<Layout> layouts(numLayers);
+
+	_bindings.clear();
+
+	// Floats allocated so far
+	cl::size_type size = 0;
+
+	cl_int2 inputSize = ph.getFirstLayerPred().getHiddenSize();
+
+	_input._offset = size;
+	_input._region = { static_cast<cl::size_type>(inputSize.x), static_cast<cl::size_type>(inputSize.y), 1 };
+
+	size += inputSize.x * inputSize.y;
+
+	for (int l = 0; l < numLayers; l++) {
+		const PredictiveHierarchy::Layer &layer = ph.getLayer(l);
+		const PredictiveHierarchy::LayerDesc &ld = ph.getLayerDescs(l);
+
+		const ComparisonSparseCoder &sc = layer._sc;
+		const Predictor &pred = layer._pred;
+
+		const ComparisonSparseCoder::VisibleLayer &scvl = sc.getVisibleLayer(0);
+		const ComparisonSparseCoder::VisibleLayer &recvl = sc.getVisibleLayer(1);
+		const Predictor::VisibleLayer &predvl = pred.getVisibleLayer(0);
+
+		Layout &lo = layouts[l];
+
+		lo._hiddenWidth = ld._size.x;
+		lo._hiddenHeight = ld._size.y;
+		lo._inputWidth = pred.getHiddenSize().x;
+		lo._inputHeight = pred.getHiddenSize().y;
+		lo._hasUpper = l < numLayers - 1;
+		lo._predThreshold = l != 0;
+		lo._feedForwardRadius = sc.getVisibleLayerDesc(0)._radius;
+		lo._recurrentRadius = sc.getVisibleLayerDesc(1)._radius;
+		lo._lateralRadius = ld._lateralRadius;
+		lo._predictiveRadius = pred.getVisibleLayerDesc(0)._radius;
+		lo._feedBackRadius = lo._hasUpper ? pred.getVisibleLayerDesc(1)._radius : 0;
+
+		lo._scReverseRadiusX = scvl._reverseRadii.x;
+		lo._scReverseRadiusY = scvl._reverseRadii.y;
+		lo._recReverseRadiusX = recvl._reverseRadii.x;
+		lo._recReverseRadiusY = recvl._reverseRadii.y;
+		lo._predReverseRadiusX = predvl._reverseRadii.x;
+		lo._predReverseRadiusY = predvl._reverseRadii.y;
+		lo._feedBackReverseRadiusX = lo._hasUpper ? pred.getVisibleLayer(1)._reverseRadii.x : 0;
+		lo._feedBackReverseRadiusY = lo._hasUpper ? pred.getVisibleLayer(1)._reverseRadii.y : 0;
+
+		lo._scToVisibleX = scvl._hiddenToVisible.x;
+		lo._scToVisibleY = scvl._hiddenToVisible.y;
+		lo._scToHiddenX = scvl._visibleToHidden.x;
+		lo._scToHiddenY = scvl._visibleToHidden.y;
+		lo._recToVisibleX = recvl._hiddenToVisible.x;
+		lo._recToVisibleY = recvl._hiddenToVisible.y;
+		lo._recToHiddenX = recvl._visibleToHidden.x;
+		lo._recToHiddenY = recvl._visibleToHidden.y;
+		lo._predToVisibleX = predvl._hiddenToVisible.x;
+		lo._predToVisibleY = predvl._hiddenToVisible.y;
+		lo._predToHiddenX = predvl._visibleToHidden.x;
+		lo._predToHiddenY = predvl._visibleToHidden.y;
+
+		lo._scWeightAlpha = sc.getVisibleLayerDesc(0)._weightAlpha;
+		lo._recWeightAlpha = sc.getVisibleLayerDesc(1)._weightAlpha;
+		lo._scWeightLambda = sc.getVisibleLayerDesc(0)._weightLambda;
+		lo._scActiveRatio = ld._scActiveRatio;
+		lo._scBoostAlpha = ld._scBoostAlpha;
+		lo._baseLineDecay = ld._baseLineDecay;
+		lo._predWeightAlpha = ld._predWeightAlpha;
+
+		// Input of the first layer is copied in every step, the others are the sparse codes below
+		lo._input = l == 0 ? static_cast<cl_int>(_input._offset) : layouts[l - 1]._scStates;
+
+		lo._scStates = bind(sc.getHiddenStates()[_back], imageRegion(sc.getHiddenStates()[_back]), 1, size);
+		lo._scStatesPrev = bind(layer._scHiddenStatesPrev, imageRegion(layer._scHiddenStatesPrev), 1, size);
+		lo._scBiases = bind(sc.getHiddenBiases()[_back], imageRegion(sc.getHiddenBiases()[_back]), 1, size);
+		lo._scWeights = bind(scvl._weights[_back], imageRegion(scvl._weights[_back]), 2, size);
+		lo._recWeights = bind(recvl._weights[_back], imageRegion(recvl._weights[_back]), 2, size);
+		lo._scReconstructionErrors = bind(scvl._reconstructionError, imageRegion(scvl._reconstructionError), 1, size);
+		lo._recReconstructionErrors = bind(recvl._reconstructionError, imageRegion(recvl._reconstructionError), 1, size);
+		lo._baseLines = bind(layer._baseLines[_back], imageRegion(layer._baseLines[_back]), 1, size);
+		lo._rewards = bind(layer._reward, imageRegion(layer._reward), 1, size);
+		lo._predStates = bind(pred.getHiddenStates()[_back], imageRegion(pred.getHiddenStates()[_back]), 1, size);
+		lo._predStatesPrev = bind(pred.getHiddenStates()[_front], imageRegion(pred.getHiddenStates()[_front]), 1, size);
+		lo._predActivations = bind(pred.getHiddenActivations()[_back], imageRegion(pred.getHiddenActivations()[_back]), 1, size);
+		lo._predWeights = bind(predvl._weights[_back], imageRegion(predvl._weights[_back]), 1, size);
+		lo._predErrors = bind(predvl._errors, imageRegion(predvl._errors), 1, size);
+
+		if (lo._hasUpper) {
+			const Predictor::VisibleLayer &fbvl = pred.getVisibleLayer(1);
+
+			lo._feedBackWeights = bind(fbvl._weights[_back], imageRegion(fbvl._weights[_back]), 1, size);
+			lo._feedBackErrors = bind(fbvl._errors, imageRegion(fbvl._errors), 1, size);
+		}
+		else {
+			lo._feedBackWeights = -1;
+			lo._feedBackErrors = -1;
+		}
+
+		// Not part of the hierarchy's state
+		lo._scActivations = static_cast<cl_int>(size);
+
+		size += ld._size.x * ld._size.y;
+
+		if (l == 0) {
+			lo._lowerFeedBackErrors = -1;
+			lo._lowerWidth = 0;
+			lo._lowerHeight = 0;
+		}
+		else {
+			lo._lowerFeedBackErrors = layouts[l - 1]._feedBackErrors;
+			lo._lowerWidth = layouts[l - 1]._hiddenWidth;
+			lo._lowerHeight = layouts[l - 1]._hiddenHeight;
+		}
+	}
+
+	_data = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, size * sizeof(cl_float));
+	_layouts = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, layouts.size() * sizeof(Layout), layouts.data());
+
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+
+	for (int bi = 0; bi < _bindings.size(); bi++)
+		cs.getQueue().enqueueCopyImageToBuffer(_bindings[bi]._image, _data, zeroOrigin, _bindings[bi]._region, _bindings[bi]._offset * sizeof(cl_float));
+
+	_prediction._image = ph.getFirstLayerPred().getHiddenStates()[_back];
+	_prediction._offset = layouts.front()._predStates;
+	_prediction._region = _input._region;
+
+	int argIndex = 0;
+
+	_stepKernel.setArg(argIndex++, _data);
+	_stepKernel.setArg(argIndex++, _layouts);
+	_stepKernel.setArg(argIndex++, static_cast<cl_int>(numLayers));
+
+	_groupSize = std::min<cl::size_type>(_stepKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cs.getDevice()), 256);
+}
+
+void HierarchyMegakernel::step(sys::ComputeSystem &cs, const cl::Image2D &input, bool learn) {
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+
+	cs.getQueue().enqueueCopyImageToBuffer(input, _data, zeroOrigin, _input._region, _input._offset * sizeof(cl_float));
+
+	_stepKernel.setArg(3, static_cast<cl_int>(learn));
+
+	// Single work-group, so barriers synchronize the whole step
+	cs.getQueue().enqueueNDRangeKernel(_stepKernel, cl::NullRange, cl::NDRange(_groupSize), cl::NDRange(_groupSize));
+
+	cs.getQueue().enqueueCopyBufferToImage(_data, _prediction._image, _prediction._offset * sizeof(cl_float), zeroOrigin, _prediction._region);
+}
+
+void HierarchyMegakernel::sync(sys::ComputeSystem &cs) const {
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+
+	for (int bi = 0; bi < _bindings.size(); bi++)
+		cs.getQueue().enqueueCopyBufferToImage(_data, _bindings[bi]._image, _bindings[bi]._offset * sizeof(cl_float), zeroOrigin, _bindings[bi]._region);
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "Helpers.h"
+
+#include <vector>
+
+namespace neo {
+	class PredictiveHierarchy;
+
+	/*!
+	\brief Whole simulation step of a predictive hierarchy as a single launch
+	For tiny hierarchies (layers of 16x16 or smaller), where launch overhead dominates device time.
+	All state is packed into one device buffer and stepped by a single work-group, which synchronizes the phases of the step with barriers.
+	Only the first layer prediction is written back to its image every step, the rest of the hierarchy's images on sync
+	*/
+	class HierarchyMegakernel {
+	private:
+		/*!
+		\brief Layout of a layer in the packed buffer (matches MegaLayer in the kernels)
+		*/
+		struct Layout {
+			cl_int _hiddenWidth, _hiddenHeight, _inputWidth, _inputHeight;
+			cl_int _hasUpper, _predThreshold, _feedForwardRadius, _recurrentRadius;
+			cl_int _lateralRadius, _predictiveRadius, _feedBackRadius;
+
+			cl_int _scReverseRadiusX, _scReverseRadiusY, _recReverseRadiusX, _recReverseRadiusY;
+			cl_int _predReverseRadiusX, _predReverseRadiusY, _feedBackReverseRadiusX, _feedBackReverseRadiusY;
+
+			cl_int _input, _scStates, _scStatesPrev, _scActivations;
+			cl_int _scBiases, _scWeights, _recWeights, _scReconstructionErrors;
+			cl_int _recReconstructionErrors, _baseLines, _rewards, _predStates;
+			cl_int _predStatesPrev, _predActivations, _predWeights, _feedBackWeights;
+			cl_int _predErrors, _feedBackErrors, _lowerFeedBackErrors, _lowerWidth, _lowerHeight;
+
+			cl_float _scToVisibleX, _scToVisibleY, _scToHiddenX, _scToHiddenY;
+			cl_float _recToVisibleX, _recToVisibleY, _recToHiddenX, _recToHiddenY;
+			cl_float _predToVisibleX, _predToVisibleY, _predToHiddenX, _predToHiddenY;
+
+			cl_float _scWeightAlpha, _recWeightAlpha, _scWeightLambda, _scActiveRatio;
+			cl_float _scBoostAlpha, _baseLineDecay, _predWeightAlpha;
+		};
+
+		/*!
+		\brief Image of the hierarchy and its region in the packed buffer
+		*/
+		struct Binding {
+			cl::Image _image;
+			cl::size_type _offset;
+			cl::array<cl::size_type, 3> _region;
+		};
+
+		//!@{
+		/*!
+		\brief Packed state and layouts (device)
+		*/
+		cl::Buffer _data;
+		cl::Buffer _layouts;
+		//!@}
+
+		/*!
+		\brief Images packed into the buffer, written back on sync
+		*/
+		std::vector<Binding> _bindings;
+
+		//!@{
+		/*!
+		\brief Input copied in, first layer prediction copied out every step
+		*/
+		Binding _input;
+		Binding _prediction;
+		//!@}
+
+		/*!
+		\brief Work-group size of the step
+		*/
+		cl::size_type _groupSize;
+
+		/*!
+		\brief Step kernel
+		*/
+		cl::Kernel _stepKernel;
+
+		/*!
+		\brief Add a binding for an image, allocating its region in the packed buffer
+		*/
+		cl_int bind(const cl::Image &image, cl::array<cl::size_type, 3> region, int channels, cl::size_type &size);
+
+	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		HierarchyMegakernel()
+			: _groupSize(0)
+		{}
+
+		/*!
+		\brief Largest layer (and input) width and height
+		*/
+		static const int _maxLayerSize = 16;
+
+		/*!
+		\brief Whether a hierarchy can be stepped by the megakernel
+		Requires layers no larger than _maxLayerSize, float sparse coder weights with traces and float predictor weights, without tick strides,
+		change skipping, inference only weights, pruning, quantization, weight mirrors, packed weights, batched learning or a learning schedule
+		*/
+		static bool isSupported(const PredictiveHierarchy &ph);
+
+		/*!
+		\brief Create the step kernel and pack the state of a hierarchy (non-blocking)
+		*/
+		void create(sys::ComputeSystem &cs, sys::ComputeProgram &program, const PredictiveHierarchy &ph);
+
+		/*!
+		\brief Pack the state of a hierarchy again, after its images were changed outside the megakernel (non-blocking)
+		*/
+		void pack(sys::ComputeSystem &cs, const PredictiveHierarchy &ph);
+
+		/*!
+		\brief Whether the megakernel was created
+		*/
+		bool isCreated() const {
+			return _data() != nullptr;
+		}
+
+		/*!
+		\brief Simulation step (non-blocking), copies the input in, runs the step, copies the first layer prediction out
+		*/
+		void step(sys::ComputeSystem &cs, const cl::Image2D &input, bool learn);
+
+		/*!
+		\brief Write the packed state back to the images of the hierarchy (non-blocking)
+		*/
+		void sync(sys::ComputeSystem &cs) const;
+	};
+}
\ No newline at end of file
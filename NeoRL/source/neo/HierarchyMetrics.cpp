@@ -0,0 +1,163 @@
+#include "HierarchyMetrics.h"
+
+using namespace neo;
+
+const int HierarchyMetrics::_metricsPerLayer;
+
+void HierarchyMetrics::create(sys::ComputeSystem &cs, sys::ComputeProgram &program, const PredictiveHierarchy &ph, int interval) {
+	assert(interval > 0);
+
+	_interval = interval;
+
+	size_t numLayers = ph.getNumLayers();
+
+	_layerSizes.resize(numLayers);
+	_targetSizes.resize(numLayers);
+	_usage.resize(numLayers);
+
+	for (int l = 0; l < numLayers; l++) {
+		_layerSizes[l] = ph.getLayerDescs(l)._size;
+		_targetSizes[l] = l == 0 ? ph.getFirstLayerPred().getHiddenSize() : ph.getLayerDescs(l - 1)._size;
+
+		_usage[l] = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, _layerSizes[l].x * _layerSizes[l].y * sizeof(cl_float));
+
+		cs.getQueue().enqueueFillBuffer(_usage[l], 0.0f, 0, _layerSizes[l].x * _layerSizes[l].y * sizeof(cl_float));
+	}
+
+	_hostMetrics.assign(numLayers * _metricsPerLayer, 0.0f);
+	_samples.assign(numLayers, 0);
+	_readSamples.assign(numLayers, 0);
+
+	_metrics = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, _hostMetrics.size() * sizeof(cl_float));
+
+	cs.getQueue().enqueueFillBuffer(_metrics, 0.0f, 0, _hostMetrics.size() * sizeof(cl_float));
+
+	_readPending = false;
+	_stepsInInterval = 0;
+	_step = 0;
+
+	_latest._step = 0;
+	_latest._numSteps = 0;
+	_latest._layers.clear();
+
+	_reduceKernel = cl::Kernel(program.getProgram(), "metricsReduce");
+	_accumulateUsageKernel = cl::Kernel(program.getProgram(), "metricsAccumulateUsage");
+	_usageEntropyKernel = cl::Kernel(program.getProgram(), "metricsUsageEntropy");
+}
+
+void HierarchyMetrics::update(sys::ComputeSystem &cs, const PredictiveHierarchy &ph, const cl::Image2D &input) {
+	assert(ph.getNumLayers() == _layerSizes.size());
+
+	// The megakernel keeps the layers' images stale until synced
+	ph.syncMegakernel(cs);
+
+	for (int l = 0; l < _layerSizes.size(); l++) {
+		// Held layers still hold the states (and prediction buffers) of an earlier step
+		if (!ph.ranLastStep(l))
+			continue;
+
+		const PredictiveHierarchy::Layer &layer = ph.getLayer(l);
+
+		const cl::Image2D &states = layer._sc.getHiddenStates()[_back];
+		const cl::Image2D &targets = l == 0 ? input : ph.getLayer(l - 1)._sc.getHiddenStates()[_back];
+
+		// The previous prediction is in the front buffer after a step
+		metricsReduce(cs, _reduceKernel, layer._pred.getHiddenStates()[_front], targets, _targetSizes[l], true, _metrics, l * _metricsPerLayer + 0);
+		metricsReduce(cs, _reduceKernel, layer._reward, layer._reward, _layerSizes[l], false, _metrics, l * _metricsPerLayer + 1);
+		metricsReduce(cs, _reduceKernel, states, states, _layerSizes[l], false, _metrics, l * _metricsPerLayer + 2);
+
+		int argIndex = 0;
+
+		_accumulateUsageKernel.setArg(argIndex++, states);
+		_accumulateUsageKernel.setArg(argIndex++, _usage[l]);
+		_accumulateUsageKernel.setArg(argIndex++, _layerSizes[l].x);
+
+		cs.enqueueKernel(_accumulateUsageKernel, cl::NDRange(_layerSizes[l].x, _layerSizes[l].y));
+
+		_samples[l]++;
+	}
+
+	_step++;
+	_stepsInInterval++;
+
+	if (_stepsInInterval < _interval)
+		return;
+
+	// Previous readback had a whole interval to complete
+	if (_readPending) {
+		_readEvent.wait();
+
+		publish();
+	}
+
+	for (int l = 0; l < _layerSizes.size(); l++) {
+		int argIndex = 0;
+
+		_usageEntropyKernel.setArg(argIndex++, _usage[l]);
+		_usageEntropyKernel.setArg(argIndex++, _layerSizes[l].x * _layerSizes[l].y);
+		_usageEntropyKernel.setArg(argIndex++, _metrics);
+		_usageEntropyKernel.setArg(argIndex++, l * _metricsPerLayer + 3);
+		_usageEntropyKernel.setArg(argIndex++, cl::Local(metricsReduceSize * sizeof(cl_float)));
+
+		cs.getQueue().enqueueNDRangeKernel(_usageEntropyKernel, cl::NullRange, cl::NDRange(metricsReduceSize), cl::NDRange(metricsReduceSize));
+	}
+
+	cs.getQueue().enqueueReadBuffer(_metrics, CL_FALSE, 0, _hostMetrics.size() * sizeof(cl_float), _hostMetrics.data(), nullptr, &_readEvent);
+
+	// The queue is in order, so the reset happens after the read
+	cs.getQueue().enqueueFillBuffer(_metrics, 0.0f, 0, _hostMetrics.size() * sizeof(cl_float));
+
+	for (int l = 0; l < _layerSizes.size(); l++)
+		cs.getQueue().enqueueFillBuffer(_usage[l], 0.0f, 0, _layerSizes[l].x * _layerSizes[l].y * sizeof(cl_float));
+
+	cs.getQueue().flush();
+
+	_readPending = true;
+	_readSteps = _stepsInInterval;
+	_readStep = _step;
+	_readSamples = _samples;
+
+	_samples.assign(_samples.size(), 0);
+
+	_stepsInInterval = 0;
+}
+
+bool HierarchyMetrics::poll() {
+	if (!_readPending || _readEvent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE)
+		return false;
+
+	publish();
+
+	return true;
+}
+
+void HierarchyMetrics::publish() {
+	_latest._step = _readStep;
+	_latest._numSteps = _readSteps;
+	_latest._layers.resize(_layerSizes.size());
+
+	for (int l = 0; l < _layerSizes.size(); l++) {
+		const cl_float* pMetrics = &_hostMetrics[l * _metricsPerLayer];
+
+		LayerMetrics &lm = _latest._layers[l];
+
+		lm._numSteps = _readSamples[l];
+
+		if (_readSamples[l] == 0) {
+			lm._predictionError = lm._rewardMean = lm._sparsity = lm._usageEntropy = 0.0f;
+
+			continue;
+		}
+
+		float steps = static_cast<float>(_readSamples[l]);
+		float units = static_cast<float>(_layerSizes[l].x * _layerSizes[l].y);
+		float targets = static_cast<float>(_targetSizes[l].x * _targetSizes[l].y);
+
+		lm._predictionError = pMetrics[0] / (steps * targets);
+		lm._rewardMean = pMetrics[1] / (steps * units);
+		lm._sparsity = pMetrics[2] / (steps * units);
+		lm._usageEntropy = pMetrics[3];
+	}
+
+	_readPending = false;
+}
\ No newline at end of file
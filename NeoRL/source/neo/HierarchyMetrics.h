@@ -0,0 +1,175 @@
+#pragma once
+
+#include "PredictiveHierarchy.h"
+
+namespace neo {
+	/*!
+	\brief On-device metrics for a predictive hierarchy
+	Reduces per-layer statistics on the device each step, and reads them back asynchronously every interval steps,
+	so monitoring never stalls the step loop
+	*/
+	class HierarchyMetrics : private sys::Uncopyable {
+	public:
+		/*!
+		\brief Metrics of a layer, averaged over an interval
+		*/
+		struct LayerMetrics {
+			/*!
+			\brief Mean squared error of the previous prediction against the layer's current input
+			*/
+			cl_float _predictionError;
+
+			/*!
+			\brief Mean sparse coder reward (from the baselines)
+			*/
+			cl_float _rewardMean;
+
+			/*!
+			\brief Fraction of active units
+			*/
+			cl_float _sparsity;
+
+			/*!
+			\brief Entropy of unit usage, normalized to [0, 1] (1 = all units used equally)
+			*/
+			cl_float _usageEntropy;
+
+			/*!
+			\brief Number of steps the layer ran in the interval, the metrics are zero if it did not run
+			*/
+			int _numSteps;
+		};
+
+		/*!
+		\brief Metrics of all layers over an interval
+		*/
+		struct Report {
+			/*!
+			\brief Number of updates at the end of the interval
+			*/
+			cl_ulong _step;
+
+			/*!
+			\brief Number of steps in the interval
+			*/
+			int _numSteps;
+
+			/*!
+			\brief Per-layer metrics
+			*/
+			std::vector<LayerMetrics> _layers;
+		};
+
+	private:
+		/*!
+		\brief Number of metrics per layer in the device buffer
+		*/
+		static const int _metricsPerLayer = 4;
+
+		/*!
+		\brief Accumulated metrics (device)
+		*/
+		cl::Buffer _metrics;
+
+		/*!
+		\brief Per-layer unit usage counts (device)
+		*/
+		std::vector<cl::Buffer> _usage;
+
+		//!@{
+		/*!
+		\brief Per-layer sizes (units, prediction targets)
+		*/
+		std::vector<cl_int2> _layerSizes;
+		std::vector<cl_int2> _targetSizes;
+		//!@}
+
+		/*!
+		\brief Host copy of the metrics being read
+		*/
+		std::vector<cl_float> _hostMetrics;
+
+		//!@{
+		/*!
+		\brief Per-layer number of steps the layer ran (this interval, and of the readback in flight)
+		*/
+		std::vector<int> _samples;
+		std::vector<int> _readSamples;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Readback in flight
+		*/
+		cl::Event _readEvent;
+		bool _readPending;
+		int _readSteps;
+		cl_ulong _readStep;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Interval and progress
+		*/
+		int _interval;
+		int _stepsInInterval;
+		cl_ulong _step;
+		//!@}
+
+		/*!
+		\brief Latest report
+		*/
+		Report _latest;
+
+		//!@{
+		/*!
+		\brief Kernels
+		*/
+		cl::Kernel _reduceKernel;
+		cl::Kernel _accumulateUsageKernel;
+		cl::Kernel _usageEntropyKernel;
+		//!@}
+
+		/*!
+		\brief Turn a completed readback into the latest report
+		*/
+		void publish();
+
+	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		HierarchyMetrics()
+			: _readPending(false), _readSteps(0), _readStep(0), _interval(100), _stepsInInterval(0), _step(0)
+		{
+			_latest._step = 0;
+			_latest._numSteps = 0;
+		}
+
+		/*!
+		\brief Create metrics for a hierarchy, read back every interval steps
+		*/
+		void create(sys::ComputeSystem &cs, sys::ComputeProgram &program, const PredictiveHierarchy &ph, int interval = 100);
+
+		/*!
+		\brief Accumulate the metrics of a step (non-blocking), call after simStep with the same input
+		Layers that did not run on the step (held by tick strides or change skipping) are not sampled.
+		With the megakernel, syncs its state to the layers first (see PredictiveHierarchy::syncMegakernel).
+		Every interval steps, starts an asynchronous readback
+		*/
+		void update(sys::ComputeSystem &cs, const PredictiveHierarchy &ph, const cl::Image2D &input);
+
+		/*!
+		\brief Check for a completed readback (non-blocking)
+		Returns true if a new report is available through getLatest
+		*/
+		bool poll();
+
+		/*!
+		\brief Get the latest report (no layers if none is available yet)
+		*/
+		const Report &getLatest() const {
+			return _latest;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "HierarchyStream.h"
+
+#include <algorithm>
+
+using namespace neo;
+
+HierarchyStream::~HierarchyStream() {
+	if (_slots.empty())
+		return;
+
+	waitAll();
+
+	for (int si = 0; si < _slots.size(); si++) {
+		Slot &slot = _slots[si];
+
+		_queue.enqueueUnmapMemObject(slot._inputBuffer, slot._pInput);
+		_queue.enqueueUnmapMemObject(slot._predictionBuffer, slot._pPrediction);
+	}
+
+	_queue.finish();
+}
+
+void HierarchyStream::create(sys::ComputeSystem &cs, cl_int2 inputSize, int numSlots) {
+	assert(numSlots > 0);
+	assert(_slots.empty());
+
+	_size = inputSize;
+	_queue = cs.getQueue();
+
+	size_t numBytes = static_cast<size_t>(_size.x) * _size.y * sizeof(cl_float);
+
+	_input = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), _size.x, _size.y);
+
+	{
+		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+		cl::array<cl::size_type, 3> inputRegion = { static_cast<cl::size_type>(_size.x), static_cast<cl::size_type>(_size.y), 1 };
+
+		cs.getQueue().enqueueFillImage(_input, zeroColor, zeroOrigin, inputRegion);
+	}
+
+	_slots.resize(numSlots);
+
+	// Map each staging buffer once, the mapped pointers serve as pinned host memory for transfers
+	for (int si = 0; si < _slots.size(); si++) {
+		Slot &slot = _slots[si];
+
+		slot._inputBuffer = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, numBytes);
+		slot._predictionBuffer = cl::Buffer(cs.getContext(), CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, numBytes);
+
+		slot._pInput = static_cast<cl_float*>(cs.getQueue().enqueueMapBuffer(slot._inputBuffer, CL_TRUE, CL_MAP_WRITE, 0, numBytes));
+		slot._pPrediction = static_cast<cl_float*>(cs.getQueue().enqueueMapBuffer(slot._predictionBuffer, CL_TRUE, CL_MAP_READ, 0, numBytes));
+
+		slot._step = 0;
+		slot._inFlight = false;
+		slot._pStream = this;
+	}
+
+	_nextSlot = 0;
+	_step = 0;
+}
+
+void CL_CALLBACK HierarchyStream::onReadComplete(cl_event event, cl_int status, void* pUserData) {
+	Slot &slot = *static_cast<Slot*>(pUserData);
+
+	HierarchyStream &stream = *slot._pStream;
+
+	std::vector<cl_float> prediction;
+
+	// Negative status means the commands were aborted, deliver an empty prediction
+	if (status == CL_COMPLETE)
+		prediction.assign(slot._pPrediction, slot._pPrediction + static_cast<size_t>(stream._size.x) * stream._size.y);
+
+	if (stream._callback)
+		stream._callback(slot._step, prediction);
+
+	slot._promise.set_value(std::move(prediction));
+
+	// Notify while holding the lock, once it is released waitAll may return and the stream may be destroyed
+	std::lock_guard<std::mutex> lock(stream._mutex);
+
+	slot._inFlight = false;
+
+	stream._slotDone.notify_all();
+}
+
+std::future<std::vector<cl_float>> HierarchyStream::submit(sys::ComputeSystem &cs, PredictiveHierarchy &ph, const std::vector<cl_float> &input, bool learn) {
+	assert(!_slots.empty());
+	assert(input.size() == static_cast<size_t>(_size.x) * _size.y);
+	assert(ph.getFirstLayerPred().getHiddenSize().x == _size.x && ph.getFirstLayerPred().getHiddenSize().y == _size.y);
+
+	Slot &slot = _slots[_nextSlot];
+
+	_nextSlot = (_nextSlot + 1) % _slots.size();
+
+	// Wait for the slot to come back around
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		_slotDone.wait(lock, [&slot] { return !slot._inFlight; });
+
+		slot._inFlight = true;
+	}
+
+	slot._step = _step++;
+	slot._promise = std::promise<std::vector<cl_float>>();
+
+	std::future<std::vector<cl_float>> result = slot._promise.get_future();
+
+	std::copy(input.begin(), input.end(), slot._pInput);
+
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+	cl::array<cl::size_type, 3> region = { static_cast<cl::size_type>(_size.x), static_cast<cl::size_type>(_size.y), 1 };
+
+	// The queue is in order, so the upload does not overwrite the input of the previous step before it is used
+	cs.getQueue().enqueueWriteImage(_input, CL_FALSE, zeroOrigin, region, 0, 0, slot._pInput);
+
+	ph.simStep(cs, _input, learn);
+
+	cs.getQueue().enqueueReadImage(ph.getFirstLayerPred().getHiddenStates()[_back], CL_FALSE, zeroOrigin, region, 0, 0, slot._pPrediction, nullptr, &slot._readEvent);
+
+	slot._readEvent.setCallback(CL_COMPLETE, onReadComplete, &slot);
+
+	cs.getQueue().flush();
+
+	return result;
+}
+
+void HierarchyStream::waitAll() {
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	_slotDone.wait(lock, [this] {
+		for (int si = 0; si < _slots.size(); si++)
+			if (_slots[si]._inFlight)
+				return false;
+
+		return true;
+	});
+}
\ No newline at end of file
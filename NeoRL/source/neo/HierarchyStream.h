@@ -0,0 +1,169 @@
+#pragma once
+
+#include "PredictiveHierarchy.h"
+
+#include <functional>
+
+namespace neo {
+	/*!
+	\brief Streaming I/O for a predictive hierarchy
+	Stages inputs and predictions through a ring of pinned host buffers, so the input of the next step can be submitted
+	while the prediction of the current step is still being computed and read back.
+	Predictions are delivered through futures and/or a completion callback
+	*/
+	class HierarchyStream : private sys::Uncopyable {
+	public:
+		/*!
+		\brief Completion callback, called with the step index and prediction
+		Called from an OpenCL runtime thread, so it must not enqueue blocking commands
+		*/
+		typedef std::function<void(cl_ulong step, const std::vector<cl_float> &prediction)> Callback;
+
+	private:
+		/*!
+		\brief Staging slot
+		*/
+		struct Slot {
+			//!@{
+			/*!
+			\brief Pinned staging buffers and their (persistent) host mappings
+			*/
+			cl::Buffer _inputBuffer;
+			cl::Buffer _predictionBuffer;
+			cl_float* _pInput;
+			cl_float* _pPrediction;
+			//!@}
+
+			/*!
+			\brief Completion of the prediction read
+			*/
+			cl::Event _readEvent;
+
+			/*!
+			\brief Step the slot is used for
+			*/
+			cl_ulong _step;
+
+			/*!
+			\brief Whether the slot is in flight
+			*/
+			bool _inFlight;
+
+			/*!
+			\brief Prediction result
+			*/
+			std::promise<std::vector<cl_float>> _promise;
+
+			/*!
+			\brief Owning stream (for the completion callback)
+			*/
+			HierarchyStream* _pStream;
+		};
+
+		/*!
+		\brief Ring of slots
+		*/
+		std::vector<Slot> _slots;
+
+		/*!
+		\brief Next slot to use
+		*/
+		int _nextSlot;
+
+		/*!
+		\brief Device input image
+		*/
+		cl::Image2D _input;
+
+		/*!
+		\brief Input (and prediction) size
+		*/
+		cl_int2 _size;
+
+		/*!
+		\brief Number of steps submitted
+		*/
+		cl_ulong _step;
+
+		/*!
+		\brief Completion callback
+		*/
+		Callback _callback;
+
+		/*!
+		\brief Queue the staging buffers are mapped on
+		*/
+		cl::CommandQueue _queue;
+
+		//!@{
+		/*!
+		\brief Synchronization with completion callbacks
+		*/
+		std::mutex _mutex;
+		std::condition_variable _slotDone;
+		//!@}
+
+		/*!
+		\brief Called when a prediction read completes
+		*/
+		static void CL_CALLBACK onReadComplete(cl_event event, cl_int status, void* pUserData);
+
+	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		HierarchyStream()
+			: _nextSlot(0), _step(0)
+		{}
+
+		/*!
+		\brief Waits for all steps in flight and unmaps the staging buffers
+		*/
+		~HierarchyStream();
+
+		/*!
+		\brief Create staging for a hierarchy with the given input size
+		The number of slots bounds the number of steps in flight
+		*/
+		void create(sys::ComputeSystem &cs, cl_int2 inputSize, int numSlots = 3);
+
+		/*!
+		\brief Set the completion callback (optional)
+		*/
+		void setCallback(const Callback &callback) {
+			_callback = callback;
+		}
+
+		/*!
+		\brief Submit a step: stage the input, step the hierarchy, and read back the prediction, all non-blocking
+		Blocks only if all slots are in flight. Input must have inputSize.x * inputSize.y values
+		*/
+		std::future<std::vector<cl_float>> submit(sys::ComputeSystem &cs, PredictiveHierarchy &ph, const std::vector<cl_float> &input, bool learn = true);
+
+		/*!
+		\brief Wait until all submitted steps have completed (including their callbacks)
+		*/
+		void waitAll();
+
+		/*!
+		\brief Get number of steps submitted
+		*/
+		cl_ulong getStep() const {
+			return _step;
+		}
+
+		/*!
+		\brief Get number of slots
+		*/
+		size_t getNumSlots() const {
+			return _slots.size();
+		}
+
+		/*!
+		\brief Get device input image
+		*/
+		const cl::Image2D &getInput() const {
+			return _input;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#include "LearnRecords.h"
+
+using namespace neo;
+
+void LearnRecords::create(sys::ComputeSystem &cs, int numUnits, int capacity) {
+	_capacity = capacity;
+
+	_steps = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, numUnits * _capacity * sizeof(cl_int));
+	_values = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, numUnits * _capacity * sizeof(cl_float));
+	_counts = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, numUnits * sizeof(cl_int));
+}
+
+void LearnRecords::release() {
+	_steps = cl::Buffer();
+	_values = cl::Buffer();
+	_counts = cl::Buffer();
+
+	_capacity = 0;
+}
+
+void LearnRecords::record(sys::ComputeSystem &cs, cl::Kernel &recordActiveKernel, const cl::Image2D &values, cl_int2 size, int step) {
+	assert(step < _capacity);
+
+	int argIndex = 0;
+
+	recordActiveKernel.setArg(argIndex++, values);
+	setArgs(recordActiveKernel, argIndex);
+	recordActiveKernel.setArg(argIndex++, static_cast<cl_int>(step));
+
+	cs.enqueueKernel(recordActiveKernel, cl::NDRange(size.x, size.y));
+}
+
+void LearnRecords::setArgs(cl::Kernel &kernel, int &argIndex) const {
+	kernel.setArg(argIndex++, _steps);
+	kernel.setArg(argIndex++, _values);
+	kernel.setArg(argIndex++, _counts);
+	kernel.setArg(argIndex++, static_cast<cl_int>(_capacity));
+}
\ No newline at end of file
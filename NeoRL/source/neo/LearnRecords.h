@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Helpers.h"
+
+namespace neo {
+	/*!
+	\brief Compact per unit records of the steps of a learning batch
+	Each unit keeps the steps (in order) at which its value was nonzero, and those values, so batched learning
+	stores and replays only the active units instead of a dense image per step.
+	Recording step 0 starts a new batch, every unit must be recorded at every step
+	*/
+	class LearnRecords {
+	private:
+		//!@{
+		/*!
+		\brief Per unit steps and values (capacity entries per unit), and number of entries used
+		*/
+		cl::Buffer _steps;
+		cl::Buffer _values;
+		cl::Buffer _counts;
+		//!@}
+
+		/*!
+		\brief Maximum number of steps per batch
+		*/
+		int _capacity;
+
+	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		LearnRecords()
+			: _capacity(0)
+		{}
+
+		/*!
+		\brief Create records for a number of units and steps per batch
+		*/
+		void create(sys::ComputeSystem &cs, int numUnits, int capacity);
+
+		/*!
+		\brief Release the buffers
+		*/
+		void release();
+
+		/*!
+		\brief Record the nonzero values of an image at a step of the batch (non-blocking)
+		*/
+		void record(sys::ComputeSystem &cs, cl::Kernel &recordActiveKernel, const cl::Image2D &values, cl_int2 size, int step);
+
+		/*!
+		\brief Set the arguments of a kernel recording or reading the records (steps, values, counts, capacity)
+		*/
+		void setArgs(cl::Kernel &kernel, int &argIndex) const;
+
+		/*!
+		\brief Whether the records were created
+		*/
+		bool isCreated() const {
+			return _capacity > 0;
+		}
+	};
+}
\ No newline at end of file
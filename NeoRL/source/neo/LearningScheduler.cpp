@@ -0,0 +1,94 @@
+#include "LearningScheduler.h"
+
+#include <algorithm>
+
+using namespace neo;
+
+void LearningScheduler::create(sys::ComputeSystem &cs, sys::ComputeProgram &program, int numLayers, const Params &params) {
+	assert(params._interval > 0);
+	assert(params._maxStride >= 1);
+
+	_params = params;
+
+	_hostErrors.assign(numLayers, 0.0f);
+	_samples.assign(numLayers, 0);
+	_readSamples.assign(numLayers, 0);
+
+	_strides.assign(numLayers, 1);
+	_paused.assign(numLayers, false);
+	_prevErrors.assign(numLayers, -1.0f);
+	_bestErrors.assign(numLayers, -1.0f);
+
+	_errors = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, numLayers * sizeof(cl_float));
+
+	cs.getQueue().enqueueFillBuffer(_errors, 0.0f, 0, numLayers * sizeof(cl_float));
+
+	_readPending = false;
+	_stepsInInterval = 0;
+	_step = 0;
+
+	_reduceKernel = cl::Kernel(program.getProgram(), "metricsReduce");
+}
+
+void LearningScheduler::accumulate(sys::ComputeSystem &cs, int l, const cl::Image2D &predictions, const cl::Image2D &targets, cl_int2 size) {
+	metricsReduce(cs, _reduceKernel, predictions, targets, size, true, _errors, l);
+
+	_samples[l]++;
+}
+
+void LearningScheduler::step(sys::ComputeSystem &cs) {
+	_step++;
+	_stepsInInterval++;
+
+	if (_stepsInInterval < _params._interval)
+		return;
+
+	// Previous readback had a whole interval to complete
+	if (_readPending) {
+		_readEvent.wait();
+
+		reschedule();
+	}
+
+	cs.getQueue().enqueueReadBuffer(_errors, CL_FALSE, 0, _hostErrors.size() * sizeof(cl_float), _hostErrors.data(), nullptr, &_readEvent);
+
+	// The queue is in order, so the reset happens after the read
+	cs.getQueue().enqueueFillBuffer(_errors, 0.0f, 0, _hostErrors.size() * sizeof(cl_float));
+
+	cs.getQueue().flush();
+
+	_readPending = true;
+	_readSamples = _samples;
+
+	std::fill(_samples.begin(), _samples.end(), 0);
+
+	_stepsInInterval = 0;
+}
+
+void LearningScheduler::reschedule() {
+	for (int l = 0; l < _strides.size(); l++) {
+		if (_readSamples[l] == 0)
+			continue;
+
+		float error = _hostErrors[l] / _readSamples[l];
+
+		if (_bestErrors[l] >= 0.0f && error > _bestErrors[l] * (1.0f + _params._riseTolerance)) {
+			// Rising, learn every step again and track the new level
+			_strides[l] = 1;
+			_paused[l] = false;
+			_bestErrors[l] = error;
+		}
+		else if (_prevErrors[l] >= 0.0f && _prevErrors[l] - error < _params._plateauTolerance * _prevErrors[l]) {
+			// Plateau, learn less often
+			if (_strides[l] < _params._maxStride)
+				_strides[l] = std::min(_strides[l] * 2, _params._maxStride);
+			else if (_params._pauseAtMax)
+				_paused[l] = true;
+		}
+
+		_bestErrors[l] = _bestErrors[l] < 0.0f ? error : std::min(_bestErrors[l], error);
+		_prevErrors[l] = error;
+	}
+
+	_readPending = false;
+}
\ No newline at end of file
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "Helpers.h"
+
+#include <vector>
+
+namespace neo {
+	/*!
+	\brief Adaptive per-layer learning schedule
+	Accumulates the prediction error of each layer on the device, and reads it back asynchronously every interval steps.
+	When the error of a layer plateaus, the layer learns less often (its stride doubles, up to a maximum, after which
+	learning pauses if enabled). When the error rises again, the layer learns every step
+	*/
+	class LearningScheduler {
+	public:
+		/*!
+		\brief Schedule parameters
+		*/
+		struct Params {
+			/*!
+			\brief Steps between error readbacks
+			*/
+			int _interval;
+
+			/*!
+			\brief Relative improvement over an interval below which the error has plateaued
+			*/
+			float _plateauTolerance;
+
+			/*!
+			\brief Relative rise above the best interval error at which learning resumes every step
+			*/
+			float _riseTolerance;
+
+			/*!
+			\brief Largest learning stride
+			*/
+			int _maxStride;
+
+			/*!
+			\brief Whether learning pauses once the stride is at its maximum and the error still plateaus
+			*/
+			bool _pauseAtMax;
+
+			/*!
+			\brief Initialize defaults
+			*/
+			Params()
+				: _interval(100), _plateauTolerance(0.01f), _riseTolerance(0.1f), _maxStride(16), _pauseAtMax(false)
+			{}
+		};
+
+	private:
+		/*!
+		\brief Parameters
+		*/
+		Params _params;
+
+		/*!
+		\brief Accumulated squared errors per layer (device)
+		*/
+		cl::Buffer _errors;
+
+		//!@{
+		/*!
+		\brief Per-layer error samples (accumulated this interval, and of the readback in flight)
+		*/
+		std::vector<cl_float> _hostErrors;
+		std::vector<int> _samples;
+		std::vector<int> _readSamples;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Per-layer schedule
+		*/
+		std::vector<int> _strides;
+		std::vector<bool> _paused;
+		std::vector<float> _prevErrors;
+		std::vector<float> _bestErrors;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Readback in flight
+		*/
+		cl::Event _readEvent;
+		bool _readPending;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Progress
+		*/
+		int _stepsInInterval;
+		cl_ulong _step;
+		//!@}
+
+		/*!
+		\brief Reduction kernel
+		*/
+		cl::Kernel _reduceKernel;
+
+		/*!
+		\brief Update the schedule from a completed readback
+		*/
+		void reschedule();
+
+	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		LearningScheduler()
+			: _readPending(false), _stepsInInterval(0), _step(0)
+		{}
+
+		/*!
+		\brief Create a schedule for a number of layers, all learning every step
+		*/
+		void create(sys::ComputeSystem &cs, sys::ComputeProgram &program, int numLayers, const Params &params = Params());
+
+		/*!
+		\brief Whether the schedule was created
+		*/
+		bool isCreated() const {
+			return _errors() != nullptr;
+		}
+
+		/*!
+		\brief Accumulate the squared error of a layer's predictions against its targets (non-blocking)
+		*/
+		void accumulate(sys::ComputeSystem &cs, int l, const cl::Image2D &predictions, const cl::Image2D &targets, cl_int2 size);
+
+		/*!
+		\brief End a step, every interval steps starts an asynchronous readback and applies the previous one
+		*/
+		void step(sys::ComputeSystem &cs);
+
+		/*!
+		\brief Whether a layer learns on the current step
+		*/
+		bool learns(int l) const {
+			return !_paused[l] && _step % _strides[l] == 0;
+		}
+
+		/*!
+		\brief Get the learning stride of a layer
+		*/
+		int getStride(int l) const {
+			return _strides[l];
+		}
+
+		/*!
+		\brief Whether learning of a layer is paused
+		*/
+		bool isPaused(int l) const {
+			return _paused[l];
+		}
+
+		/*!
+		\brief Get the parameters
+		*/
+		const Params &getParams() const {
+			return _params;
+		}
+	};
+}
\ No newline at end of file
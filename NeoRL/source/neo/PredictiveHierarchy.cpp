@@ -58,6 +58,8 @@ void PredictiveHierarchy::createRandom(sys::ComputeSystem &cs, sys::ComputeProgr
 
 		_layers[l]._scHiddenStatesPrev = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), _layerDescs[l]._size.x, _layerDescs[l]._size.y);
 
+		createPooledInputs(cs, l);
+
 		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
 
 		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
@@ -67,25 +69,111 @@ void PredictiveHierarchy::createRandom(sys::ComputeSystem &cs, sys::ComputeProgr
 		cs.getQueue().enqueueFillImage(_layers[l]._scHiddenStatesPrev, zeroColor, zeroOrigin, layerRegion);
 	}
 
+	_tick = 0;
+
+	createKernels(program);
+}
+
+void PredictiveHierarchy::createPooledInputs(sys::ComputeSystem &cs, int l) {
+	if (l == 0 || _layerDescs[l]._tickStride <= 1) {
+		_layers[l]._pooledInputs = DoubleBuffer2D();
+
+		return;
+	}
+
+	cl_int2 inputSize = _layerDescs[l - 1]._size;
+
+	_layers[l]._pooledInputs = createDoubleBuffer2D(cs, inputSize, CL_R, CL_FLOAT);
+
+	cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+	cl::array<cl::size_type, 3> inputRegion = { inputSize.x, inputSize.y, 1 };
+
+	cs.getQueue().enqueueFillImage(_layers[l]._pooledInputs[_back], zeroColor, zeroOrigin, inputRegion);
+}
+
+void PredictiveHierarchy::createKernels(sys::ComputeProgram &program) {
 	_baseLineUpdateKernel = cl::Kernel(program.getProgram(), "phBaseLineUpdate");
 	_baseLineUpdateSumErrorKernel = cl::Kernel(program.getProgram(), "phBaseLineUpdateSumError");
+	_poolInputKernel = cl::Kernel(program.getProgram(), "phPoolInput");
+	_countChangesKernel = cl::Kernel(program.getProgram(), "phCountChanges");
+	_rolloutArgmaxKernel = cl::Kernel(program.getProgram(), "phRolloutArgmax");
+	_rolloutPostProcessKernel = cl::Kernel(program.getProgram(), "phRolloutPostProcess");
+
+	// Layers may have changed, enable again after reading
+	_learningScheduler = LearningScheduler();
+	_megakernel = HierarchyMegakernel();
 }
 
 void PredictiveHierarchy::simStep(sys::ComputeSystem &cs, const cl::Image2D &input, bool learn) {
+	if (learn)
+		materializeStateSlots(cs);
+
+	if (_megakernel.isCreated()) {
+		_megakernel.step(cs, input, learn);
+
+		_ranLastStep.assign(_layers.size(), true);
+
+		_tick++;
+
+		return;
+	}
+
 	// Feed forward
 	cl::Image2D prelayerState = input;
 
+	// Input of each layer (pooled for strided layers)
+	std::vector<cl::Image2D> layerInputs(_layers.size());
+
+	// Layers that run this step, others (strided layers that do not tick, layers above an unchanged layer) are held
+	std::vector<bool> runs(_layers.size());
+
+	// Layers that learn this step
+	std::vector<bool> learns(_layers.size());
+
 	for (int l = 0; l < _layers.size(); l++) {
+		runs[l] = ticks(l);
+		learns[l] = learn && (!_learningScheduler.isCreated() || _learningScheduler.learns(l));
+	}
+
+	for (int l = 0; l < _layers.size(); l++) {
+		layerInputs[l] = prelayerState;
+
+		if (l != 0 && _layerDescs[l]._tickStride > 1) {
+			cl_int2 inputSize = _layerDescs[l - 1]._size;
+
+			int argIndex = 0;
+
+			_poolInputKernel.setArg(argIndex++, prelayerState);
+			_poolInputKernel.setArg(argIndex++, _layers[l]._pooledInputs[_back]);
+			_poolInputKernel.setArg(argIndex++, _layers[l]._pooledInputs[_front]);
+			_poolInputKernel.setArg(argIndex++, static_cast<cl_int>(_tick % _layerDescs[l]._tickStride == 1));
+
+			cs.enqueueKernel(_poolInputKernel, cl::NDRange(inputSize.x, inputSize.y));
+
+			std::swap(_layers[l]._pooledInputs[_front], _layers[l]._pooledInputs[_back]);
+
+			layerInputs[l] = _layers[l]._pooledInputs[_back];
+		}
+
+		// Held layers keep their states, the layers above see them unchanged
+		if (!runs[l]) {
+			prelayerState = _layers[l]._sc.getHiddenStates()[_back];
+
+			continue;
+		}
+
 		{
 			std::vector<cl::Image2D> visibleStates(2);
 
-			visibleStates[0] = prelayerState;
+			visibleStates[0] = layerInputs[l];
 			visibleStates[1] = _layers[l]._scHiddenStatesPrev;
 
-			_layers[l]._sc.activate(cs, visibleStates, _layerDescs[l]._scActiveRatio);
-
-			if (learn)
-				_layers[l]._sc.learn(cs, _layers[l]._reward, visibleStates, _layerDescs[l]._scBoostAlpha, _layerDescs[l]._scActiveRatio);
+			if (learns[l])
+				_layers[l]._sc.activateAndLearn(cs, _layers[l]._reward, visibleStates, _layerDescs[l]._scBoostAlpha, _layerDescs[l]._scActiveRatio);
+			else
+				_layers[l]._sc.activate(cs, visibleStates, _layerDescs[l]._scActiveRatio);
 		}
 
 		// Get reward
@@ -100,7 +188,7 @@ void PredictiveHierarchy::simStep(sys::ComputeSystem &cs, const cl::Image2D &inp
 			_baseLineUpdateKernel.setArg(argIndex++, _layerDescs[l]._baseLineDecay);
 			_baseLineUpdateKernel.setArg(argIndex++, _layerDescs[l]._baseLineSensitivity);
 
-			cs.getQueue().enqueueNDRangeKernel(_baseLineUpdateKernel, cl::NullRange, cl::NDRange(_layerDescs[l]._size.x, _layerDescs[l]._size.y));
+			cs.enqueueKernel(_baseLineUpdateKernel, cl::NDRange(_layerDescs[l]._size.x, _layerDescs[l]._size.y));
 		}
 		else {
 			int argIndex = 0;
@@ -114,13 +202,22 @@ void PredictiveHierarchy::simStep(sys::ComputeSystem &cs, const cl::Image2D &inp
 			_baseLineUpdateSumErrorKernel.setArg(argIndex++, _layerDescs[l]._baseLineDecay);
 			_baseLineUpdateSumErrorKernel.setArg(argIndex++, _layerDescs[l]._baseLineSensitivity);
 
-			cs.getQueue().enqueueNDRangeKernel(_baseLineUpdateSumErrorKernel, cl::NullRange, cl::NDRange(_layerDescs[l]._size.x, _layerDescs[l]._size.y));
+			cs.enqueueKernel(_baseLineUpdateSumErrorKernel, cl::NDRange(_layerDescs[l]._size.x, _layerDescs[l]._size.y));
 		}
 
 		prelayerState = _layers[l]._sc.getHiddenStates()[_back];
+
+		// Unchanged sparse code, the layers above would see the same input
+		if (_skipUnchanged && !learn && l < _layers.size() - 1 && !hasChanged(cs, l)) {
+			for (int ul = l + 1; ul < _layers.size(); ul++)
+				runs[ul] = false;
+		}
 	}
 
 	for (int l = _layers.size() - 1; l >= 0; l--) {
+		if (!runs[l])
+			continue;
+
 		std::vector<cl::Image2D> visibleStates;
 
 		if (l < _layers.size() - 1) {
@@ -135,22 +232,25 @@ void PredictiveHierarchy::simStep(sys::ComputeSystem &cs, const cl::Image2D &inp
 			visibleStates[0] = _layers[l]._sc.getHiddenStates()[_back];
 		}
 
-		_layers[l]._pred.activate(cs, visibleStates, l != 0);
+		_layers[l]._pred.activateAndPropagate(cs, visibleStates, l != 0, layerInputs[l]);
 
-		if (l == 0)
-			_layers[l]._pred.propagateError(cs, input);
-		else
-			_layers[l]._pred.propagateError(cs, _layers[l - 1]._sc.getHiddenStates()[_back]);
+		// Error of the previous prediction, which is in the front buffer
+		if (_learningScheduler.isCreated())
+			_learningScheduler.accumulate(cs, l, _layers[l]._pred.getHiddenStates()[_front], layerInputs[l], _layers[l]._pred.getHiddenSize());
 	}
 
 	for (int l = _layers.size() - 1; l >= 0; l--) {
+		if (!runs[l])
+			continue;
+
 		std::vector<cl::Image2D> visibleStatesPrev;
 
 		if (l < _layers.size() - 1) {
 			visibleStatesPrev.resize(2);
 
+			// Feedback used on the previous step, which is still current if the layer above did not tick
 			visibleStatesPrev[0] = _layers[l]._scHiddenStatesPrev;
-			visibleStatesPrev[1] = _layers[l + 1]._pred.getHiddenStates()[_front];
+			visibleStatesPrev[1] = _layers[l + 1]._pred.getHiddenStates()[runs[l + 1] ? _front : _back];
 		}
 		else {
 			visibleStatesPrev.resize(1);
@@ -158,16 +258,15 @@ void PredictiveHierarchy::simStep(sys::ComputeSystem &cs, const cl::Image2D &inp
 			visibleStatesPrev[0] = _layers[l]._scHiddenStatesPrev;
 		}
 
-		if (learn) {
-			if (l == 0)
-				_layers[l]._pred.learn(cs, input, visibleStatesPrev, _layerDescs[l]._predWeightAlpha);
-			else
-				_layers[l]._pred.learn(cs, _layers[l - 1]._sc.getHiddenStates()[_back], visibleStatesPrev, _layerDescs[l]._predWeightAlpha);
-		}
+		if (learns[l])
+			_layers[l]._pred.learn(cs, layerInputs[l], visibleStatesPrev, _layerDescs[l]._predWeightAlpha);
 	}
 
 	// Buffer updates
 	for (int l = 0; l < _layers.size(); l++) {
+		if (!runs[l])
+			continue;
+
 		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
 		cl::array<cl::size_type, 3> layerRegion = { _layerDescs[l]._size.x, _layerDescs[l]._size.y, 1 };
 
@@ -175,20 +274,220 @@ void PredictiveHierarchy::simStep(sys::ComputeSystem &cs, const cl::Image2D &inp
 
 		std::swap(_layers[l]._baseLines[_front], _layers[l]._baseLines[_back]);
 	}
+
+	if (learn && _learningScheduler.isCreated())
+		_learningScheduler.step(cs);
+
+	_ranLastStep = runs;
+
+	_tick++;
+}
+
+bool PredictiveHierarchy::setMegakernel(sys::ComputeSystem &cs, sys::ComputeProgram &program, bool enabled) {
+	if (!enabled) {
+		if (_megakernel.isCreated()) {
+			_megakernel.sync(cs);
+
+			_megakernel = HierarchyMegakernel();
+		}
+
+		return true;
+	}
+
+	if (!HierarchyMegakernel::isSupported(*this))
+		return false;
+
+	materializeStateSlots(cs);
+
+	_megakernel.create(cs, program, *this);
+
+	return true;
+}
+
+bool PredictiveHierarchy::hasChanged(sys::ComputeSystem &cs, int l) {
+	// Layers may have been recreated since the counts were
+	if (_changeCounts.size() != _layers.size()) {
+		_changeCounts.resize(_layers.size());
+
+		for (int ol = 0; ol < _changeCounts.size(); ol++)
+			_changeCounts[ol] = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, sizeof(cl_int));
+	}
+
+	cs.getQueue().enqueueFillBuffer(_changeCounts[l], static_cast<cl_int>(0), 0, sizeof(cl_int));
+
+	int argIndex = 0;
+
+	_countChangesKernel.setArg(argIndex++, _layers[l]._sc.getHiddenStates()[_back]);
+	_countChangesKernel.setArg(argIndex++, _layers[l]._scHiddenStatesPrev);
+	_countChangesKernel.setArg(argIndex++, _changeCounts[l]);
+
+	cs.enqueueKernel(_countChangesKernel, cl::NDRange(_layerDescs[l]._size.x, _layerDescs[l]._size.y));
+
+	cl_int count;
+
+	cs.getQueue().enqueueReadBuffer(_changeCounts[l], CL_TRUE, 0, sizeof(cl_int), &count);
+
+	return count != 0;
+}
+
+void PredictiveHierarchy::simStep(sys::ComputeSystem &cs, SharedChannel &input, SharedChannel &prediction, bool learn) {
+	input.toImage(cs);
+
+	simStep(cs, input.getImage(), learn);
+
+	prediction.fromImage(cs, getFirstLayerPred().getHiddenStates()[_back]);
+}
+
+void PredictiveHierarchy::rollout(sys::ComputeSystem &cs, int numSteps, std::vector<cl_float> &trajectory, RolloutMode mode, float threshold) {
+	assert(numSteps > 0);
+
+	cl_int2 inputSize = getFirstLayerPred().getHiddenSize();
+
+	int inputCount = inputSize.x * inputSize.y;
+
+	if (_rolloutCapacity == 0)
+		_rolloutMaxIndex = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, sizeof(cl_int));
+
+	// The first layer may have been recreated with a different size since the last rollout
+	if (_rolloutCapacity == 0
+		|| _rolloutInput.getImageInfo<CL_IMAGE_WIDTH>() != static_cast<size_t>(inputSize.x)
+		|| _rolloutInput.getImageInfo<CL_IMAGE_HEIGHT>() != static_cast<size_t>(inputSize.y))
+		_rolloutInput = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), inputSize.x, inputSize.y);
+
+	if (numSteps * inputCount > _rolloutCapacity) {
+		_rolloutTrajectory = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, static_cast<size_t>(numSteps) * inputCount * sizeof(cl_float));
+
+		_rolloutCapacity = numSteps * inputCount;
+	}
+
+	for (int s = 0; s < numSteps; s++) {
+		const cl::Image2D &predictions = getFirstLayerPred().getHiddenStates()[_back];
+
+		if (mode == _rolloutOneHot) {
+			int argIndex = 0;
+
+			_rolloutArgmaxKernel.setArg(argIndex++, predictions);
+			_rolloutArgmaxKernel.setArg(argIndex++, _rolloutMaxIndex);
+			_rolloutArgmaxKernel.setArg(argIndex++, inputSize);
+
+			cs.getQueue().enqueueNDRangeKernel(_rolloutArgmaxKernel, cl::NullRange, cl::NDRange(1));
+		}
+
+		{
+			int argIndex = 0;
+
+			_rolloutPostProcessKernel.setArg(argIndex++, predictions);
+			_rolloutPostProcessKernel.setArg(argIndex++, _rolloutInput);
+			_rolloutPostProcessKernel.setArg(argIndex++, _rolloutMaxIndex);
+			_rolloutPostProcessKernel.setArg(argIndex++, _rolloutTrajectory);
+			_rolloutPostProcessKernel.setArg(argIndex++, inputSize);
+			_rolloutPostProcessKernel.setArg(argIndex++, static_cast<cl_int>(mode));
+			_rolloutPostProcessKernel.setArg(argIndex++, threshold);
+			_rolloutPostProcessKernel.setArg(argIndex++, s * inputCount);
+
+			cs.enqueueKernel(_rolloutPostProcessKernel, cl::NDRange(inputSize.x, inputSize.y));
+		}
+
+		simStep(cs, _rolloutInput, false);
+	}
+
+	trajectory.resize(static_cast<size_t>(numSteps) * inputCount);
+
+	cs.getQueue().enqueueReadBuffer(_rolloutTrajectory, CL_TRUE, 0, trajectory.size() * sizeof(cl_float), trajectory.data());
+}
+
+void PredictiveHierarchy::materializeStateSlots(sys::ComputeSystem &cs) {
+	for (int si = 0; si < _stateSlots.size(); si++)
+		if (_stateSlots[si].isPending())
+			_stateSlots[si].materialize(cs);
+}
+
+void PredictiveHierarchy::saveState(sys::ComputeSystem &cs, int slotIndex, bool withWeights) {
+	StateSlot &slot = _stateSlots[slotIndex];
+
+	// Images are only current after a sync (the queue is in order, so the copies below see it)
+	syncMegakernel(cs);
+
+	slot.beginWrite(withWeights);
+
+	for (int l = 0; l < _layers.size(); l++) {
+		_layers[l]._sc.writeToStateSlot(cs, slot);
+		_layers[l]._pred.writeToStateSlot(cs, slot);
+
+		slot.writeState(cs, _layers[l]._baseLines[_back]);
+		slot.writeState(cs, _layers[l]._reward);
+		slot.writeState(cs, _layers[l]._scHiddenStatesPrev);
+
+		if (l != 0 && _layerDescs[l]._tickStride > 1)
+			slot.writeState(cs, _layers[l]._pooledInputs[_back]);
+	}
+
+	_stateSlotTicks[slotIndex] = _tick;
+}
+
+void PredictiveHierarchy::restoreState(sys::ComputeSystem &cs, int slotIndex) {
+	StateSlot &slot = _stateSlots[slotIndex];
+
+	// Rewinding weights modifies them, so other slots that still refer to them must copy them first
+	if (slot.hasWeights() && !slot.isPending()) {
+		for (int si = 0; si < _stateSlots.size(); si++)
+			if (si != slotIndex && _stateSlots[si].isPending())
+				_stateSlots[si].materialize(cs);
+	}
+
+	// Parts not held by the slot (weights of a slot without them) must be current before packing again
+	syncMegakernel(cs);
+
+	slot.beginRead();
+
+	for (int l = 0; l < _layers.size(); l++) {
+		_layers[l]._sc.readFromStateSlot(cs, slot);
+		_layers[l]._pred.readFromStateSlot(cs, slot);
+
+		slot.readState(cs, _layers[l]._baseLines[_back]);
+		slot.readState(cs, _layers[l]._reward);
+		slot.readState(cs, _layers[l]._scHiddenStatesPrev);
+
+		if (l != 0 && _layerDescs[l]._tickStride > 1)
+			slot.readState(cs, _layers[l]._pooledInputs[_back]);
+	}
+
+	_tick = _stateSlotTicks[slotIndex];
+
+	if (_megakernel.isCreated())
+		_megakernel.pack(cs, *this);
 }
 
 void PredictiveHierarchy::clearMemory(sys::ComputeSystem &cs) {
 	cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
 	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
 
+	syncMegakernel(cs);
+
 	for (int l = 0; l < _layers.size(); l++) {
 		cl::array<cl::size_type, 3> layerRegion = { _layerDescs[l]._size.x, _layerDescs[l]._size.y, 1 };
 
 		cs.getQueue().enqueueFillImage(_layers[l]._scHiddenStatesPrev, zeroColor, zeroOrigin, layerRegion);
+
+		if (l != 0 && _layerDescs[l]._tickStride > 1) {
+			cl_int2 inputSize = _layerDescs[l - 1]._size;
+
+			cl::array<cl::size_type, 3> inputRegion = { inputSize.x, inputSize.y, 1 };
+
+			cs.getQueue().enqueueFillImage(_layers[l]._pooledInputs[_back], zeroColor, zeroOrigin, inputRegion);
+		}
 	}
+
+	_tick = 0;
+
+	if (_megakernel.isCreated())
+		_megakernel.pack(cs, *this);
 }
 
 void PredictiveHierarchy::writeToStream(sys::ComputeSystem &cs, std::ostream &os) const {
+	// Blocking reads below, so the sync completes before them
+	syncMegakernel(cs);
+
 	// Layer information
 	os << _layers.size() << std::endl;
 
@@ -241,6 +540,9 @@ void PredictiveHierarchy::writeToStream(sys::ComputeSystem &cs, std::ostream &os
 }
 
 void PredictiveHierarchy::readFromStream(sys::ComputeSystem &cs, sys::ComputeProgram &program, std::istream &is) {
+	// Step the read state with the megakernel again if it was enabled
+	bool megakernel = _megakernel.isCreated();
+
 	// Layer information
 	int numLayers;
 	
@@ -258,6 +560,9 @@ void PredictiveHierarchy::readFromStream(sys::ComputeSystem &cs, sys::ComputePro
 		is >> ld._scWeightAlpha >> ld._scWeightRecurrentAlpha >> ld._scWeightLambda >> ld._scActiveRatio >> ld._scBoostAlpha;
 		is >> ld._baseLineDecay >> ld._baseLineSensitivity >> ld._predWeightAlpha;
 
+		// Not part of the stream format
+		ld._tickStride = 1;
+
 		l._baseLines = createDoubleBuffer2D(cs, ld._size, CL_R, CL_FLOAT);
 
 		l._reward = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), ld._size.x, ld._size.y);
@@ -294,8 +599,125 @@ void PredictiveHierarchy::readFromStream(sys::ComputeSystem &cs, sys::ComputePro
 
 			cs.getQueue().enqueueWriteImage(l._scHiddenStatesPrev, CL_TRUE, { 0, 0, 0 }, { static_cast<cl::size_type>(ld._size.x), static_cast<cl::size_type>(ld._size.y), 1 }, 0, 0, hiddenStatesPrev.data());
 		}
+
+		createPooledInputs(cs, li);
 	}
 
-	_baseLineUpdateKernel = cl::Kernel(program.getProgram(), "phBaseLineUpdate");
-	_baseLineUpdateSumErrorKernel = cl::Kernel(program.getProgram(), "phBaseLineUpdateSumError");
+	_tick = 0;
+
+	createKernels(program);
+
+	if (megakernel)
+		setMegakernel(cs, program, true);
+}
+
+void PredictiveHierarchy::writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const {
+	syncMegakernel(cs);
+
+	// Layer information
+	snapshot.write(static_cast<cl_int>(_layers.size()));
+
+	for (int li = 0; li < _layers.size(); li++) {
+		const Layer &l = _layers[li];
+		const LayerDesc &ld = _layerDescs[li];
+
+		// Desc
+		snapshot.write(ld._size);
+		snapshot.write(ld._feedForwardRadius);
+		snapshot.write(ld._recurrentRadius);
+		snapshot.write(ld._lateralRadius);
+		snapshot.write(ld._feedBackRadius);
+		snapshot.write(ld._predictiveRadius);
+		snapshot.write(ld._scWeightAlpha);
+		snapshot.write(ld._scWeightRecurrentAlpha);
+		snapshot.write(ld._scWeightLambda);
+		snapshot.write(ld._scActiveRatio);
+		snapshot.write(ld._scBoostAlpha);
+		snapshot.write(ld._baseLineDecay);
+		snapshot.write(ld._baseLineSensitivity);
+		snapshot.write(ld._predWeightAlpha);
+		snapshot.write(ld._tickStride);
+
+		l._sc.writeToSnapshot(cs, snapshot);
+		l._pred.writeToSnapshot(cs, snapshot);
+
+		// Layer
+		snapshot.writeImage(cs, l._baseLines[_back]);
+		snapshot.writeImage(cs, l._reward);
+		snapshot.writeImage(cs, l._scHiddenStatesPrev);
+
+		if (li != 0 && ld._tickStride > 1)
+			snapshot.writeImage(cs, l._pooledInputs[_back]);
+	}
+
+	snapshot.write(_tick);
+}
+
+void PredictiveHierarchy::readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot, bool inferenceOnly) {
+	// Step the read state with the megakernel again if it was enabled
+	bool megakernel = _megakernel.isCreated();
+
+	// Layer information
+	cl_int numLayers;
+
+	snapshot.read(numLayers);
+
+	_layers.resize(numLayers);
+	_layerDescs.resize(numLayers);
+
+	for (int li = 0; li < _layers.size(); li++) {
+		Layer &l = _layers[li];
+		LayerDesc &ld = _layerDescs[li];
+
+		// Desc
+		snapshot.read(ld._size);
+		snapshot.read(ld._feedForwardRadius);
+		snapshot.read(ld._recurrentRadius);
+		snapshot.read(ld._lateralRadius);
+		snapshot.read(ld._feedBackRadius);
+		snapshot.read(ld._predictiveRadius);
+		snapshot.read(ld._scWeightAlpha);
+		snapshot.read(ld._scWeightRecurrentAlpha);
+		snapshot.read(ld._scWeightLambda);
+		snapshot.read(ld._scActiveRatio);
+		snapshot.read(ld._scBoostAlpha);
+		snapshot.read(ld._baseLineDecay);
+		snapshot.read(ld._baseLineSensitivity);
+		snapshot.read(ld._predWeightAlpha);
+		snapshot.read(ld._tickStride);
+
+		l._sc.readFromSnapshot(cs, program, snapshot, inferenceOnly);
+		l._pred.readFromSnapshot(cs, program, snapshot, inferenceOnly);
+
+		// Layer
+		l._baseLines = createDoubleBuffer2D(cs, ld._size, CL_R, CL_FLOAT);
+
+		l._reward = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), ld._size.x, ld._size.y);
+
+		l._scHiddenStatesPrev = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), ld._size.x, ld._size.y);
+
+		snapshot.readImage(cs, l._baseLines[_back]);
+		snapshot.readImage(cs, l._reward);
+		snapshot.readImage(cs, l._scHiddenStatesPrev);
+
+		createPooledInputs(cs, li);
+
+		if (li != 0 && ld._tickStride > 1)
+			snapshot.readImage(cs, l._pooledInputs[_back]);
+	}
+
+	snapshot.read(_tick);
+
+	createKernels(program);
+
+	if (megakernel)
+		setMegakernel(cs, program, true);
+}
+
+std::future<bool> PredictiveHierarchy::checkpoint(sys::ComputeSystem &cs, Checkpointer &checkpointer, const std::string &fileName, SnapshotChain* pChain) const {
+	std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>();
+
+	writeToSnapshot(cs, *snapshot);
+
+	return checkpointer.submit(cs, snapshot, fileName, pChain);
 }
\ No newline at end of file
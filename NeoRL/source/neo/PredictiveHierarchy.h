@@ -2,6 +2,10 @@
 
 #include "ComparisonSparseCoder.h"
 #include "Predictor.h"
+#include "Checkpointer.h"
+#include "SharedChannel.h"
+#include "LearningScheduler.h"
+#include "HierarchyMegakernel.h"
 
 namespace neo {
 	/*!
@@ -47,6 +51,12 @@ namespace neo {
 			*/
 			cl_float _predWeightAlpha;
 
+			/*!
+			\brief Tick stride, the layer only activates and learns every _tickStride steps, pooling its input in between
+			Should be a multiple of the stride of the layer below. The first layer always ticks
+			*/
+			cl_int _tickStride;
+
 			/*!
 			\brief Initialize defaults
 			*/
@@ -56,7 +66,8 @@ namespace neo {
 				_scWeightAlpha(0.0005f), _scWeightRecurrentAlpha(0.0002f), _scWeightLambda(0.95f),
 				_scActiveRatio(0.05f), _scBoostAlpha(0.01f),
 				_baseLineDecay(0.01f), _baseLineSensitivity(0.01f),
-				_predWeightAlpha(0.02f)
+				_predWeightAlpha(0.02f),
+				_tickStride(1)
 			{}
 		};
 
@@ -86,6 +97,18 @@ namespace neo {
 			\brief Previous hidden states
 			*/
 			cl::Image2D _scHiddenStatesPrev;
+
+			/*!
+			\brief Input pooled over the steps between ticks (strided layers only)
+			*/
+			DoubleBuffer2D _pooledInputs;
+		};
+
+		/*!
+		\brief Post-processing of predictions before they are fed back during a rollout
+		*/
+		enum RolloutMode {
+			_rolloutNone = 0, _rolloutOneHot = 1, _rolloutThreshold = 2
 		};
 
 	private:
@@ -103,9 +126,93 @@ namespace neo {
 		*/
 		cl::Kernel _baseLineUpdateKernel;
 		cl::Kernel _baseLineUpdateSumErrorKernel;
+		cl::Kernel _poolInputKernel;
+		cl::Kernel _countChangesKernel;
+		cl::Kernel _rolloutArgmaxKernel;
+		cl::Kernel _rolloutPostProcessKernel;
 		//!@}
 
+		//!@{
+		/*!
+		\brief Rollout buffers (created on first use, resized as needed, capacity in floats)
+		*/
+		cl::Image2D _rolloutInput;
+		cl::Buffer _rolloutMaxIndex;
+		cl::Buffer _rolloutTrajectory;
+		int _rolloutCapacity;
+		//!@}
+
+		/*!
+		\brief Number of steps simulated (for tick strides)
+		*/
+		cl_ulong _tick;
+
+		/*!
+		\brief Layers that ran on the last step, held layers kept their states
+		*/
+		std::vector<bool> _ranLastStep;
+
+		//!@{
+		/*!
+		\brief Change detection, per layer count of changed units
+		*/
+		bool _skipUnchanged;
+		std::vector<cl::Buffer> _changeCounts;
+		//!@}
+
+		/*!
+		\brief Adaptive learning schedule (not created when disabled)
+		*/
+		LearningScheduler _learningScheduler;
+
+		/*!
+		\brief Whole-step megakernel (not created when disabled)
+		*/
+		HierarchyMegakernel _megakernel;
+
+		/*!
+		\brief Whether the sparse code of a layer changed on the current step (blocking)
+		*/
+		bool hasChanged(sys::ComputeSystem &cs, int l);
+
+		/*!
+		\brief Whether a layer ticks on the current step
+		*/
+		bool ticks(int l) const {
+			return l == 0 || _tick % _layerDescs[l]._tickStride == 0;
+		}
+
+		/*!
+		\brief Create pooled input buffers for strided layers (same size as the layer below)
+		*/
+		void createPooledInputs(sys::ComputeSystem &cs, int l);
+
+		//!@{
+		/*!
+		\brief Device side state slots, and the step counter at the time of each save
+		*/
+		std::vector<StateSlot> _stateSlots;
+		std::vector<cl_ulong> _stateSlotTicks;
+		//!@}
+
+		/*!
+		\brief Copy weights recorded by slots before they are modified
+		*/
+		void materializeStateSlots(sys::ComputeSystem &cs);
+
+		/*!
+		\brief Create kernels from the program
+		*/
+		void createKernels(sys::ComputeProgram &program);
+
 	public:
+		/*!
+		\brief Initialize defaults
+		*/
+		PredictiveHierarchy()
+			: _rolloutCapacity(0), _tick(0), _skipUnchanged(false)
+		{}
+
 		/*!
 		\brief Create a comparison sparse coder with random initialization
 		Requires the compute system, program with the NeoRL kernels, and initialization information
@@ -120,6 +227,169 @@ namespace neo {
 		*/
 		void simStep(sys::ComputeSystem &cs, const cl::Image2D &input, bool learn = true);
 
+		/*!
+		\brief Simulation step of hierarchy through shared channels
+		Input is copied from the input channel, the first layer prediction is copied into the prediction channel (both non-blocking)
+		*/
+		void simStep(sys::ComputeSystem &cs, SharedChannel &input, SharedChannel &prediction, bool learn = true);
+
+		/*!
+		\brief Generate a sequence on device, without learning
+		Each step post-processes the current prediction, records it in the trajectory and feeds it back as the next input.
+		The trajectory (numSteps inputs of the input size, step-major) is read back once at the end
+		*/
+		void rollout(sys::ComputeSystem &cs, int numSteps, std::vector<cl_float> &trajectory, RolloutMode mode = _rolloutNone, float threshold = 0.5f);
+
+		/*!
+		\brief Set the number of device side state slots
+		*/
+		void createStateSlots(int numSlots) {
+			_stateSlots.clear();
+			_stateSlots.resize(numSlots);
+			_stateSlotTicks.assign(numSlots, 0);
+		}
+
+		/*!
+		\brief Save the recurrent state to a slot, entirely on device (non-blocking)
+		With weights, the weights are only copied if a later learning step (or a rewind) is about to modify them
+		*/
+		void saveState(sys::ComputeSystem &cs, int slotIndex, bool withWeights = false);
+
+		/*!
+		\brief Rewind to the state saved in a slot, entirely on device (non-blocking)
+		*/
+		void restoreState(sys::ComputeSystem &cs, int slotIndex);
+
+		/*!
+		\brief Enable change-driven layer skipping
+		When not learning, the sparse code of each layer is compared to its previous one after activation.
+		If it did not change, the layers above are held (not activated) for the step, as their inputs are the same.
+		The comparison is read back on the step (blocking), so only enable it when the held layers save more than the readbacks cost
+		*/
+		void setSkipUnchanged(bool skipUnchanged) {
+			assert(!skipUnchanged || !_megakernel.isCreated());
+
+			_skipUnchanged = skipUnchanged;
+		}
+
+		/*!
+		\brief Whether change-driven layer skipping is enabled
+		*/
+		bool getSkipUnchanged() const {
+			return _skipUnchanged;
+		}
+
+		/*!
+		\brief Enable the adaptive learning schedule
+		Layers whose prediction error plateaus learn less often, or pause, until their error rises again (see LearningScheduler)
+		*/
+		void setLearningSchedule(sys::ComputeSystem &cs, sys::ComputeProgram &program, const LearningScheduler::Params &params = LearningScheduler::Params()) {
+			// The megakernel does not schedule learning
+			assert(!_megakernel.isCreated());
+
+			_learningScheduler.create(cs, program, _layers.size(), params);
+		}
+
+		/*!
+		\brief Disable the adaptive learning schedule, all layers learn every step
+		*/
+		void clearLearningSchedule() {
+			_learningScheduler = LearningScheduler();
+		}
+
+		/*!
+		\brief Get the adaptive learning schedule
+		*/
+		const LearningScheduler &getLearningScheduler() const {
+			return _learningScheduler;
+		}
+
+		/*!
+		\brief Enable or disable stepping with the whole-step megakernel (see HierarchyMegakernel)
+		Enable after configuring the hierarchy, returns false (staying disabled) if it is not supported.
+		While enabled, the layers' images are only current after syncMegakernel (or disabling), except the first layer prediction.
+		State slots, clearing memory, writing and reading keep working, reading enables it again if still supported
+		*/
+		bool setMegakernel(sys::ComputeSystem &cs, sys::ComputeProgram &program, bool enabled);
+
+		/*!
+		\brief Whether steps run as the whole-step megakernel
+		*/
+		bool usesMegakernel() const {
+			return _megakernel.isCreated();
+		}
+
+		/*!
+		\brief Write the megakernel state back to the layers (non-blocking), call before accessing the layers' images directly
+		State slots, clearing memory, writing and metrics updates sync by themselves
+		*/
+		void syncMegakernel(sys::ComputeSystem &cs) const {
+			if (_megakernel.isCreated())
+				_megakernel.sync(cs);
+		}
+
+		/*!
+		\brief Set the number of steps the predictors accumulate before updating their weights (see Predictor::setLearnBatch)
+		*/
+		void setPredLearnBatch(sys::ComputeSystem &cs, int steps, bool averaged = false) {
+			// The megakernel learns every step
+			assert(steps <= 1 || !_megakernel.isCreated());
+
+			for (int l = 0; l < _layers.size(); l++)
+				_layers[l]._pred.setLearnBatch(cs, steps, averaged);
+		}
+
+		/*!
+		\brief Set the number of steps the sparse coders accumulate before updating their traced weights (see ComparisonSparseCoder::setLearnBatch)
+		*/
+		void setScLearnBatch(sys::ComputeSystem &cs, int steps) {
+			// The megakernel learns every step
+			assert(steps <= 1 || !_megakernel.isCreated());
+
+			for (int l = 0; l < _layers.size(); l++)
+				_layers[l]._sc.setLearnBatch(cs, steps);
+		}
+
+		/*!
+		\brief Apply the pending sparse coder and predictor updates of a partial batch (non-blocking), call before writing
+		*/
+		void flushLearn(sys::ComputeSystem &cs) {
+			for (int l = 0; l < _layers.size(); l++) {
+				_layers[l]._sc.flushLearn(cs);
+				_layers[l]._pred.flushLearn(cs);
+			}
+		}
+
+		/*!
+		\brief Enable or disable packed weights for all sparse coders and predictors (see Predictor::setPackedWeights)
+		*/
+		void setPackedWeights(sys::ComputeSystem &cs, bool enabled) {
+			// The megakernel keeps its own copy of the weights
+			assert(!enabled || !_megakernel.isCreated());
+
+			for (int l = 0; l < _layers.size(); l++) {
+				for (int vli = 0; vli < _layers[l]._sc.getNumVisibleLayers(); vli++)
+					_layers[l]._sc.setPackedWeights(cs, vli, enabled);
+
+				for (int vli = 0; vli < _layers[l]._pred.getNumVisibleLayers(); vli++)
+					_layers[l]._pred.setPackedWeights(cs, vli, enabled);
+			}
+		}
+
+		/*!
+		\brief Get number of steps simulated
+		*/
+		cl_ulong getTick() const {
+			return _tick;
+		}
+
+		/*!
+		\brief Get number of state slots
+		*/
+		size_t getNumStateSlots() const {
+			return _stateSlots.size();
+		}
+
 		/*!
 		\brief Clear working memory
 		*/
@@ -135,6 +405,25 @@ namespace neo {
 		*/
 		void readFromStream(sys::ComputeSystem &cs, sys::ComputeProgram &program, std::istream &is);
 
+		/*!
+		\brief Write to snapshot (non-blocking, the snapshot must be waited on before use)
+		*/
+		void writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const;
+
+		/*!
+		\brief Read from snapshot
+		With inferenceOnly, the layers may share their weights with a mapped snapshot and can not learn (see Predictor::readFromSnapshot)
+		*/
+		void readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot, bool inferenceOnly = false);
+
+		/*!
+		\brief Asynchronous checkpoint
+		Captures the current state (call between steps) and writes it to a file on the checkpointer's worker thread.
+		Blocks only if the checkpointer already has its maximum number of checkpoints in flight.
+		With a chain, only the tiles that changed since the last checkpoint are written (see SnapshotChain)
+		*/
+		std::future<bool> checkpoint(sys::ComputeSystem &cs, Checkpointer &checkpointer, const std::string &fileName, SnapshotChain* pChain = nullptr) const;
+
 		/*!
 		\brief Get number of layers
 		*/
@@ -149,6 +438,13 @@ namespace neo {
 			return _layers[index];
 		}
 
+		/*!
+		\brief Whether a layer ran on the last step (false if it was held by its tick stride or an unchanged layer below)
+		*/
+		bool ranLastStep(int index) const {
+			return index < _ranLastStep.size() && _ranLastStep[index];
+		}
+
 		/*!
 		\brief Get access to a layer desc
 		*/
@@ -1,5 +1,7 @@
 #include "Predictor.h"
 
+#include <algorithm>
+
 using namespace neo;
 
 void Predictor::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &program,
@@ -35,6 +37,8 @@ void Predictor::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &progra
 
 		vl._reverseRadii = cl_int2{ static_cast<int>(std::ceil(vl._visibleToHidden.x * vld._radius)), static_cast<int>(std::ceil(vl._visibleToHidden.y * vld._radius)) };
 
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._radius, vl._reverseRadii);
+
 		vl._errors = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
 
 		cs.getQueue().enqueueFillImage(vl._errors, zeroColor, zeroOrigin, { static_cast<cl::size_type>(vld._size.x), static_cast<cl::size_type>(vld._size.y), 1 });
@@ -61,15 +65,60 @@ void Predictor::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &progra
 	cs.getQueue().enqueueFillImage(_hiddenActivations[_back], zeroColor, zeroOrigin, hiddenRegion);
 
 	// Create kernels
+	createKernels(program);
+}
+
+void Predictor::createKernels(sys::ComputeProgram &program) {
 	_activateKernel = cl::Kernel(program.getProgram(), "predActivate");
 	_solveHiddenThresholdKernel = cl::Kernel(program.getProgram(), "predSolveHiddenThreshold");
 	_solveHiddenKernel = cl::Kernel(program.getProgram(), "predSolveHidden");
 	_errorPropagateKernel = cl::Kernel(program.getProgram(), "predErrorPropagate");
 	_learnWeightsKernel = cl::Kernel(program.getProgram(), "predLearnWeights");
 	_learnWeightsTracesKernel = cl::Kernel(program.getProgram(), "predLearnWeightsTraces");
+
+	_quantizeScalesKernel = cl::Kernel(program.getProgram(), "predQuantizeScales");
+	_quantizeWeightsKernel = cl::Kernel(program.getProgram(), "predQuantizeWeights");
+	_activateQuantizedKernel = cl::Kernel(program.getProgram(), "predActivateQuantized");
+	_solveHiddenQuantizedKernel = cl::Kernel(program.getProgram(), "predSolveHiddenQuantized");
+	_solveHiddenThresholdQuantizedKernel = cl::Kernel(program.getProgram(), "predSolveHiddenThresholdQuantized");
+
+	_prunedActivateKernel = cl::Kernel(program.getProgram(), "prunedActivate");
+	_prunedErrorPropagateKernel = cl::Kernel(program.getProgram(), "prunedErrorPropagate");
+
+	_mirrorWeightsKernel = cl::Kernel(program.getProgram(), "mirrorWeights");
+	_errorPropagateMirroredKernel = cl::Kernel(program.getProgram(), "predErrorPropagateMirrored");
+
+	_recordErrorKernel = cl::Kernel(program.getProgram(), "predRecordError");
+	_recordActiveKernel = cl::Kernel(program.getProgram(), "recordActive");
+	_learnWeightsBatchedKernel = cl::Kernel(program.getProgram(), "predLearnWeightsBatched");
+
+	_activatePropagateKernel = cl::Kernel(program.getProgram(), "predActivatePropagate");
+
+	_packWeightsKernel = cl::Kernel(program.getProgram(), "packWeights");
+	_activatePackedKernel = cl::Kernel(program.getProgram(), "predActivatePacked");
+
+	_quantized = false;
+	_pruned = false;
+	_inferenceOnly = false;
+
+	_batchErrors.release();
+	_learnBatch = 1;
+	_batchCount = 0;
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		_visibleLayers[vli]._weightsMirror = cl::Buffer();
+		_visibleLayers[vli]._weightsPacked = cl::Image3D();
+		_visibleLayers[vli]._batchStates.release();
+	}
 }
 
 void Predictor::activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold) {
+	if (_quantized) {
+		activateQuantized(cs, visibleStates, threshold);
+
+		return;
+	}
+
 	// Start by clearing summation buffer
 	{
 		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
@@ -84,17 +133,45 @@ void Predictor::activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D>
 		VisibleLayer &vl = _visibleLayers[vli];
 		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
 
-		int argIndex = 0;
+		if (_pruned) {
+			int argIndex = 0;
 
-		_activateKernel.setArg(argIndex++, visibleStates[vli]);
-		_activateKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
-		_activateKernel.setArg(argIndex++, _hiddenSummationTemp[_front]);
-		_activateKernel.setArg(argIndex++, vl._weights[_back]);
-		_activateKernel.setArg(argIndex++, vld._size);
-		_activateKernel.setArg(argIndex++, vl._hiddenToVisible);
-		_activateKernel.setArg(argIndex++, vld._radius);
+			_prunedActivateKernel.setArg(argIndex++, visibleStates[vli]);
+			_prunedActivateKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
+			_prunedActivateKernel.setArg(argIndex++, _hiddenSummationTemp[_front]);
+			vl._prunedWeights.setHiddenArgs(_prunedActivateKernel, argIndex);
+			_prunedActivateKernel.setArg(argIndex++, _hiddenSize);
+			_prunedActivateKernel.setArg(argIndex++, vl._hiddenToVisible);
+			_prunedActivateKernel.setArg(argIndex++, vld._radius);
 
-		cs.getQueue().enqueueNDRangeKernel(_activateKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+			cs.enqueueKernel(_prunedActivateKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		}
+		else if (vl._weightsPacked() != nullptr) {
+			int argIndex = 0;
+
+			_activatePackedKernel.setArg(argIndex++, visibleStates[vli]);
+			_activatePackedKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
+			_activatePackedKernel.setArg(argIndex++, _hiddenSummationTemp[_front]);
+			_activatePackedKernel.setArg(argIndex++, vl._weightsPacked);
+			_activatePackedKernel.setArg(argIndex++, vld._size);
+			vl._fieldTables.setHiddenArgs(_activatePackedKernel, argIndex);
+			_activatePackedKernel.setArg(argIndex++, vld._radius);
+
+			cs.enqueueKernel(_activatePackedKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		}
+		else {
+			int argIndex = 0;
+
+			_activateKernel.setArg(argIndex++, visibleStates[vli]);
+			_activateKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
+			_activateKernel.setArg(argIndex++, _hiddenSummationTemp[_front]);
+			_activateKernel.setArg(argIndex++, vl._weights[_back]);
+			_activateKernel.setArg(argIndex++, vld._size);
+			vl._fieldTables.setHiddenArgs(_activateKernel, argIndex);
+			_activateKernel.setArg(argIndex++, vld._radius);
+
+			cs.enqueueKernel(_activateKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		}
 
 		// Swap buffers
 		std::swap(_hiddenSummationTemp[_front], _hiddenSummationTemp[_back]);
@@ -109,7 +186,7 @@ void Predictor::activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D>
 		_solveHiddenThresholdKernel.setArg(argIndex++, _hiddenActivations[_back]);
 		_solveHiddenThresholdKernel.setArg(argIndex++, _hiddenActivations[_front]);
 
-		cs.getQueue().enqueueNDRangeKernel(_solveHiddenThresholdKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_solveHiddenThresholdKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 	}
 	else {
 		int argIndex = 0;
@@ -120,37 +197,405 @@ void Predictor::activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D>
 		_solveHiddenKernel.setArg(argIndex++, _hiddenActivations[_back]);
 		_solveHiddenKernel.setArg(argIndex++, _hiddenActivations[_front]);
 
-		cs.getQueue().enqueueNDRangeKernel(_solveHiddenKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_solveHiddenKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+	}
+
+	// Swap hidden state buffers
+	std::swap(_hiddenStates[_front], _hiddenStates[_back]);
+	std::swap(_hiddenActivations[_front], _hiddenActivations[_back]);
+}
+
+void Predictor::activateAndPropagate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold, const cl::Image2D &targets) {
+	bool fused = !_quantized && !_pruned && _visibleLayers.size() <= 2;
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++)
+		fused = fused && _visibleLayers[vli]._weightsMirror() == nullptr && _visibleLayers[vli]._weightsPacked() == nullptr;
+
+	if (!fused) {
+		activate(cs, visibleStates, threshold);
+		propagateError(cs, targets);
+
+		return;
+	}
+
+	cl_int2 range = _hiddenSize;
+
+	int argIndex = 0;
+
+	// Second layer slots repeat the first when there is only one
+	for (int li = 0; li < 2; li++) {
+		int vli = std::min<int>(li, _visibleLayers.size() - 1);
+
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		_activatePropagateKernel.setArg(argIndex++, visibleStates[vli]);
+		_activatePropagateKernel.setArg(argIndex++, vl._weights[_back]);
+		vl._fieldTables.setHiddenArgs(_activatePropagateKernel, argIndex);
+		vl._fieldTables.setVisibleArgs(_activatePropagateKernel, argIndex);
+		_activatePropagateKernel.setArg(argIndex++, vl._errors);
+		_activatePropagateKernel.setArg(argIndex++, vld._size);
+		_activatePropagateKernel.setArg(argIndex++, vld._radius);
+
+		range.x = std::max(range.x, vld._size.x);
+		range.y = std::max(range.y, vld._size.y);
 	}
 
+	_activatePropagateKernel.setArg(argIndex++, static_cast<cl_int>(_visibleLayers.size()));
+	_activatePropagateKernel.setArg(argIndex++, targets);
+	_activatePropagateKernel.setArg(argIndex++, _hiddenStates[_back]);
+	_activatePropagateKernel.setArg(argIndex++, _hiddenStates[_front]);
+	_activatePropagateKernel.setArg(argIndex++, _hiddenActivations[_front]);
+	_activatePropagateKernel.setArg(argIndex++, _hiddenSize);
+	_activatePropagateKernel.setArg(argIndex++, static_cast<cl_int>(threshold));
+
+	cs.enqueueKernel(_activatePropagateKernel, cl::NDRange(range.x, range.y));
+
 	// Swap hidden state buffers
 	std::swap(_hiddenStates[_front], _hiddenStates[_back]);
 	std::swap(_hiddenActivations[_front], _hiddenActivations[_back]);
 }
 
+void Predictor::activateQuantized(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold) {
+	// Start by clearing summation buffer
+	{
+		cl_int4 zeroColor = { 0, 0, 0, 0 };
+
+		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+		cl::array<cl::size_type, 3> hiddenRegion = { _hiddenSize.x, _hiddenSize.y, 1 };
+
+		cs.getQueue().enqueueFillImage(_quantizedSummationTemp[_back], zeroColor, zeroOrigin, hiddenRegion);
+	}
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int argIndex = 0;
+
+		_activateQuantizedKernel.setArg(argIndex++, visibleStates[vli]);
+		_activateQuantizedKernel.setArg(argIndex++, _quantizedSummationTemp[_back]);
+		_activateQuantizedKernel.setArg(argIndex++, _quantizedSummationTemp[_front]);
+		_activateQuantizedKernel.setArg(argIndex++, vl._weightsQuantized);
+		_activateQuantizedKernel.setArg(argIndex++, vld._size);
+		_activateQuantizedKernel.setArg(argIndex++, vl._hiddenToVisible);
+		_activateQuantizedKernel.setArg(argIndex++, vld._radius);
+
+		cs.enqueueKernel(_activateQuantizedKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+
+		// Swap buffers
+		std::swap(_quantizedSummationTemp[_front], _quantizedSummationTemp[_back]);
+	}
+
+	cl::Kernel &solveKernel = threshold ? _solveHiddenThresholdQuantizedKernel : _solveHiddenQuantizedKernel;
+
+	int argIndex = 0;
+
+	solveKernel.setArg(argIndex++, _quantizedSummationTemp[_back]);
+	solveKernel.setArg(argIndex++, _quantizedScales);
+	solveKernel.setArg(argIndex++, _hiddenStates[_front]);
+	solveKernel.setArg(argIndex++, _hiddenActivations[_front]);
+
+	cs.enqueueKernel(solveKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+
+	// Swap hidden state buffers
+	std::swap(_hiddenStates[_front], _hiddenStates[_back]);
+	std::swap(_hiddenActivations[_front], _hiddenActivations[_back]);
+}
+
+void Predictor::quantize(sys::ComputeSystem &cs) {
+	assert(hasFloatWeights());
+
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+	cl::array<cl::size_type, 3> hiddenRegion = { _hiddenSize.x, _hiddenSize.y, 1 };
+
+	// Largest absolute weight of each hidden unit over all visible layers
+	DoubleBuffer2D scales = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+
+	{
+		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+		cs.getQueue().enqueueFillImage(scales[_back], zeroColor, zeroOrigin, hiddenRegion);
+	}
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int weightDiam = vld._radius * 2 + 1;
+
+		int numWeights = weightDiam * weightDiam;
+
+		int argIndex = 0;
+
+		_quantizeScalesKernel.setArg(argIndex++, vl._weights[_back]);
+		_quantizeScalesKernel.setArg(argIndex++, scales[_back]);
+		_quantizeScalesKernel.setArg(argIndex++, scales[_front]);
+		_quantizeScalesKernel.setArg(argIndex++, numWeights);
+
+		cs.getQueue().enqueueNDRangeKernel(_quantizeScalesKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+
+		std::swap(scales[_front], scales[_back]);
+	}
+
+	_quantizedScales = scales[_back];
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int weightDiam = vld._radius * 2 + 1;
+
+		int numWeights = weightDiam * weightDiam;
+
+		vl._weightsQuantized = cl::Image3D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_SIGNED_INT8), _hiddenSize.x, _hiddenSize.y, numWeights);
+
+		int argIndex = 0;
+
+		_quantizeWeightsKernel.setArg(argIndex++, vl._weights[_back]);
+		_quantizeWeightsKernel.setArg(argIndex++, _quantizedScales);
+		_quantizeWeightsKernel.setArg(argIndex++, vl._weightsQuantized);
+
+		cs.getQueue().enqueueNDRangeKernel(_quantizeWeightsKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y, numWeights));
+	}
+
+	_quantizedSummationTemp = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_SIGNED_INT32);
+
+	_quantized = true;
+	_pruned = false;
+}
+
+float Predictor::prune(sys::ComputeSystem &cs, float threshold, int topK) {
+	assert(hasFloatWeights());
+
+	int numRetained = 0;
+	int numConnections = 0;
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		vl._prunedWeights.create(cs, vl._weights[_back], _hiddenSize, vld._size, vl._hiddenToVisible, vld._radius, threshold, topK, false);
+
+		numRetained += vl._prunedWeights.getNumRetained();
+		numConnections += vl._prunedWeights.getNumConnections();
+	}
+
+	_pruned = true;
+	_quantized = false;
+
+	return numConnections > 0 ? static_cast<float>(numRetained) / static_cast<float>(numConnections) : 1.0f;
+}
+
+QuantizationReport Predictor::compareQuantized(sys::ComputeSystem &cs, const std::vector<std::vector<cl::Image2D>> &sequence, bool threshold) {
+	assert(_quantized && hasFloatWeights());
+
+	QuantizationReport report;
+
+	std::vector<cl_float> reference(_hiddenSize.x * _hiddenSize.y);
+	std::vector<cl_float> quantized(_hiddenSize.x * _hiddenSize.y);
+
+	for (int t = 0; t < sequence.size(); t++) {
+		_quantized = false;
+
+		activate(cs, sequence[t], threshold);
+
+		cs.getQueue().enqueueReadImage(_hiddenStates[_back], CL_FALSE, { 0, 0, 0 }, { static_cast<cl::size_type>(_hiddenSize.x), static_cast<cl::size_type>(_hiddenSize.y), 1 }, 0, 0, reference.data());
+
+		_quantized = true;
+
+		activate(cs, sequence[t], threshold);
+
+		cs.getQueue().enqueueReadImage(_hiddenStates[_back], CL_TRUE, { 0, 0, 0 }, { static_cast<cl::size_type>(_hiddenSize.x), static_cast<cl::size_type>(_hiddenSize.y), 1 }, 0, 0, quantized.data());
+
+		report.add(reference, quantized);
+	}
+
+	return report;
+}
+
+void Predictor::releaseFloatWeights() {
+	assert(_quantized || _pruned);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		_visibleLayers[vli]._weights[_front] = cl::Image3D();
+		_visibleLayers[vli]._weights[_back] = cl::Image3D();
+		_visibleLayers[vli]._weightsMirror = cl::Buffer();
+		_visibleLayers[vli]._weightsPacked = cl::Image3D();
+		_visibleLayers[vli]._batchStates.release();
+	}
+
+	_batchErrors.release();
+	_learnBatch = 1;
+	_batchCount = 0;
+}
+
 void Predictor::propagateError(sys::ComputeSystem &cs, const cl::Image2D &targets) {
+	assert(_pruned || hasFloatWeights());
+
 	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
 		VisibleLayer &vl = _visibleLayers[vli];
 		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
 
+		if (_pruned) {
+			int argIndex = 0;
+
+			_prunedErrorPropagateKernel.setArg(argIndex++, targets);
+			_prunedErrorPropagateKernel.setArg(argIndex++, _hiddenStates[_front]);
+			_prunedErrorPropagateKernel.setArg(argIndex++, vl._errors);
+			vl._prunedWeights.setVisibleArgs(_prunedErrorPropagateKernel, argIndex);
+			_prunedErrorPropagateKernel.setArg(argIndex++, vld._size);
+			_prunedErrorPropagateKernel.setArg(argIndex++, _hiddenSize);
+
+			cs.enqueueKernel(_prunedErrorPropagateKernel, cl::NDRange(vld._size.x, vld._size.y));
+
+			continue;
+		}
+
+		if (vl._weightsMirror() != nullptr) {
+			int argIndex = 0;
+
+			_errorPropagateMirroredKernel.setArg(argIndex++, targets);
+			_errorPropagateMirroredKernel.setArg(argIndex++, _hiddenStates[_front]);
+			_errorPropagateMirroredKernel.setArg(argIndex++, vl._errors);
+			_errorPropagateMirroredKernel.setArg(argIndex++, vl._weightsMirror);
+			_errorPropagateMirroredKernel.setArg(argIndex++, vld._size);
+			_errorPropagateMirroredKernel.setArg(argIndex++, _hiddenSize);
+			_errorPropagateMirroredKernel.setArg(argIndex++, vl._visibleToHidden);
+			_errorPropagateMirroredKernel.setArg(argIndex++, vl._reverseRadii);
+
+			cs.enqueueKernel(_errorPropagateMirroredKernel, cl::NDRange(vld._size.x, vld._size.y));
+
+			continue;
+		}
+
 		int argIndex = 0;
 
 		_errorPropagateKernel.setArg(argIndex++, targets);
 		_errorPropagateKernel.setArg(argIndex++, _hiddenStates[_front]);
 		_errorPropagateKernel.setArg(argIndex++, vl._errors);
 		_errorPropagateKernel.setArg(argIndex++, vl._weights[_back]);
+		vl._fieldTables.setVisibleArgs(_errorPropagateKernel, argIndex);
 		_errorPropagateKernel.setArg(argIndex++, vld._size);
-		_errorPropagateKernel.setArg(argIndex++, _hiddenSize);
-		_errorPropagateKernel.setArg(argIndex++, vl._visibleToHidden);
-		_errorPropagateKernel.setArg(argIndex++, vl._hiddenToVisible);
-		_errorPropagateKernel.setArg(argIndex++, vld._radius);
-		_errorPropagateKernel.setArg(argIndex++, vl._reverseRadii);
 
-		cs.getQueue().enqueueNDRangeKernel(_errorPropagateKernel, cl::NullRange, cl::NDRange(vld._size.x, vld._size.y));
+		cs.enqueueKernel(_errorPropagateKernel, cl::NDRange(vld._size.x, vld._size.y));
+	}
+}
+
+void Predictor::setWeightMirror(sys::ComputeSystem &cs, int vli, bool enabled) {
+	VisibleLayer &vl = _visibleLayers[vli];
+
+	if (!enabled) {
+		vl._weightsMirror = cl::Buffer();
+
+		return;
+	}
+
+	assert(hasFloatWeights());
+
+	if (vl._weightsMirror() == nullptr) {
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int numSlots = (vl._reverseRadii.x * 2 + 1) * (vl._reverseRadii.y * 2 + 1);
+
+		vl._weightsMirror = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, vld._size.x * vld._size.y * numSlots * sizeof(cl_float));
 	}
+
+	rebuildWeightMirror(cs, vli);
+}
+
+void Predictor::rebuildWeightMirror(sys::ComputeSystem &cs, int vli) {
+	VisibleLayer &vl = _visibleLayers[vli];
+	VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+	int argIndex = 0;
+
+	_mirrorWeightsKernel.setArg(argIndex++, vl._weights[_back]);
+	_mirrorWeightsKernel.setArg(argIndex++, vl._weightsMirror);
+	_mirrorWeightsKernel.setArg(argIndex++, vld._size);
+	_mirrorWeightsKernel.setArg(argIndex++, _hiddenSize);
+	_mirrorWeightsKernel.setArg(argIndex++, vl._visibleToHidden);
+	_mirrorWeightsKernel.setArg(argIndex++, vl._hiddenToVisible);
+	_mirrorWeightsKernel.setArg(argIndex++, vld._radius);
+	_mirrorWeightsKernel.setArg(argIndex++, vl._reverseRadii);
+
+	cs.getQueue().enqueueNDRangeKernel(_mirrorWeightsKernel, cl::NullRange, cl::NDRange(vld._size.x, vld._size.y));
+}
+
+void Predictor::setPackedWeights(sys::ComputeSystem &cs, int vli, bool enabled) {
+	VisibleLayer &vl = _visibleLayers[vli];
+
+	if (!enabled) {
+		vl._weightsPacked = cl::Image3D();
+
+		return;
+	}
+
+	assert(hasFloatWeights());
+
+	if (vl._weightsPacked() == nullptr) {
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int weightDiam = vld._radius * 2 + 1;
+
+		int numTexels = (weightDiam * weightDiam + 3) / 4;
+
+		vl._weightsPacked = cl::Image3D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), _hiddenSize.x, _hiddenSize.y, numTexels);
+	}
+
+	repackWeights(cs, vli);
+}
+
+void Predictor::repackWeights(sys::ComputeSystem &cs, int vli) {
+	VisibleLayer &vl = _visibleLayers[vli];
+	VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+	int weightDiam = vld._radius * 2 + 1;
+
+	int numWeights = weightDiam * weightDiam;
+
+	int argIndex = 0;
+
+	_packWeightsKernel.setArg(argIndex++, vl._weights[_back]);
+	_packWeightsKernel.setArg(argIndex++, vl._weightsPacked);
+	_packWeightsKernel.setArg(argIndex++, numWeights);
+
+	cs.getQueue().enqueueNDRangeKernel(_packWeightsKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y, (numWeights + 3) / 4));
 }
 
 void Predictor::learn(sys::ComputeSystem &cs, const cl::Image2D &targets, std::vector<cl::Image2D> &visibleStatesPrev, float weightAlpha) {
+	assert(hasFloatWeights());
+	assert(!_inferenceOnly);
+
+	// Quantized and pruned weights would be stale
+	_quantized = false;
+	_pruned = false;
+
+	if (_learnBatch > 1) {
+		// Record the active units of the step, the weights are updated once the batch is full
+		{
+			int argIndex = 0;
+
+			_recordErrorKernel.setArg(argIndex++, targets);
+			_recordErrorKernel.setArg(argIndex++, _hiddenStates[_front]);
+			_batchErrors.setArgs(_recordErrorKernel, argIndex);
+			_recordErrorKernel.setArg(argIndex++, _batchAveraged ? weightAlpha / _learnBatch : weightAlpha);
+			_recordErrorKernel.setArg(argIndex++, static_cast<cl_int>(_batchCount));
+
+			cs.enqueueKernel(_recordErrorKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		}
+
+		for (int vli = 0; vli < _visibleLayers.size(); vli++)
+			_visibleLayers[vli]._batchStates.record(cs, _recordActiveKernel, visibleStatesPrev[vli], _visibleLayerDescs[vli]._size, _batchCount);
+
+		_batchCount++;
+
+		if (_batchCount >= _learnBatch)
+			flushLearn(cs);
+
+		return;
+	}
+
 	// Learn weights
 	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
 		VisibleLayer &vl = _visibleLayers[vli];
@@ -164,17 +609,84 @@ void Predictor::learn(sys::ComputeSystem &cs, const cl::Image2D &targets, std::v
 		_learnWeightsKernel.setArg(argIndex++, vl._weights[_back]);
 		_learnWeightsKernel.setArg(argIndex++, vl._weights[_front]);
 		_learnWeightsKernel.setArg(argIndex++, vld._size);
-		_learnWeightsKernel.setArg(argIndex++, vl._hiddenToVisible);
+		vl._fieldTables.setHiddenArgs(_learnWeightsKernel, argIndex);
 		_learnWeightsKernel.setArg(argIndex++, vld._radius);
 		_learnWeightsKernel.setArg(argIndex++, weightAlpha);
+		_learnWeightsKernel.setArg(argIndex++, vl._weightsMirror);
+		_learnWeightsKernel.setArg(argIndex++, vl._visibleToHidden);
+		_learnWeightsKernel.setArg(argIndex++, vl._reverseRadii);
 
-		cs.getQueue().enqueueNDRangeKernel(_learnWeightsKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_learnWeightsKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		std::swap(vl._weights[_front], vl._weights[_back]);
+
+		if (vl._weightsPacked() != nullptr)
+			repackWeights(cs, vli);
+	}
+}
+
+void Predictor::setLearnBatch(sys::ComputeSystem &cs, int steps, bool averaged) {
+	assert(steps >= 1);
+	assert(!_inferenceOnly);
+
+	flushLearn(cs);
+
+	_learnBatch = steps;
+	_batchAveraged = averaged;
+
+	if (_learnBatch <= 1) {
+		_batchErrors.release();
+
+		for (int vli = 0; vli < _visibleLayers.size(); vli++)
+			_visibleLayers[vli]._batchStates.release();
+
+		return;
+	}
+
+	_batchErrors.create(cs, _hiddenSize.x * _hiddenSize.y, _learnBatch);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		_visibleLayers[vli]._batchStates.create(cs, vld._size.x * vld._size.y, _learnBatch);
+	}
+}
+
+void Predictor::flushLearn(sys::ComputeSystem &cs) {
+	if (_batchCount == 0)
+		return;
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int argIndex = 0;
+
+		vl._batchStates.setArgs(_learnWeightsBatchedKernel, argIndex);
+		_batchErrors.setArgs(_learnWeightsBatchedKernel, argIndex);
+		_learnWeightsBatchedKernel.setArg(argIndex++, vl._weights[_back]);
+		_learnWeightsBatchedKernel.setArg(argIndex++, vl._weights[_front]);
+		_learnWeightsBatchedKernel.setArg(argIndex++, vld._size);
+		vl._fieldTables.setHiddenArgs(_learnWeightsBatchedKernel, argIndex);
+		_learnWeightsBatchedKernel.setArg(argIndex++, vld._radius);
+		_learnWeightsBatchedKernel.setArg(argIndex++, vl._weightsMirror);
+		_learnWeightsBatchedKernel.setArg(argIndex++, vl._visibleToHidden);
+		_learnWeightsBatchedKernel.setArg(argIndex++, vl._reverseRadii);
+
+		cs.enqueueKernel(_learnWeightsBatchedKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+
+		std::swap(vl._weights[_front], vl._weights[_back]);
+
+		if (vl._weightsPacked() != nullptr)
+			repackWeights(cs, vli);
 	}
+
+	_batchCount = 0;
 }
 
 void Predictor::writeToStream(sys::ComputeSystem &cs, std::ostream &os) const {
+	assert(hasFloatWeights());
+
 	os << _hiddenSize.x << " " << _hiddenSize.y << std::endl;
 
 	{
@@ -298,13 +810,131 @@ void Predictor::readFromStream(sys::ComputeSystem &cs, sys::ComputeProgram &prog
 		}
 
 		is >> vl._hiddenToVisible.x >> vl._hiddenToVisible.y >> vl._visibleToHidden.x >> vl._visibleToHidden.y >> vl._reverseRadii.x >> vl._reverseRadii.y;
+
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._radius, vl._reverseRadii);
 	}
 
 	// Create kernels
-	_activateKernel = cl::Kernel(program.getProgram(), "predActivate");
-	_solveHiddenThresholdKernel = cl::Kernel(program.getProgram(), "predSolveHiddenThreshold");
-	_solveHiddenKernel = cl::Kernel(program.getProgram(), "predSolveHidden");
-	_errorPropagateKernel = cl::Kernel(program.getProgram(), "predErrorPropagate");
-	_learnWeightsKernel = cl::Kernel(program.getProgram(), "predLearnWeights");
-	_learnWeightsTracesKernel = cl::Kernel(program.getProgram(), "predLearnWeightsTraces");
+	createKernels(program);
+}
+
+void Predictor::writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const {
+	assert(hasFloatWeights());
+
+	snapshot.write(_hiddenSize);
+
+	snapshot.writeImage(cs, _hiddenStates[_back]);
+	snapshot.writeImage(cs, _hiddenActivations[_back]);
+
+	// Layer information
+	snapshot.write(static_cast<cl_int>(_visibleLayers.size()));
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		const VisibleLayer &vl = _visibleLayers[vli];
+		const VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		// Desc
+		snapshot.write(vld._size);
+		snapshot.write(vld._radius);
+
+		// Layer
+		snapshot.writeImage(cs, vl._errors);
+		snapshot.writeImage(cs, vl._weights[_back]);
+
+		snapshot.write(vl._hiddenToVisible);
+		snapshot.write(vl._visibleToHidden);
+		snapshot.write(vl._reverseRadii);
+	}
+}
+
+void Predictor::readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot, bool inferenceOnly) {
+	snapshot.read(_hiddenSize);
+
+	_hiddenStates = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+
+	_hiddenActivations = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+
+	_hiddenSummationTemp = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+
+	snapshot.readImage(cs, _hiddenStates[_back]);
+	snapshot.readImage(cs, _hiddenActivations[_back]);
+
+	// Layer information
+	cl_int numLayers;
+
+	snapshot.read(numLayers);
+
+	_visibleLayerDescs.resize(numLayers);
+	_visibleLayers.resize(numLayers);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		// Desc
+		snapshot.read(vld._size);
+		snapshot.read(vld._radius);
+
+		// Layer
+		vl._errors = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
+
+		int weightDiam = vld._radius * 2 + 1;
+
+		int numWeights = weightDiam * weightDiam;
+
+		cl_int3 weightsSize = cl_int3{ _hiddenSize.x, _hiddenSize.y, numWeights };
+
+		vl._weights = createDoubleBuffer3D(cs, weightsSize, CL_R, CL_FLOAT);
+
+		snapshot.readImage(cs, vl._errors);
+		snapshot.readImage(cs, vl._weights[_back], inferenceOnly);
+
+		snapshot.read(vl._hiddenToVisible);
+		snapshot.read(vl._visibleToHidden);
+		snapshot.read(vl._reverseRadii);
+
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._radius, vl._reverseRadii);
+	}
+
+	// Create kernels
+	createKernels(program);
+
+	_inferenceOnly = inferenceOnly;
+}
+
+void Predictor::writeToStateSlot(sys::ComputeSystem &cs, StateSlot &slot) const {
+	slot.writeState(cs, _hiddenStates[_back]);
+	slot.writeState(cs, _hiddenStates[_front]);
+	slot.writeState(cs, _hiddenActivations[_back]);
+	slot.writeState(cs, _hiddenActivations[_front]);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		slot.writeState(cs, _visibleLayers[vli]._errors);
+		slot.writeWeights(_visibleLayers[vli]._weights[_back]);
+	}
+}
+
+void Predictor::readFromStateSlot(sys::ComputeSystem &cs, StateSlot &slot) {
+	// Weights read for inference may be read-only
+	assert(!_inferenceOnly || !slot.hasWeights());
+
+	slot.readState(cs, _hiddenStates[_back]);
+	slot.readState(cs, _hiddenStates[_front]);
+	slot.readState(cs, _hiddenActivations[_back]);
+	slot.readState(cs, _hiddenActivations[_front]);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		slot.readState(cs, _visibleLayers[vli]._errors);
+		slot.readWeights(cs, _visibleLayers[vli]._weights[_back]);
+
+		if (slot.hasWeights() && _visibleLayers[vli]._weightsMirror() != nullptr)
+			rebuildWeightMirror(cs, vli);
+
+		if (slot.hasWeights() && _visibleLayers[vli]._weightsPacked() != nullptr)
+			repackWeights(cs, vli);
+	}
+
+	// Pending updates belong to the weights that were replaced
+	if (slot.hasWeights())
+		_batchCount = 0;
 }
\ No newline at end of file
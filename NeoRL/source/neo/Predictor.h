@@ -1,6 +1,11 @@
 #pragma once
 
-#include "Helpers.h"
+#include "Snapshot.h"
+#include "StateSlot.h"
+#include "Quantization.h"
+#include "PrunedWeights.h"
+#include "FieldTables.h"
+#include "LearnRecords.h"
 
 namespace neo {
 	/*!
@@ -45,6 +50,36 @@ namespace neo {
 			*/
 			DoubleBuffer3D _weights;
 
+			/*!
+			\brief Quantized weights (int8, scaled per hidden unit)
+			*/
+			cl::Image3D _weightsQuantized;
+
+			/*!
+			\brief Retained weights after pruning
+			*/
+			PrunedWeights _prunedWeights;
+
+			/*!
+			\brief Precomputed receptive field connectivity
+			*/
+			FieldTables _fieldTables;
+
+			/*!
+			\brief Visible-major copy of the weights for error propagation (empty when disabled)
+			*/
+			cl::Buffer _weightsMirror;
+
+			/*!
+			\brief Weights packed four per RGBA texel for activation (empty when disabled)
+			*/
+			cl::Image3D _weightsPacked;
+
+			/*!
+			\brief Nonzero visible states of the steps recorded for batched learning (not created when not batching)
+			*/
+			LearnRecords _batchStates;
+
 			//!@{
 			/*!
 			\brief Transformations
@@ -98,7 +133,112 @@ namespace neo {
 		cl::Kernel _learnWeightsTracesKernel;
 		//!@}
 
+		//!@{
+		/*!
+		\brief Quantized inference (scales are the largest absolute weight of each hidden unit)
+		*/
+		cl::Image2D _quantizedScales;
+		DoubleBuffer2D _quantizedSummationTemp;
+		bool _quantized;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Quantization kernels
+		*/
+		cl::Kernel _quantizeScalesKernel;
+		cl::Kernel _quantizeWeightsKernel;
+		cl::Kernel _activateQuantizedKernel;
+		cl::Kernel _solveHiddenQuantizedKernel;
+		cl::Kernel _solveHiddenThresholdQuantizedKernel;
+		//!@}
+
+		/*!
+		\brief Whether activation and error propagation use the pruned weights
+		*/
+		bool _pruned;
+
+		/*!
+		\brief Whether the weights were read for inference only (possibly shared with a mapped snapshot, never written)
+		*/
+		bool _inferenceOnly;
+
+		//!@{
+		/*!
+		\brief Pruned weight kernels
+		*/
+		cl::Kernel _prunedActivateKernel;
+		cl::Kernel _prunedErrorPropagateKernel;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Weight mirror kernels
+		*/
+		cl::Kernel _mirrorWeightsKernel;
+		cl::Kernel _errorPropagateMirroredKernel;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Packed weight kernels
+		*/
+		cl::Kernel _packWeightsKernel;
+		cl::Kernel _activatePackedKernel;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Batched learning (nonzero scaled errors of the recorded steps)
+		*/
+		LearnRecords _batchErrors;
+		int _learnBatch;
+		int _batchCount;
+		bool _batchAveraged;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Batched learning kernels
+		*/
+		cl::Kernel _recordErrorKernel;
+		cl::Kernel _recordActiveKernel;
+		cl::Kernel _learnWeightsBatchedKernel;
+		//!@}
+
+		/*!
+		\brief Fused activation and error propagation kernel
+		*/
+		cl::Kernel _activatePropagateKernel;
+
+		/*!
+		\brief Create kernels from the program
+		*/
+		void createKernels(sys::ComputeProgram &program);
+
+		/*!
+		\brief Activate from the quantized weights
+		*/
+		void activateQuantized(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold);
+
+		/*!
+		\brief Rebuild the weight mirror of a visible layer from its weights
+		*/
+		void rebuildWeightMirror(sys::ComputeSystem &cs, int vli);
+
+		/*!
+		\brief Repack the packed weights of a visible layer from its weights
+		*/
+		void repackWeights(sys::ComputeSystem &cs, int vli);
+
 	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		Predictor()
+			: _quantized(false), _pruned(false), _inferenceOnly(false), _learnBatch(1), _batchCount(0), _batchAveraged(false)
+		{}
+
 		/*!
 		\brief Create a comparison sparse coder with random initialization
 		Requires the compute system, program with the NeoRL kernels, and initialization information
@@ -109,9 +249,91 @@ namespace neo {
 
 		/*!
 		\brief Activate predictor
+		Uses the quantized or pruned weights once quantized or pruned
 		*/
 		void activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold);
 
+		/*!
+		\brief Activate predictor and propagate prediction errors of the previous step, as activate followed by propagateError
+		Runs as a single launch for up to two visible layers with float weights and no weight mirrors, otherwise falls back to the separate calls
+		*/
+		void activateAndPropagate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold, const cl::Image2D &targets);
+
+		/*!
+		\brief Quantize the weights to int8 for inference (non-blocking)
+		Visible states are then treated as binary (> 0.5). Learning drops the quantization, call again after learning
+		*/
+		void quantize(sys::ComputeSystem &cs);
+
+		/*!
+		\brief Prune the weights for inference (blocking), returns the fraction of connections retained
+		Keeps weights with a magnitude of at least threshold, and of those only the topK largest per unit if topK > 0.
+		Replaces quantization. Learning drops the pruning, call again after learning
+		*/
+		float prune(sys::ComputeSystem &cs, float threshold, int topK = 0);
+
+		/*!
+		\brief Compare quantized against float predictions over a held-out sequence of visible states
+		Requires the float weights, leaves the quantized predictions of the last step as the hidden states
+		*/
+		QuantizationReport compareQuantized(sys::ComputeSystem &cs, const std::vector<std::vector<cl::Image2D>> &sequence, bool threshold);
+
+		/*!
+		\brief Release the float weights of a quantized or pruned predictor, for inference only
+		Learning and writing the predictor are no longer possible, nor error propagation unless pruned
+		*/
+		void releaseFloatWeights();
+
+		/*!
+		\brief Whether activation uses the quantized weights
+		*/
+		bool isQuantized() const {
+			return _quantized;
+		}
+
+		/*!
+		\brief Whether activation and error propagation use the pruned weights
+		*/
+		bool isPruned() const {
+			return _pruned;
+		}
+
+		/*!
+		\brief Enable or disable the weight mirror of a visible layer (non-blocking)
+		Error propagation then reads the weights of each visible unit contiguously, learning keeps the mirror up to date.
+		Not part of snapshots or streams, enable again after reading
+		*/
+		void setWeightMirror(sys::ComputeSystem &cs, int vli, bool enabled);
+
+		/*!
+		\brief Whether a visible layer has a weight mirror
+		*/
+		bool hasWeightMirror(int vli) const {
+			return _visibleLayers[vli]._weightsMirror() != nullptr;
+		}
+
+		/*!
+		\brief Enable or disable packed weights for a visible layer (non-blocking)
+		Activation then fetches four weights per texel, learning repacks after each weight update,
+		so this pays off when activations outnumber updates (inference, batched or scheduled learning).
+		Not part of snapshots or streams, enable again after reading
+		*/
+		void setPackedWeights(sys::ComputeSystem &cs, int vli, bool enabled);
+
+		/*!
+		\brief Whether a visible layer has packed weights
+		*/
+		bool hasPackedWeights(int vli) const {
+			return _visibleLayers[vli]._weightsPacked() != nullptr;
+		}
+
+		/*!
+		\brief Whether the float weights are held (see releaseFloatWeights)
+		*/
+		bool hasFloatWeights() const {
+			return _visibleLayers.empty() || _visibleLayers.front()._weights[_back]() != nullptr;
+		}
+
 		/*!
 		\brief Propagate prediction errors back to inputs based on targets
 		*/
@@ -125,6 +347,26 @@ namespace neo {
 		void learn(sys::ComputeSystem &cs, const cl::Image2D &targets, std::vector<cl::Image2D> &visibleStatesPrev, float weightAlpha);
 		//!@}
 
+		/*!
+		\brief Set the number of steps learn accumulates before updating the weights in one pass (1 updates every step)
+		Each step only records the hidden units with a nonzero error and the nonzero visible states, the weights are swept once per batch.
+		The updates of a batch are summed, or averaged if averaged is set. Applies pending updates first.
+		Pending updates are not part of snapshots, streams or state slots, call flushLearn before writing
+		*/
+		void setLearnBatch(sys::ComputeSystem &cs, int steps, bool averaged = false);
+
+		/*!
+		\brief Get the number of steps per learning batch
+		*/
+		int getLearnBatch() const {
+			return _learnBatch;
+		}
+
+		/*!
+		\brief Apply the pending updates of a partial batch (non-blocking)
+		*/
+		void flushLearn(sys::ComputeSystem &cs);
+
 		/*!
 		\brief Write to stream
 		*/
@@ -135,6 +377,34 @@ namespace neo {
 		*/
 		void readFromStream(sys::ComputeSystem &cs, sys::ComputeProgram &program, std::istream &is);
 
+		/*!
+		\brief Write to snapshot (non-blocking)
+		*/
+		void writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const;
+
+		/*!
+		\brief Read from snapshot
+		With inferenceOnly, the weights may be created over the data of a mapped snapshot (see Snapshot::readImage), the model then can not learn
+		*/
+		void readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot, bool inferenceOnly = false);
+
+		/*!
+		\brief Whether the model was read for inference only
+		*/
+		bool isInferenceOnly() const {
+			return _inferenceOnly;
+		}
+
+		/*!
+		\brief Save state (and optionally weights) to a device side slot (non-blocking)
+		*/
+		void writeToStateSlot(sys::ComputeSystem &cs, StateSlot &slot) const;
+
+		/*!
+		\brief Restore state (and optionally weights) from a device side slot (non-blocking)
+		*/
+		void readFromStateSlot(sys::ComputeSystem &cs, StateSlot &slot);
+
 		/*!
 		\brief Get number of visible layers
 		*/
@@ -169,5 +439,12 @@ namespace neo {
 		const DoubleBuffer2D &getHiddenStates() const {
 			return _hiddenStates;
 		}
+
+		/*!
+		\brief Get hidden activations
+		*/
+		const DoubleBuffer2D &getHiddenActivations() const {
+			return _hiddenActivations;
+		}
 	};
 }
\ No newline at end of file
@@ -30,6 +30,8 @@ void PredictorSwarm::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &p
 
 		vl._reverseRadii = cl_int2{ static_cast<int>(std::ceil(vl._visibleToHidden.x * vld._radius)), static_cast<int>(std::ceil(vl._visibleToHidden.y * vld._radius)) };
 
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._radius, vl._reverseRadii);
+
 		vl._errors = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
 
 		int weightDiam = vld._radius * 2 + 1;
@@ -58,15 +60,31 @@ void PredictorSwarm::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &p
 	cs.getQueue().enqueueFillImage(_hiddenStates[_back], zeroColor, zeroOrigin, hiddenRegion);
 	cs.getQueue().enqueueFillImage(_hiddenActivations[_back], zeroColor, zeroOrigin, hiddenRegion);
 
+	_random.create(cs, program, rng);
+
 	// Create kernels
+	createKernels(program);
+}
+
+void PredictorSwarm::createKernels(sys::ComputeProgram &program) {
 	_activateKernel = cl::Kernel(program.getProgram(), "predActivateSwarm");
 	_solveHiddenThresholdKernel = cl::Kernel(program.getProgram(), "predSolveHiddenThresholdSwarm");
 	_solveHiddenKernel = cl::Kernel(program.getProgram(), "predSolveHiddenSwarm");
 	_learnWeightsTracesKernel = cl::Kernel(program.getProgram(), "predLearnWeightsTracesSwarm");
 	_errorPropagateKernel = cl::Kernel(program.getProgram(), "predErrorPropagateSwarm");
+
+	_quantizeScalesKernel = cl::Kernel(program.getProgram(), "predQuantizeScalesSwarm");
+	_quantizeWeightsKernel = cl::Kernel(program.getProgram(), "predQuantizeWeightsSwarm");
+	_activateQuantizedKernel = cl::Kernel(program.getProgram(), "predActivateQuantizedSwarm");
+	_solveHiddenQuantizedKernel = cl::Kernel(program.getProgram(), "predSolveHiddenQuantizedSwarm");
+	_solveHiddenThresholdQuantizedKernel = cl::Kernel(program.getProgram(), "predSolveHiddenThresholdQuantizedSwarm");
+
+	_quantized = false;
 }
 
 void PredictorSwarm::propagateError(sys::ComputeSystem &cs, const cl::Image2D &targets) {
+	assert(hasFloatWeights());
+
 	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
 		VisibleLayer &vl = _visibleLayers[vli];
 		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
@@ -77,18 +95,20 @@ void PredictorSwarm::propagateError(sys::ComputeSystem &cs, const cl::Image2D &t
 		_errorPropagateKernel.setArg(argIndex++, _hiddenStates[_front]);
 		_errorPropagateKernel.setArg(argIndex++, vl._errors);
 		_errorPropagateKernel.setArg(argIndex++, vl._weights[_back]);
+		vl._fieldTables.setVisibleArgs(_errorPropagateKernel, argIndex);
 		_errorPropagateKernel.setArg(argIndex++, vld._size);
-		_errorPropagateKernel.setArg(argIndex++, _hiddenSize);
-		_errorPropagateKernel.setArg(argIndex++, vl._visibleToHidden);
-		_errorPropagateKernel.setArg(argIndex++, vl._hiddenToVisible);
-		_errorPropagateKernel.setArg(argIndex++, vld._radius);
-		_errorPropagateKernel.setArg(argIndex++, vl._reverseRadii);
 
-		cs.getQueue().enqueueNDRangeKernel(_errorPropagateKernel, cl::NullRange, cl::NDRange(vld._size.x, vld._size.y));
+		cs.enqueueKernel(_errorPropagateKernel, cl::NDRange(vld._size.x, vld._size.y));
 	}
 }
 
-void PredictorSwarm::activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold, float noise, std::mt19937 &rng) {
+void PredictorSwarm::activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold, float noise) {
+	if (_quantized) {
+		activateQuantized(cs, visibleStates, threshold, noise);
+
+		return;
+	}
+
 	// Start by clearing summation buffer
 	{
 		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
@@ -110,19 +130,15 @@ void PredictorSwarm::activate(sys::ComputeSystem &cs, const std::vector<cl::Imag
 		_activateKernel.setArg(argIndex++, _hiddenSummationTemp[_front]);
 		_activateKernel.setArg(argIndex++, vl._weights[_back]);
 		_activateKernel.setArg(argIndex++, vld._size);
-		_activateKernel.setArg(argIndex++, vl._hiddenToVisible);
+		vl._fieldTables.setHiddenArgs(_activateKernel, argIndex);
 		_activateKernel.setArg(argIndex++, vld._radius);
 
-		cs.getQueue().enqueueNDRangeKernel(_activateKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_activateKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		// Swap buffers
 		std::swap(_hiddenSummationTemp[_front], _hiddenSummationTemp[_back]);
 	}
 
-	std::uniform_int_distribution<int> seedDist;
-
-	cl_uint2 seed = { seedDist(rng), seedDist(rng) };
-
 	if (threshold) {
 		int argIndex = 0;
 
@@ -132,9 +148,9 @@ void PredictorSwarm::activate(sys::ComputeSystem &cs, const std::vector<cl::Imag
 		_solveHiddenThresholdKernel.setArg(argIndex++, _hiddenActivations[_back]);
 		_solveHiddenThresholdKernel.setArg(argIndex++, _hiddenActivations[_front]);
 		_solveHiddenThresholdKernel.setArg(argIndex++, noise);
-		_solveHiddenThresholdKernel.setArg(argIndex++, seed);
+		_random.setArgs(_solveHiddenThresholdKernel, argIndex);
 
-		cs.getQueue().enqueueNDRangeKernel(_solveHiddenThresholdKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_solveHiddenThresholdKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 	}
 	else {
 		int argIndex = 0;
@@ -145,17 +161,173 @@ void PredictorSwarm::activate(sys::ComputeSystem &cs, const std::vector<cl::Imag
 		_solveHiddenKernel.setArg(argIndex++, _hiddenActivations[_back]);
 		_solveHiddenKernel.setArg(argIndex++, _hiddenActivations[_front]);
 		_solveHiddenKernel.setArg(argIndex++, noise);
-		_solveHiddenKernel.setArg(argIndex++, seed);
+		_random.setArgs(_solveHiddenKernel, argIndex);
+
+		cs.enqueueKernel(_solveHiddenKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+	}
+
+	_random.advance(cs);
+
+	// Swap hidden state buffers
+	std::swap(_hiddenStates[_front], _hiddenStates[_back]);
+	std::swap(_hiddenActivations[_front], _hiddenActivations[_back]);
+}
+
+void PredictorSwarm::activateQuantized(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold, float noise) {
+	// Start by clearing summation buffer
+	{
+		cl_int4 zeroColor = { 0, 0, 0, 0 };
+
+		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+		cl::array<cl::size_type, 3> hiddenRegion = { _hiddenSize.x, _hiddenSize.y, 1 };
 
-		cs.getQueue().enqueueNDRangeKernel(_solveHiddenKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.getQueue().enqueueFillImage(_quantizedSummationTemp[_back], zeroColor, zeroOrigin, hiddenRegion);
 	}
 
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int argIndex = 0;
+
+		_activateQuantizedKernel.setArg(argIndex++, visibleStates[vli]);
+		_activateQuantizedKernel.setArg(argIndex++, _quantizedSummationTemp[_back]);
+		_activateQuantizedKernel.setArg(argIndex++, _quantizedSummationTemp[_front]);
+		_activateQuantizedKernel.setArg(argIndex++, vl._weightsQuantized);
+		_activateQuantizedKernel.setArg(argIndex++, vld._size);
+		_activateQuantizedKernel.setArg(argIndex++, vl._hiddenToVisible);
+		_activateQuantizedKernel.setArg(argIndex++, vld._radius);
+
+		cs.enqueueKernel(_activateQuantizedKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+
+		// Swap buffers
+		std::swap(_quantizedSummationTemp[_front], _quantizedSummationTemp[_back]);
+	}
+
+	cl::Kernel &solveKernel = threshold ? _solveHiddenThresholdQuantizedKernel : _solveHiddenQuantizedKernel;
+
+	int argIndex = 0;
+
+	solveKernel.setArg(argIndex++, _quantizedSummationTemp[_back]);
+	solveKernel.setArg(argIndex++, _quantizedScales);
+	solveKernel.setArg(argIndex++, _hiddenStates[_front]);
+	solveKernel.setArg(argIndex++, _hiddenActivations[_front]);
+	solveKernel.setArg(argIndex++, noise);
+	_random.setArgs(solveKernel, argIndex);
+
+	cs.enqueueKernel(solveKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+
+	_random.advance(cs);
+
 	// Swap hidden state buffers
 	std::swap(_hiddenStates[_front], _hiddenStates[_back]);
 	std::swap(_hiddenActivations[_front], _hiddenActivations[_back]);
 }
 
+void PredictorSwarm::quantize(sys::ComputeSystem &cs) {
+	assert(hasFloatWeights());
+
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+	cl::array<cl::size_type, 3> hiddenRegion = { _hiddenSize.x, _hiddenSize.y, 1 };
+
+	// Largest absolute weights of each hidden unit over all visible layers
+	DoubleBuffer2D scales = createDoubleBuffer2D(cs, _hiddenSize, CL_RG, CL_FLOAT);
+
+	{
+		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+		cs.getQueue().enqueueFillImage(scales[_back], zeroColor, zeroOrigin, hiddenRegion);
+	}
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int weightDiam = vld._radius * 2 + 1;
+
+		int numWeights = weightDiam * weightDiam;
+
+		int argIndex = 0;
+
+		_quantizeScalesKernel.setArg(argIndex++, vl._weights[_back]);
+		_quantizeScalesKernel.setArg(argIndex++, scales[_back]);
+		_quantizeScalesKernel.setArg(argIndex++, scales[_front]);
+		_quantizeScalesKernel.setArg(argIndex++, numWeights);
+
+		cs.getQueue().enqueueNDRangeKernel(_quantizeScalesKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+
+		std::swap(scales[_front], scales[_back]);
+	}
+
+	_quantizedScales = scales[_back];
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int weightDiam = vld._radius * 2 + 1;
+
+		int numWeights = weightDiam * weightDiam;
+
+		vl._weightsQuantized = cl::Image3D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_RG, CL_SIGNED_INT8), _hiddenSize.x, _hiddenSize.y, numWeights);
+
+		int argIndex = 0;
+
+		_quantizeWeightsKernel.setArg(argIndex++, vl._weights[_back]);
+		_quantizeWeightsKernel.setArg(argIndex++, _quantizedScales);
+		_quantizeWeightsKernel.setArg(argIndex++, vl._weightsQuantized);
+
+		cs.getQueue().enqueueNDRangeKernel(_quantizeWeightsKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y, numWeights));
+	}
+
+	_quantizedSummationTemp = createDoubleBuffer2D(cs, _hiddenSize, CL_RG, CL_SIGNED_INT32);
+
+	_quantized = true;
+}
+
+QuantizationReport PredictorSwarm::compareQuantized(sys::ComputeSystem &cs, const std::vector<std::vector<cl::Image2D>> &sequence, bool threshold) {
+	assert(_quantized && hasFloatWeights());
+
+	QuantizationReport report;
+
+	// Hidden states are (state, value) pairs, only states are compared
+	std::vector<cl_float> reference(_hiddenSize.x * _hiddenSize.y * 2);
+	std::vector<cl_float> quantized(_hiddenSize.x * _hiddenSize.y * 2);
+
+	for (int t = 0; t < sequence.size(); t++) {
+		_quantized = false;
+
+		activate(cs, sequence[t], threshold, 0.0f);
+
+		cs.getQueue().enqueueReadImage(_hiddenStates[_back], CL_FALSE, { 0, 0, 0 }, { static_cast<cl::size_type>(_hiddenSize.x), static_cast<cl::size_type>(_hiddenSize.y), 1 }, 0, 0, reference.data());
+
+		_quantized = true;
+
+		activate(cs, sequence[t], threshold, 0.0f);
+
+		cs.getQueue().enqueueReadImage(_hiddenStates[_back], CL_TRUE, { 0, 0, 0 }, { static_cast<cl::size_type>(_hiddenSize.x), static_cast<cl::size_type>(_hiddenSize.y), 1 }, 0, 0, quantized.data());
+
+		report.add(reference, quantized, 2);
+	}
+
+	return report;
+}
+
+void PredictorSwarm::releaseFloatWeights() {
+	assert(_quantized);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		_visibleLayers[vli]._weights[_front] = cl::Image3D();
+		_visibleLayers[vli]._weights[_back] = cl::Image3D();
+	}
+}
+
 void PredictorSwarm::learnTrace(sys::ComputeSystem &cs, float reward, float gamma, const cl::Image2D &targets, std::vector<cl::Image2D> &visibleStatesPrev, cl_float3 weightAlpha, cl_float2 weightLambda) {
+	assert(hasFloatWeights());
+
+	// Quantized weights would be stale
+	_quantized = false;
+
 	// Learn weights
 	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
 		VisibleLayer &vl = _visibleLayers[vli];
@@ -171,15 +343,108 @@ void PredictorSwarm::learnTrace(sys::ComputeSystem &cs, float reward, float gamm
 		_learnWeightsTracesKernel.setArg(argIndex++, vl._weights[_back]);
 		_learnWeightsTracesKernel.setArg(argIndex++, vl._weights[_front]);
 		_learnWeightsTracesKernel.setArg(argIndex++, vld._size);
-		_learnWeightsTracesKernel.setArg(argIndex++, vl._hiddenToVisible);
+		vl._fieldTables.setHiddenArgs(_learnWeightsTracesKernel, argIndex);
 		_learnWeightsTracesKernel.setArg(argIndex++, vld._radius);
 		_learnWeightsTracesKernel.setArg(argIndex++, weightAlpha);
 		_learnWeightsTracesKernel.setArg(argIndex++, weightLambda);
 		_learnWeightsTracesKernel.setArg(argIndex++, reward);
 		_learnWeightsTracesKernel.setArg(argIndex++, gamma);
 
-		cs.getQueue().enqueueNDRangeKernel(_learnWeightsTracesKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_learnWeightsTracesKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		std::swap(vl._weights[_front], vl._weights[_back]);
 	}
+}
+
+void PredictorSwarm::writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const {
+	assert(hasFloatWeights());
+
+	snapshot.write(_hiddenSize);
+
+	snapshot.writeImage(cs, _hiddenStates[_back]);
+	snapshot.writeImage(cs, _hiddenActivations[_back]);
+
+	// Layer information
+	snapshot.write(static_cast<cl_int>(_visibleLayers.size()));
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		const VisibleLayer &vl = _visibleLayers[vli];
+		const VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		// Desc
+		snapshot.write(vld._size);
+		snapshot.write(vld._radius);
+
+		// Layer
+		snapshot.writeImage(cs, vl._errors);
+		snapshot.writeImage(cs, vl._weights[_back]);
+
+		snapshot.write(vl._hiddenToVisible);
+		snapshot.write(vl._visibleToHidden);
+		snapshot.write(vl._reverseRadii);
+	}
+
+	snapshot.write(_random.getKey());
+	snapshot.write(_random.getStep());
+}
+
+void PredictorSwarm::readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot) {
+	snapshot.read(_hiddenSize);
+
+	_hiddenStates = createDoubleBuffer2D(cs, _hiddenSize, CL_RG, CL_FLOAT);
+
+	_hiddenActivations = createDoubleBuffer2D(cs, _hiddenSize, CL_RG, CL_FLOAT);
+
+	_hiddenSummationTemp = createDoubleBuffer2D(cs, _hiddenSize, CL_RG, CL_FLOAT);
+
+	snapshot.readImage(cs, _hiddenStates[_back]);
+	snapshot.readImage(cs, _hiddenActivations[_back]);
+
+	// Layer information
+	cl_int numLayers;
+
+	snapshot.read(numLayers);
+
+	_visibleLayerDescs.resize(numLayers);
+	_visibleLayers.resize(numLayers);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		// Desc
+		snapshot.read(vld._size);
+		snapshot.read(vld._radius);
+
+		// Layer
+		vl._errors = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
+
+		int weightDiam = vld._radius * 2 + 1;
+
+		int numWeights = weightDiam * weightDiam;
+
+		cl_int3 weightsSize = { _hiddenSize.x, _hiddenSize.y, numWeights };
+
+		vl._weights = createDoubleBuffer3D(cs, weightsSize, CL_RGBA, CL_FLOAT);
+
+		snapshot.readImage(cs, vl._errors);
+		snapshot.readImage(cs, vl._weights[_back]);
+
+		snapshot.read(vl._hiddenToVisible);
+		snapshot.read(vl._visibleToHidden);
+		snapshot.read(vl._reverseRadii);
+
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._radius, vl._reverseRadii);
+	}
+
+	cl_uint2 randomKey;
+	cl_ulong randomStep;
+
+	snapshot.read(randomKey);
+	snapshot.read(randomStep);
+
+	_random.create(cs, program, randomKey);
+	_random.setStep(cs, randomStep);
+
+	createKernels(program);
 }
\ No newline at end of file
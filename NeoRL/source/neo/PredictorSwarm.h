@@ -1,6 +1,8 @@
 #pragma once
 
-#include "Helpers.h"
+#include "Snapshot.h"
+#include "Quantization.h"
+#include "FieldTables.h"
 
 namespace neo {
 	/*!
@@ -45,6 +47,16 @@ namespace neo {
 			*/
 			DoubleBuffer3D _weights;
 
+			/*!
+			\brief Quantized activation weights (int8, scaled per hidden unit)
+			*/
+			cl::Image3D _weightsQuantized;
+
+			/*!
+			\brief Precomputed receptive field connectivity
+			*/
+			FieldTables _fieldTables;
+
 			/*!
 			\brief Transformations
 			*/
@@ -96,7 +108,49 @@ namespace neo {
 		cl::Kernel _errorPropagateKernel;
 		//!@}
 
+		/*!
+		\brief Random stream for the hidden noise
+		*/
+		RandomStream _random;
+
+		//!@{
+		/*!
+		\brief Quantized inference (scales are the largest absolute weight of each hidden unit)
+		*/
+		cl::Image2D _quantizedScales;
+		DoubleBuffer2D _quantizedSummationTemp;
+		bool _quantized;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Quantization kernels
+		*/
+		cl::Kernel _quantizeScalesKernel;
+		cl::Kernel _quantizeWeightsKernel;
+		cl::Kernel _activateQuantizedKernel;
+		cl::Kernel _solveHiddenQuantizedKernel;
+		cl::Kernel _solveHiddenThresholdQuantizedKernel;
+		//!@}
+
+		/*!
+		\brief Create kernels from the program
+		*/
+		void createKernels(sys::ComputeProgram &program);
+
+		/*!
+		\brief Activate from the quantized weights
+		*/
+		void activateQuantized(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold, float noise);
+
 	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		PredictorSwarm()
+			: _quantized(false)
+		{}
+
 		/*!
 		\brief Create a comparison sparse coder with random initialization
 		Requires the compute system, program with the NeoRL kernels, and initialization information
@@ -107,8 +161,41 @@ namespace neo {
 
 		/*!
 		\brief Activate predictor
+		Uses the quantized weights once quantized
 		*/
-		void activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold, float noise, std::mt19937 &rng);
+		void activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, bool threshold, float noise);
+
+		/*!
+		\brief Quantize the activation weights to int8 for inference (non-blocking)
+		Visible states are then treated as binary (> 0.5). Learning drops the quantization, call again after learning
+		*/
+		void quantize(sys::ComputeSystem &cs);
+
+		/*!
+		\brief Compare quantized against float predictions (without noise) over a held-out sequence of visible states
+		Requires the float weights, leaves the quantized predictions of the last step as the hidden states
+		*/
+		QuantizationReport compareQuantized(sys::ComputeSystem &cs, const std::vector<std::vector<cl::Image2D>> &sequence, bool threshold);
+
+		/*!
+		\brief Release the float weights of a quantized predictor, for inference only
+		Learning, error propagation, and writing the predictor are no longer possible
+		*/
+		void releaseFloatWeights();
+
+		/*!
+		\brief Whether activation uses the quantized weights
+		*/
+		bool isQuantized() const {
+			return _quantized;
+		}
+
+		/*!
+		\brief Whether the float weights are held (see releaseFloatWeights)
+		*/
+		bool hasFloatWeights() const {
+			return _visibleLayers.empty() || _visibleLayers.front()._weights[_back]() != nullptr;
+		}
 
 		/*!
 		\brief Learn with RL + prediction error
@@ -120,6 +207,17 @@ namespace neo {
 		*/
 		void propagateError(sys::ComputeSystem &cs, const cl::Image2D &targets);
 
+		/*!
+		\brief Write to snapshot (non-blocking)
+		Includes the traces stored alongside the weights
+		*/
+		void writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const;
+
+		/*!
+		\brief Read from snapshot
+		*/
+		void readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot);
+
 		/*!
 		\brief Get number of visible layers
 		*/
@@ -0,0 +1,127 @@
+#include "PrunedWeights.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace neo;
+
+void PrunedWeights::create(sys::ComputeSystem &cs, const cl::Image3D &weights, cl_int2 hiddenSize, cl_int2 visibleSize, cl_float2 hiddenToVisible, int radius,
+	float threshold, int topK, bool ignoreMiddle)
+{
+	int weightDiam = radius * 2 + 1;
+
+	int numWeights = weightDiam * weightDiam;
+
+	int numHidden = hiddenSize.x * hiddenSize.y;
+	int numVisible = visibleSize.x * visibleSize.y;
+
+	// Weights may be stored with traces alongside, the weight is the first channel
+	int numChannels = weights.getImageInfo<CL_IMAGE_FORMAT>().image_channel_order == CL_RG ? 2 : 1;
+
+	std::vector<cl_float> weightValues(numHidden * numWeights * numChannels);
+
+	cs.getQueue().enqueueReadImage(weights, CL_TRUE, { 0, 0, 0 }, { static_cast<cl::size_type>(hiddenSize.x), static_cast<cl::size_type>(hiddenSize.y), static_cast<cl::size_type>(numWeights) }, 0, 0, weightValues.data());
+
+	std::vector<cl_int> rowStarts(numHidden + 1, 0);
+	std::vector<cl_int> weightIndices;
+	std::vector<cl_float> values;
+
+	// Visible unit of each retained connection, for the reverse rows
+	std::vector<cl_int> visibleIndices;
+
+	std::vector<std::pair<float, int>> candidates;
+
+	_numConnections = 0;
+
+	for (int hy = 0; hy < hiddenSize.y; hy++)
+		for (int hx = 0; hx < hiddenSize.x; hx++) {
+			int hiddenIndex = hx + hy * hiddenSize.x;
+
+			int fieldLowerBoundX = static_cast<int>(hx * hiddenToVisible.x + 0.5f) - radius;
+			int fieldLowerBoundY = static_cast<int>(hy * hiddenToVisible.y + 0.5f) - radius;
+
+			candidates.clear();
+
+			for (int wi = 0; wi < numWeights; wi++) {
+				int vx = fieldLowerBoundX + wi / weightDiam;
+				int vy = fieldLowerBoundY + wi % weightDiam;
+
+				if (vx < 0 || vx >= visibleSize.x || vy < 0 || vy >= visibleSize.y)
+					continue;
+
+				if (ignoreMiddle && wi / weightDiam == radius && wi % weightDiam == radius)
+					continue;
+
+				_numConnections++;
+
+				float weight = weightValues[(hiddenIndex + wi * numHidden) * numChannels];
+
+				if (std::abs(weight) >= threshold)
+					candidates.push_back(std::make_pair(weight, wi));
+			}
+
+			if (topK > 0 && candidates.size() > topK) {
+				std::partial_sort(candidates.begin(), candidates.begin() + topK, candidates.end(), [](const std::pair<float, int> &left, const std::pair<float, int> &right) {
+					return std::abs(left.first) > std::abs(right.first);
+				});
+
+				candidates.resize(topK);
+			}
+
+			// Keep receptive field order for memory locality
+			std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, int> &left, const std::pair<float, int> &right) {
+				return left.second < right.second;
+			});
+
+			for (int ci = 0; ci < candidates.size(); ci++) {
+				int wi = candidates[ci].second;
+
+				weightIndices.push_back(wi);
+				values.push_back(candidates[ci].first);
+				visibleIndices.push_back((fieldLowerBoundX + wi / weightDiam) + (fieldLowerBoundY + wi % weightDiam) * visibleSize.x);
+			}
+
+			rowStarts[hiddenIndex + 1] = static_cast<cl_int>(weightIndices.size());
+		}
+
+	_numRetained = static_cast<int>(weightIndices.size());
+
+	// Reverse rows (counting sort by visible unit)
+	std::vector<cl_int> visibleRowStarts(numVisible + 1, 0);
+
+	for (int ci = 0; ci < _numRetained; ci++)
+		visibleRowStarts[visibleIndices[ci] + 1]++;
+
+	for (int vi = 0; vi < numVisible; vi++)
+		visibleRowStarts[vi + 1] += visibleRowStarts[vi];
+
+	std::vector<cl_int2> visibleConnections(std::max(1, _numRetained));
+	std::vector<cl_int> visibleFill(visibleRowStarts.begin(), visibleRowStarts.end() - 1);
+
+	for (int hi = 0; hi < numHidden; hi++)
+		for (int ci = rowStarts[hi]; ci < rowStarts[hi + 1]; ci++)
+			visibleConnections[visibleFill[visibleIndices[ci]]++] = cl_int2{ hi, ci };
+
+	// Buffers can not be empty
+	weightIndices.resize(std::max(1, _numRetained), 0);
+	values.resize(std::max(1, _numRetained), 0.0f);
+
+	_rowStarts = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, rowStarts.size() * sizeof(cl_int), rowStarts.data());
+	_weightIndices = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, weightIndices.size() * sizeof(cl_int), weightIndices.data());
+	_values = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, values.size() * sizeof(cl_float), values.data());
+
+	_visibleRowStarts = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, visibleRowStarts.size() * sizeof(cl_int), visibleRowStarts.data());
+	_visibleConnections = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, visibleConnections.size() * sizeof(cl_int2), visibleConnections.data());
+}
+
+void PrunedWeights::setHiddenArgs(cl::Kernel &kernel, int &argIndex) const {
+	kernel.setArg(argIndex++, _rowStarts);
+	kernel.setArg(argIndex++, _weightIndices);
+	kernel.setArg(argIndex++, _values);
+}
+
+void PrunedWeights::setVisibleArgs(cl::Kernel &kernel, int &argIndex) const {
+	kernel.setArg(argIndex++, _visibleRowStarts);
+	kernel.setArg(argIndex++, _visibleConnections);
+	kernel.setArg(argIndex++, _values);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Helpers.h"
+
+#include <vector>
+
+namespace neo {
+	/*!
+	\brief Pruned receptive field weights of a visible layer
+	Only the retained connections are stored, per hidden unit (compressed rows of weight indices and values),
+	and per visible unit for the reverse direction (compressed rows of hidden index and connection index pairs),
+	so activation and error propagation only visit retained connections
+	*/
+	class PrunedWeights {
+	private:
+		//!@{
+		/*!
+		\brief Retained connections per hidden unit (row starts, weight indices into the receptive field, values)
+		*/
+		cl::Buffer _rowStarts;
+		cl::Buffer _weightIndices;
+		cl::Buffer _values;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Retained connections per visible unit (row starts, hidden index and connection index pairs)
+		*/
+		cl::Buffer _visibleRowStarts;
+		cl::Buffer _visibleConnections;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Number of retained connections, and of connections before pruning
+		*/
+		int _numRetained;
+		int _numConnections;
+		//!@}
+
+	public:
+		/*!
+		\brief Initialize defaults (empty)
+		*/
+		PrunedWeights()
+			: _numRetained(0), _numConnections(0)
+		{}
+
+		/*!
+		\brief Prune weights (blocking)
+		Keeps weights with a magnitude of at least threshold, and of those only the topK largest per hidden unit if topK > 0.
+		Connections outside the visible layer, and the center connection if ignoreMiddle is set, are dropped
+		*/
+		void create(sys::ComputeSystem &cs, const cl::Image3D &weights, cl_int2 hiddenSize, cl_int2 visibleSize, cl_float2 hiddenToVisible, int radius,
+			float threshold, int topK, bool ignoreMiddle);
+
+		/*!
+		\brief Set the arguments of a kernel visiting connections per hidden unit
+		*/
+		void setHiddenArgs(cl::Kernel &kernel, int &argIndex) const;
+
+		/*!
+		\brief Set the arguments of a kernel visiting connections per visible unit
+		*/
+		void setVisibleArgs(cl::Kernel &kernel, int &argIndex) const;
+
+		/*!
+		\brief Get the number of retained connections
+		*/
+		int getNumRetained() const {
+			return _numRetained;
+		}
+
+		/*!
+		\brief Get the number of connections before pruning
+		*/
+		int getNumConnections() const {
+			return _numConnections;
+		}
+	};
+}
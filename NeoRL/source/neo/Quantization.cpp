@@ -0,0 +1,33 @@
+#include "Quantization.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace neo;
+
+void QuantizationReport::add(const std::vector<cl_float> &reference, const std::vector<cl_float> &quantized, int stride) {
+	assert(reference.size() == quantized.size());
+
+	double errorSum = static_cast<double>(_meanAbsError) * _numValues;
+	double mismatches = static_cast<double>(_mismatchRate) * _numValues;
+
+	for (size_t i = 0; i < reference.size(); i += stride) {
+		float error = std::abs(reference[i] - quantized[i]);
+
+		errorSum += error;
+
+		_maxAbsError = std::max(_maxAbsError, error);
+
+		if ((reference[i] > 0.5f) != (quantized[i] > 0.5f))
+			mismatches++;
+
+		_numValues++;
+	}
+
+	if (_numValues > 0) {
+		_meanAbsError = static_cast<cl_float>(errorSum / _numValues);
+		_mismatchRate = static_cast<cl_float>(mismatches / _numValues);
+	}
+
+	_numSteps++;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Helpers.h"
+
+#include <vector>
+
+namespace neo {
+	/*!
+	\brief Accuracy of quantized (int8) inference against the float weights
+	Built by comparing the predictions of both paths over a held-out sequence
+	*/
+	struct QuantizationReport {
+		/*!
+		\brief Mean absolute difference of the predictions
+		*/
+		cl_float _meanAbsError;
+
+		/*!
+		\brief Largest absolute difference of the predictions
+		*/
+		cl_float _maxAbsError;
+
+		/*!
+		\brief Fraction of predictions that differ once thresholded (at 0.5)
+		*/
+		cl_float _mismatchRate;
+
+		/*!
+		\brief Number of steps compared
+		*/
+		int _numSteps;
+
+		/*!
+		\brief Number of predictions compared
+		*/
+		cl_ulong _numValues;
+
+		/*!
+		\brief Initialize defaults (empty)
+		*/
+		QuantizationReport()
+			: _meanAbsError(0.0f), _maxAbsError(0.0f), _mismatchRate(0.0f), _numSteps(0), _numValues(0)
+		{}
+
+		/*!
+		\brief Add a step, comparing every stride-th value of the float and quantized predictions
+		*/
+		void add(const std::vector<cl_float> &reference, const std::vector<cl_float> &quantized, int stride = 1);
+	};
+}
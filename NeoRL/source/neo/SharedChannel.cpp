@@ -0,0 +1,154 @@
+#include "SharedChannel.h"
+
+using namespace neo;
+
+SharedChannel::~SharedChannel() {
+	if (_pSVM != nullptr) {
+		if (_lastAccess() != nullptr)
+			_lastAccess.wait();
+
+		clSVMFree(_context(), _pSVM);
+	}
+}
+
+void SharedChannel::create(sys::ComputeSystem &cs, sys::ComputeProgram &program, cl_int2 size, bool allowSVM) {
+	assert(_pSVM == nullptr);
+
+	_size = size;
+	_context = cs.getContext();
+
+	size_t numBytes = static_cast<size_t>(_size.x) * _size.y * sizeof(cl_float);
+
+	cl_device_svm_capabilities capabilities = 0;
+
+	if (allowSVM) {
+		cl_int error;
+
+		capabilities = cs.getDevice().getInfo<CL_DEVICE_SVM_CAPABILITIES>(&error);
+
+		// Pre 2.0 devices do not know the query
+		if (error != CL_SUCCESS)
+			capabilities = 0;
+	}
+
+	if (capabilities & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) {
+		_pSVM = static_cast<cl_float*>(clSVMAlloc(_context(), CL_MEM_READ_WRITE | CL_MEM_SVM_FINE_GRAIN_BUFFER, numBytes, 0));
+
+		_mode = _fineGrained;
+	}
+	else if (capabilities & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER) {
+		_pSVM = static_cast<cl_float*>(clSVMAlloc(_context(), CL_MEM_READ_WRITE, numBytes, 0));
+
+		_mode = _coarseGrained;
+	}
+
+	if (_pSVM == nullptr) {
+		_buffer = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, numBytes);
+
+		_mode = _mappedBuffer;
+	}
+
+	_image = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), _size.x, _size.y);
+
+	// Start zeroed
+	{
+		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+		cl::array<cl::size_type, 3> region = { static_cast<cl::size_type>(_size.x), static_cast<cl::size_type>(_size.y), 1 };
+
+		cs.getQueue().enqueueFillImage(_image, zeroColor, zeroOrigin, region);
+
+		cl_float* pHost = map(cs, CL_MAP_WRITE_INVALIDATE_REGION);
+
+		std::fill(pHost, pHost + _size.x * _size.y, 0.0f);
+
+		unmap(cs);
+	}
+
+	_toImageKernel = cl::Kernel(program.getProgram(), "channelToImage");
+	_fromImageKernel = cl::Kernel(program.getProgram(), "imageToChannel");
+}
+
+void SharedChannel::setMemoryArg(cl::Kernel &kernel, int argIndex) {
+	if (_mode == _mappedBuffer)
+		kernel.setArg(argIndex, _buffer);
+	else
+		kernel.setArg(argIndex, _pSVM);
+}
+
+cl_float* SharedChannel::map(sys::ComputeSystem &cs, cl_map_flags flags) {
+	assert(_pMapped == nullptr);
+
+	size_t numBytes = static_cast<size_t>(_size.x) * _size.y * sizeof(cl_float);
+
+	switch (_mode) {
+	case _fineGrained:
+		// Memory is coherent, only need to wait for the device to be done with it
+		if (_lastAccess() != nullptr)
+			_lastAccess.wait();
+
+		_pMapped = _pSVM;
+
+		break;
+	case _coarseGrained:
+		cs.getQueue().enqueueMapSVM(_pSVM, CL_TRUE, flags, numBytes);
+
+		_pMapped = _pSVM;
+
+		break;
+	case _mappedBuffer:
+		_pMapped = static_cast<cl_float*>(cs.getQueue().enqueueMapBuffer(_buffer, CL_TRUE, flags, 0, numBytes));
+
+		break;
+	}
+
+	return _pMapped;
+}
+
+void SharedChannel::unmap(sys::ComputeSystem &cs) {
+	assert(_pMapped != nullptr);
+
+	switch (_mode) {
+	case _fineGrained:
+		break;
+	case _coarseGrained:
+		cs.getQueue().enqueueUnmapSVM(_pSVM);
+
+		break;
+	case _mappedBuffer:
+		cs.getQueue().enqueueUnmapMemObject(_buffer, _pMapped);
+
+		break;
+	}
+
+	_pMapped = nullptr;
+}
+
+void SharedChannel::toImage(sys::ComputeSystem &cs) {
+	assert(_pMapped == nullptr);
+
+	int argIndex = 0;
+
+	setMemoryArg(_toImageKernel, argIndex++);
+	_toImageKernel.setArg(argIndex++, _image);
+	_toImageKernel.setArg(argIndex++, _size.x);
+
+	cs.getQueue().enqueueNDRangeKernel(_toImageKernel, cl::NullRange, cl::NDRange(_size.x, _size.y), cl::NullRange, nullptr, &_lastAccess);
+}
+
+void SharedChannel::fromImage(sys::ComputeSystem &cs, const cl::Image2D &image) {
+	assert(_pMapped == nullptr);
+
+	int argIndex = 0;
+
+	_fromImageKernel.setArg(argIndex++, image);
+	setMemoryArg(_fromImageKernel, argIndex++);
+	_fromImageKernel.setArg(argIndex++, _size.x);
+
+	cs.getQueue().enqueueNDRangeKernel(_fromImageKernel, cl::NullRange, cl::NDRange(_size.x, _size.y), cl::NullRange, nullptr, &_lastAccess);
+
+	// Fine-grained waits on the event, make sure the command actually starts
+	if (_mode == _fineGrained)
+		cs.getQueue().flush();
+}
\ No newline at end of file
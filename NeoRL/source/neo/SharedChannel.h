@@ -0,0 +1,134 @@
+#pragma once
+
+#include "Helpers.h"
+
+namespace neo {
+	/*!
+	\brief Host-device channel for small 2D inputs and outputs
+	Host memory shared with the device through OpenCL 2.0 SVM (fine-grained when supported, otherwise coarse-grained with map/unmap),
+	falling back to a mapped host buffer on devices without SVM. Copies to and from an image are done by kernels on the device
+	*/
+	class SharedChannel : private sys::Uncopyable {
+	public:
+		/*!
+		\brief Kind of memory backing the channel
+		*/
+		enum Mode {
+			_fineGrained, _coarseGrained, _mappedBuffer
+		};
+
+	private:
+		/*!
+		\brief Memory mode
+		*/
+		Mode _mode;
+
+		/*!
+		\brief Channel size
+		*/
+		cl_int2 _size;
+
+		/*!
+		\brief Context the SVM allocation belongs to
+		*/
+		cl::Context _context;
+
+		/*!
+		\brief SVM allocation (SVM modes)
+		*/
+		cl_float* _pSVM;
+
+		/*!
+		\brief Host accessible buffer (mapped buffer mode)
+		*/
+		cl::Buffer _buffer;
+
+		/*!
+		\brief Host pointer while mapped, nullptr otherwise
+		*/
+		cl_float* _pMapped;
+
+		/*!
+		\brief Device side image
+		*/
+		cl::Image2D _image;
+
+		/*!
+		\brief Last device command that accessed the memory
+		*/
+		cl::Event _lastAccess;
+
+		//!@{
+		/*!
+		\brief Kernels
+		*/
+		cl::Kernel _toImageKernel;
+		cl::Kernel _fromImageKernel;
+		//!@}
+
+		/*!
+		\brief Set the memory as the first kernel argument
+		*/
+		void setMemoryArg(cl::Kernel &kernel, int argIndex);
+
+	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		SharedChannel()
+			: _mode(_mappedBuffer), _pSVM(nullptr), _pMapped(nullptr)
+		{}
+
+		/*!
+		\brief Frees the shared memory
+		*/
+		~SharedChannel();
+
+		/*!
+		\brief Create a channel of the given size, using SVM if the device supports it and it is allowed
+		*/
+		void create(sys::ComputeSystem &cs, sys::ComputeProgram &program, cl_int2 size, bool allowSVM = true);
+
+		/*!
+		\brief Get host access to the channel memory (size.x * size.y floats, x fastest)
+		Waits for pending device accesses. Call unmap before the next device access
+		*/
+		cl_float* map(sys::ComputeSystem &cs, cl_map_flags flags);
+
+		/*!
+		\brief End host access
+		*/
+		void unmap(sys::ComputeSystem &cs);
+
+		/*!
+		\brief Enqueue a copy of the channel memory into the channel image (non-blocking)
+		*/
+		void toImage(sys::ComputeSystem &cs);
+
+		/*!
+		\brief Enqueue a copy of an image of the channel size into the channel memory (non-blocking)
+		*/
+		void fromImage(sys::ComputeSystem &cs, const cl::Image2D &image);
+
+		/*!
+		\brief Get the channel image
+		*/
+		const cl::Image2D &getImage() const {
+			return _image;
+		}
+
+		/*!
+		\brief Get the memory mode
+		*/
+		Mode getMode() const {
+			return _mode;
+		}
+
+		/*!
+		\brief Get channel size
+		*/
+		cl_int2 getSize() const {
+			return _size;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,518 @@
+#include "Snapshot.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace neo;
+
+// Serialized layout:
+// Header (magic, version, alignment, number of parameter bytes, number of tensors)
+// Parameter bytes
+// Tensor table (parameter offset, size, channels, data offset)
+// Tensor data, each starting on a multiple of the alignment (offsets are relative to the start of the snapshot)
+
+const cl_uint Snapshot::_version;
+const cl_uint Snapshot::_defaultAlignment;
+const cl_uint Snapshot::_mappingAlignment;
+
+static const char snapshotMagic[4] = { 'N', 'E', 'O', 'S' };
+
+static const cl_ulong snapshotHeaderSize = sizeof(snapshotMagic) + 2 * sizeof(cl_uint) + 2 * sizeof(cl_ulong);
+static const cl_ulong snapshotTableEntrySize = 2 * sizeof(cl_ulong) + 4 * sizeof(cl_int);
+
+namespace neo {
+	struct MappedFile {
+		char* _pData;
+		size_t _size;
+
+#ifdef _WIN32
+		HANDLE _file;
+		HANDLE _mapping;
+
+		MappedFile()
+			: _pData(nullptr), _size(0), _file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+		{}
+
+		bool open(const std::string &fileName) {
+			_file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+			if (_file == INVALID_HANDLE_VALUE)
+				return false;
+
+			LARGE_INTEGER fileSize;
+
+			if (!GetFileSizeEx(_file, &fileSize) || fileSize.QuadPart == 0)
+				return false;
+
+			_size = static_cast<size_t>(fileSize.QuadPart);
+
+			_mapping = CreateFileMappingA(_file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+
+			if (_mapping == nullptr)
+				return false;
+
+			_pData = static_cast<char*>(MapViewOfFile(_mapping, FILE_MAP_COPY, 0, 0, 0));
+
+			return _pData != nullptr;
+		}
+
+		~MappedFile() {
+			if (_pData != nullptr)
+				UnmapViewOfFile(_pData);
+
+			if (_mapping != nullptr)
+				CloseHandle(_mapping);
+
+			if (_file != INVALID_HANDLE_VALUE)
+				CloseHandle(_file);
+		}
+#else
+		MappedFile()
+			: _pData(nullptr), _size(0)
+		{}
+
+		bool open(const std::string &fileName) {
+			int file = ::open(fileName.c_str(), O_RDONLY);
+
+			if (file == -1)
+				return false;
+
+			struct stat fileStat;
+
+			if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0) {
+				::close(file);
+
+				return false;
+			}
+
+			_size = static_cast<size_t>(fileStat.st_size);
+
+			// Private mapping, so kernels writing to images created over it never modify the file
+			void* pData = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+
+			::close(file);
+
+			if (pData == MAP_FAILED)
+				return false;
+
+			_pData = static_cast<char*>(pData);
+
+			return true;
+		}
+
+		~MappedFile() {
+			if (_pData != nullptr)
+				munmap(_pData, _size);
+		}
+#endif
+	};
+}
+
+static cl_int numChannels(cl_channel_order channelOrder) {
+	switch (channelOrder) {
+	case CL_R:
+		return 1;
+	case CL_RG:
+		return 2;
+	case CL_RGBA:
+		return 4;
+	}
+
+	assert(false);
+
+	return 1;
+}
+
+static cl_ulong alignOffset(cl_ulong offset, cl_uint alignment) {
+	return (offset + alignment - 1) & ~static_cast<cl_ulong>(alignment - 1);
+}
+
+template <class T>
+static void writeRaw(std::ostream &os, const T &value) {
+	os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <class T>
+static void readRaw(std::istream &is, T &value) {
+	is.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+static void CL_CALLBACK releaseMapping(cl_mem memObj, void* pUserData) {
+	delete static_cast<std::shared_ptr<MappedFile>*>(pUserData);
+}
+
+void Snapshot::captureImage(sys::ComputeSystem &cs, const cl::Image &image, cl_int3 size) {
+	Tensor tensor;
+
+	tensor._offset = _bytes.size();
+	tensor._size = size;
+	tensor._channels = numChannels(image.getImageInfo<CL_IMAGE_FORMAT>().image_channel_order);
+	tensor._data.resize(tensor.getNumElements());
+
+	_tensors.push_back(std::move(tensor));
+
+	cl::Event readEvent;
+
+	cs.getQueue().enqueueReadImage(image, CL_FALSE, { 0, 0, 0 }, { static_cast<cl::size_type>(size.x), static_cast<cl::size_type>(size.y), static_cast<cl::size_type>(size.z) }, 0, 0, _tensors.back()._data.data(), nullptr, &readEvent);
+
+	_readEvents.push_back(readEvent);
+}
+
+const Snapshot::Tensor &Snapshot::nextTensor(const cl::Image &image, cl_int3 size) {
+	assert(_tensorPosition < _tensors.size());
+
+	const Tensor &tensor = _tensors[_tensorPosition++];
+
+	// Tensors must be read back in the order they were written
+	assert(tensor._offset == _bytePosition);
+	assert(tensor._size.x == size.x && tensor._size.y == size.y && tensor._size.z == size.z);
+	assert(tensor._channels == numChannels(image.getImageInfo<CL_IMAGE_FORMAT>().image_channel_order));
+
+	return tensor;
+}
+
+void Snapshot::uploadTensor(sys::ComputeSystem &cs, const cl::Image &image, const Tensor &tensor) {
+	cs.getQueue().enqueueWriteImage(image, CL_TRUE, { 0, 0, 0 }, { static_cast<cl::size_type>(tensor._size.x), static_cast<cl::size_type>(tensor._size.y), static_cast<cl::size_type>(tensor._size.z) }, 0, 0, tensor.getData());
+}
+
+bool Snapshot::canUseHostPtr(sys::ComputeSystem &cs, const Tensor &tensor) const {
+	if (tensor._pMappedData == nullptr)
+		return false;
+
+	// Without shared memory the runtime would copy anyways
+	if (!cs.getDevice().getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>())
+		return false;
+
+	// Misaligned host pointers also make the runtime fall back to a copy
+	cl_uint baseAlignment = std::max(cs.getDevice().getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8, static_cast<cl_uint>(1));
+
+	return reinterpret_cast<std::uintptr_t>(tensor._pMappedData) % baseAlignment == 0;
+}
+
+void Snapshot::retainMapping(cl::Memory &memory) const {
+	memory.setDestructorCallback(releaseMapping, new std::shared_ptr<MappedFile>(_mapping));
+}
+
+void Snapshot::writeImage(sys::ComputeSystem &cs, const cl::Image2D &image) {
+	cl_int3 size = { static_cast<cl_int>(image.getImageInfo<CL_IMAGE_WIDTH>()), static_cast<cl_int>(image.getImageInfo<CL_IMAGE_HEIGHT>()), 1 };
+
+	captureImage(cs, image, size);
+}
+
+void Snapshot::writeImage(sys::ComputeSystem &cs, const cl::Image3D &image) {
+	cl_int3 size = { static_cast<cl_int>(image.getImageInfo<CL_IMAGE_WIDTH>()), static_cast<cl_int>(image.getImageInfo<CL_IMAGE_HEIGHT>()), static_cast<cl_int>(image.getImageInfo<CL_IMAGE_DEPTH>()) };
+
+	captureImage(cs, image, size);
+}
+
+void Snapshot::readImage(sys::ComputeSystem &cs, cl::Image2D &image, bool zeroCopy) {
+	cl_int3 size = { static_cast<cl_int>(image.getImageInfo<CL_IMAGE_WIDTH>()), static_cast<cl_int>(image.getImageInfo<CL_IMAGE_HEIGHT>()), 1 };
+
+	const Tensor &tensor = nextTensor(image, size);
+
+	if (zeroCopy && canUseHostPtr(cs, tensor)) {
+		image = cl::Image2D(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, image.getImageInfo<CL_IMAGE_FORMAT>(), size.x, size.y, 0, tensor._pMappedData);
+
+		retainMapping(image);
+	}
+	else
+		uploadTensor(cs, image, tensor);
+}
+
+void Snapshot::readImage(sys::ComputeSystem &cs, cl::Image3D &image, bool zeroCopy) {
+	cl_int3 size = { static_cast<cl_int>(image.getImageInfo<CL_IMAGE_WIDTH>()), static_cast<cl_int>(image.getImageInfo<CL_IMAGE_HEIGHT>()), static_cast<cl_int>(image.getImageInfo<CL_IMAGE_DEPTH>()) };
+
+	const Tensor &tensor = nextTensor(image, size);
+
+	if (zeroCopy && canUseHostPtr(cs, tensor)) {
+		image = cl::Image3D(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, image.getImageInfo<CL_IMAGE_FORMAT>(), size.x, size.y, size.z, 0, 0, tensor._pMappedData);
+
+		retainMapping(image);
+	}
+	else
+		uploadTensor(cs, image, tensor);
+}
+
+void Snapshot::wait() {
+	if (!_readEvents.empty()) {
+		cl::WaitForEvents(_readEvents);
+
+		_readEvents.clear();
+	}
+}
+
+void Snapshot::clear() {
+	wait();
+
+	_bytes.clear();
+	_tensors.clear();
+
+	_mapping.reset();
+
+	rewind();
+}
+
+void Snapshot::unmap() {
+	if (_mapping == nullptr)
+		return;
+
+	for (int ti = 0; ti < _tensors.size(); ti++) {
+		Tensor &tensor = _tensors[ti];
+
+		if (tensor._pMappedData != nullptr) {
+			tensor._data.assign(tensor._pMappedData, tensor._pMappedData + tensor.getNumElements());
+
+			tensor._pMappedData = nullptr;
+		}
+	}
+
+	_mapping.reset();
+}
+
+size_t Snapshot::getTensorBytes() const {
+	size_t total = 0;
+
+	for (int ti = 0; ti < _tensors.size(); ti++)
+		total += _tensors[ti].getNumElements() * sizeof(cl_float);
+
+	return total;
+}
+
+bool Snapshot::writeToStream(std::ostream &os) const {
+	assert(_readEvents.empty());
+
+	cl_ulong numBytes = _bytes.size();
+	cl_ulong numTensors = _tensors.size();
+
+	// Header
+	os.write(snapshotMagic, sizeof(snapshotMagic));
+	writeRaw(os, _version);
+	writeRaw(os, _alignment);
+	writeRaw(os, numBytes);
+	writeRaw(os, numTensors);
+
+	// Parameters
+	if (!_bytes.empty())
+		os.write(_bytes.data(), _bytes.size());
+
+	// Table
+	cl_ulong position = snapshotHeaderSize + numBytes + numTensors * snapshotTableEntrySize;
+
+	std::vector<cl_ulong> dataOffsets(_tensors.size());
+
+	for (int ti = 0; ti < _tensors.size(); ti++) {
+		const Tensor &tensor = _tensors[ti];
+
+		dataOffsets[ti] = alignOffset(position, _alignment);
+
+		position = dataOffsets[ti] + tensor.getNumElements() * sizeof(cl_float);
+
+		writeRaw(os, tensor._offset);
+		writeRaw(os, tensor._size.x);
+		writeRaw(os, tensor._size.y);
+		writeRaw(os, tensor._size.z);
+		writeRaw(os, tensor._channels);
+		writeRaw(os, dataOffsets[ti]);
+	}
+
+	// Data
+	position = snapshotHeaderSize + numBytes + numTensors * snapshotTableEntrySize;
+
+	const char padding[64] = { 0 };
+
+	for (int ti = 0; ti < _tensors.size(); ti++) {
+		const Tensor &tensor = _tensors[ti];
+
+		while (position < dataOffsets[ti]) {
+			cl_ulong padSize = std::min(dataOffsets[ti] - position, static_cast<cl_ulong>(sizeof(padding)));
+
+			os.write(padding, padSize);
+
+			position += padSize;
+		}
+
+		os.write(reinterpret_cast<const char*>(tensor.getData()), tensor.getNumElements() * sizeof(cl_float));
+
+		position += tensor.getNumElements() * sizeof(cl_float);
+	}
+
+	return os.good();
+}
+
+bool Snapshot::readTable(std::istream &is, std::vector<cl_ulong> &dataOffsets) {
+	char magic[4];
+
+	is.read(magic, sizeof(magic));
+
+	if (!is.good() || std::memcmp(magic, snapshotMagic, sizeof(magic)) != 0) {
+#ifdef SYS_DEBUG
+		std::cerr << "Not a NeoRL snapshot!" << std::endl;
+#endif
+		return false;
+	}
+
+	cl_uint version;
+	cl_ulong numBytes, numTensors;
+
+	readRaw(is, version);
+	readRaw(is, _alignment);
+	readRaw(is, numBytes);
+	readRaw(is, numTensors);
+
+	if (version != _version) {
+#ifdef SYS_DEBUG
+		std::cerr << "Unsupported snapshot version " << version << "!" << std::endl;
+#endif
+		return false;
+	}
+
+	_bytes.resize(numBytes);
+
+	if (numBytes > 0)
+		is.read(_bytes.data(), numBytes);
+
+	_tensors.resize(numTensors);
+
+	dataOffsets.resize(numTensors);
+
+	for (int ti = 0; ti < _tensors.size(); ti++) {
+		Tensor &tensor = _tensors[ti];
+
+		readRaw(is, tensor._offset);
+		readRaw(is, tensor._size.x);
+		readRaw(is, tensor._size.y);
+		readRaw(is, tensor._size.z);
+		readRaw(is, tensor._channels);
+		readRaw(is, dataOffsets[ti]);
+	}
+
+	return is.good();
+}
+
+bool Snapshot::readFromStream(std::istream &is) {
+	clear();
+
+	std::vector<cl_ulong> dataOffsets;
+
+	if (!readTable(is, dataOffsets))
+		return false;
+
+	cl_ulong position = snapshotHeaderSize + _bytes.size() + _tensors.size() * snapshotTableEntrySize;
+
+	for (int ti = 0; ti < _tensors.size() && is.good(); ti++) {
+		Tensor &tensor = _tensors[ti];
+
+		if (dataOffsets[ti] < position)
+			return false;
+
+		is.ignore(dataOffsets[ti] - position);
+
+		tensor._data.resize(tensor.getNumElements());
+
+		is.read(reinterpret_cast<char*>(tensor._data.data()), tensor._data.size() * sizeof(cl_float));
+
+		position = dataOffsets[ti] + tensor._data.size() * sizeof(cl_float);
+	}
+
+	return is.good();
+}
+
+bool Snapshot::saveToFile(const std::string &fileName) const {
+	std::string tempFileName = fileName + ".tmp";
+
+	{
+		std::ofstream toFile(tempFileName, std::ios::binary);
+
+		if (!toFile.is_open()) {
+#ifdef SYS_DEBUG
+			std::cerr << "Could not open file " << tempFileName << "!" << std::endl;
+#endif
+			return false;
+		}
+
+		if (!writeToStream(toFile))
+			return false;
+	}
+
+	std::remove(fileName.c_str());
+
+	return std::rename(tempFileName.c_str(), fileName.c_str()) == 0;
+}
+
+bool Snapshot::loadFromFile(const std::string &fileName) {
+	std::ifstream fromFile(fileName, std::ios::binary);
+
+	if (!fromFile.is_open()) {
+#ifdef SYS_DEBUG
+		std::cerr << "Could not open file " << fileName << "!" << std::endl;
+#endif
+		return false;
+	}
+
+	return readFromStream(fromFile);
+}
+
+bool Snapshot::mapFromFile(const std::string &fileName) {
+	clear();
+
+	// Header and table are small, parse them from a regular stream
+	std::vector<cl_ulong> dataOffsets;
+
+	{
+		std::ifstream fromFile(fileName, std::ios::binary);
+
+		if (!fromFile.is_open()) {
+#ifdef SYS_DEBUG
+			std::cerr << "Could not open file " << fileName << "!" << std::endl;
+#endif
+			return false;
+		}
+
+		if (!readTable(fromFile, dataOffsets))
+			return false;
+	}
+
+#ifdef SYS_DEBUG
+	if (_alignment < _mappingAlignment)
+		std::cerr << "Snapshot " << fileName << " was not saved with mapping alignment, images may be copied" << std::endl;
+#endif
+
+	std::shared_ptr<MappedFile> mapping = std::make_shared<MappedFile>();
+
+	if (!mapping->open(fileName)) {
+#ifdef SYS_DEBUG
+		std::cerr << "Could not map file " << fileName << "!" << std::endl;
+#endif
+		return false;
+	}
+
+	for (int ti = 0; ti < _tensors.size(); ti++) {
+		Tensor &tensor = _tensors[ti];
+
+		if (dataOffsets[ti] + tensor.getNumElements() * sizeof(cl_float) > mapping->_size || dataOffsets[ti] % sizeof(cl_float) != 0) {
+			_tensors.clear();
+
+			return false;
+		}
+
+		tensor._pMappedData = reinterpret_cast<cl_float*>(mapping->_pData + dataOffsets[ti]);
+	}
+
+	_mapping = mapping;
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "Helpers.h"
+
+#include <type_traits>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <memory>
+
+namespace neo {
+	/*!
+	\brief Read-only file mapping (copy-on-write, so devices may write to images created over it)
+	*/
+	struct MappedFile;
+
+	/*!
+	\brief Binary snapshot of a model
+	Holds parameters and host copies of device images in the order they were written.
+	Images are captured with non-blocking reads, so a model can be snapshotted at a step boundary
+	and serialized later (for instance on a background thread, see Checkpointer).
+	A snapshot saved with a page sized alignment can be mapped instead of loaded. On devices that share host memory,
+	reading weight images from a mapped snapshot can then create them directly over the mapping (no copy)
+	*/
+	class Snapshot {
+	public:
+		/*!
+		\brief Host copy of an image
+		*/
+		struct Tensor {
+			/*!
+			\brief Position in the parameter bytes at which the tensor was written
+			*/
+			cl_ulong _offset;
+
+			/*!
+			\brief Image size (z is 1 for 2D images)
+			*/
+			cl_int3 _size;
+
+			/*!
+			\brief Number of float channels per texel
+			*/
+			cl_int _channels;
+
+			/*!
+			\brief Texel data, x fastest, channels interleaved (empty when mapped)
+			*/
+			std::vector<cl_float> _data;
+
+			/*!
+			\brief Texel data in the file mapping, if mapped
+			*/
+			cl_float* _pMappedData;
+
+			/*!
+			\brief Initialize defaults
+			*/
+			Tensor()
+				: _pMappedData(nullptr)
+			{}
+
+			/*!
+			\brief Number of floats in the tensor
+			*/
+			size_t getNumElements() const {
+				return static_cast<size_t>(_size.x) * _size.y * _size.z * _channels;
+			}
+
+			/*!
+			\brief Get texel data, owned or mapped
+			*/
+			const cl_float* getData() const {
+				return _pMappedData != nullptr ? _pMappedData : _data.data();
+			}
+		};
+
+		/*!
+		\brief Alignment to use for snapshots that are to be mapped (a page on common systems)
+		*/
+		static const cl_uint _mappingAlignment = 4096;
+
+		/*!
+		\brief Format version, increased whenever the layout changes
+		*/
+		static const cl_uint _version = 1;
+
+		/*!
+		\brief Default alignment of tensor data in serialized snapshots (bytes)
+		Mapping alignment, so any saved snapshot satisfies the device base address alignment and can be read zero-copy
+		*/
+		static const cl_uint _defaultAlignment = _mappingAlignment;
+
+	private:
+		/*!
+		\brief Parameter bytes
+		*/
+		std::vector<char> _bytes;
+
+		/*!
+		\brief Tensors
+		*/
+		std::vector<Tensor> _tensors;
+
+		/*!
+		\brief Pending device to host reads
+		*/
+		std::vector<cl::Event> _readEvents;
+
+		//!@{
+		/*!
+		\brief Read cursors
+		*/
+		size_t _bytePosition;
+		size_t _tensorPosition;
+		//!@}
+
+		/*!
+		\brief Alignment of tensor data when serialized
+		*/
+		cl_uint _alignment;
+
+		/*!
+		\brief File mapping the tensors point into, if mapped
+		*/
+		std::shared_ptr<MappedFile> _mapping;
+
+		/*!
+		\brief Start a tensor for the image and enqueue a non-blocking read of it
+		*/
+		void captureImage(sys::ComputeSystem &cs, const cl::Image &image, cl_int3 size);
+
+		/*!
+		\brief Consume the next tensor, checking that it matches the image
+		*/
+		const Tensor &nextTensor(const cl::Image &image, cl_int3 size);
+
+		/*!
+		\brief Upload a tensor to an image (blocking)
+		*/
+		void uploadTensor(sys::ComputeSystem &cs, const cl::Image &image, const Tensor &tensor);
+
+		/*!
+		\brief Whether an image can be created directly over the mapped data of a tensor
+		*/
+		bool canUseHostPtr(sys::ComputeSystem &cs, const Tensor &tensor) const;
+
+		/*!
+		\brief Keep the mapping alive until the memory object is released
+		*/
+		void retainMapping(cl::Memory &memory) const;
+
+		/*!
+		\brief Read header and tensor table (not the tensor data)
+		*/
+		bool readTable(std::istream &is, std::vector<cl_ulong> &dataOffsets);
+
+		/*!
+		\brief Copy mapped tensors into owned storage and release the mapping
+		*/
+		void unmap();
+
+		friend class SnapshotDelta;
+		friend class SnapshotChain;
+
+	public:
+		/*!
+		\brief Initialize defaults
+		*/
+		Snapshot()
+			: _bytePosition(0), _tensorPosition(0), _alignment(_defaultAlignment)
+		{}
+
+		/*!
+		\brief Write a parameter (plain data only)
+		*/
+		template <class T>
+		void write(const T &value) {
+			static_assert(std::is_trivially_copyable<T>::value, "Snapshot parameters must be plain data");
+
+			const char *pValue = reinterpret_cast<const char*>(&value);
+
+			_bytes.insert(_bytes.end(), pValue, pValue + sizeof(T));
+		}
+
+		/*!
+		\brief Read the next parameter
+		*/
+		template <class T>
+		void read(T &value) {
+			static_assert(std::is_trivially_copyable<T>::value, "Snapshot parameters must be plain data");
+
+			assert(_bytePosition + sizeof(T) <= _bytes.size());
+
+			std::copy(_bytes.begin() + _bytePosition, _bytes.begin() + _bytePosition + sizeof(T), reinterpret_cast<char*>(&value));
+
+			_bytePosition += sizeof(T);
+		}
+
+		//!@{
+		/*!
+		\brief Capture an image (non-blocking, call wait before accessing the data)
+		*/
+		void writeImage(sys::ComputeSystem &cs, const cl::Image2D &image);
+		void writeImage(sys::ComputeSystem &cs, const cl::Image3D &image);
+		//!@}
+
+		//!@{
+		/*!
+		\brief Upload the next tensor into an existing image of matching size and format
+		With zeroCopy, when mapped and the device shares host memory, the image is instead replaced by a read-only one created over the mapping.
+		Models read from the same mapped snapshot then share that memory, so only ask for it for tensors that are never written
+		after loading (weights of models read with inferenceOnly, which refuse to learn), state is always copied into the image
+		*/
+		void readImage(sys::ComputeSystem &cs, cl::Image2D &image, bool zeroCopy = false);
+		void readImage(sys::ComputeSystem &cs, cl::Image3D &image, bool zeroCopy = false);
+		//!@}
+
+		/*!
+		\brief Wait for all pending captures to complete
+		*/
+		void wait();
+
+		/*!
+		\brief Move the read cursors back to the start
+		*/
+		void rewind() {
+			_bytePosition = 0;
+			_tensorPosition = 0;
+		}
+
+		/*!
+		\brief Remove all parameters and tensors
+		*/
+		void clear();
+
+		/*!
+		\brief Serialize (captures must be complete)
+		*/
+		bool writeToStream(std::ostream &os) const;
+
+		/*!
+		\brief Deserialize, replacing the current contents
+		*/
+		bool readFromStream(std::istream &is);
+
+		//!@{
+		/*!
+		\brief File helpers. Saving writes to a temporary file first so an interrupted save never replaces a good file
+		*/
+		bool saveToFile(const std::string &fileName) const;
+		bool loadFromFile(const std::string &fileName);
+		//!@}
+
+		/*!
+		\brief Map a saved snapshot instead of loading its tensor data, replacing the current contents
+		Tensor data stays in the file mapping, which lives as long as the snapshot or any image created over it.
+		Models read from a mapping with inferenceOnly may share their weights with it (read-only), others copy them
+		*/
+		bool mapFromFile(const std::string &fileName);
+
+		/*!
+		\brief Whether the tensor data is mapped from a file
+		*/
+		bool isMapped() const {
+			return _mapping != nullptr;
+		}
+
+		/*!
+		\brief Set alignment of tensor data (power of 2) for serialization
+		*/
+		void setAlignment(cl_uint alignment) {
+			assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+			_alignment = alignment;
+		}
+
+		/*!
+		\brief Get alignment of tensor data
+		*/
+		cl_uint getAlignment() const {
+			return _alignment;
+		}
+
+		/*!
+		\brief Get parameter bytes
+		*/
+		const std::vector<char> &getBytes() const {
+			return _bytes;
+		}
+
+		/*!
+		\brief Get number of tensors
+		*/
+		size_t getNumTensors() const {
+			return _tensors.size();
+		}
+
+		/*!
+		\brief Get access to a tensor
+		*/
+		const Tensor &getTensor(int index) const {
+			return _tensors[index];
+		}
+
+		/*!
+		\brief Get total size of tensor data in bytes
+		*/
+		size_t getTensorBytes() const;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,414 @@
+#include "SnapshotDelta.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+using namespace neo;
+
+// Serialized layout:
+// Header (magic, version, tile size, threshold, number of parameter bytes, number of tensors)
+// Parameter bytes
+// Per tensor: number of elements, number of changed tiles, tile indices, tile data
+
+const cl_uint SnapshotDelta::_version;
+
+static const char deltaMagic[4] = { 'N', 'E', 'O', 'D' };
+static const char snapshotMagic[4] = { 'N', 'E', 'O', 'S' };
+
+template <class T>
+static void writeRaw(std::ostream &os, const T &value) {
+	os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <class T>
+static void readRaw(std::istream &is, T &value) {
+	is.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+static bool sameStructure(const Snapshot &left, const Snapshot &right) {
+	if (left.getNumTensors() != right.getNumTensors())
+		return false;
+
+	for (int ti = 0; ti < left.getNumTensors(); ti++) {
+		const Snapshot::Tensor &l = left.getTensor(ti);
+		const Snapshot::Tensor &r = right.getTensor(ti);
+
+		if (l._offset != r._offset || l._size.x != r._size.x || l._size.y != r._size.y || l._size.z != r._size.z || l._channels != r._channels)
+			return false;
+	}
+
+	return true;
+}
+
+bool SnapshotDelta::create(const Snapshot &reference, const Snapshot &current, cl_float threshold, cl_uint tileSize) {
+	assert(tileSize > 0);
+	assert(threshold >= 0.0f);
+
+	_tileSize = tileSize;
+	_threshold = threshold;
+
+	_bytes.clear();
+	_tensorDeltas.clear();
+
+	if (!sameStructure(reference, current))
+		return false;
+
+	_bytes = current.getBytes();
+
+	_tensorDeltas.resize(current.getNumTensors());
+
+	for (int ti = 0; ti < current.getNumTensors(); ti++) {
+		const cl_float* referenceData = reference.getTensor(ti).getData();
+		const cl_float* currentData = current.getTensor(ti).getData();
+
+		TensorDelta &tensorDelta = _tensorDeltas[ti];
+
+		tensorDelta._numElements = current.getTensor(ti).getNumElements();
+
+		size_t numTiles = (tensorDelta._numElements + _tileSize - 1) / _tileSize;
+
+		for (size_t tile = 0; tile < numTiles; tile++) {
+			size_t start = tile * _tileSize;
+			size_t end = std::min(start + _tileSize, static_cast<size_t>(tensorDelta._numElements));
+
+			bool changed = false;
+
+			for (size_t i = start; i < end; i++)
+				// Negated comparison so NaN also counts as a change
+				if (!(std::abs(currentData[i] - referenceData[i]) <= _threshold)) {
+					changed = true;
+
+					break;
+				}
+
+			if (changed) {
+				tensorDelta._tiles.push_back(static_cast<cl_uint>(tile));
+				tensorDelta._data.insert(tensorDelta._data.end(), currentData + start, currentData + end);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool SnapshotDelta::applyTo(Snapshot &snapshot) const {
+	if (snapshot.getNumTensors() != _tensorDeltas.size())
+		return false;
+
+	for (int ti = 0; ti < _tensorDeltas.size(); ti++)
+		if (snapshot._tensors[ti].getNumElements() != _tensorDeltas[ti]._numElements)
+			return false;
+
+	// Mapped data is shared with the file, modify a copy
+	snapshot.unmap();
+
+	snapshot._bytes = _bytes;
+
+	for (int ti = 0; ti < _tensorDeltas.size(); ti++) {
+		const TensorDelta &tensorDelta = _tensorDeltas[ti];
+
+		std::vector<cl_float> &data = snapshot._tensors[ti]._data;
+
+		size_t source = 0;
+
+		for (int i = 0; i < tensorDelta._tiles.size(); i++) {
+			size_t start = static_cast<size_t>(tensorDelta._tiles[i]) * _tileSize;
+			size_t end = std::min(start + _tileSize, data.size());
+
+			assert(source + (end - start) <= tensorDelta._data.size());
+
+			std::copy(tensorDelta._data.begin() + source, tensorDelta._data.begin() + source + (end - start), data.begin() + start);
+
+			source += end - start;
+		}
+	}
+
+	snapshot.rewind();
+
+	return true;
+}
+
+size_t SnapshotDelta::getNumChangedTiles() const {
+	size_t total = 0;
+
+	for (int ti = 0; ti < _tensorDeltas.size(); ti++)
+		total += _tensorDeltas[ti]._tiles.size();
+
+	return total;
+}
+
+size_t SnapshotDelta::getNumTiles() const {
+	size_t total = 0;
+
+	for (int ti = 0; ti < _tensorDeltas.size(); ti++)
+		total += (_tensorDeltas[ti]._numElements + _tileSize - 1) / _tileSize;
+
+	return total;
+}
+
+bool SnapshotDelta::writeToStream(std::ostream &os) const {
+	cl_ulong numBytes = _bytes.size();
+	cl_ulong numTensors = _tensorDeltas.size();
+
+	// Header
+	os.write(deltaMagic, sizeof(deltaMagic));
+	writeRaw(os, _version);
+	writeRaw(os, _tileSize);
+	writeRaw(os, _threshold);
+	writeRaw(os, numBytes);
+	writeRaw(os, numTensors);
+
+	// Parameters
+	if (!_bytes.empty())
+		os.write(_bytes.data(), _bytes.size());
+
+	// Tiles
+	for (int ti = 0; ti < _tensorDeltas.size(); ti++) {
+		const TensorDelta &tensorDelta = _tensorDeltas[ti];
+
+		cl_uint numTiles = static_cast<cl_uint>(tensorDelta._tiles.size());
+
+		writeRaw(os, tensorDelta._numElements);
+		writeRaw(os, numTiles);
+
+		if (numTiles > 0) {
+			os.write(reinterpret_cast<const char*>(tensorDelta._tiles.data()), tensorDelta._tiles.size() * sizeof(cl_uint));
+			os.write(reinterpret_cast<const char*>(tensorDelta._data.data()), tensorDelta._data.size() * sizeof(cl_float));
+		}
+	}
+
+	return os.good();
+}
+
+bool SnapshotDelta::readFromStream(std::istream &is) {
+	_bytes.clear();
+	_tensorDeltas.clear();
+
+	char magic[4];
+
+	is.read(magic, sizeof(magic));
+
+	if (!is.good() || std::memcmp(magic, deltaMagic, sizeof(magic)) != 0) {
+#ifdef SYS_DEBUG
+		std::cerr << "Not a NeoRL snapshot delta!" << std::endl;
+#endif
+		return false;
+	}
+
+	cl_uint version;
+	cl_ulong numBytes, numTensors;
+
+	readRaw(is, version);
+	readRaw(is, _tileSize);
+	readRaw(is, _threshold);
+	readRaw(is, numBytes);
+	readRaw(is, numTensors);
+
+	if (version != _version || _tileSize == 0) {
+#ifdef SYS_DEBUG
+		std::cerr << "Unsupported snapshot delta version " << version << "!" << std::endl;
+#endif
+		return false;
+	}
+
+	_bytes.resize(numBytes);
+
+	if (numBytes > 0)
+		is.read(_bytes.data(), numBytes);
+
+	_tensorDeltas.resize(numTensors);
+
+	for (int ti = 0; ti < _tensorDeltas.size() && is.good(); ti++) {
+		TensorDelta &tensorDelta = _tensorDeltas[ti];
+
+		cl_uint numTiles;
+
+		readRaw(is, tensorDelta._numElements);
+		readRaw(is, numTiles);
+
+		tensorDelta._tiles.resize(numTiles);
+
+		if (numTiles == 0)
+			continue;
+
+		is.read(reinterpret_cast<char*>(tensorDelta._tiles.data()), tensorDelta._tiles.size() * sizeof(cl_uint));
+
+		// Only the last tile of a tensor can be partial
+		size_t numElements = 0;
+
+		for (int i = 0; i < numTiles; i++) {
+			size_t start = static_cast<size_t>(tensorDelta._tiles[i]) * _tileSize;
+
+			if (start >= tensorDelta._numElements)
+				return false;
+
+			numElements += std::min(static_cast<size_t>(_tileSize), static_cast<size_t>(tensorDelta._numElements) - start);
+		}
+
+		tensorDelta._data.resize(numElements);
+
+		is.read(reinterpret_cast<char*>(tensorDelta._data.data()), tensorDelta._data.size() * sizeof(cl_float));
+	}
+
+	return is.good();
+}
+
+bool SnapshotDelta::saveToFile(const std::string &fileName) const {
+	std::string tempFileName = fileName + ".tmp";
+
+	{
+		std::ofstream toFile(tempFileName, std::ios::binary);
+
+		if (!toFile.is_open()) {
+#ifdef SYS_DEBUG
+			std::cerr << "Could not open file " << tempFileName << "!" << std::endl;
+#endif
+			return false;
+		}
+
+		if (!writeToStream(toFile))
+			return false;
+	}
+
+	std::remove(fileName.c_str());
+
+	return std::rename(tempFileName.c_str(), fileName.c_str()) == 0;
+}
+
+bool SnapshotDelta::loadFromFile(const std::string &fileName) {
+	std::ifstream fromFile(fileName, std::ios::binary);
+
+	if (!fromFile.is_open()) {
+#ifdef SYS_DEBUG
+		std::cerr << "Could not open file " << fileName << "!" << std::endl;
+#endif
+		return false;
+	}
+
+	return readFromStream(fromFile);
+}
+
+void SnapshotChain::create(cl_float threshold, cl_uint tileSize, int maxChainLength, float maxChangedFraction) {
+	assert(tileSize > 0);
+	assert(maxChainLength > 0);
+
+	_threshold = threshold;
+	_tileSize = tileSize;
+	_maxChainLength = maxChainLength;
+	_maxChangedFraction = maxChangedFraction;
+
+	_reference.clear();
+
+	_hasBase = false;
+	_chainLength = 0;
+	_lastChangedFraction = 0.0f;
+}
+
+void SnapshotChain::setBase(const Snapshot &base) {
+	// Copy only the data, the base may still be referenced elsewhere
+	_reference._bytes = base._bytes;
+	_reference._tensors = base._tensors;
+	_reference._readEvents.clear();
+	_reference._mapping = base._mapping;
+	_reference.unmap();
+	_reference.rewind();
+
+	_hasBase = true;
+	_chainLength = 0;
+	_lastChangedFraction = 0.0f;
+}
+
+bool SnapshotChain::append(const Snapshot &current, SnapshotDelta &delta) {
+	assert(_hasBase);
+
+	if (!delta.create(_reference, current, _threshold, _tileSize))
+		return false;
+
+	commit(delta);
+
+	return true;
+}
+
+void SnapshotChain::commit(const SnapshotDelta &delta) {
+	// Next delta is relative to what a restore would produce, not to the exact state
+	delta.applyTo(_reference);
+
+	_chainLength++;
+
+	size_t numTiles = delta.getNumTiles();
+
+	_lastChangedFraction = numTiles > 0 ? static_cast<float>(delta.getNumChangedTiles()) / numTiles : 0.0f;
+}
+
+bool SnapshotChain::save(const Snapshot &current, const std::string &fileName) {
+	if (!needsCompaction()) {
+		SnapshotDelta delta;
+
+		if (delta.create(_reference, current, _threshold, _tileSize)) {
+			if (!delta.saveToFile(fileName))
+				return false;
+
+			commit(delta);
+
+			return true;
+		}
+	}
+
+	if (!current.saveToFile(fileName))
+		return false;
+
+	setBase(current);
+
+	return true;
+}
+
+bool SnapshotChain::restore(const std::vector<std::string> &fileNames, Snapshot &snapshot) {
+	// Find the last full snapshot
+	int baseIndex = -1;
+
+	for (int fi = 0; fi < fileNames.size(); fi++) {
+		std::ifstream fromFile(fileNames[fi], std::ios::binary);
+
+		char magic[4];
+
+		fromFile.read(magic, sizeof(magic));
+
+		if (fromFile.good() && std::memcmp(magic, snapshotMagic, sizeof(magic)) == 0)
+			baseIndex = fi;
+	}
+
+	if (baseIndex == -1) {
+#ifdef SYS_DEBUG
+		std::cerr << "No full snapshot in chain!" << std::endl;
+#endif
+		return false;
+	}
+
+	if (!snapshot.loadFromFile(fileNames[baseIndex]))
+		return false;
+
+	for (int fi = baseIndex + 1; fi < fileNames.size(); fi++) {
+		SnapshotDelta delta;
+
+		if (!delta.loadFromFile(fileNames[fi]) || !delta.applyTo(snapshot)) {
+#ifdef SYS_DEBUG
+			std::cerr << "Could not apply delta " << fileNames[fi] << "!" << std::endl;
+#endif
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool SnapshotChain::compact(const std::vector<std::string> &fileNames, const std::string &outputFileName) {
+	Snapshot snapshot;
+
+	if (!restore(fileNames, snapshot))
+		return false;
+
+	return snapshot.saveToFile(outputFileName);
+}
\ No newline at end of file
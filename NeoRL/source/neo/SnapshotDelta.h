@@ -0,0 +1,235 @@
+#pragma once
+
+#include "Snapshot.h"
+
+namespace neo {
+	/*!
+	\brief Incremental snapshot
+	Stores the tiles of each tensor that changed by more than a threshold relative to a reference snapshot.
+	Tiles that changed less are quantized to the reference, so the error of a restored tensor is at most the threshold
+	*/
+	class SnapshotDelta {
+	public:
+		/*!
+		\brief Changed tiles of a tensor
+		*/
+		struct TensorDelta {
+			/*!
+			\brief Number of floats in the tensor (for validation)
+			*/
+			cl_ulong _numElements;
+
+			/*!
+			\brief Indices of changed tiles
+			*/
+			std::vector<cl_uint> _tiles;
+
+			/*!
+			\brief New values of the changed tiles, concatenated (the last tile of a tensor may be partial)
+			*/
+			std::vector<cl_float> _data;
+		};
+
+		/*!
+		\brief Format version, increased whenever the layout changes
+		*/
+		static const cl_uint _version = 1;
+
+	private:
+		/*!
+		\brief Parameter bytes (stored in full, they are small)
+		*/
+		std::vector<char> _bytes;
+
+		/*!
+		\brief Per tensor deltas, one for each tensor of the reference
+		*/
+		std::vector<TensorDelta> _tensorDeltas;
+
+		/*!
+		\brief Tile size in floats
+		*/
+		cl_uint _tileSize;
+
+		/*!
+		\brief Change threshold
+		*/
+		cl_float _threshold;
+
+	public:
+		/*!
+		\brief Initialize defaults
+		*/
+		SnapshotDelta()
+			: _tileSize(1024), _threshold(0.0f)
+		{}
+
+		/*!
+		\brief Create from a reference and the current snapshot (captures must be complete)
+		Returns false if the snapshots do not have the same structure
+		*/
+		bool create(const Snapshot &reference, const Snapshot &current, cl_float threshold, cl_uint tileSize = 1024);
+
+		/*!
+		\brief Apply to the snapshot the delta was created against (in place)
+		Returns false if the structure does not match
+		*/
+		bool applyTo(Snapshot &snapshot) const;
+
+		/*!
+		\brief Serialize
+		*/
+		bool writeToStream(std::ostream &os) const;
+
+		/*!
+		\brief Deserialize, replacing the current contents
+		*/
+		bool readFromStream(std::istream &is);
+
+		//!@{
+		/*!
+		\brief File helpers
+		*/
+		bool saveToFile(const std::string &fileName) const;
+		bool loadFromFile(const std::string &fileName);
+		//!@}
+
+		/*!
+		\brief Get number of changed tiles over all tensors
+		*/
+		size_t getNumChangedTiles() const;
+
+		/*!
+		\brief Get total number of tiles over all tensors
+		*/
+		size_t getNumTiles() const;
+
+		/*!
+		\brief Get tile size in floats
+		*/
+		cl_uint getTileSize() const {
+			return _tileSize;
+		}
+
+		/*!
+		\brief Get change threshold
+		*/
+		cl_float getThreshold() const {
+			return _threshold;
+		}
+	};
+
+	/*!
+	\brief Chain of incremental snapshots on top of a full snapshot
+	Keeps the reconstruction of base + deltas so far as the reference for the next delta, so quantization errors do not accumulate.
+	Compacts (starts over from a new full snapshot) when the chain gets long or a delta gets close to the size of a full snapshot
+	*/
+	class SnapshotChain {
+	private:
+		/*!
+		\brief Reconstruction of the base plus all deltas so far
+		*/
+		Snapshot _reference;
+
+		/*!
+		\brief Whether a base has been set
+		*/
+		bool _hasBase;
+
+		/*!
+		\brief Number of deltas since the base
+		*/
+		int _chainLength;
+
+		//!@{
+		/*!
+		\brief Delta parameters
+		*/
+		cl_float _threshold;
+		cl_uint _tileSize;
+		//!@}
+
+		//!@{
+		/*!
+		\brief Compaction parameters
+		*/
+		int _maxChainLength;
+		float _maxChangedFraction;
+		//!@}
+
+		/*!
+		\brief Fraction of tiles changed in the last delta
+		*/
+		float _lastChangedFraction;
+
+		/*!
+		\brief Advance the chain past a delta created against it
+		*/
+		void commit(const SnapshotDelta &delta);
+
+	public:
+		/*!
+		\brief Initialize defaults
+		*/
+		SnapshotChain()
+			: _hasBase(false), _chainLength(0),
+			_threshold(0.0001f), _tileSize(1024),
+			_maxChainLength(32), _maxChangedFraction(0.5f),
+			_lastChangedFraction(0.0f)
+		{}
+
+		/*!
+		\brief Set delta and compaction parameters
+		*/
+		void create(cl_float threshold, cl_uint tileSize = 1024, int maxChainLength = 32, float maxChangedFraction = 0.5f);
+
+		/*!
+		\brief Whether the next snapshot should be stored in full
+		*/
+		bool needsCompaction() const {
+			return !_hasBase || _chainLength >= _maxChainLength || _lastChangedFraction > _maxChangedFraction;
+		}
+
+		/*!
+		\brief Start a new chain from a full snapshot (captures must be complete)
+		*/
+		void setBase(const Snapshot &base);
+
+		/*!
+		\brief Create the delta of the current snapshot against the chain and append it
+		Returns false (and leaves the chain untouched) if the structure changed, in which case a new base is needed
+		*/
+		bool append(const Snapshot &current, SnapshotDelta &delta);
+
+		/*!
+		\brief Save the current snapshot to a file, in full or as a delta depending on the chain state
+		The chain only advances once the file was written, so a failed save can be retried
+		*/
+		bool save(const Snapshot &current, const std::string &fileName);
+
+		/*!
+		\brief Get the reconstruction of the base plus all deltas so far
+		*/
+		const Snapshot &getReference() const {
+			return _reference;
+		}
+
+		/*!
+		\brief Get number of deltas since the base
+		*/
+		int getChainLength() const {
+			return _chainLength;
+		}
+
+		/*!
+		\brief Restore from a list of files in the order they were written (full snapshots and deltas)
+		Starts from the last full snapshot in the list and applies the deltas after it
+		*/
+		static bool restore(const std::vector<std::string> &fileNames, Snapshot &snapshot);
+
+		/*!
+		\brief Compact a list of files into a single full snapshot file
+		*/
+		static bool compact(const std::vector<std::string> &fileNames, const std::string &outputFileName);
+	};
+}
\ No newline at end of file
@@ -1,7 +1,21 @@
 #include "SparseCoder.h"
 
+#include <algorithm>
+
 using namespace neo;
 
+static cl::array<cl::size_type, 3> imageRegion(const cl::Image2D &image) {
+	cl::array<cl::size_type, 3> region = { image.getImageInfo<CL_IMAGE_WIDTH>(), image.getImageInfo<CL_IMAGE_HEIGHT>(), 1 };
+
+	return region;
+}
+
+static cl::array<cl::size_type, 3> imageRegion(const cl::Image3D &image) {
+	cl::array<cl::size_type, 3> region = { image.getImageInfo<CL_IMAGE_WIDTH>(), image.getImageInfo<CL_IMAGE_HEIGHT>(), image.getImageInfo<CL_IMAGE_DEPTH>() };
+
+	return region;
+}
+
 void SparseCoder::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &program,
 	const std::vector<VisibleLayerDesc> &visibleLayerDescs, cl_int2 hiddenSize, cl_int lateralRadius, cl_float2 initWeightRange, cl_float2 initLateralWeightRange, cl_float initThreshold,
 	bool enableTraces,
@@ -41,6 +55,8 @@ void SparseCoder::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &prog
 
 		vl._reverseRadii = cl_int2 { static_cast<int>(std::ceil(vl._visibleToHidden.x * vld._radius)), static_cast<int>(std::ceil(vl._visibleToHidden.y * vld._radius)) };
 
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._radius, vl._reverseRadii);
+
 		// Create images
 		vl._reconstructionError = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
 
@@ -85,6 +101,10 @@ void SparseCoder::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &prog
 	cs.getQueue().enqueueFillImage(_hiddenActivations[_back], zeroColor, zeroOrigin, hiddenRegion);
 
 	// Create kernels
+	createKernels(program);
+}
+
+void SparseCoder::createKernels(sys::ComputeProgram &program) {
 	_reconstructVisibleErrorKernel = cl::Kernel(program.getProgram(), "scReconstructVisibleError");
 	_activateFromReconstructionErrorKernel = cl::Kernel(program.getProgram(), "scActivateFromReconstructionError");
 	_solveHiddenKernel = cl::Kernel(program.getProgram(), "scSolveHidden");
@@ -92,6 +112,13 @@ void SparseCoder::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &prog
 	_learnWeightsKernel = cl::Kernel(program.getProgram(), "scLearnSparseCoderWeights");
 	_learnWeightsTracesKernel = cl::Kernel(program.getProgram(), "scLearnSparseCoderWeightsTraces");
 	_learnWeightsLateralKernel = cl::Kernel(program.getProgram(), "scLearnSparseCoderWeightsLateral");
+	_countSpikeChangesKernel = cl::Kernel(program.getProgram(), "scCountSpikeChanges");
+	_solvePersistentKernel = cl::Kernel(program.getProgram(), "scSolvePersistent");
+
+	// Sizes may have changed, recreated on use
+	_packedLayers = cl::Buffer();
+
+	_inferenceOnly = false;
 }
 
 void SparseCoder::reconstructError(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates) {
@@ -105,18 +132,227 @@ void SparseCoder::reconstructError(sys::ComputeSystem &cs, const std::vector<cl:
 		_reconstructVisibleErrorKernel.setArg(argIndex++, visibleStates[vli]);
 		_reconstructVisibleErrorKernel.setArg(argIndex++, vl._reconstructionError);
 		_reconstructVisibleErrorKernel.setArg(argIndex++, vl._weights[_back]);
+		vl._fieldTables.setVisibleArgs(_reconstructVisibleErrorKernel, argIndex);
 		_reconstructVisibleErrorKernel.setArg(argIndex++, vld._size);
-		_reconstructVisibleErrorKernel.setArg(argIndex++, _hiddenSize);
-		_reconstructVisibleErrorKernel.setArg(argIndex++, vl._visibleToHidden);
-		_reconstructVisibleErrorKernel.setArg(argIndex++, vl._hiddenToVisible);
-		_reconstructVisibleErrorKernel.setArg(argIndex++, vld._radius);
-		_reconstructVisibleErrorKernel.setArg(argIndex++, vl._reverseRadii);
 
-		cs.getQueue().enqueueNDRangeKernel(_reconstructVisibleErrorKernel, cl::NullRange, cl::NDRange(vld._size.x, vld._size.y));
+		cs.enqueueKernel(_reconstructVisibleErrorKernel, cl::NDRange(vld._size.x, vld._size.y));
 	}
 }
 
 void SparseCoder::activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, cl_int iterations, cl_float leak) {
+	beginActivate(cs);
+
+	for (cl_int iter = 0; iter < iterations; iter++)
+		iterate(cs, visibleStates, iter, leak);
+
+	_iterationsUsed = iterations;
+}
+
+cl_int SparseCoder::activateAdaptive(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, cl_int maxIterations, cl_float leak,
+	cl_float tolerance, cl_int readbackLag)
+{
+	if (_changeCounts() == nullptr || _changeCounts.getInfo<CL_MEM_SIZE>() < maxIterations * sizeof(cl_int))
+		_changeCounts = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, maxIterations * sizeof(cl_int));
+
+	cs.getQueue().enqueueFillBuffer(_changeCounts, static_cast<cl_int>(0), 0, maxIterations * sizeof(cl_int));
+
+	int maxChanges = static_cast<int>(tolerance * _hiddenSize.x * _hiddenSize.y);
+
+	std::vector<cl_int> counts(maxIterations);
+	std::vector<cl::Event> readEvents(maxIterations);
+
+	beginActivate(cs);
+
+	cl_int iterations = 0;
+
+	while (iterations < maxIterations) {
+		iterate(cs, visibleStates, iterations, leak);
+
+		// Spikes were swapped, front holds the previous iteration's
+		{
+			int argIndex = 0;
+
+			_countSpikeChangesKernel.setArg(argIndex++, _hiddenSpikes[_back]);
+			_countSpikeChangesKernel.setArg(argIndex++, _hiddenSpikes[_front]);
+			_countSpikeChangesKernel.setArg(argIndex++, _changeCounts);
+			_countSpikeChangesKernel.setArg(argIndex++, iterations);
+
+			cs.enqueueKernel(_countSpikeChangesKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		}
+
+		cs.getQueue().enqueueReadBuffer(_changeCounts, CL_FALSE, iterations * sizeof(cl_int), sizeof(cl_int), &counts[iterations], nullptr, &readEvents[iterations]);
+
+		iterations++;
+
+		// Check the iteration readbackLag behind, later ones stay queued
+		int checked = iterations - 1 - readbackLag;
+
+		if (checked >= 0) {
+			readEvents[checked].wait();
+
+			if (counts[checked] <= maxChanges)
+				break;
+		}
+	}
+
+	// Host counts must stay valid until the outstanding reads complete
+	for (int i = std::max(0, iterations - readbackLag); i < iterations; i++)
+		readEvents[i].wait();
+
+	_iterationsUsed = iterations;
+
+	return iterations;
+}
+
+bool SparseCoder::activatePersistent(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, cl_int iterations, cl_float leak) {
+	int numHidden = _hiddenSize.x * _hiddenSize.y;
+
+	// Spikes (double buffered), states and activations
+	cl::size_type localSize = numHidden * sizeof(cl_float);
+
+	if (4 * localSize > cs.getDevice().getInfo<CL_DEVICE_LOCAL_MEM_SIZE>()) {
+		activate(cs, visibleStates, iterations, leak);
+
+		return false;
+	}
+
+	if (_packedLayers() == nullptr)
+		createPackedBuffers(cs);
+
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+
+	// Pack the visible layers
+	cl::size_type visibleOffset = 0;
+	cl::size_type weightOffset = 0;
+
+	int maxVisible = 0;
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		cs.getQueue().enqueueCopyImageToBuffer(vl._weights[_back], _packedWeights, zeroOrigin, imageRegion(vl._weights[_back]), weightOffset);
+		cs.getQueue().enqueueCopyImageToBuffer(visibleStates[vli], _packedVisibleStates, zeroOrigin, imageRegion(visibleStates[vli]), visibleOffset);
+		cs.getQueue().enqueueCopyImageToBuffer(vl._reconstructionError, _packedReconstructionErrors, zeroOrigin, imageRegion(vl._reconstructionError), visibleOffset);
+
+		int numVisible = vld._size.x * vld._size.y;
+
+		visibleOffset += numVisible * sizeof(cl_float);
+		weightOffset += vl._weights[_back].getImageInfo<CL_IMAGE_DEPTH>() * numHidden * (vl._weights[_back].getImageInfo<CL_IMAGE_FORMAT>().image_channel_order == CL_RG ? 2 : 1) * sizeof(cl_float);
+
+		maxVisible = std::max(maxVisible, numVisible);
+	}
+
+	cs.getQueue().enqueueCopyImageToBuffer(_lateralWeights[_back], _packedLateralWeights, zeroOrigin, imageRegion(_lateralWeights[_back]), 0);
+	cs.getQueue().enqueueCopyImageToBuffer(_hiddenThresholds[_back], _packedThresholds, zeroOrigin, imageRegion(_hiddenThresholds[_back]), 0);
+	cs.getQueue().enqueueCopyImageToBuffer(_hiddenSpikes[_back], _packedSpikes, zeroOrigin, imageRegion(_hiddenSpikes[_back]), 0);
+
+	// Clear previous aggregate state information
+	cs.getQueue().enqueueFillBuffer(_packedStates, static_cast<cl_float>(0.0f), 0, localSize);
+	cs.getQueue().enqueueFillBuffer(_packedActivations, static_cast<cl_float>(0.0f), 0, localSize);
+
+	{
+		int argIndex = 0;
+
+		_solvePersistentKernel.setArg(argIndex++, _packedWeights);
+		_solvePersistentKernel.setArg(argIndex++, _packedVisibleStates);
+		_solvePersistentKernel.setArg(argIndex++, _packedReconstructionErrors);
+		_solvePersistentKernel.setArg(argIndex++, _packedLayers);
+		_solvePersistentKernel.setArg(argIndex++, _packedLayerTransforms);
+		_solvePersistentKernel.setArg(argIndex++, static_cast<cl_int>(_visibleLayers.size()));
+		_solvePersistentKernel.setArg(argIndex++, _packedThresholds);
+		_solvePersistentKernel.setArg(argIndex++, _packedLateralWeights);
+		_solvePersistentKernel.setArg(argIndex++, _packedSpikes);
+		_solvePersistentKernel.setArg(argIndex++, _packedStates);
+		_solvePersistentKernel.setArg(argIndex++, _packedActivations);
+		_solvePersistentKernel.setArg(argIndex++, cl::Local(localSize));
+		_solvePersistentKernel.setArg(argIndex++, cl::Local(localSize));
+		_solvePersistentKernel.setArg(argIndex++, cl::Local(localSize));
+		_solvePersistentKernel.setArg(argIndex++, cl::Local(localSize));
+		_solvePersistentKernel.setArg(argIndex++, _hiddenSize);
+		_solvePersistentKernel.setArg(argIndex++, _lateralRadius);
+		_solvePersistentKernel.setArg(argIndex++, leak);
+		_solvePersistentKernel.setArg(argIndex++, iterations);
+
+		// Single work-group, so barriers synchronize the whole solver
+		cl::size_type groupSize = std::min<cl::size_type>(_solvePersistentKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cs.getDevice()), std::max(numHidden, maxVisible));
+
+		cs.getQueue().enqueueNDRangeKernel(_solvePersistentKernel, cl::NullRange, cl::NDRange(groupSize), cl::NDRange(groupSize));
+	}
+
+	// Unpack results
+	cs.getQueue().enqueueCopyBufferToImage(_packedSpikes, _hiddenSpikes[_back], 0, zeroOrigin, imageRegion(_hiddenSpikes[_back]));
+	cs.getQueue().enqueueCopyBufferToImage(_packedStates, _hiddenStates[_back], 0, zeroOrigin, imageRegion(_hiddenStates[_back]));
+	cs.getQueue().enqueueCopyBufferToImage(_packedActivations, _hiddenActivations[_back], 0, zeroOrigin, imageRegion(_hiddenActivations[_back]));
+
+	visibleOffset = 0;
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		cs.getQueue().enqueueCopyBufferToImage(_packedReconstructionErrors, vl._reconstructionError, visibleOffset, zeroOrigin, imageRegion(vl._reconstructionError));
+
+		visibleOffset += vld._size.x * vld._size.y * sizeof(cl_float);
+	}
+
+	_iterationsUsed = iterations;
+
+	return true;
+}
+
+void SparseCoder::createPackedBuffers(sys::ComputeSystem &cs) {
+	int numHidden = _hiddenSize.x * _hiddenSize.y;
+
+	std::vector<cl_int> layers(_visibleLayers.size() * 8);
+	std::vector<cl_float> layerTransforms(_visibleLayers.size() * 4);
+
+	int visibleOffset = 0;
+	int weightOffset = 0;
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int weightDiam = vld._radius * 2 + 1;
+
+		int channels = vl._weights[_back].getImageInfo<CL_IMAGE_FORMAT>().image_channel_order == CL_RG ? 2 : 1;
+
+		cl_int* layer = &layers[vli * 8];
+
+		layer[0] = vld._size.x;
+		layer[1] = vld._size.y;
+		layer[2] = vld._radius;
+		layer[3] = channels;
+		layer[4] = visibleOffset;
+		layer[5] = weightOffset;
+		layer[6] = vl._reverseRadii.x;
+		layer[7] = vl._reverseRadii.y;
+
+		layerTransforms[vli * 4 + 0] = vl._hiddenToVisible.x;
+		layerTransforms[vli * 4 + 1] = vl._hiddenToVisible.y;
+		layerTransforms[vli * 4 + 2] = vl._visibleToHidden.x;
+		layerTransforms[vli * 4 + 3] = vl._visibleToHidden.y;
+
+		visibleOffset += vld._size.x * vld._size.y;
+		weightOffset += numHidden * weightDiam * weightDiam * channels;
+	}
+
+	int lateralWeightDiam = _lateralRadius * 2 + 1;
+
+	_packedWeights = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, std::max(1, weightOffset) * sizeof(cl_float));
+	_packedVisibleStates = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, std::max(1, visibleOffset) * sizeof(cl_float));
+	_packedReconstructionErrors = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, std::max(1, visibleOffset) * sizeof(cl_float));
+	_packedLayers = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, std::max<size_t>(1, layers.size()) * sizeof(cl_int), layers.data());
+	_packedLayerTransforms = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, std::max<size_t>(1, layerTransforms.size()) * sizeof(cl_float), layerTransforms.data());
+	_packedLateralWeights = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, numHidden * lateralWeightDiam * lateralWeightDiam * sizeof(cl_float));
+	_packedThresholds = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, numHidden * sizeof(cl_float));
+	_packedSpikes = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, numHidden * sizeof(cl_float));
+	_packedStates = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, numHidden * sizeof(cl_float));
+	_packedActivations = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE, numHidden * sizeof(cl_float));
+}
+
+void SparseCoder::beginActivate(sys::ComputeSystem &cs) {
 	// Clear previous aggregate state information
 	{
 		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
@@ -127,69 +363,71 @@ void SparseCoder::activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D
 		cs.getQueue().enqueueFillImage(_hiddenStates[_back], zeroColor, zeroOrigin, hiddenRegion);
 		cs.getQueue().enqueueFillImage(_hiddenActivations[_back], zeroColor, zeroOrigin, hiddenRegion);
 	}
+}
 
-	for (cl_int iter = 0; iter < iterations; iter++) {
-		// Start by clearing summation buffer
-		{
-			cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+void SparseCoder::iterate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, cl_int iter, cl_float leak) {
+	// Start by clearing summation buffer
+	{
+		cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
 
-			cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
-			cl::array<cl::size_type, 3> hiddenRegion = { _hiddenSize.x, _hiddenSize.y, 1 };
+		cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+		cl::array<cl::size_type, 3> hiddenRegion = { _hiddenSize.x, _hiddenSize.y, 1 };
 
-			cs.getQueue().enqueueFillImage(_hiddenSummationTemp[_back], zeroColor, zeroOrigin, hiddenRegion);
-		}
+		cs.getQueue().enqueueFillImage(_hiddenSummationTemp[_back], zeroColor, zeroOrigin, hiddenRegion);
+	}
 
-		for (int vli = 0; vli < _visibleLayers.size(); vli++) {
-			VisibleLayer &vl = _visibleLayers[vli];
-			VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
 
-			int argIndex = 0;
+		int argIndex = 0;
 
-			_activateFromReconstructionErrorKernel.setArg(argIndex++, vl._reconstructionError);
-			_activateFromReconstructionErrorKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
-			_activateFromReconstructionErrorKernel.setArg(argIndex++, _hiddenSummationTemp[_front]);
-			_activateFromReconstructionErrorKernel.setArg(argIndex++, vl._weights[_back]);
-			_activateFromReconstructionErrorKernel.setArg(argIndex++, vld._size);
-			_activateFromReconstructionErrorKernel.setArg(argIndex++, vl._hiddenToVisible);
-			_activateFromReconstructionErrorKernel.setArg(argIndex++, vld._radius);
+		_activateFromReconstructionErrorKernel.setArg(argIndex++, vl._reconstructionError);
+		_activateFromReconstructionErrorKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
+		_activateFromReconstructionErrorKernel.setArg(argIndex++, _hiddenSummationTemp[_front]);
+		_activateFromReconstructionErrorKernel.setArg(argIndex++, vl._weights[_back]);
+		_activateFromReconstructionErrorKernel.setArg(argIndex++, vld._size);
+		vl._fieldTables.setHiddenArgs(_activateFromReconstructionErrorKernel, argIndex);
+		_activateFromReconstructionErrorKernel.setArg(argIndex++, vld._radius);
 
-			cs.getQueue().enqueueNDRangeKernel(_activateFromReconstructionErrorKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_activateFromReconstructionErrorKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
-			// Swap buffers
-			std::swap(_hiddenSummationTemp[_front], _hiddenSummationTemp[_back]);
-		}
+		// Swap buffers
+		std::swap(_hiddenSummationTemp[_front], _hiddenSummationTemp[_back]);
+	}
 
-		// Back now contains the sums. Solve sparse codes from this
-		{
-			int argIndex = 0;
+	// Back now contains the sums. Solve sparse codes from this
+	{
+		int argIndex = 0;
 
-			_solveHiddenKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
-			_solveHiddenKernel.setArg(argIndex++, _hiddenSpikes[_back]);
-			_solveHiddenKernel.setArg(argIndex++, _hiddenSpikes[_front]);
-			_solveHiddenKernel.setArg(argIndex++, _hiddenStates[_back]);
-			_solveHiddenKernel.setArg(argIndex++, _hiddenStates[_front]);
-			_solveHiddenKernel.setArg(argIndex++, _hiddenActivations[_back]);
-			_solveHiddenKernel.setArg(argIndex++, _hiddenActivations[_front]);
-			_solveHiddenKernel.setArg(argIndex++, _hiddenThresholds[_back]);
-			_solveHiddenKernel.setArg(argIndex++, _lateralWeights[_back]);
-			_solveHiddenKernel.setArg(argIndex++, _hiddenSize);
-			_solveHiddenKernel.setArg(argIndex++, _lateralRadius);
-			_solveHiddenKernel.setArg(argIndex++, leak);
-			_solveHiddenKernel.setArg(argIndex++, 1.0f / (1.0f + iter));
-
-			cs.getQueue().enqueueNDRangeKernel(_solveHiddenKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
-		}
+		_solveHiddenKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
+		_solveHiddenKernel.setArg(argIndex++, _hiddenSpikes[_back]);
+		_solveHiddenKernel.setArg(argIndex++, _hiddenSpikes[_front]);
+		_solveHiddenKernel.setArg(argIndex++, _hiddenStates[_back]);
+		_solveHiddenKernel.setArg(argIndex++, _hiddenStates[_front]);
+		_solveHiddenKernel.setArg(argIndex++, _hiddenActivations[_back]);
+		_solveHiddenKernel.setArg(argIndex++, _hiddenActivations[_front]);
+		_solveHiddenKernel.setArg(argIndex++, _hiddenThresholds[_back]);
+		_solveHiddenKernel.setArg(argIndex++, _lateralWeights[_back]);
+		_solveHiddenKernel.setArg(argIndex++, _hiddenSize);
+		_solveHiddenKernel.setArg(argIndex++, _lateralRadius);
+		_solveHiddenKernel.setArg(argIndex++, leak);
+		_solveHiddenKernel.setArg(argIndex++, 1.0f / (1.0f + iter));
+
+		cs.enqueueKernel(_solveHiddenKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+	}
 
-		// Swap hidden state buffers
-		std::swap(_hiddenSpikes[_front], _hiddenSpikes[_back]);
-		std::swap(_hiddenStates[_front], _hiddenStates[_back]);
-		std::swap(_hiddenActivations[_front], _hiddenActivations[_back]);
+	// Swap hidden state buffers
+	std::swap(_hiddenSpikes[_front], _hiddenSpikes[_back]);
+	std::swap(_hiddenStates[_front], _hiddenStates[_back]);
+	std::swap(_hiddenActivations[_front], _hiddenActivations[_back]);
 
-		reconstructError(cs, visibleStates);
-	}
+	reconstructError(cs, visibleStates);
 }
 
 void SparseCoder::learn(sys::ComputeSystem &cs, float weightAlpha, float weightLateralAlpha, float thresholdAlpha, float activeRatio) {
+	assert(!_inferenceOnly);
+
 	// Learn Thresholds
 	{
 		int argIndex = 0;
@@ -200,7 +438,7 @@ void SparseCoder::learn(sys::ComputeSystem &cs, float weightAlpha, float weightL
 		_learnThresholdsKernel.setArg(argIndex++, thresholdAlpha);
 		_learnThresholdsKernel.setArg(argIndex++, activeRatio);
 
-		cs.getQueue().enqueueNDRangeKernel(_learnThresholdsKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_learnThresholdsKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		std::swap(_hiddenThresholds[_front], _hiddenThresholds[_back]);
 	}
@@ -217,11 +455,11 @@ void SparseCoder::learn(sys::ComputeSystem &cs, float weightAlpha, float weightL
 		_learnWeightsKernel.setArg(argIndex++, vl._weights[_back]);
 		_learnWeightsKernel.setArg(argIndex++, vl._weights[_front]);
 		_learnWeightsKernel.setArg(argIndex++, vld._size);
-		_learnWeightsKernel.setArg(argIndex++, vl._hiddenToVisible);
+		vl._fieldTables.setHiddenArgs(_learnWeightsKernel, argIndex);
 		_learnWeightsKernel.setArg(argIndex++, vld._radius);
 		_learnWeightsKernel.setArg(argIndex++, weightAlpha);
 
-		cs.getQueue().enqueueNDRangeKernel(_learnWeightsKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_learnWeightsKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		std::swap(vl._weights[_front], vl._weights[_back]);
 	}
@@ -238,13 +476,15 @@ void SparseCoder::learn(sys::ComputeSystem &cs, float weightAlpha, float weightL
 		_learnWeightsLateralKernel.setArg(argIndex++, weightLateralAlpha);
 		_learnWeightsLateralKernel.setArg(argIndex++, activeRatio * activeRatio);
 
-		cs.getQueue().enqueueNDRangeKernel(_learnWeightsLateralKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_learnWeightsLateralKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		std::swap(_lateralWeights[_front], _lateralWeights[_back]);
 	}
 }
 
 void SparseCoder::learnTrace(sys::ComputeSystem &cs, const cl::Image2D &rewards, float weightAlpha, float weightLateralAlpha, float weightTraceLambda, float thresholdAlpha, float activeRatio) {
+	assert(!_inferenceOnly);
+
 	// Learn Thresholds
 	{
 		int argIndex = 0;
@@ -255,7 +495,7 @@ void SparseCoder::learnTrace(sys::ComputeSystem &cs, const cl::Image2D &rewards,
 		_learnThresholdsKernel.setArg(argIndex++, thresholdAlpha);
 		_learnThresholdsKernel.setArg(argIndex++, activeRatio);
 
-		cs.getQueue().enqueueNDRangeKernel(_learnThresholdsKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_learnThresholdsKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		std::swap(_hiddenThresholds[_front], _hiddenThresholds[_back]);
 	}
@@ -273,12 +513,12 @@ void SparseCoder::learnTrace(sys::ComputeSystem &cs, const cl::Image2D &rewards,
 		_learnWeightsTracesKernel.setArg(argIndex++, vl._weights[_front]);
 		_learnWeightsTracesKernel.setArg(argIndex++, rewards);
 		_learnWeightsTracesKernel.setArg(argIndex++, vld._size);
-		_learnWeightsTracesKernel.setArg(argIndex++, vl._hiddenToVisible);
+		vl._fieldTables.setHiddenArgs(_learnWeightsTracesKernel, argIndex);
 		_learnWeightsTracesKernel.setArg(argIndex++, vld._radius);
 		_learnWeightsTracesKernel.setArg(argIndex++, weightAlpha);
 		_learnWeightsTracesKernel.setArg(argIndex++, weightTraceLambda);
 
-		cs.getQueue().enqueueNDRangeKernel(_learnWeightsTracesKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_learnWeightsTracesKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		std::swap(vl._weights[_front], vl._weights[_back]);
 	}
@@ -295,8 +535,124 @@ void SparseCoder::learnTrace(sys::ComputeSystem &cs, const cl::Image2D &rewards,
 		_learnWeightsLateralKernel.setArg(argIndex++, weightLateralAlpha);
 		_learnWeightsLateralKernel.setArg(argIndex++, activeRatio * activeRatio);
 
-		cs.getQueue().enqueueNDRangeKernel(_learnWeightsLateralKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_learnWeightsLateralKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 
 		std::swap(_lateralWeights[_front], _lateralWeights[_back]);
 	}
+}
+
+void SparseCoder::writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const {
+	snapshot.write(_hiddenSize);
+	snapshot.write(_lateralRadius);
+
+	snapshot.writeImage(cs, _hiddenSpikes[_back]);
+	snapshot.writeImage(cs, _hiddenStates[_back]);
+	snapshot.writeImage(cs, _hiddenActivations[_back]);
+	snapshot.writeImage(cs, _hiddenThresholds[_back]);
+	snapshot.writeImage(cs, _lateralWeights[_back]);
+
+	// Layer information
+	snapshot.write(static_cast<cl_int>(_visibleLayers.size()));
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		const VisibleLayer &vl = _visibleLayers[vli];
+		const VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		// Desc
+		snapshot.write(vld._size);
+		snapshot.write(vld._radius);
+		snapshot.write(static_cast<cl_int>(vld._ignoreMiddle));
+
+		// Weights carry traces in a second channel when enabled
+		snapshot.write(vl._weights[_back].getImageInfo<CL_IMAGE_FORMAT>().image_channel_order);
+
+		// Layer
+		snapshot.writeImage(cs, vl._reconstructionError);
+		snapshot.writeImage(cs, vl._weights[_back]);
+
+		snapshot.write(vl._hiddenToVisible);
+		snapshot.write(vl._visibleToHidden);
+		snapshot.write(vl._reverseRadii);
+	}
+}
+
+void SparseCoder::readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot, bool inferenceOnly) {
+	snapshot.read(_hiddenSize);
+	snapshot.read(_lateralRadius);
+
+	_hiddenStates = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+	_hiddenSpikes = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+	_hiddenActivations = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+
+	_hiddenThresholds = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+
+	_hiddenSummationTemp = createDoubleBuffer2D(cs, _hiddenSize, CL_R, CL_FLOAT);
+
+	{
+		int lateralWeightDiam = _lateralRadius * 2 + 1;
+
+		int numLateralWeights = lateralWeightDiam * lateralWeightDiam;
+
+		cl_int3 lateralWeightsSize = cl_int3{ _hiddenSize.x, _hiddenSize.y, numLateralWeights };
+
+		_lateralWeights = createDoubleBuffer3D(cs, lateralWeightsSize, CL_R, CL_FLOAT);
+	}
+
+	snapshot.readImage(cs, _hiddenSpikes[_back]);
+	snapshot.readImage(cs, _hiddenStates[_back]);
+	snapshot.readImage(cs, _hiddenActivations[_back]);
+	snapshot.readImage(cs, _hiddenThresholds[_back]);
+	snapshot.readImage(cs, _lateralWeights[_back], inferenceOnly);
+
+	// Layer information
+	cl_int numLayers;
+
+	snapshot.read(numLayers);
+
+	_visibleLayerDescs.resize(numLayers);
+	_visibleLayers.resize(numLayers);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		// Desc
+		cl_int ignoreMiddle;
+
+		snapshot.read(vld._size);
+		snapshot.read(vld._radius);
+		snapshot.read(ignoreMiddle);
+
+		vld._ignoreMiddle = ignoreMiddle != 0;
+
+		cl_channel_order weightChannels;
+
+		snapshot.read(weightChannels);
+
+		// Layer
+		vl._reconstructionError = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
+
+		int weightDiam = vld._radius * 2 + 1;
+
+		int numWeights = weightDiam * weightDiam;
+
+		cl_int3 weightsSize = cl_int3{ _hiddenSize.x, _hiddenSize.y, numWeights };
+
+		vl._weights = createDoubleBuffer3D(cs, weightsSize, weightChannels, CL_FLOAT);
+
+		snapshot.readImage(cs, vl._reconstructionError);
+
+		// Traces are state, so only plain weights can stay in a mapping
+		snapshot.readImage(cs, vl._weights[_back], inferenceOnly);
+
+		snapshot.read(vl._hiddenToVisible);
+		snapshot.read(vl._visibleToHidden);
+		snapshot.read(vl._reverseRadii);
+
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._radius, vl._reverseRadii);
+	}
+
+	createKernels(program);
+
+	_inferenceOnly = inferenceOnly;
 }
\ No newline at end of file
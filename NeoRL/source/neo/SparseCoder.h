@@ -1,6 +1,7 @@
 #pragma once
 
-#include "Helpers.h"
+#include "Snapshot.h"
+#include "FieldTables.h"
 
 namespace neo {
 	/*!
@@ -63,6 +64,11 @@ namespace neo {
 			\brief Radius onto hidden (reverse from visible layer desc)
 			*/
 			cl_int2 _reverseRadii;
+
+			/*!
+			\brief Precomputed receptive field connectivity
+			*/
+			FieldTables _fieldTables;
 		};
 
 	private:
@@ -115,14 +121,72 @@ namespace neo {
 		cl::Kernel _learnWeightsKernel;
 		cl::Kernel _learnWeightsTracesKernel;
 		cl::Kernel _learnWeightsLateralKernel;
+		cl::Kernel _countSpikeChangesKernel;
+		cl::Kernel _solvePersistentKernel;
 		//!@}
 
+		//!@{
+		/*!
+		\brief Persistent solver buffers (visible layers packed into flat buffers, hidden layer as buffers)
+		*/
+		cl::Buffer _packedWeights;
+		cl::Buffer _packedVisibleStates;
+		cl::Buffer _packedReconstructionErrors;
+		cl::Buffer _packedLayers;
+		cl::Buffer _packedLayerTransforms;
+		cl::Buffer _packedLateralWeights;
+		cl::Buffer _packedThresholds;
+		cl::Buffer _packedSpikes;
+		cl::Buffer _packedStates;
+		cl::Buffer _packedActivations;
+		//!@}
+
+		/*!
+		\brief Per iteration counts of changed spikes (adaptive activation)
+		*/
+		cl::Buffer _changeCounts;
+
+		/*!
+		\brief Number of iterations run by the last activation
+		*/
+		cl_int _iterationsUsed;
+
+		/*!
+		\brief Whether the weights were read for inference only (possibly shared with a mapped snapshot, never written)
+		*/
+		bool _inferenceOnly;
+
+		/*!
+		\brief Create kernels from the program
+		*/
+		void createKernels(sys::ComputeProgram &program);
+
 		/*!
 		\brief Reconstruct and find error to inputs
 		*/
 		void reconstructError(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates);
 
+		//!@{
+		/*!
+		\brief Activation steps (clear aggregate state, then one iteration at a time)
+		*/
+		void beginActivate(sys::ComputeSystem &cs);
+		void iterate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, cl_int iter, cl_float leak);
+		//!@}
+
+		/*!
+		\brief Create the persistent solver buffers and layer descriptors
+		*/
+		void createPackedBuffers(sys::ComputeSystem &cs);
+
 	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		SparseCoder()
+			: _iterationsUsed(0), _inferenceOnly(false)
+		{}
+
 		/*!
 		\brief Create a comparison sparse coder with random initialization
 		Requires the compute system, program with the NeoRL kernels, and initialization information
@@ -138,6 +202,30 @@ namespace neo {
 		*/
 		void activate(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, cl_int iterations, cl_float leak);
 
+		/*!
+		\brief Activate, stopping early once the spikes settle, returns the number of iterations run
+		Stops after the first iteration in which at most tolerance (fraction) of the hidden units changed their spike.
+		Change counts are read back asynchronously readbackLag iterations behind, so the device keeps that many iterations queued
+		(and up to that many run past convergence)
+		*/
+		cl_int activateAdaptive(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, cl_int maxIterations, cl_float leak,
+			cl_float tolerance, cl_int readbackLag = 2);
+
+		/*!
+		\brief Activate with all iterations in a single launch, equivalent to activate
+		Runs on one work-group with the hidden layer in local memory, for small coders where launch overhead dominates.
+		Visible states must be single channel float images. Falls back to activate (returning false) if the hidden layer
+		does not fit in local memory
+		*/
+		bool activatePersistent(sys::ComputeSystem &cs, const std::vector<cl::Image2D> &visibleStates, cl_int iterations, cl_float leak);
+
+		/*!
+		\brief Get the number of iterations run by the last activation
+		*/
+		cl_int getIterationsUsed() const {
+			return _iterationsUsed;
+		}
+
 		//!@{
 		/*!
 		\brief Learn functions, with and without eligibility traces/rewards
@@ -146,6 +234,25 @@ namespace neo {
 		void learnTrace(sys::ComputeSystem &cs, const cl::Image2D &rewards, float weightAlpha, float weightLateralAlpha, float weightTraceLambda, float thresholdAlpha, float activeRatio);
 		//!@}
 
+		/*!
+		\brief Write to snapshot (non-blocking)
+		Includes the traces stored alongside the weights when enabled
+		*/
+		void writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const;
+
+		/*!
+		\brief Read from snapshot
+		With inferenceOnly, the weights may be created over the data of a mapped snapshot (see Snapshot::readImage), the model then can not learn
+		*/
+		void readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot, bool inferenceOnly = false);
+
+		/*!
+		\brief Whether the model was read for inference only
+		*/
+		bool isInferenceOnly() const {
+			return _inferenceOnly;
+		}
+
 		/*!
 		\brief Get number of visible layers
 		*/
@@ -0,0 +1,119 @@
+#include "StateSlot.h"
+
+using namespace neo;
+
+static cl::array<cl::size_type, 3> imageRegion(const cl::Image2D &image) {
+	cl::array<cl::size_type, 3> region = { image.getImageInfo<CL_IMAGE_WIDTH>(), image.getImageInfo<CL_IMAGE_HEIGHT>(), 1 };
+
+	return region;
+}
+
+static cl::array<cl::size_type, 3> imageRegion(const cl::Image3D &image) {
+	cl::array<cl::size_type, 3> region = { image.getImageInfo<CL_IMAGE_WIDTH>(), image.getImageInfo<CL_IMAGE_HEIGHT>(), image.getImageInfo<CL_IMAGE_DEPTH>() };
+
+	return region;
+}
+
+static cl::Image2D createLike(sys::ComputeSystem &cs, const cl::Image2D &image) {
+	return cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, image.getImageInfo<CL_IMAGE_FORMAT>(), image.getImageInfo<CL_IMAGE_WIDTH>(), image.getImageInfo<CL_IMAGE_HEIGHT>());
+}
+
+static cl::Image3D createLike(sys::ComputeSystem &cs, const cl::Image3D &image) {
+	return cl::Image3D(cs.getContext(), CL_MEM_READ_WRITE, image.getImageInfo<CL_IMAGE_FORMAT>(), image.getImageInfo<CL_IMAGE_WIDTH>(), image.getImageInfo<CL_IMAGE_HEIGHT>(), image.getImageInfo<CL_IMAGE_DEPTH>());
+}
+
+static bool sameLayout(const cl::Image &left, const cl::Image &right) {
+	cl::ImageFormat leftFormat = left.getImageInfo<CL_IMAGE_FORMAT>();
+	cl::ImageFormat rightFormat = right.getImageInfo<CL_IMAGE_FORMAT>();
+
+	return leftFormat.image_channel_order == rightFormat.image_channel_order && leftFormat.image_channel_data_type == rightFormat.image_channel_data_type &&
+		left.getImageInfo<CL_IMAGE_WIDTH>() == right.getImageInfo<CL_IMAGE_WIDTH>() &&
+		left.getImageInfo<CL_IMAGE_HEIGHT>() == right.getImageInfo<CL_IMAGE_HEIGHT>() &&
+		left.getImageInfo<CL_IMAGE_DEPTH>() == right.getImageInfo<CL_IMAGE_DEPTH>();
+}
+
+// Copy an image into the copy at a given index, (re)allocating the copy if its size or format does not match
+template <class T>
+static void copyInto(sys::ComputeSystem &cs, const T &image, std::vector<T> &copies, size_t index) {
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+	cl::array<cl::size_type, 3> region = imageRegion(image);
+
+	bool reuse = false;
+
+	if (index < copies.size())
+		reuse = sameLayout(image, copies[index]);
+	else
+		copies.resize(index + 1);
+
+	if (!reuse)
+		copies[index] = createLike(cs, image);
+
+	cs.getQueue().enqueueCopyImage(image, copies[index], zeroOrigin, zeroOrigin, region);
+}
+
+void StateSlot::beginWrite(bool withWeights) {
+	_state2DIndex = 0;
+	_state3DIndex = 0;
+	_weightIndex = 0;
+
+	_hasWeights = withWeights;
+	_valid = true;
+
+	_weightSources.clear();
+}
+
+void StateSlot::beginRead() {
+	assert(_valid);
+
+	_state2DIndex = 0;
+	_state3DIndex = 0;
+	_weightIndex = 0;
+}
+
+void StateSlot::writeState(sys::ComputeSystem &cs, const cl::Image2D &image) {
+	copyInto(cs, image, _states2D, _state2DIndex++);
+}
+
+void StateSlot::writeState(sys::ComputeSystem &cs, const cl::Image3D &image) {
+	copyInto(cs, image, _states3D, _state3DIndex++);
+}
+
+void StateSlot::writeWeights(const cl::Image3D &image) {
+	if (_hasWeights)
+		_weightSources.push_back(image);
+}
+
+void StateSlot::readState(sys::ComputeSystem &cs, const cl::Image2D &image) {
+	assert(_state2DIndex < _states2D.size());
+
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+
+	cs.getQueue().enqueueCopyImage(_states2D[_state2DIndex++], image, zeroOrigin, zeroOrigin, imageRegion(image));
+}
+
+void StateSlot::readState(sys::ComputeSystem &cs, const cl::Image3D &image) {
+	assert(_state3DIndex < _states3D.size());
+
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+
+	cs.getQueue().enqueueCopyImage(_states3D[_state3DIndex++], image, zeroOrigin, zeroOrigin, imageRegion(image));
+}
+
+void StateSlot::readWeights(sys::ComputeSystem &cs, const cl::Image3D &image) {
+	// Not yet copied means the weights were not modified since the save
+	if (!_hasWeights || isPending())
+		return;
+
+	assert(_weightIndex < _weights.size());
+
+	cl::array<cl::size_type, 3> zeroOrigin = { 0, 0, 0 };
+
+	cs.getQueue().enqueueCopyImage(_weights[_weightIndex++], image, zeroOrigin, zeroOrigin, imageRegion(image));
+}
+
+void StateSlot::materialize(sys::ComputeSystem &cs) {
+	for (size_t wi = 0; wi < _weightSources.size(); wi++)
+		copyInto(cs, _weightSources[wi], _weights, wi);
+
+	_weightSources.clear();
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "Helpers.h"
+
+#include <vector>
+
+namespace neo {
+	/*!
+	\brief Device side copy of the recurrent state of a model
+	Images are copied on the device in the order they are written, and copied back in the same order when read,
+	so saving and rewinding never touch the host. Weights are optional and copy-on-write: saving only records the
+	live weight images, and they are copied when the model is about to modify them (see materialize)
+	*/
+	class StateSlot {
+	private:
+		//!@{
+		/*!
+		\brief Copies of state images
+		*/
+		std::vector<cl::Image2D> _states2D;
+		std::vector<cl::Image3D> _states3D;
+		//!@}
+
+		/*!
+		\brief Copies of weight images (valid once materialized)
+		*/
+		std::vector<cl::Image3D> _weights;
+
+		/*!
+		\brief Live weight images at save time, while not yet copied
+		*/
+		std::vector<cl::Image3D> _weightSources;
+
+		//!@{
+		/*!
+		\brief Read/write positions
+		*/
+		size_t _state2DIndex;
+		size_t _state3DIndex;
+		size_t _weightIndex;
+		//!@}
+
+		/*!
+		\brief Whether weights are part of the slot
+		*/
+		bool _hasWeights;
+
+		/*!
+		\brief Whether the slot holds a saved state
+		*/
+		bool _valid;
+
+	public:
+		/*!
+		\brief Initialize defaults (empty)
+		*/
+		StateSlot()
+			: _state2DIndex(0), _state3DIndex(0), _weightIndex(0), _hasWeights(false), _valid(false)
+		{}
+
+		/*!
+		\brief Start saving a state, optionally including weights
+		Copies made for a previous save are reused when the image sizes match
+		*/
+		void beginWrite(bool withWeights);
+
+		/*!
+		\brief Start restoring the saved state
+		*/
+		void beginRead();
+
+		//!@{
+		/*!
+		\brief Copy a state image into the slot (non-blocking)
+		*/
+		void writeState(sys::ComputeSystem &cs, const cl::Image2D &image);
+		void writeState(sys::ComputeSystem &cs, const cl::Image3D &image);
+		//!@}
+
+		/*!
+		\brief Record a weight image (copied later, only if it is about to be modified)
+		Ignored if the slot does not include weights
+		*/
+		void writeWeights(const cl::Image3D &image);
+
+		//!@{
+		/*!
+		\brief Copy a state image back out of the slot (non-blocking)
+		*/
+		void readState(sys::ComputeSystem &cs, const cl::Image2D &image);
+		void readState(sys::ComputeSystem &cs, const cl::Image3D &image);
+		//!@}
+
+		/*!
+		\brief Copy a weight image back out of the slot (non-blocking)
+		Does nothing if the weights were never modified since the save, or the slot does not include weights
+		*/
+		void readWeights(sys::ComputeSystem &cs, const cl::Image3D &image);
+
+		/*!
+		\brief Copy the recorded weights, must be called before the recorded weight images are modified
+		*/
+		void materialize(sys::ComputeSystem &cs);
+
+		/*!
+		\brief Whether recorded weights still have to be copied
+		*/
+		bool isPending() const {
+			return !_weightSources.empty();
+		}
+
+		/*!
+		\brief Whether weights are part of the slot
+		*/
+		bool hasWeights() const {
+			return _hasWeights;
+		}
+
+		/*!
+		\brief Whether the slot holds a saved state
+		*/
+		bool isValid() const {
+			return _valid;
+		}
+	};
+}
\ No newline at end of file
@@ -40,6 +40,8 @@ void Swarm::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &program,
 
 		vl._reverseQRadii = cl_int2{ static_cast<int>(std::ceil(vl._visibleToHidden.x * vld._qRadius)), static_cast<int>(std::ceil(vl._visibleToHidden.y * vld._qRadius)) };
 
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._qRadius, vl._reverseQRadii);
+
 		vl._actions = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
 		vl._actionsExploratory = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
 		vl._predictedAction = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
@@ -114,7 +116,13 @@ void Swarm::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &program,
 
 	_reverseQRadii = cl_int2{ static_cast<int>(std::ceil(_hiddenToQ.x * _qRadius)), static_cast<int>(std::ceil(_hiddenToQ.y * _qRadius)) };
 
+	_random.create(cs, program, rng);
+
 	// Create kernels
+	createKernels(program);
+}
+
+void Swarm::createKernels(sys::ComputeProgram &program) {
 	_predictAction = cl::Kernel(program.getProgram(), "swarmPredictAction");
 	_qInitSummationKernel = cl::Kernel(program.getProgram(), "swarmInitSummation");
 	_qActivateToHiddenKernel = cl::Kernel(program.getProgram(), "swarmQActivateToHidden");
@@ -128,12 +136,89 @@ void Swarm::createRandom(sys::ComputeSystem &cs, sys::ComputeProgram &program,
 	_qLearnVisibleWeightsTracesKernel = cl::Kernel(program.getProgram(), "swarmQLearnVisibleWeightsTraces");
 	_qLearnHiddenWeightsTracesKernel = cl::Kernel(program.getProgram(), "swarmQLearnHiddenWeightsTraces");
 	_qLearnHiddenBiasesTracesKernel = cl::Kernel(program.getProgram(), "swarmQLearnHiddenBiasesTraces");
+
+	_packWeightPairsKernel = cl::Kernel(program.getProgram(), "packWeightPairs");
+	_qActivateToHiddenPackedKernel = cl::Kernel(program.getProgram(), "swarmQActivateToHiddenPacked");
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++)
+		_visibleLayers[vli]._qWeightsPacked = cl::Image3D();
+}
+
+void Swarm::activateToHidden(sys::ComputeSystem &cs, const cl::Image2D &actions, int vli) {
+	VisibleLayer &vl = _visibleLayers[vli];
+	VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+	cl::Kernel &activateKernel = vl._qWeightsPacked() != nullptr ? _qActivateToHiddenPackedKernel : _qActivateToHiddenKernel;
+
+	int argIndex = 0;
+
+	activateKernel.setArg(argIndex++, actions);
+	activateKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
+	activateKernel.setArg(argIndex++, _hiddenSummationTemp[_front]);
+
+	// The packed layout walks whole fields, so it computes its own field bounds
+	if (vl._qWeightsPacked() != nullptr) {
+		activateKernel.setArg(argIndex++, vl._qWeightsPacked);
+		activateKernel.setArg(argIndex++, vld._size);
+		activateKernel.setArg(argIndex++, vl._hiddenToVisible);
+	}
+	else {
+		activateKernel.setArg(argIndex++, vl._qWeights[_back]);
+		activateKernel.setArg(argIndex++, vld._size);
+		vl._fieldTables.setHiddenArgs(activateKernel, argIndex);
+	}
+
+	activateKernel.setArg(argIndex++, vld._qRadius);
+
+	cs.enqueueKernel(activateKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+
+	// Swap buffers
+	std::swap(_hiddenSummationTemp[_front], _hiddenSummationTemp[_back]);
+}
+
+void Swarm::setPackedWeights(sys::ComputeSystem &cs, int vli, bool enabled) {
+	VisibleLayer &vl = _visibleLayers[vli];
+
+	if (!enabled) {
+		vl._qWeightsPacked = cl::Image3D();
+
+		return;
+	}
+
+	if (vl._qWeightsPacked() == nullptr) {
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		int weightDiam = vld._qRadius * 2 + 1;
+
+		int numTexels = (weightDiam * weightDiam + 1) / 2;
+
+		vl._qWeightsPacked = cl::Image3D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), _hiddenSize.x, _hiddenSize.y, numTexels);
+	}
+
+	repackWeights(cs, vli);
+}
+
+void Swarm::repackWeights(sys::ComputeSystem &cs, int vli) {
+	VisibleLayer &vl = _visibleLayers[vli];
+	VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+	int weightDiam = vld._qRadius * 2 + 1;
+
+	int numWeights = weightDiam * weightDiam;
+
+	int argIndex = 0;
+
+	_packWeightPairsKernel.setArg(argIndex++, vl._qWeights[_back]);
+	_packWeightPairsKernel.setArg(argIndex++, vl._qWeightsPacked);
+	_packWeightPairsKernel.setArg(argIndex++, numWeights);
+
+	cs.getQueue().enqueueNDRangeKernel(_packWeightPairsKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y, (numWeights + 1) / 2));
 }
 
 void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 	const cl::Image2D &hiddenStatesFeedForward, const cl::Image2D &actionsFeedBack,
 	float expPert, float expBreak, int annealIterations, float actionAlpha,
-	float alphaHiddenQ, float alphaQ, float alphaPred, float lambda, float gamma, std::mt19937 &rng)
+	float alphaHiddenQ, float alphaQ, float alphaPred, float lambda, float gamma)
 {
 	cl_float4 zeroColor = { 0.0f, 0.0f, 0.0f, 0.0f };
 
@@ -153,7 +238,7 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 		_qPropagateToHiddenErrorKernel.setArg(argIndex++, _qRadius);
 		_qPropagateToHiddenErrorKernel.setArg(argIndex++, _reverseQRadii);
 
-		cs.getQueue().enqueueNDRangeKernel(_qPropagateToHiddenErrorKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_qPropagateToHiddenErrorKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 	}
 	
 	// Find starting action by activating action predictors from hidden state
@@ -173,7 +258,7 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 		_predictAction.setArg(argIndex++, vl._visibleToHidden);
 		_predictAction.setArg(argIndex++, vld._startRadius);
 
-		cs.getQueue().enqueueNDRangeKernel(_predictAction, cl::NullRange, cl::NDRange(vld._size.x, vld._size.y));
+		cs.enqueueKernel(_predictAction, cl::NDRange(vld._size.x, vld._size.y));
 
 		// Copy as a starting point
 		cs.getQueue().enqueueCopyImage(vl._predictedAction, vl._actions, zeroOrigin, zeroOrigin, visibleRegion);
@@ -187,34 +272,13 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 			_qInitSummationKernel.setArg(argIndex++, _hiddenBiases[_back]);
 			_qInitSummationKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
 		
-			cs.getQueue().enqueueNDRangeKernel(_qInitSummationKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+			cs.enqueueKernel(_qInitSummationKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 		}
 
-		for (int vli = 0; vli < _visibleLayers.size(); vli++) {
-			VisibleLayer &vl = _visibleLayers[vli];
-			VisibleLayerDesc &vld = _visibleLayerDescs[vli];
-
-			int argIndex = 0;
-
-			_qActivateToHiddenKernel.setArg(argIndex++, vl._actions);
-			_qActivateToHiddenKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
-			_qActivateToHiddenKernel.setArg(argIndex++, _hiddenSummationTemp[_front]);
-			_qActivateToHiddenKernel.setArg(argIndex++, vl._qWeights[_back]);
-			_qActivateToHiddenKernel.setArg(argIndex++, vld._size);
-			_qActivateToHiddenKernel.setArg(argIndex++, vl._hiddenToVisible);
-			_qActivateToHiddenKernel.setArg(argIndex++, vld._qRadius);
-
-			cs.getQueue().enqueueNDRangeKernel(_qActivateToHiddenKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
-
-			// Swap buffers
-			std::swap(_hiddenSummationTemp[_front], _hiddenSummationTemp[_back]);
-		}
+		for (int vli = 0; vli < _visibleLayers.size(); vli++)
+			activateToHidden(cs, _visibleLayers[vli]._actions, vli);
 
 		{
-			std::uniform_int_distribution<int> seedDist;
-
-			cl_uint2 seed = { seedDist(rng), seedDist(rng) };
-
 			int argIndex = 0;
 
 			_qSolveHiddenKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
@@ -222,7 +286,7 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 			_qSolveHiddenKernel.setArg(argIndex++, actionsFeedBack);
 			_qSolveHiddenKernel.setArg(argIndex++, _hiddenStates[_front]);
 
-			cs.getQueue().enqueueNDRangeKernel(_qSolveHiddenKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+			cs.enqueueKernel(_qSolveHiddenKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 		}
 
 		// Backpropagate
@@ -237,15 +301,11 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 			_hiddenPropagateToVisibleActionKernel.setArg(argIndex++, vl._qWeights[_back]);
 			_hiddenPropagateToVisibleActionKernel.setArg(argIndex++, vl._actions);
 			_hiddenPropagateToVisibleActionKernel.setArg(argIndex++, vl._actionsExploratory); // Use exploratory actions buffer temporarily here, not used yet anyways
-			_hiddenPropagateToVisibleActionKernel.setArg(argIndex++, _hiddenSize);
+			vl._fieldTables.setVisibleArgs(_hiddenPropagateToVisibleActionKernel, argIndex);
 			_hiddenPropagateToVisibleActionKernel.setArg(argIndex++, vld._size);
-			_hiddenPropagateToVisibleActionKernel.setArg(argIndex++, vl._hiddenToVisible);
-			_hiddenPropagateToVisibleActionKernel.setArg(argIndex++, vl._visibleToHidden);
-			_hiddenPropagateToVisibleActionKernel.setArg(argIndex++, vld._qRadius);
-			_hiddenPropagateToVisibleActionKernel.setArg(argIndex++, vl._reverseQRadii);
 			_hiddenPropagateToVisibleActionKernel.setArg(argIndex++, actionAlpha);
 
-			cs.getQueue().enqueueNDRangeKernel(_hiddenPropagateToVisibleActionKernel, cl::NullRange, cl::NDRange(vld._size.x, vld._size.y));
+			cs.enqueueKernel(_hiddenPropagateToVisibleActionKernel, cl::NDRange(vld._size.x, vld._size.y));
 		
 			std::swap(vl._actions, vl._actionsExploratory);
 		}
@@ -256,21 +316,19 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 		VisibleLayer &vl = _visibleLayers[vli];
 		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
 
-		std::uniform_int_distribution<int> seedDist;
-
-		cl_uint2 seed = { seedDist(rng), seedDist(rng) };
-
 		int argIndex = 0;
 
 		_explorationKernel.setArg(argIndex++, vl._actions);
 		_explorationKernel.setArg(argIndex++, vl._actionsExploratory);
 		_explorationKernel.setArg(argIndex++, expPert);
 		_explorationKernel.setArg(argIndex++, expBreak);
-		_explorationKernel.setArg(argIndex++, seed);
+		_random.setArgs(_explorationKernel, argIndex, vli);
 
-		cs.getQueue().enqueueNDRangeKernel(_explorationKernel, cl::NullRange, cl::NDRange(vld._size.x, vld._size.y));
+		cs.enqueueKernel(_explorationKernel, cl::NDRange(vld._size.x, vld._size.y));
 	}
 
+	_random.advance(cs);
+
 	// Activate from exploratory action
 	{
 		{
@@ -279,41 +337,20 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 			_qInitSummationKernel.setArg(argIndex++, _hiddenBiases[_back]);
 			_qInitSummationKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
 
-			cs.getQueue().enqueueNDRangeKernel(_qInitSummationKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+			cs.enqueueKernel(_qInitSummationKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 		}
 
-		for (int vli = 0; vli < _visibleLayers.size(); vli++) {
-			VisibleLayer &vl = _visibleLayers[vli];
-			VisibleLayerDesc &vld = _visibleLayerDescs[vli];
-
-			int argIndex = 0;
-
-			_qActivateToHiddenKernel.setArg(argIndex++, vl._actionsExploratory); // Use exploratory action now
-			_qActivateToHiddenKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
-			_qActivateToHiddenKernel.setArg(argIndex++, _hiddenSummationTemp[_front]);
-			_qActivateToHiddenKernel.setArg(argIndex++, vl._qWeights[_back]);
-			_qActivateToHiddenKernel.setArg(argIndex++, vld._size);
-			_qActivateToHiddenKernel.setArg(argIndex++, vl._hiddenToVisible);
-			_qActivateToHiddenKernel.setArg(argIndex++, vld._qRadius);
-
-			cs.getQueue().enqueueNDRangeKernel(_qActivateToHiddenKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
-
-			// Swap buffers
-			std::swap(_hiddenSummationTemp[_front], _hiddenSummationTemp[_back]);
-		}
+		for (int vli = 0; vli < _visibleLayers.size(); vli++)
+			activateToHidden(cs, _visibleLayers[vli]._actionsExploratory, vli); // Use exploratory action now
 
 		{
-			std::uniform_int_distribution<int> seedDist;
-
-			cl_uint2 seed = { seedDist(rng), seedDist(rng) };
-
 			int argIndex = 0;
 
 			_qSolveHiddenKernel.setArg(argIndex++, _hiddenSummationTemp[_back]);
 			_qSolveHiddenKernel.setArg(argIndex++, hiddenStatesFeedForward);
 			_qSolveHiddenKernel.setArg(argIndex++, _hiddenStates[_front]);
 	
-			cs.getQueue().enqueueNDRangeKernel(_qSolveHiddenKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+			cs.enqueueKernel(_qSolveHiddenKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 		}
 	}
 
@@ -328,7 +365,7 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 		_qActivateToQKernel.setArg(argIndex++, _qToHidden);
 		_qActivateToQKernel.setArg(argIndex++, _qRadius);
 
-		cs.getQueue().enqueueNDRangeKernel(_qActivateToQKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_qActivateToQKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 	}
 
 	// Find TD errors
@@ -347,7 +384,7 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 		_qPropagateToHiddenTDKernel.setArg(argIndex++, reward);
 		_qPropagateToHiddenTDKernel.setArg(argIndex++, gamma);
 
-		cs.getQueue().enqueueNDRangeKernel(_qPropagateToHiddenTDKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_qPropagateToHiddenTDKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 	}
 
 	// Weight updates
@@ -370,7 +407,7 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 			_qLearnVisibleWeightsTracesKernel.setArg(argIndex++, alphaHiddenQ);
 			_qLearnVisibleWeightsTracesKernel.setArg(argIndex++, lambda);
 
-			cs.getQueue().enqueueNDRangeKernel(_qLearnVisibleWeightsTracesKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+			cs.enqueueKernel(_qLearnVisibleWeightsTracesKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 		}
 
 		{
@@ -387,7 +424,7 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 			_startLearnWeightsKernel.setArg(argIndex++, vld._startRadius);
 			_startLearnWeightsKernel.setArg(argIndex++, alphaPred);
 
-			cs.getQueue().enqueueNDRangeKernel(_startLearnWeightsKernel, cl::NullRange, cl::NDRange(vld._size.x, vld._size.y));
+			cs.enqueueKernel(_startLearnWeightsKernel, cl::NDRange(vld._size.x, vld._size.y));
 		}
 	}
 
@@ -408,7 +445,7 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 		_qLearnHiddenWeightsTracesKernel.setArg(argIndex++, reward);
 		_qLearnHiddenWeightsTracesKernel.setArg(argIndex++, gamma);
 
-		cs.getQueue().enqueueNDRangeKernel(_qLearnHiddenWeightsTracesKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_qLearnHiddenWeightsTracesKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 	}
 
 	// Learn biases
@@ -422,7 +459,7 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 		_qLearnHiddenBiasesTracesKernel.setArg(argIndex++, alphaHiddenQ);
 		_qLearnHiddenBiasesTracesKernel.setArg(argIndex++, lambda);
 
-		cs.getQueue().enqueueNDRangeKernel(_qLearnHiddenBiasesTracesKernel, cl::NullRange, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
+		cs.enqueueKernel(_qLearnHiddenBiasesTracesKernel, cl::NDRange(_hiddenSize.x, _hiddenSize.y));
 	}
 
 	// Swap buffers
@@ -438,5 +475,160 @@ void Swarm::simStep(sys::ComputeSystem &cs, float reward,
 
 		std::swap(vl._qWeights[_front], vl._qWeights[_back]);
 		std::swap(vl._startWeights[_front], vl._startWeights[_back]);
+
+		if (vl._qWeightsPacked() != nullptr)
+			repackWeights(cs, vli);
+	}
+}
+
+void Swarm::writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const {
+	snapshot.write(_qSize);
+	snapshot.write(_hiddenSize);
+	snapshot.write(static_cast<cl_int>(_qRadius));
+
+	snapshot.write(_qToHidden);
+	snapshot.write(_hiddenToQ);
+	snapshot.write(_reverseQRadii);
+
+	snapshot.writeImage(cs, _qStates[_back]);
+	snapshot.writeImage(cs, _hiddenStates[_back]);
+	snapshot.writeImage(cs, _hiddenBiases[_back]);
+	snapshot.writeImage(cs, _qWeights[_back]);
+	snapshot.writeImage(cs, _hiddenErrors);
+	snapshot.writeImage(cs, _hiddenTD);
+
+	// Layer information
+	snapshot.write(static_cast<cl_int>(_visibleLayers.size()));
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		const VisibleLayer &vl = _visibleLayers[vli];
+		const VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		// Desc
+		snapshot.write(vld._size);
+		snapshot.write(vld._qRadius);
+		snapshot.write(vld._startRadius);
+
+		// Layer
+		snapshot.writeImage(cs, vl._predictedAction);
+		snapshot.writeImage(cs, vl._actions);
+		snapshot.writeImage(cs, vl._actionsExploratory);
+		snapshot.writeImage(cs, vl._qWeights[_back]);
+		snapshot.writeImage(cs, vl._startWeights[_back]);
+
+		snapshot.write(vl._hiddenToVisible);
+		snapshot.write(vl._visibleToHidden);
+		snapshot.write(vl._reverseQRadii);
+	}
+
+	snapshot.write(_random.getKey());
+	snapshot.write(_random.getStep());
+}
+
+void Swarm::readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot) {
+	cl_int qRadius;
+
+	snapshot.read(_qSize);
+	snapshot.read(_hiddenSize);
+	snapshot.read(qRadius);
+
+	_qRadius = qRadius;
+
+	snapshot.read(_qToHidden);
+	snapshot.read(_hiddenToQ);
+	snapshot.read(_reverseQRadii);
+
+	_qStates = createDoubleBuffer2D(cs, _qSize, CL_R, CL_FLOAT);
+
+	_hiddenStates = createDoubleBuffer2D(cs, _hiddenSize, CL_RG, CL_FLOAT);
+
+	_hiddenBiases = createDoubleBuffer2D(cs, _hiddenSize, CL_RGBA, CL_FLOAT);
+
+	{
+		int weightDiam = _qRadius * 2 + 1;
+
+		int numWeights = weightDiam * weightDiam;
+
+		cl_int3 weightsSize = { _qSize.x, _qSize.y, numWeights };
+
+		_qWeights = createDoubleBuffer3D(cs, weightsSize, CL_RGBA, CL_FLOAT);
+	}
+
+	_hiddenErrors = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_RG, CL_FLOAT), _hiddenSize.x, _hiddenSize.y);
+	_hiddenTD = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), _hiddenSize.x, _hiddenSize.y);
+
+	_hiddenSummationTemp = createDoubleBuffer2D(cs, _hiddenSize, CL_RG, CL_FLOAT);
+
+	snapshot.readImage(cs, _qStates[_back]);
+	snapshot.readImage(cs, _hiddenStates[_back]);
+	snapshot.readImage(cs, _hiddenBiases[_back]);
+	snapshot.readImage(cs, _qWeights[_back]);
+	snapshot.readImage(cs, _hiddenErrors);
+	snapshot.readImage(cs, _hiddenTD);
+
+	// Layer information
+	cl_int numLayers;
+
+	snapshot.read(numLayers);
+
+	_visibleLayerDescs.resize(numLayers);
+	_visibleLayers.resize(numLayers);
+
+	for (int vli = 0; vli < _visibleLayers.size(); vli++) {
+		VisibleLayer &vl = _visibleLayers[vli];
+		VisibleLayerDesc &vld = _visibleLayerDescs[vli];
+
+		// Desc
+		snapshot.read(vld._size);
+		snapshot.read(vld._qRadius);
+		snapshot.read(vld._startRadius);
+
+		// Layer
+		vl._predictedAction = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
+		vl._actions = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
+		vl._actionsExploratory = cl::Image2D(cs.getContext(), CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), vld._size.x, vld._size.y);
+
+		{
+			int weightDiam = vld._qRadius * 2 + 1;
+
+			int numWeights = weightDiam * weightDiam;
+
+			cl_int3 weightsSize = { _hiddenSize.x, _hiddenSize.y, numWeights };
+
+			vl._qWeights = createDoubleBuffer3D(cs, weightsSize, CL_RGBA, CL_FLOAT);
+		}
+
+		{
+			int weightDiam = vld._startRadius * 2 + 1;
+
+			int numWeights = weightDiam * weightDiam;
+
+			cl_int3 weightsSize = { vld._size.x, vld._size.y, numWeights };
+
+			vl._startWeights = createDoubleBuffer3D(cs, weightsSize, CL_RG, CL_FLOAT);
+		}
+
+		snapshot.readImage(cs, vl._predictedAction);
+		snapshot.readImage(cs, vl._actions);
+		snapshot.readImage(cs, vl._actionsExploratory);
+		snapshot.readImage(cs, vl._qWeights[_back]);
+		snapshot.readImage(cs, vl._startWeights[_back]);
+
+		snapshot.read(vl._hiddenToVisible);
+		snapshot.read(vl._visibleToHidden);
+		snapshot.read(vl._reverseQRadii);
+
+		vl._fieldTables.create(cs, _hiddenSize, vld._size, vl._hiddenToVisible, vl._visibleToHidden, vld._qRadius, vl._reverseQRadii);
 	}
+
+	cl_uint2 randomKey;
+	cl_ulong randomStep;
+
+	snapshot.read(randomKey);
+	snapshot.read(randomStep);
+
+	_random.create(cs, program, randomKey);
+	_random.setStep(cs, randomStep);
+
+	createKernels(program);
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
-#include "Helpers.h"
+#include "Snapshot.h"
+#include "FieldTables.h"
 
 namespace neo {
 	/*!
@@ -59,6 +60,11 @@ namespace neo {
 			DoubleBuffer3D _startWeights;
 			//!@}
 
+			/*!
+			\brief Q weights packed two per RGBA texel for activation (empty when disabled)
+			*/
+			cl::Image3D _qWeightsPacked;
+
 			//!@{
 			/*!
 			\brief Transformations
@@ -71,6 +77,11 @@ namespace neo {
 			\brief Radius onto hidden (reverse from visible layer desc)
 			*/
 			cl_int2 _reverseQRadii;
+
+			/*!
+			\brief Precomputed receptive field connectivity of the Q weights
+			*/
+			FieldTables _fieldTables;
 		};
 
 	private:
@@ -154,6 +165,34 @@ namespace neo {
 		cl::Kernel _qLearnHiddenBiasesTracesKernel;
 		//!@}
 
+		//!@{
+		/*!
+		\brief Packed weight kernels
+		*/
+		cl::Kernel _packWeightPairsKernel;
+		cl::Kernel _qActivateToHiddenPackedKernel;
+		//!@}
+
+		/*!
+		\brief Random stream for exploration
+		*/
+		RandomStream _random;
+
+		/*!
+		\brief Create kernels from the program
+		*/
+		void createKernels(sys::ComputeProgram &program);
+
+		/*!
+		\brief Sum the Q contribution of a visible layer onto the hidden units
+		*/
+		void activateToHidden(sys::ComputeSystem &cs, const cl::Image2D &actions, int vli);
+
+		/*!
+		\brief Repack the packed Q weights of a visible layer from its Q weights
+		*/
+		void repackWeights(sys::ComputeSystem &cs, int vli);
+
 	public:
 		/*!
 		\brief Create a comparison sparse coder with random initialization
@@ -170,7 +209,32 @@ namespace neo {
 		void simStep(sys::ComputeSystem &cs, float reward,
 			const cl::Image2D &hiddenStatesFeedForward, const cl::Image2D &actionsFeedBack,
 			float expPert, float expBreak, int annealIterations, float actionAlpha,
-			float alphaHiddenQ, float alphaQ, float alphaPred, float lambda, float gamma, std::mt19937 &rng);
+			float alphaHiddenQ, float alphaQ, float alphaPred, float lambda, float gamma);
+
+		/*!
+		\brief Write to snapshot (non-blocking)
+		Includes Q states and the traces stored alongside the weights
+		*/
+		void writeToSnapshot(sys::ComputeSystem &cs, Snapshot &snapshot) const;
+
+		/*!
+		\brief Read from snapshot
+		*/
+		void readFromSnapshot(sys::ComputeSystem &cs, sys::ComputeProgram &program, Snapshot &snapshot);
+
+		/*!
+		\brief Enable or disable packed Q weights for a visible layer (non-blocking)
+		Each annealing iteration then fetches two weight indices per texel, the step repacks after its weight update,
+		so this pays off with several annealing iterations. Not part of snapshots, enable again after reading
+		*/
+		void setPackedWeights(sys::ComputeSystem &cs, int vli, bool enabled);
+
+		/*!
+		\brief Whether a visible layer has packed Q weights
+		*/
+		bool hasPackedWeights(int vli) const {
+			return _visibleLayers[vli]._qWeightsPacked() != nullptr;
+		}
 
 		/*!
 		\brief Get number of visible layers
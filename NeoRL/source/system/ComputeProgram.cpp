@@ -1,4 +1,5 @@
 #include "ComputeProgram.h"
+#include "KernelTuner.h"
 
 #include <fstream>
 #include <iostream>
@@ -34,5 +35,8 @@ bool ComputeProgram::loadFromFile(const std::string &name, ComputeSystem &cs) {
 		return false;
 	}
 
+	// Work-group sizes tuned for this program on this device are kept next to it
+	cs.getTuner().useCache(name, cs.getDevice());
+
 	return true;
 }
\ No newline at end of file
@@ -1,9 +1,16 @@
 #include "ComputeSystem.h"
+#include "KernelTuner.h"
 
 #include <iostream>
 
 using namespace sys;
 
+ComputeSystem::ComputeSystem()
+	: _tuner(new KernelTuner())
+{}
+
+ComputeSystem::~ComputeSystem() {}
+
 bool ComputeSystem::create(DeviceType type, bool createFromGLContext) {
 	if (type == _none) {
 #ifdef SYS_DEBUG
@@ -91,4 +98,8 @@ bool ComputeSystem::create(DeviceType type, bool createFromGLContext) {
 	_queue = cl::CommandQueue(_context, _device);
 
 	return true;
+}
+
+void ComputeSystem::enqueueKernel(cl::Kernel &kernel, const cl::NDRange &global) {
+	_tuner->enqueue(_queue, _device, kernel, global);
 }
\ No newline at end of file
@@ -7,11 +7,15 @@
 
 #include <CL/cl2.hpp>
 
+#include <memory>
+
 #define SYS_DEBUG
 
 #define SYS_ALLOW_CL_GL_CONTEXT 0
 
 namespace sys {
+	class KernelTuner;
+
 	/*!
 	\brief Compute system
 	Holds OpenCL platform, device, context, and command queue
@@ -33,7 +37,19 @@ namespace sys {
 		cl::CommandQueue _queue;
 		//!@}
 
+		/*!
+		\brief Work-group size autotuner for kernel launches
+		*/
+		std::unique_ptr<KernelTuner> _tuner;
+
 	public:
+		/*!
+		\brief Initialize defaults (not created)
+		*/
+		ComputeSystem();
+
+		~ComputeSystem();
+
 		/*!
 		\brief Create compute system with a given device type
 		Optional: Create from an OpenGL context
@@ -67,5 +83,17 @@ namespace sys {
 		cl::CommandQueue &getQueue() {
 			return _queue;
 		}
+
+		/*!
+		\brief Enqueue a kernel with a tuned work-group size (see KernelTuner)
+		*/
+		void enqueueKernel(cl::Kernel &kernel, const cl::NDRange &global);
+
+		/*!
+		\brief Get the work-group size autotuner
+		*/
+		KernelTuner &getTuner() {
+			return *_tuner;
+		}
 	};
 }
\ No newline at end of file
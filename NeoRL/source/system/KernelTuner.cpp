@@ -0,0 +1,198 @@
+#include "KernelTuner.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+using namespace sys;
+
+static cl::size_type gcd(cl::size_type a, cl::size_type b) {
+	while (b != 0) {
+		cl::size_type t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static std::string tuningKey(const cl::Kernel &kernel, const cl::NDRange &global) {
+	std::ostringstream key;
+
+	key << kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+
+	for (cl::size_type d = 0; d < 3; d++)
+		key << " " << (d < global.dimensions() ? global.get()[d] : 1);
+
+	return key.str();
+}
+
+static cl::NDRange localRange(const KernelTuner::LocalSize &local, cl::size_type dimensions) {
+	if (local[0] == 0)
+		return cl::NullRange;
+
+	switch (dimensions) {
+	case 1:
+		return cl::NDRange(local[0]);
+	case 2:
+		return cl::NDRange(local[0], local[1]);
+	}
+
+	return cl::NDRange(local[0], local[1], local[2]);
+}
+
+void KernelTuner::createCandidates(const cl::Device &device, const cl::Kernel &kernel, const cl::NDRange &global, std::vector<LocalSize> &candidates) const {
+	static const cl::size_type targets[][3] = {
+		{ 32, 1, 1 }, { 64, 1, 1 }, { 128, 1, 1 }, { 256, 1, 1 },
+		{ 4, 4, 1 }, { 8, 4, 1 }, { 8, 8, 1 }, { 16, 4, 1 }, { 16, 8, 1 }, { 16, 16, 1 }, { 32, 2, 1 }, { 32, 4, 1 }, { 32, 8, 1 },
+		{ 4, 4, 4 }, { 8, 4, 2 }, { 8, 8, 2 }
+	};
+
+	cl::size_type maxGroupSize = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+
+	std::vector<cl::size_type> maxItemSizes = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+
+	// Driver default is always a candidate, so tuning never does worse
+	candidates.clear();
+	candidates.push_back(LocalSize{ 0, 0, 0 });
+
+	cl::size_type dimensions = global.dimensions();
+
+	for (const cl::size_type* target : targets) {
+		LocalSize local = { 1, 1, 1 };
+
+		cl::size_type groupSize = 1;
+
+		// Only sizes that divide the global size, so no launch is padded
+		for (cl::size_type d = 0; d < dimensions; d++) {
+			local[d] = gcd(global.get()[d], target[d]);
+
+			if (d < maxItemSizes.size())
+				local[d] = std::min(local[d], maxItemSizes[d]);
+
+			while (global.get()[d] % local[d] != 0)
+				local[d]--;
+
+			groupSize *= local[d];
+		}
+
+		if (groupSize < 4 || groupSize > maxGroupSize)
+			continue;
+
+		if (std::find(candidates.begin(), candidates.end(), local) == candidates.end())
+			candidates.push_back(local);
+	}
+}
+
+void KernelTuner::useCache(const std::string &programFileName, const cl::Device &device) {
+	std::string deviceName = device.getInfo<CL_DEVICE_NAME>() + "_" + device.getInfo<CL_DRIVER_VERSION>();
+
+	for (char &c : deviceName)
+		if (!std::isalnum(static_cast<unsigned char>(c)))
+			c = '_';
+
+	_cacheFileName = programFileName + "." + deviceName + ".tuning";
+
+	std::ifstream fromFile(_cacheFileName);
+
+	if (!fromFile.is_open())
+		return;
+
+	std::string line;
+
+	while (std::getline(fromFile, line)) {
+		std::istringstream entry(line);
+
+		std::string name;
+		cl::size_type global[3];
+		LocalSize local;
+
+		if (entry >> name >> global[0] >> global[1] >> global[2] >> local[0] >> local[1] >> local[2]) {
+			std::ostringstream key;
+
+			key << name << " " << global[0] << " " << global[1] << " " << global[2];
+
+			_winners[key.str()] = local;
+		}
+	}
+}
+
+void KernelTuner::enqueue(cl::CommandQueue &queue, const cl::Device &device, cl::Kernel &kernel, const cl::NDRange &global) {
+	if (!_enabled) {
+		queue.enqueueNDRangeKernel(kernel, cl::NullRange, global);
+
+		return;
+	}
+
+	std::string key = tuningKey(kernel, global);
+
+	std::map<std::string, LocalSize>::const_iterator winner = _winners.find(key);
+
+	if (winner != _winners.end()) {
+		queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, localRange(winner->second, global.dimensions()));
+
+		return;
+	}
+
+	std::map<std::string, Trial>::iterator it = _trials.find(key);
+
+	if (it == _trials.end()) {
+		Trial trial;
+
+		createCandidates(device, kernel, global, trial._candidates);
+
+		trial._bestTimes.assign(trial._candidates.size(), -1.0);
+		trial._launches = 0;
+
+		it = _trials.insert(std::make_pair(key, trial)).first;
+	}
+
+	Trial &trial = it->second;
+
+	int candidate = trial._launches % trial._candidates.size();
+
+	// Time this launch alone
+	queue.finish();
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, localRange(trial._candidates[candidate], global.dimensions()));
+
+	queue.finish();
+
+	double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	if (trial._bestTimes[candidate] < 0.0 || time < trial._bestTimes[candidate])
+		trial._bestTimes[candidate] = time;
+
+	trial._launches++;
+
+	if (trial._launches < _rounds * static_cast<int>(trial._candidates.size()))
+		return;
+
+	int best = std::min_element(trial._bestTimes.begin(), trial._bestTimes.end()) - trial._bestTimes.begin();
+
+	_winners[key] = trial._candidates[best];
+
+	_trials.erase(it);
+
+	save();
+}
+
+bool KernelTuner::save() const {
+	if (_cacheFileName.empty())
+		return false;
+
+	std::ofstream toFile(_cacheFileName);
+
+	if (!toFile.is_open())
+		return false;
+
+	for (std::map<std::string, LocalSize>::const_iterator it = _winners.begin(); it != _winners.end(); it++)
+		toFile << it->first << " " << it->second[0] << " " << it->second[1] << " " << it->second[2] << std::endl;
+
+	return true;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <system/ComputeSystem.h>
+
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+#include <assert.h>
+
+namespace sys {
+	/*!
+	\brief Work-group size autotuner
+	Picks the local size of kernel launches per kernel, global size, and device. The first launches of an untuned
+	kernel and shape cycle through candidate local sizes (each one is a real launch), timing them, and the fastest
+	is kept and written to a cache file next to the program, so later runs on the same device skip the tuning
+	*/
+	class KernelTuner : private Uncopyable {
+	public:
+		/*!
+		\brief Local size (all zeros means the driver default)
+		*/
+		typedef std::array<cl::size_type, 3> LocalSize;
+
+	private:
+		/*!
+		\brief Tuning in progress for a kernel and shape
+		*/
+		struct Trial {
+			/*!
+			\brief Candidate local sizes
+			*/
+			std::vector<LocalSize> _candidates;
+
+			/*!
+			\brief Best time of each candidate (seconds)
+			*/
+			std::vector<double> _bestTimes;
+
+			/*!
+			\brief Number of launches so far
+			*/
+			int _launches;
+		};
+
+		/*!
+		\brief Chosen local sizes, by key
+		*/
+		std::map<std::string, LocalSize> _winners;
+
+		/*!
+		\brief Tunings in progress, by key
+		*/
+		std::map<std::string, Trial> _trials;
+
+		/*!
+		\brief Cache file (empty if not persisted)
+		*/
+		std::string _cacheFileName;
+
+		/*!
+		\brief Timed launches per candidate
+		*/
+		int _rounds;
+
+		/*!
+		\brief Whether tuning is enabled (if not, the driver default is used)
+		*/
+		bool _enabled;
+
+		/*!
+		\brief Build the candidates for a global size, that divide it evenly and fit the kernel
+		*/
+		void createCandidates(const cl::Device &device, const cl::Kernel &kernel, const cl::NDRange &global, std::vector<LocalSize> &candidates) const;
+
+	public:
+		/*!
+		\brief Initialize defaults (enabled, not persisted)
+		*/
+		KernelTuner()
+			: _rounds(3), _enabled(true)
+		{}
+
+		/*!
+		\brief Persist winners in a cache file named after a program file and a device
+		Loads the winners found by previous runs, if any
+		*/
+		void useCache(const std::string &programFileName, const cl::Device &device);
+
+		/*!
+		\brief Enqueue a kernel with the tuned local size
+		Blocks on the queue while the kernel and shape are still being tuned
+		*/
+		void enqueue(cl::CommandQueue &queue, const cl::Device &device, cl::Kernel &kernel, const cl::NDRange &global);
+
+		/*!
+		\brief Write the winners to the cache file
+		*/
+		bool save() const;
+
+		/*!
+		\brief Enable or disable tuning
+		*/
+		void setEnabled(bool enabled) {
+			_enabled = enabled;
+		}
+
+		/*!
+		\brief Set the number of timed launches per candidate
+		*/
+		void setRounds(int rounds) {
+			assert(rounds > 0);
+
+			_rounds = rounds;
+		}
+
+		/*!
+		\brief Whether tuning is enabled
+		*/
+		bool isEnabled() const {
+			return _enabled;
+		}
+	};
+}